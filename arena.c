@@ -0,0 +1,116 @@
+#include "arena.h"
+
+#include <stdalign.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_BLOCK_SIZE (64 * 1024) //< bytes of a regular block, larger requests get their own
+#define ARENA_ALIGN alignof(max_align_t)
+
+struct ArenaBlock {
+    struct ArenaBlock* next;
+    size_t size; //< usable bytes after the header
+    alignas(max_align_t) char data[];
+};
+
+static size_t alignUp(size_t n) { return (n + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1); }
+
+struct Arena createArena(void)
+{
+    struct Arena arena = { NULL, NULL, NULL, NULL };
+    return arena;
+}
+
+void freeArena(struct Arena* arena)
+{
+    struct ArenaBlock* b = arena->first;
+    while (b) {
+        struct ArenaBlock* next = b->next;
+        free(b);
+        b = next;
+    }
+    *arena = createArena();
+}
+
+void resetArena(struct Arena* arena)
+{
+    arena->current = arena->first;
+    arena->ptr = arena->first ? arena->first->data : NULL;
+    arena->end = arena->first ? arena->first->data + arena->first->size : NULL;
+}
+
+static void enterBlock(struct Arena* arena, struct ArenaBlock* b)
+{
+    arena->current = b;
+    arena->ptr = b->data;
+    arena->end = b->data + b->size;
+}
+
+// Moves on to the next block that can hold `size` bytes. Blocks too small for it are skipped
+// and stay in the chain for later rounds; a new block is linked in after the current one.
+static bool nextBlock(struct Arena* arena, size_t size)
+{
+    struct ArenaBlock* prev = arena->current;
+    for (struct ArenaBlock* b = prev ? prev->next : NULL; b; b = b->next) {
+        if (b->size >= size) {
+            enterBlock(arena, b);
+            return true;
+        }
+    }
+    size_t blockSize = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+    struct ArenaBlock* b = malloc(sizeof(*b) + blockSize);
+    if (!b)
+        return false;
+    b->size = blockSize;
+    if (prev) {
+        b->next = prev->next;
+        prev->next = b;
+    } else {
+        b->next = arena->first;
+        arena->first = b;
+    }
+    enterBlock(arena, b);
+    return true;
+}
+
+void* arenaAlloc(struct Arena* arena, size_t size)
+{
+    size = alignUp(size ? size : 1);
+    if ((size_t)(arena->end - arena->ptr) < size && !nextBlock(arena, size))
+        return NULL;
+    void* p = arena->ptr;
+    arena->ptr += size;
+    return p;
+}
+
+void* arenaRealloc(struct Arena* arena, void* p, size_t oldSize, size_t newSize)
+{
+    if (!p)
+        return arenaAlloc(arena, newSize);
+    char* last = (char*)p + alignUp(oldSize ? oldSize : 1);
+    if (last == arena->ptr && (size_t)(arena->end - (char*)p) >= alignUp(newSize)) {
+        arena->ptr = (char*)p + alignUp(newSize);
+        return p;
+    }
+    void* q = arenaAlloc(arena, newSize);
+    if (q)
+        memcpy(q, p, oldSize < newSize ? oldSize : newSize);
+    return q;
+}
+
+void* arenaOrHeapAlloc(struct Arena* arena, size_t size)
+{
+    return arena ? arenaAlloc(arena, size) : malloc(size);
+}
+
+void* arenaOrHeapRealloc(struct Arena* arena, void* p, size_t oldSize, size_t newSize)
+{
+    return arena ? arenaRealloc(arena, p, oldSize, newSize) : realloc(p, newSize);
+}
+
+void arenaOrHeapFree(struct Arena* arena, void* p)
+{
+    if (!arena)
+        free(p);
+}
@@ -0,0 +1,41 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct ArenaBlock;
+
+// Bump allocator for memory that dies together, e.g. everything compiled for one expression of a
+// batch. Allocations are carved from large blocks and never freed one by one; resetArena()
+// releases all of them in O(1) and keeps the blocks for the next round, so a long-running batch
+// reaches a steady state without calling malloc. An arena must not be used by two threads at once.
+struct Arena {
+    struct ArenaBlock* first; //< blocks are chained in allocation order
+    struct ArenaBlock* current;
+    char* ptr; //< next free byte of current
+    char* end;
+};
+
+struct Arena createArena(void); //< allocates nothing until first used
+void freeArena(struct Arena* arena);
+void resetArena(struct Arena* arena);
+// Returns `size` bytes aligned for any type, or NULL if memory runs out
+void* arenaAlloc(struct Arena* arena, size_t size);
+// Grows the allocation p of oldSize bytes, in place when it is the most recent allocation. The
+// contents are copied otherwise; the old space is only reclaimed by the next reset.
+void* arenaRealloc(struct Arena* arena, void* p, size_t oldSize, size_t newSize);
+
+// Helpers for code that allocates from an optional arena: NULL selects malloc() and free()
+void* arenaOrHeapAlloc(struct Arena* arena, size_t size);
+void* arenaOrHeapRealloc(struct Arena* arena, void* p, size_t oldSize, size_t newSize);
+void arenaOrHeapFree(struct Arena* arena, void* p); //< no-op for arena memory
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
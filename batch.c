@@ -0,0 +1,211 @@
+#include "program.h"
+#include "vecmath.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Columnar evaluation: every instruction is applied to a block of BATCH_BLOCK points before the
+// next one is dispatched, so the interpreter overhead is paid once per block instead of once per
+// point. Arithmetic runs on 8-lane vectors which the compiler lowers to one AVX-512, two AVX2 or
+// four SSE2 instructions depending on the target the kernel is instantiated for. So do the
+// functions, unless the program asks for ACCURACY_EXACT.
+
+#define BATCH_VECS 8
+#define BATCH_BLOCK (BATCH_VECS * VEC_LANES)
+#define BATCH_STACK_SIZE 32 //< operand stack depth kept on the C stack
+
+static inline __attribute__((always_inline)) void applyFunction(
+    Vec* restrict a, double (*f)(double))
+{
+    for (unsigned i = 0; i < BATCH_VECS; i++)
+        for (unsigned l = 0; l < VEC_LANES; l++)
+            a[i][l] = f(a[i][l]);
+}
+
+// libm lane by lane for ACCURACY_EXACT, otherwise the vector kernel of vecmath.h
+#define APPLY_MATH(a, accuracy, f, vecf)                                                           \
+    do {                                                                                           \
+        if ((accuracy) == ACCURACY_EXACT) {                                                        \
+            applyFunction(a, f);                                                                   \
+            break;                                                                                 \
+        }                                                                                          \
+        for (unsigned i = 0; i < BATCH_VECS; i++)                                                  \
+            a[i] = vecf(a[i], (accuracy) == ACCURACY_FAST);                                        \
+    } while (0)
+
+static inline __attribute__((always_inline)) void evaluateBlock(
+    const struct Program* prog, const Vec* restrict x, Vec* restrict stack)
+{
+    Vec* regs = stack + prog->maxDepth * BATCH_VECS;
+    unsigned depth = 0;
+    const struct Instruction* ip = prog->code;
+    const struct Instruction* end = ip + prog->len;
+    for (; ip != end; ++ip) {
+        Vec* top = stack + (depth > 0 ? depth - 1 : 0) * BATCH_VECS;
+        Vec* a = depth > 1 ? top - BATCH_VECS : top; //< left operand of binary operators
+        switch (ip->op) {
+        case OP_CONST: {
+            top = stack + depth++ * BATCH_VECS;
+            double c = prog->consts[ip->arg];
+            for (unsigned i = 0; i < BATCH_VECS; i++)
+                top[i] = (Vec) { c, c, c, c, c, c, c, c };
+            break;
+        }
+        case OP_VAR:
+            top = stack + depth++ * BATCH_VECS;
+            for (unsigned i = 0; i < BATCH_VECS; i++)
+                top[i] = x[i];
+            break;
+        case OP_NEG:
+            for (unsigned i = 0; i < BATCH_VECS; i++)
+                top[i] = -top[i];
+            break;
+        case OP_ADD:
+            for (unsigned i = 0; i < BATCH_VECS; i++)
+                a[i] += top[i];
+            depth--;
+            break;
+        case OP_SUB:
+            for (unsigned i = 0; i < BATCH_VECS; i++)
+                a[i] -= top[i];
+            depth--;
+            break;
+        case OP_MUL:
+            for (unsigned i = 0; i < BATCH_VECS; i++)
+                a[i] *= top[i];
+            depth--;
+            break;
+        case OP_DIV:
+            for (unsigned i = 0; i < BATCH_VECS; i++)
+                a[i] /= top[i];
+            depth--;
+            break;
+        case OP_POW: //< libm at every accuracy, there is no vector kernel
+            for (unsigned i = 0; i < BATCH_VECS; i++)
+                for (unsigned l = 0; l < VEC_LANES; l++)
+                    a[i][l] = pow(a[i][l], top[i][l]);
+            depth--;
+            break;
+        case OP_SIN:
+            APPLY_MATH(top, prog->accuracy, sin, vecSin);
+            break;
+        case OP_COS:
+            APPLY_MATH(top, prog->accuracy, cos, vecCos);
+            break;
+        case OP_TAN:
+            APPLY_MATH(top, prog->accuracy, tan, vecTan);
+            break;
+        case OP_ATAN:
+            APPLY_MATH(top, prog->accuracy, atan, vecAtan);
+            break;
+        case OP_EXP:
+            APPLY_MATH(top, prog->accuracy, exp, vecExp);
+            break;
+        case OP_SQRT:
+            for (unsigned i = 0; i < BATCH_VECS; i++)
+                top[i] = vecSqrt(top[i]);
+            break;
+        case OP_LOAD:
+            top = stack + depth++ * BATCH_VECS;
+            for (unsigned i = 0; i < BATCH_VECS; i++)
+                top[i] = regs[ip->arg * BATCH_VECS + i];
+            break;
+        case OP_STORE:
+            for (unsigned i = 0; i < BATCH_VECS; i++)
+                regs[ip->arg * BATCH_VECS + i] = top[i];
+            break;
+        }
+    }
+}
+
+static inline __attribute__((always_inline)) void evaluateBlocks(
+    const struct Program* prog, const double* xs, double* out, size_t n)
+{
+    Vec buf[BATCH_STACK_SIZE * BATCH_VECS];
+    Vec* stack = buf;
+    size_t slots = (size_t)prog->maxDepth + prog->nregs; //< registers follow the operand stack
+    if (slots > BATCH_STACK_SIZE) {
+        stack = aligned_alloc(sizeof(Vec), slots * BATCH_VECS * sizeof(Vec));
+        if (!stack) {
+            for (size_t i = 0; i < n; i++)
+                out[i] = NAN;
+            return;
+        }
+    }
+    Vec x[BATCH_VECS];
+    for (size_t begin = 0; begin < n; begin += BATCH_BLOCK) {
+        size_t count = n - begin < BATCH_BLOCK ? n - begin : BATCH_BLOCK;
+        memcpy(x, xs + begin, count * sizeof(double));
+        for (size_t i = count; i < BATCH_BLOCK; i++)
+            ((double*)x)[i] = xs[begin]; //< pad the last block with a valid point
+        evaluateBlock(prog, x, stack);
+        memcpy(out + begin, stack, count * sizeof(double));
+    }
+    if (stack != buf)
+        free(stack);
+}
+
+static void evaluateBatchDefault(
+    const struct Program* prog, const double* xs, double* out, size_t n)
+{
+    evaluateBlocks(prog, xs, out, n);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2,fma"))) static void evaluateBatchAvx2(
+    const struct Program* prog, const double* xs, double* out, size_t n)
+{
+    evaluateBlocks(prog, xs, out, n);
+}
+
+__attribute__((target("avx512f"))) static void evaluateBatchAvx512(
+    const struct Program* prog, const double* xs, double* out, size_t n)
+{
+    evaluateBlocks(prog, xs, out, n);
+}
+#endif
+
+enum SimdLevel detectSimdLevel(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+        return SIMD_AVX512;
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        return SIMD_AVX2;
+    if (__builtin_cpu_supports("sse2"))
+        return SIMD_SSE2;
+#endif
+    return SIMD_SCALAR;
+}
+
+void evaluateBatchSimd(
+    const struct Program* prog, const double* xs, double* out, size_t n, enum SimdLevel level)
+{
+    enum SimdLevel supported = detectSimdLevel();
+    if (level > supported)
+        level = supported;
+    switch (level) {
+    case SIMD_SCALAR:
+        for (size_t i = 0; i < n; i++)
+            out[i] = evaluateProgram(prog, xs[i]);
+        break;
+#if defined(__x86_64__) || defined(__i386__)
+    case SIMD_AVX512:
+        evaluateBatchAvx512(prog, xs, out, n);
+        break;
+    case SIMD_AVX2:
+        evaluateBatchAvx2(prog, xs, out, n);
+        break;
+#endif
+    default:
+        evaluateBatchDefault(prog, xs, out, n); //< SSE2 is the x86-64 baseline
+        break;
+    }
+}
+
+void evaluateBatch(const struct Program* prog, const double* xs, double* out, size_t n)
+{
+    evaluateBatchSimd(prog, xs, out, n, SIMD_AVX512);
+}
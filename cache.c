@@ -0,0 +1,351 @@
+#include "cache.h"
+#include "program.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CACHE_SHARDS 16 //< power of two, picked by the top bits of the hash
+#define CACHE_SHARD_SHIFT 60 //< 64 - log2(CACHE_SHARDS)
+
+struct CacheEntry {
+    uint64_t hash;
+    char* key; //< normalized text
+    struct CacheEntry* chain; //< next entry of the same bucket
+    struct CacheEntry* newer; //< LRU list, most recently used first
+    struct CacheEntry* older;
+    struct Program prog; //< empty when parsing failed
+    enum ParsingResult result;
+    unsigned errIdx; //< into key
+    const char* errMsg;
+    struct Variable var;
+};
+
+struct CacheShard {
+    _Alignas(64) pthread_mutex_t lock; //< every shard starts on its own cache line
+    struct CacheEntry** buckets;
+    size_t nbuckets; //< power of two, at least twice the capacity
+    size_t capacity;
+    size_t count;
+    struct CacheEntry* newest;
+    struct CacheEntry* oldest;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+};
+
+struct ExprCache {
+    struct CacheShard shards[CACHE_SHARDS];
+};
+
+static bool isSpace(char c) { return c == ' ' || (c >= '\t' && c <= '\r'); }
+
+// Index of the first character after the run of whitespace at text[i]
+static unsigned skipSpace(const char* text, unsigned len, unsigned i)
+{
+    while (i < len && isSpace(text[i]))
+        i++;
+    return i;
+}
+
+// FNV-1a of the normalized text, whose length is stored in *keyLen. The text is the first len
+// characters here and below, its NUL characters have been cut off by the caller. FNV-1a leaves
+// the top bits that pick the shard alike for texts differing in their last character, so the
+// result goes through the murmur3 finalizer, which makes every bit depend on every input bit.
+static uint64_t hashNormalized(const char* text, unsigned len, size_t* keyLen)
+{
+    uint64_t h = 14695981039346656037ull;
+    size_t n = 0;
+    for (unsigned i = 0; i < len; n++) {
+        char c = text[i];
+        if (isSpace(c)) {
+            c = ' ';
+            i = skipSpace(text, len, i);
+        } else {
+            i++;
+        }
+        h = (h ^ (unsigned char)c) * 1099511628211ull;
+    }
+    *keyLen = n;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    return h;
+}
+
+static bool matchesNormalized(const char* key, const char* text, unsigned len)
+{
+    unsigned i = 0;
+    for (; *key; key++) {
+        if (i == len)
+            return false;
+        if (isSpace(text[i])) {
+            if (*key != ' ')
+                return false;
+            i = skipSpace(text, len, i);
+        } else if (text[i++] != *key) {
+            return false;
+        }
+    }
+    return i == len;
+}
+
+static void normalize(const char* text, unsigned len, char* out)
+{
+    for (unsigned i = 0; i < len;) {
+        if (isSpace(text[i])) {
+            *out++ = ' ';
+            i = skipSpace(text, len, i);
+        } else {
+            *out++ = text[i++];
+        }
+    }
+    *out = '\0';
+}
+
+// Position of text[idx] in the normalized text. The parser only reports positions at the start
+// or right after a run of whitespace, which stay distinct after normalization.
+static unsigned normalizedIndex(const char* text, unsigned len, unsigned idx)
+{
+    unsigned n = 0;
+    unsigned i = 0;
+    while (i < idx && i < len) {
+        if (isSpace(text[i])) {
+            unsigned end = skipSpace(text, len, i);
+            if (end > idx)
+                break; //< inside the run, which is represented by its space
+            i = end;
+        } else {
+            i++;
+        }
+        n++;
+    }
+    return n;
+}
+
+// Inverse of normalizedIndex(), the space of a run maps to the first character of the run
+static unsigned originalIndex(const char* text, unsigned len, unsigned n)
+{
+    unsigned i = 0;
+    for (; n > 0 && i < len; n--)
+        i = isSpace(text[i]) ? skipSpace(text, len, i) : i + 1;
+    return i;
+}
+
+struct ExprCache* createExprCache(size_t capacity)
+{
+    struct ExprCache* cache = aligned_alloc(_Alignof(struct ExprCache), sizeof(*cache));
+    if (!cache)
+        return NULL;
+    memset(cache, 0, sizeof(*cache));
+    size_t perShard = (capacity + CACHE_SHARDS - 1) / CACHE_SHARDS;
+    if (perShard == 0)
+        perShard = 1;
+    size_t nbuckets = 1;
+    while (nbuckets < 2 * perShard)
+        nbuckets *= 2;
+    for (unsigned i = 0; i < CACHE_SHARDS; i++) {
+        struct CacheShard* s = &cache->shards[i];
+        s->buckets = calloc(nbuckets, sizeof(*s->buckets));
+        if (!s->buckets) {
+            for (unsigned j = 0; j < i; j++) {
+                free(cache->shards[j].buckets);
+                pthread_mutex_destroy(&cache->shards[j].lock);
+            }
+            free(cache);
+            return NULL;
+        }
+        s->nbuckets = nbuckets;
+        s->capacity = perShard;
+        pthread_mutex_init(&s->lock, NULL);
+    }
+    return cache;
+}
+
+static void freeEntry(struct CacheEntry* entry)
+{
+    if (!entry)
+        return;
+    freeProgram(&entry->prog);
+    free(entry->key);
+    free(entry);
+}
+
+void freeExprCache(struct ExprCache* cache)
+{
+    if (!cache)
+        return;
+    for (unsigned i = 0; i < CACHE_SHARDS; i++) {
+        struct CacheShard* s = &cache->shards[i];
+        while (s->newest) {
+            struct CacheEntry* next = s->newest->older;
+            freeEntry(s->newest);
+            s->newest = next;
+        }
+        free(s->buckets);
+        pthread_mutex_destroy(&s->lock);
+    }
+    free(cache);
+}
+
+static struct CacheEntry* findEntry(
+    const struct CacheShard* s, uint64_t hash, const char* text, unsigned len)
+{
+    struct CacheEntry* e = s->buckets[hash & (s->nbuckets - 1)];
+    while (e && (e->hash != hash || !matchesNormalized(e->key, text, len)))
+        e = e->chain;
+    return e;
+}
+
+static void unlinkLru(struct CacheShard* s, struct CacheEntry* e)
+{
+    if (e->newer)
+        e->newer->older = e->older;
+    else
+        s->newest = e->older;
+    if (e->older)
+        e->older->newer = e->newer;
+    else
+        s->oldest = e->newer;
+}
+
+static void pushNewest(struct CacheShard* s, struct CacheEntry* e)
+{
+    e->newer = NULL;
+    e->older = s->newest;
+    if (s->newest)
+        s->newest->newer = e;
+    else
+        s->oldest = e;
+    s->newest = e;
+}
+
+// Removes the least recently used entry, which the caller frees after unlocking
+static struct CacheEntry* evictOldest(struct CacheShard* s)
+{
+    struct CacheEntry* victim = s->oldest;
+    struct CacheEntry** link = &s->buckets[victim->hash & (s->nbuckets - 1)];
+    while (*link != victim)
+        link = &(*link)->chain;
+    *link = victim->chain;
+    unlinkLru(s, victim);
+    s->count--;
+    s->evictions++;
+    return victim;
+}
+
+static struct CacheEntry* createEntry(uint64_t hash, const char* text, unsigned len,
+    size_t keyLen, const struct Expression* e, const struct Program* prog)
+{
+    struct CacheEntry* entry = malloc(sizeof(*entry));
+    if (!entry)
+        return NULL;
+    entry->hash = hash;
+    entry->key = malloc(keyLen + 1);
+    entry->prog = createProgram();
+    entry->result = e->result;
+    entry->errMsg = e->errMsg;
+    entry->var = e->var;
+    if (!entry->key || (e->result == RES_OK && !copyProgram(&entry->prog, prog))) {
+        freeEntry(entry);
+        return NULL;
+    }
+    normalize(text, len, entry->key);
+    entry->errIdx = normalizedIndex(text, len, e->errIdx);
+    return entry;
+}
+
+// Adds an entry unless another thread has added the same key since the lookup
+static void insertEntry(
+    struct CacheShard* s, struct CacheEntry* entry, const char* text, unsigned len)
+{
+    struct CacheEntry* garbage = entry;
+    pthread_mutex_lock(&s->lock);
+    if (!findEntry(s, entry->hash, text, len)) {
+        struct CacheEntry** bucket = &s->buckets[entry->hash & (s->nbuckets - 1)];
+        entry->chain = *bucket;
+        *bucket = entry;
+        pushNewest(s, entry);
+        garbage = ++s->count > s->capacity ? evictOldest(s) : NULL;
+    }
+    pthread_mutex_unlock(&s->lock);
+    freeEntry(garbage);
+}
+
+// Builds the result of a cache hit; called with the shard locked since an eviction frees entry
+static struct Expression expressionFromEntry(
+    const struct CacheEntry* entry, const char* text, unsigned len, struct Program* prog)
+{
+    struct Expression e = createExpressionView(text, len);
+    e.var = entry->var;
+    e.result = entry->result;
+    e.errIdx = originalIndex(text, len, entry->errIdx);
+    e.errMsg = entry->errMsg;
+    if (e.result != RES_OK) {
+        clearProgram(prog);
+    } else if (!copyProgram(prog, &entry->prog)) {
+        e.result = RES_ERR_INTERNAL;
+        e.errIdx = 0;
+        e.errMsg = "Out of memory";
+    }
+    return e;
+}
+
+struct Expression compileExpressionCached(
+    struct ExprCache* cache, const char* expr, struct Program* prog)
+{
+    return compileExpressionCachedView(cache, expr, (unsigned)strlen(expr), prog);
+}
+
+struct Expression compileExpressionCachedView(
+    struct ExprCache* cache, const char* expr, unsigned len, struct Program* prog)
+{
+    const char* nul = memchr(expr, '\0', len); //< ends the expression for the parser too
+    if (nul)
+        len = (unsigned)(nul - expr);
+    size_t keyLen;
+    uint64_t hash = hashNormalized(expr, len, &keyLen);
+    struct CacheShard* s = &cache->shards[hash >> CACHE_SHARD_SHIFT];
+    pthread_mutex_lock(&s->lock);
+    struct CacheEntry* entry = findEntry(s, hash, expr, len);
+    if (entry) {
+        s->hits++;
+        unlinkLru(s, entry);
+        pushNewest(s, entry);
+        struct Expression e = expressionFromEntry(entry, expr, len, prog);
+        pthread_mutex_unlock(&s->lock);
+        return e;
+    }
+    s->misses++;
+    pthread_mutex_unlock(&s->lock);
+
+    // parse without holding the lock, concurrent misses of a shard do not wait for each other
+    clearProgram(prog);
+    struct Expression e = compileExpressionView(expr, len, prog, NULL);
+    if (e.result == RES_OK && hasVariable(&e))
+        optimizeProgram(prog);
+    if (e.result != RES_ERR_INTERNAL) { //< running out of memory is no property of the text
+        entry = createEntry(hash, expr, len, keyLen, &e, prog);
+        if (entry)
+            insertEntry(s, entry, expr, len);
+    }
+    return e;
+}
+
+struct ExprCacheStats exprCacheStats(struct ExprCache* cache)
+{
+    struct ExprCacheStats stats;
+    memset(&stats, 0, sizeof(stats));
+    for (unsigned i = 0; i < CACHE_SHARDS; i++) {
+        struct CacheShard* s = &cache->shards[i];
+        pthread_mutex_lock(&s->lock);
+        stats.hits += s->hits;
+        stats.misses += s->misses;
+        stats.evictions += s->evictions;
+        stats.entries += s->count;
+        pthread_mutex_unlock(&s->lock);
+    }
+    return stats;
+}
@@ -0,0 +1,46 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include "parser.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct Program;
+
+// Bounded, thread-safe map from expression text to its compiled and optimized program together
+// with its parsing diagnostics, so recurring expressions are parsed once. Keys are normalized by
+// collapsing every run of whitespace into one space; whitespace is never dropped entirely, which
+// keeps error indices exact when they are mapped back to the caller's text. The cache is split
+// into shards with a lock and an LRU list each, picked by the hash of the key.
+struct ExprCache;
+
+struct ExprCacheStats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    size_t entries;
+};
+
+// Holds at most `capacity` expressions (at least one per shard). Returns NULL if memory could not
+// be allocated.
+struct ExprCache* createExprCache(size_t capacity);
+void freeExprCache(struct ExprCache* cache); //< NULL is ignored
+// Same as compileExpression() followed by optimizeProgram() for an expression with a variable,
+// but a cached expression is copied into prog instead of being parsed. prog is overwritten.
+// Failed parses are cached too; their errIdx refers to `expr` like an uncached parse would.
+struct Expression compileExpressionCached(
+    struct ExprCache* cache, const char* expr, struct Program* prog);
+struct Expression compileExpressionCachedView(
+    struct ExprCache* cache, const char* expr, unsigned len, struct Program* prog);
+struct ExprCacheStats exprCacheStats(struct ExprCache* cache); //< totals over all shards
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,239 @@
+#include "format.h"
+
+#include <math.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The shortest digits are found with Giulietti's Schubfach algorithm: the bounds of the interval
+// that rounds to x are scaled by a 126-bit approximation of a power of ten so that the candidates
+// are integers, and at most one of them is examined with a single division.
+
+#define POW10_MIN -292 //< range of the powers 10^-k with k = floor(log10(2^q)) for doubles
+#define POW10_MAX 324
+#define BIGNUM_WORDS 40 //< 1280 bits, enough for 10^324 and for 2^1270 / 10^292
+
+typedef unsigned __int128 u128;
+
+// g = floor(10^e / 2^r) + 1 with r chosen so that 2^125 <= g < 2^126, at index e - POW10_MIN
+static u128 pow10Table[POW10_MAX - POW10_MIN + 1];
+static pthread_once_t pow10Once = PTHREAD_ONCE_INIT;
+
+static unsigned bitLength(const uint32_t* x)
+{
+    for (unsigned i = BIGNUM_WORDS; i-- > 0;) {
+        if (x[i])
+            return 32 * i + 32 - __builtin_clz(x[i]);
+    }
+    return 0;
+}
+
+// floor(x / 2^(length - 126)) + 1, or x shifted left when it is shorter than 126 bits
+static u128 leadingBits(const uint32_t* x)
+{
+    int shift = (int)bitLength(x) - 126;
+    u128 g = 0;
+    for (int bit = 125; bit >= 0; bit--) {
+        int i = bit + shift;
+        if (i >= 0 && (x[i / 32] >> (i % 32) & 1))
+            g |= (u128)1 << bit;
+    }
+    return g + 1;
+}
+
+// Exact big integer arithmetic, run once: 10^e by repeated multiplication and 10^-e as
+// floor(2^1270 / 10^e) by repeated division, each keeping only its 126 leading bits
+static void computePow10Table(void)
+{
+    uint32_t x[BIGNUM_WORDS] = { 1 };
+    for (int e = 0; e <= POW10_MAX; e++) {
+        if (e > 0) {
+            uint64_t carry = 0;
+            for (unsigned i = 0; i < BIGNUM_WORDS; i++) {
+                uint64_t t = (uint64_t)x[i] * 10 + carry;
+                x[i] = (uint32_t)t;
+                carry = t >> 32;
+            }
+        }
+        pow10Table[e - POW10_MIN] = leadingBits(x);
+    }
+    memset(x, 0, sizeof(x));
+    x[BIGNUM_WORDS - 1] = 1u << 22;
+    for (int e = -1; e >= POW10_MIN; e--) {
+        uint64_t rem = 0;
+        for (unsigned i = BIGNUM_WORDS; i-- > 0;) {
+            uint64_t t = rem << 32 | x[i];
+            x[i] = (uint32_t)(t / 10);
+            rem = t % 10;
+        }
+        pow10Table[e - POW10_MIN] = leadingBits(x);
+    }
+}
+
+static int floorLog10Pow2(int q) { return (int)((int64_t)q * 661971961083LL >> 41); }
+static int floorLog10ThreeQuartersPow2(int q)
+{
+    return (int)(((int64_t)q * 661971961083LL - 274743187321LL) >> 41);
+}
+static int floorLog2Pow10(int e) { return (int)((int64_t)e * 913124641741LL >> 38); }
+
+// (g * cp) / 2^127 rounded to odd, which keeps whether the scaled bound was exact. As in the
+// paper, the bits below 2^64 of the product of the low half of g are dropped, which the error
+// analysis of g = floor(beta) + 1 relies on.
+static uint64_t roundToOdd(u128 g, uint64_t cp)
+{
+    uint64_t g1 = (uint64_t)(g >> 63), g0 = (uint64_t)g & ~(~0ull << 63);
+    u128 y = (u128)g1 * cp;
+    uint64_t z = ((uint64_t)y >> 1) + (uint64_t)((u128)g0 * cp >> 64);
+    uint64_t vbp = (uint64_t)(y >> 64) + (z >> 63);
+    return vbp | (((z & ~(~0ull << 63)) + ~(~0ull << 63)) >> 63);
+}
+
+// Shortest f * 10^*e in the rounding interval of c * 2^q, the closest to it if there are several
+static uint64_t shortestDecimal(uint64_t c, int q, int* e)
+{
+    uint64_t out = c & 1; //< the bounds belong to the interval when c is even
+    uint64_t cb = c << 2;
+    uint64_t cbr = cb + 2;
+    uint64_t cbl;
+    int k;
+    if (c != (1ull << 52) || q == -1074) {
+        cbl = cb - 2;
+        k = floorLog10Pow2(q);
+    } else { //< the gap to the next smaller double is half as wide
+        cbl = cb - 1;
+        k = floorLog10ThreeQuartersPow2(q);
+    }
+    int h = q + floorLog2Pow10(-k) + 2;
+    u128 g = pow10Table[-k - POW10_MIN];
+    uint64_t vb = roundToOdd(g, cb << h); //< 4 x 10^-k and the bounds, rounded to odd
+    uint64_t vbl = roundToOdd(g, cbl << h);
+    uint64_t vbr = roundToOdd(g, cbr << h);
+    uint64_t s = vb >> 2;
+    if (s >= 10) { //< one digit less, if a multiple of 10 lies in the interval
+        uint64_t sp10 = s / 10 * 10;
+        uint64_t tp10 = sp10 + 10;
+        bool upin = vbl + out <= sp10 << 2;
+        bool wpin = (tp10 << 2) + out <= vbr;
+        if (upin != wpin) {
+            *e = k;
+            return upin ? sp10 : tp10;
+        }
+    }
+    uint64_t t = s + 1;
+    bool uin = vbl + out <= s << 2;
+    bool win = (t << 2) + out <= vbr;
+    *e = k;
+    if (uin != win)
+        return uin ? s : t;
+    int64_t cmp = (int64_t)(vb - ((s + t) << 1)); //< the closer one, or the even one on a tie
+    return cmp < 0 || (cmp == 0 && (s & 1) == 0) ? s : t;
+}
+
+static const char digitPairs[] = "00010203040506070809101112131415161718192021222324252627282930"
+                                "31323334353637383940414243444546474849505152535455565758596061"
+                                "6263646566676869707172737475767778798081828384858687888990919293"
+                                "949596979899";
+
+// Writes the decimal digits of f and returns their count, two at a time in 32-bit arithmetic
+static size_t writeDigits(uint64_t f, char* out)
+{
+    char digits[20];
+    char* p = digits + sizeof(digits);
+    while (f >= 100000000) {
+        uint32_t low = (uint32_t)(f % 100000000);
+        f /= 100000000;
+        for (int i = 0; i < 4; i++, low /= 100)
+            memcpy(p -= 2, digitPairs + 2 * (low % 100), 2);
+    }
+    uint32_t high = (uint32_t)f;
+    for (; high >= 100; high /= 100)
+        memcpy(p -= 2, digitPairs + 2 * (high % 100), 2);
+    if (high >= 10)
+        memcpy(p -= 2, digitPairs + 2 * high, 2);
+    else
+        *--p = (char)('0' + high);
+    size_t n = (size_t)(digits + sizeof(digits) - p);
+    memcpy(out, p, n);
+    return n;
+}
+
+size_t formatDouble(double x, char* out)
+{
+    if (isnan(x)) {
+        memcpy(out, "nan", 3);
+        return 3;
+    }
+    char* p = out;
+    if (signbit(x))
+        *p++ = '-';
+    if (isinf(x)) {
+        memcpy(p, "inf", 3);
+        return (size_t)(p - out) + 3;
+    }
+    uint64_t bits;
+    memcpy(&bits, &x, sizeof(bits));
+    uint64_t t = bits & ((1ull << 52) - 1);
+    int bq = (int)(bits >> 52 & 0x7ff);
+    uint64_t f;
+    int e;
+    if (bq != 0) {
+        uint64_t c = t | 1ull << 52;
+        int q = bq - 1075;
+        if (-q > 0 && -q < 53 && (c & ((1ull << -q) - 1)) == 0) { //< an integer below 2^53
+            f = c >> -q;
+            e = 0;
+        } else {
+            pthread_once(&pow10Once, computePow10Table);
+            f = shortestDecimal(c, q, &e);
+        }
+    } else if (t != 0) {
+        pthread_once(&pow10Once, computePow10Table);
+        f = shortestDecimal(t, -1074, &e);
+    } else {
+        *p = '0';
+        return (size_t)(p - out) + 1;
+    }
+    while (f % 10 == 0) {
+        f /= 10;
+        e++;
+    }
+
+    char digits[20];
+    int n = (int)writeDigits(f, digits);
+    int exp10 = e + n - 1; //< of the leading digit
+    int expDigits = abs(exp10) >= 100 ? 3 : 2;
+    int scientificLen = n + (n > 1) + 2 + expDigits;
+    int fixedLen = exp10 >= 0 ? (n > exp10 + 1 ? n + 1 : exp10 + 1) : n + 1 - exp10;
+    if (fixedLen <= scientificLen) {
+        if (exp10 < 0) { //< 0.000ddd
+            memcpy(p, "0.", 2);
+            memset(p + 2, '0', -exp10 - 1);
+            memcpy(p + 1 - exp10, digits, n);
+        } else if (n > exp10 + 1) { //< ddd.ddd
+            memcpy(p, digits, exp10 + 1);
+            p[exp10 + 1] = '.';
+            memcpy(p + exp10 + 2, digits + exp10 + 1, n - exp10 - 1);
+        } else { //< ddd000
+            memcpy(p, digits, n);
+            memset(p + n, '0', exp10 + 1 - n);
+        }
+        return (size_t)(p - out) + fixedLen;
+    }
+    *p++ = digits[0];
+    if (n > 1) {
+        *p++ = '.';
+        memcpy(p, digits + 1, n - 1);
+        p += n - 1;
+    }
+    *p++ = 'e';
+    *p++ = exp10 < 0 ? '-' : '+';
+    unsigned a = (unsigned)abs(exp10);
+    if (expDigits == 3)
+        *p++ = (char)('0' + a / 100);
+    *p++ = (char)('0' + a / 10 % 10);
+    *p++ = (char)('0' + a % 10);
+    return (size_t)(p - out);
+}
@@ -0,0 +1,22 @@
+#ifndef FORMAT_H
+#define FORMAT_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FORMAT_DOUBLE_MAX 24 //< longest text formatDouble() writes, e.g. -2.2250738585072014e-308
+
+// Writes the shortest decimal text that strtod() reads back as exactly x, without a terminating
+// NUL, and returns its length. Of several shortest candidates the one closest to x is taken.
+// Like C++'s std::to_chars, the text is in fixed or scientific notation, whichever is shorter:
+// 0.1, 1e+22, 123456, 1.5e-07. Infinities and NaN are written as inf, -inf and nan.
+size_t formatDouble(double x, char* out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
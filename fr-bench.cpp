@@ -0,0 +1,375 @@
+// Performance regression suite. Machine-readable results are written with the usual Google
+// Benchmark flags, e.g. fr-bench --benchmark_format=json or --benchmark_out=results.json.
+#include "arena.h"
+#include "format.h"
+#include "fr.hpp"
+#include "parser.h"
+#include "polynomial.h"
+#include "program.h"
+#include "solver.h"
+#include "stats.h"
+#include <benchmark/benchmark.h>
+#include <math.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+namespace {
+
+enum Shape {
+    SHORT,
+    NESTED, //< 32 levels of parentheses
+    FUNCTIONS, //< every function of the grammar
+    LONG_SUM, //< 256 terms
+};
+
+const std::string& corpus(Shape shape)
+{
+    static const std::string exprs[] = {
+        "x*x - 2",
+        [] {
+            std::string s = "x";
+            for (int i = 0; i < 32; i++)
+                s = "(" + s + "*1.01 - 0.5)";
+            return s;
+        }(),
+        "sin(x) + cos(x)*exp(-x*x/4) + atan(x/2) - sqrt(x*x+1)/2 + tan(x/8)",
+        [] {
+            std::string s = "x/1";
+            for (int i = 2; i <= 256; i++)
+                s += " + x/" + std::to_string(i);
+            return s + " - 10";
+        }(),
+    };
+    return exprs[shape];
+}
+
+unsigned countTokens(const char* s)
+{
+    Expression e = createExpressionWithVariable(s, 1.);
+    unsigned n = 0;
+    while (readToken(&e).type != TOK_NONE && e.result == RES_OK)
+        n++;
+    return n;
+}
+
+// Reports the time per token through an inverted rate counter
+void BM_readToken(benchmark::State& state, Shape shape)
+{
+    const char* s = corpus(shape).c_str();
+    for (auto _ : state) {
+        Expression e = createExpressionWithVariable(s, 1.);
+        Token_t t;
+        do
+            t = readToken(&e);
+        while (t.type != TOK_NONE && e.result == RES_OK);
+        benchmark::DoNotOptimize(t);
+    }
+    state.counters["s/token"] = benchmark::Counter(countTokens(s),
+        benchmark::Counter::kIsIterationInvariantRate | benchmark::Counter::kInvert);
+}
+
+void BM_evaluateExpression(benchmark::State& state, Shape shape)
+{
+    const char* s = corpus(shape).c_str();
+    for (auto _ : state) {
+        Expression e = createExpressionWithVariable(s, 0.5);
+        benchmark::DoNotOptimize(evaluateExpression(&e));
+    }
+}
+
+void BM_evaluateProgram(benchmark::State& state, Shape shape)
+{
+    Program prog = createProgram();
+    compileExpression(corpus(shape).c_str(), &prog);
+    optimizeProgram(&prog);
+    for (auto _ : state)
+        benchmark::DoNotOptimize(evaluateProgram(&prog, 0.5));
+    freeProgram(&prog);
+}
+
+// The FUNCTIONS shape parsed by the compiler, to compare with BM_evaluateProgram/functions
+constexpr fr::FixedString functionsText
+    = "sin(x) + cos(x)*exp(-x*x/4) + atan(x/2) - sqrt(x*x+1)/2 + tan(x/8)";
+
+void BM_evaluateStatic(benchmark::State& state)
+{
+    constexpr auto f = fr::expression<functionsText>;
+    double x = 0.5;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(x);
+        benchmark::DoNotOptimize(f(x));
+    }
+}
+
+// Compiles and optimizes one expression the way --batch does for every line, with a fresh heap
+// program or with an arena reset after each expression
+void compileRepeatedly(benchmark::State& state, Shape shape, bool arena)
+{
+    const char* s = corpus(shape).c_str();
+    Arena a = createArena();
+    for (auto _ : state) {
+        Program prog = arena ? createProgramInArena(&a) : createProgram();
+        compileExpression(s, &prog);
+        optimizeProgram(&prog);
+        benchmark::DoNotOptimize(prog.code);
+        if (arena)
+            resetArena(&a);
+        else
+            freeProgram(&prog);
+    }
+    freeArena(&a);
+}
+
+void BM_compileHeap(benchmark::State& state, Shape shape)
+{
+    compileRepeatedly(state, shape, false);
+}
+
+void BM_compileArena(benchmark::State& state, Shape shape)
+{
+    compileRepeatedly(state, shape, true);
+}
+
+// Compiles a signed, parenthesized power nested `range(0)` levels deep; time and memory of the
+// explicit parser stack grow linearly with the depth
+void BM_compileDeep(benchmark::State& state)
+{
+    size_t n = state.range(0);
+    std::string s = std::string(n, '-') + std::string(n, '(') + "x**2" + std::string(n, ')');
+    Program prog = createProgram();
+    for (auto _ : state) {
+        clearProgram(&prog);
+        compileExpression(s.c_str(), &prog);
+        benchmark::DoNotOptimize(prog.code);
+    }
+    state.SetComplexityN(n);
+    freeProgram(&prog);
+}
+
+struct CountingObjective {
+    Objective inner;
+    size_t evals;
+    size_t intervalEvals;
+};
+
+double countingEval(const void* ctx, double x, double* dfdx)
+{
+    auto* c = static_cast<CountingObjective*>(const_cast<void*>(ctx));
+    c->evals++;
+    return c->inner.eval(c->inner.ctx, x, dfdx);
+}
+
+Interval countingEvalInterval(const void* ctx, Interval x, Interval* dfdx)
+{
+    auto* c = static_cast<CountingObjective*>(const_cast<void*>(ctx));
+    c->intervalEvals++;
+    return c->inner.evalInterval(c->inner.ctx, x, dfdx);
+}
+
+// One iteration finds one root the way fr does: compile, optimize, solve. The reported time is
+// the wall time per root, "evals" the objective evaluations Newton needed for it.
+void BM_newton(benchmark::State& state, Shape shape)
+{
+    const char* s = corpus(shape).c_str();
+    size_t evals = 0;
+    size_t failures = 0;
+    for (auto _ : state) {
+        Program prog = createProgram();
+        compileExpression(s, &prog);
+        optimizeProgram(&prog);
+        CountingObjective counting = { programObjective(&prog), 0, 0 };
+        Objective f = { countingEval, nullptr, &counting, nullptr, nullptr };
+        SolveResult r = newtonSolve(f, 0.5, 1e-10, 50);
+        benchmark::DoNotOptimize(r.x);
+        evals += counting.evals;
+        failures += r.status != SOLVE_OK;
+        freeProgram(&prog);
+    }
+    state.counters["evals"] = benchmark::Counter(evals, benchmark::Counter::kAvgIterations);
+    if (failures)
+        state.SkipWithError("Newton did not converge");
+}
+
+// One iteration finds every root of a damped oscillation in [-20, 20], either by a dense scan
+// with Brent on every sign change or by interval Newton. "evals" counts point evaluations and
+// "interval_evals" interval evaluations; the scan cannot rule out roots between its points.
+void BM_allRoots(benchmark::State& state, SolveMethod method)
+{
+    Program prog = createProgram();
+    compileExpression("sin(3*x) * exp(-x*x/50) - 0.1", &prog);
+    optimizeProgram(&prog);
+    std::vector<double> roots(4097);
+    size_t evals = 0;
+    size_t intervalEvals = 0;
+    size_t nroots = 0;
+    for (auto _ : state) {
+        CountingObjective counting = { programObjective(&prog), 0, 0 };
+        Objective f = { countingEval, nullptr, &counting, countingEvalInterval, nullptr };
+        bool ok;
+        if (method == METHOD_INTERVAL) {
+            double* found;
+            ok = intervalMultiSolve(f, -20., 20., 16, 1e-10, 60, 1, &found, &nroots);
+            free(found);
+        } else {
+            ok = bracketMultiSolve(f, method, -20., 20., 4096, 1e-10, 60, 1, roots.data(), &nroots);
+        }
+        benchmark::DoNotOptimize(ok);
+        evals += counting.evals;
+        intervalEvals += counting.intervalEvals;
+    }
+    state.counters["evals"] = benchmark::Counter(evals, benchmark::Counter::kAvgIterations);
+    state.counters["interval_evals"]
+        = benchmark::Counter(intervalEvals, benchmark::Counter::kAvgIterations);
+    state.counters["roots"] = nroots;
+    freeProgram(&prog);
+}
+
+// All roots of a degree-12 polynomial with real and complex roots, once by expanding it and
+// running Aberth-Ehrlich and once by multi-start Newton over the range of its real roots, which
+// cannot find the complex ones. "roots" counts the roots found.
+void BM_polynomialRoots(benchmark::State& state, SolveMethod method)
+{
+    std::string expr = "(x*x + 1)";
+    for (int k = 1; k <= 10; k++)
+        expr += "*(x - " + std::to_string(k / 4.) + ")";
+    Program prog = createProgram();
+    compileExpression(expr.c_str(), &prog);
+    optimizeProgram(&prog);
+    std::vector<double> xs(65);
+    std::vector<Complex> zs(16);
+    size_t nroots = 0;
+    for (auto _ : state) {
+        if (method == METHOD_ABERTH) {
+            Polynomial p = { nullptr, 0 };
+            unsigned iterations;
+            bool ok = expandPolynomial(&prog, &p)
+                && aberthSolve(&p, 100, true, zs.data(), &iterations) == SOLVE_OK;
+            nroots = ok ? p.degree : 0;
+            freePolynomial(&p);
+        } else {
+            newtonMultiStart(
+                programObjective(&prog), 0., 3., 64, 1e-10, 50, 1, xs.data(), &nroots);
+        }
+        benchmark::DoNotOptimize(nroots);
+    }
+    state.counters["roots"] = nroots;
+    freeProgram(&prog);
+}
+
+// One root of a transcendental function at a tight tolerance by Householder's method of the
+// given order (1 is Newton), with "evals" the evaluations it took
+void BM_householder(benchmark::State& state, unsigned order)
+{
+    Program prog = createProgram();
+    compileExpression("exp(x) - 3*x*x + sin(x) + atan(x/2)", &prog);
+    optimizeProgram(&prog);
+    SolveResult r = {};
+    StatsSink sink = {};
+    setStatsSink(&sink);
+    for (auto _ : state) {
+        r = householderSolve(programObjective(&prog), order, 1., 1e-15, 50);
+        benchmark::DoNotOptimize(r.x);
+    }
+    setStatsSink(nullptr);
+    state.counters["evals"] = benchmark::Counter(sink.evals, benchmark::Counter::kAvgIterations);
+    if (r.status != SOLVE_OK)
+        state.SkipWithError("did not converge");
+    freeProgram(&prog);
+}
+
+// Roots of x^3 - p*x - 1 for 1000 values of p, cold starts from x0 against continuation
+void BM_parameterSweep(benchmark::State& state, bool continuation)
+{
+    SymbolTable symbols;
+    symbols.count = 0;
+    Program prog = createProgram();
+    compileExpressionWithSymbols("x*x*x - p*x - 1", &prog, &symbols);
+    optimizeProgram(&prog);
+    ParameterizedProgram family = { &prog, 0, 1 };
+    FamilyObjective f = programFamilyObjective(&family);
+    const size_t steps = 1000;
+    std::vector<SolveResult> results(steps);
+    unsigned nthreads = (unsigned)state.range(0);
+    for (auto _ : state) {
+        if (continuation) {
+            continuationSolve(f, 1.5, 0., 10., steps, 1e-10, 50, nthreads, results.data());
+        } else {
+            for (size_t i = 0; i < steps; i++) {
+                double p = 10. * i / (steps - 1);
+                continuationSolve(f, 1.5, p, p, 1, 1e-10, 50, 1, &results[i]);
+            }
+        }
+        benchmark::DoNotOptimize(results.data());
+    }
+    unsigned iterations = 0;
+    for (const SolveResult& r : results)
+        iterations += r.iterations;
+    state.counters["iterations"] = iterations;
+    freeProgram(&prog);
+}
+
+// Every function of the grammar over 4096 points in one evaluateBatch() call
+void BM_evaluateBatch(benchmark::State& state, MathAccuracy accuracy)
+{
+    Program prog = createProgram();
+    compileExpression(corpus(FUNCTIONS).c_str(), &prog);
+    prog.accuracy = accuracy;
+    std::vector<double> xs(4096), out(xs.size());
+    for (size_t i = 0; i < xs.size(); i++)
+        xs[i] = -10. + 20. * i / xs.size();
+    for (auto _ : state) {
+        evaluateBatch(&prog, xs.data(), out.data(), xs.size());
+        benchmark::DoNotOptimize(out.data());
+    }
+    state.SetItemsProcessed(state.iterations() * xs.size());
+    freeProgram(&prog);
+}
+
+// Text of a table column, by formatDouble() or by printf("%.17g") which also reads back
+void BM_formatDouble(benchmark::State& state, bool shortest)
+{
+    std::vector<double> xs(4096);
+    for (size_t i = 0; i < xs.size(); i++)
+        xs[i] = sin(0.01 * i) * exp(-1e-3 * i);
+    char buf[32];
+    for (auto _ : state) {
+        for (double x : xs) {
+            size_t n = shortest ? formatDouble(x, buf) : snprintf(buf, sizeof(buf), "%.17g", x);
+            benchmark::DoNotOptimize(n);
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * xs.size());
+}
+
+} // namespace
+
+// Registers `bench` once per corpus shape, the optional argument is applied to each of them
+#define FR_CORPUS(bench, ...)                                                                      \
+    BENCHMARK_CAPTURE(bench, short, SHORT) __VA_ARGS__;                                            \
+    BENCHMARK_CAPTURE(bench, nested, NESTED) __VA_ARGS__;                                          \
+    BENCHMARK_CAPTURE(bench, functions, FUNCTIONS) __VA_ARGS__;                                    \
+    BENCHMARK_CAPTURE(bench, long_sum, LONG_SUM) __VA_ARGS__
+
+FR_CORPUS(BM_readToken);
+FR_CORPUS(BM_evaluateExpression);
+FR_CORPUS(BM_evaluateProgram);
+BENCHMARK(BM_evaluateStatic);
+BENCHMARK_CAPTURE(BM_evaluateBatch, exact, ACCURACY_EXACT);
+BENCHMARK_CAPTURE(BM_evaluateBatch, 1ulp, ACCURACY_1ULP);
+BENCHMARK_CAPTURE(BM_evaluateBatch, fast, ACCURACY_FAST);
+BENCHMARK_CAPTURE(BM_formatDouble, shortest, true);
+BENCHMARK_CAPTURE(BM_formatDouble, printf, false);
+FR_CORPUS(BM_compileHeap);
+FR_CORPUS(BM_compileArena);
+BENCHMARK(BM_compileDeep)->RangeMultiplier(10)->Range(100, 100000)->Complexity(benchmark::oN);
+FR_CORPUS(BM_newton, ->UseRealTime());
+BENCHMARK_CAPTURE(BM_allRoots, brent_scan, METHOD_BRENT);
+BENCHMARK_CAPTURE(BM_allRoots, interval, METHOD_INTERVAL);
+BENCHMARK_CAPTURE(BM_polynomialRoots, newton_multistart, METHOD_NEWTON);
+BENCHMARK_CAPTURE(BM_polynomialRoots, aberth, METHOD_ABERTH);
+BENCHMARK_CAPTURE(BM_householder, newton, 1);
+BENCHMARK_CAPTURE(BM_householder, halley, 2);
+BENCHMARK_CAPTURE(BM_householder, householder3, 3);
+BENCHMARK_CAPTURE(BM_parameterSweep, cold, false)->Arg(1);
+BENCHMARK_CAPTURE(BM_parameterSweep, continuation, true)->Arg(1)->Arg(4)->UseRealTime();
@@ -1,6 +1,31 @@
+#include "arena.h"
+#include "cache.h"
+#include "fr.h"
+#include "fr.hpp"
+#include "format.h"
+#include "jit.h"
 #include "parser.h"
+#include "polynomial.h"
+#include "pool.h"
+#include "program.h"
+#include "serve.h"
+#include "solver.h"
+#include "stats.h"
+#include "stream.h"
+#include "table.h"
 #include <catch2/catch.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <math.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <vector>
 
 #define CHECK_TOK(expr, tok)                                                                       \
     do {                                                                                           \
@@ -27,7 +52,7 @@ TEST_CASE("Token reader", "[parser]")
     CHECK_TOK("atan", TOK_ATAN);
     CHECK_TOK("exp", TOK_EXP);
     CHECK_TOK("sqrt", TOK_SQRT);
-    // CHECK_TOK("", TOK_POWER);
+    CHECK_TOK("**", TOK_POWER);
     CHECK_TOK("myVariable", TOK_VARIABLE);
 }
 #undef CHECK_TOK
@@ -54,7 +79,7 @@ TEST_CASE("Invalid expressions return correct error results", "[parser]")
 
 TEST_CASE("Addition of two integer operands", "[parser]")
 {
-    Expression expr = { "553+3", 0, RES_OK, 0, "" };
+    Expression expr = createExpression("553+3");
     SECTION("Check overall consistency")
     {
         CHECK(readNonNegativeNumber(&expr) == 553);
@@ -67,19 +92,19 @@ TEST_CASE("Addition of two integer operands", "[parser]")
 
 TEST_CASE("Addition of two negative integers", "[parser]")
 {
-    Expression expr = { "-553 + -3", 0, RES_OK, 0, "" };
+    Expression expr = createExpression("-553 + -3");
     SECTION("Check expression evaluation") { CHECK(evaluateExpression(&expr) == -556); }
 }
 
 TEST_CASE("Multiplication of two negative integers", "[parser]")
 {
-    Expression expr = { "-3 * -2", 0, RES_OK, 0, "" };
+    Expression expr = createExpression("-3 * -2");
     SECTION("Check expression evaluation") { CHECK(evaluateExpression(&expr) == 6); }
 }
 
 TEST_CASE("Addition of two floating-point operands", "[parser]")
 {
-    Expression expr = { "553.2+3.4", 0, RES_OK, 0, "" };
+    Expression expr = createExpression("553.2+3.4");
     SECTION("Check overall consistency")
     {
         CHECK(readNonNegativeNumber(&expr) == 553.2);
@@ -91,43 +116,43 @@ TEST_CASE("Addition of two floating-point operands", "[parser]")
 
 TEST_CASE("Addition of two integer operands with whitespace", "[parser]")
 {
-    Expression expr = { "    553   +   3     ", 0, RES_OK, 0, "" };
+    Expression expr = createExpression("    553   +   3     ");
     SECTION("Check expression evaluation") { CHECK(evaluateExpression(&expr) == 556); }
 }
 
 TEST_CASE("Addition of two integer operands with whitespace and brackets", "[parser]")
 {
-    Expression expr = { "  (  553   +   3  )   ", 0, RES_OK, 0, "" };
+    Expression expr = createExpression("  (  553   +   3  )   ");
     SECTION("Check expression evaluation") { CHECK(evaluateExpression(&expr) == 556); }
 }
 
 TEST_CASE("Addition of three integer operands", "[parser]")
 {
-    Expression expr = { "553+3+20", 0, RES_OK, 0, "" };
+    Expression expr = createExpression("553+3+20");
     SECTION("Check expression evaluation") { CHECK(evaluateExpression(&expr) == 576); }
 }
 
 TEST_CASE("Addition of three integer operands with whitespace", "[parser]")
 {
-    Expression expr = { "    553   +   3     +   20  ", 0, RES_OK, 0, "" };
+    Expression expr = createExpression("    553   +   3     +   20  ");
     SECTION("Check expression evaluation") { CHECK(evaluateExpression(&expr) == 576); }
 }
 
 TEST_CASE("Addition of three integer operands with whitespace and brackets", "[parser]")
 {
-    Expression expr = { "    553   +  ( 3     +   20 )    ", 0, RES_OK, 0, "" };
+    Expression expr = createExpression("    553   +  ( 3     +   20 )    ");
     CHECK(evaluateExpression(&expr) == 576);
 }
 
 TEST_CASE("Addition of multiple integer operands with whitespace and brackets", "[parser]")
 {
-    Expression expr = { "    553   +  ( 3     +   20 )    +(7+    3)", 0, RES_OK, 0, "" };
+    Expression expr = createExpression("    553   +  ( 3     +   20 )    +(7+    3)");
     CHECK(evaluateExpression(&expr) == 586);
 }
 
 TEST_CASE("Multiplication of two integer operands", "[parser]")
 {
-    Expression expr = { "5*6", 0, RES_OK, 0, "" };
+    Expression expr = createExpression("5*6");
     SECTION("Check overall consistency")
     {
         CHECK(readNonNegativeNumber(&expr) == 5);
@@ -139,41 +164,1656 @@ TEST_CASE("Multiplication of two integer operands", "[parser]")
 
 TEST_CASE("Multiplication of two floating point operands", "[parser]")
 {
-    Expression expr = { "2.5*2.5", 0, RES_OK, 0, "" };
+    Expression expr = createExpression("2.5*2.5");
     SECTION("Check expression evaluation") { CHECK(evaluateExpression(&expr) == 6.25); }
 }
 
 TEST_CASE("Multiplication precedence", "[parser]")
 {
-    Expression expr = { "2*3+4", 0, RES_OK, 0, "" };
+    Expression expr = createExpression("2*3+4");
     SECTION("Check expression evaluation") { CHECK(evaluateExpression(&expr) == 10); }
 }
 
+TEST_CASE("Power binds tighter than signs and groups to the right", "[parser]")
+{
+    auto eval = [](const char* s) {
+        Expression e = createExpressionWithVariable(s, 3.);
+        double v = evaluateExpression(&e);
+        CHECK(e.result == RES_OK);
+        return v;
+    };
+    CHECK(eval("2**10") == 1024);
+    CHECK(eval("-2**2") == -4);
+    CHECK(eval("(-2)**2") == 4);
+    CHECK(eval("2**3**2") == 512);
+    CHECK(eval("2**-1") == 0.5);
+    CHECK(eval("2*3**2") == 18);
+    CHECK(eval("2 ** x * 2") == 16);
+    CHECK(eval("-x**2 - -x") == -6);
+
+    Expression e = createExpression("1/0**2");
+    evaluateExpression(&e);
+    CHECK(e.result == RES_ERR_DIV_BY_ZERO);
+    CHECK(e.errIdx == 1);
+    e = createExpression("2***3");
+    evaluateExpression(&e);
+    CHECK(e.result == RES_ERR_INVALID_INPUT);
+    CHECK(e.errIdx == 3);
+    e = createExpression("1/0$"); //< the division comes first in the text
+    evaluateExpression(&e);
+    CHECK(e.result == RES_ERR_DIV_BY_ZERO);
+}
+
+TEST_CASE("Deeply nested expressions are parsed without recursion", "[parser]")
+{
+    const size_t n = 100000;
+    std::string parens = std::string(n, '(') + "x" + std::string(n, ')');
+    std::string signs = std::string(n, '-') + "x";
+    std::string calls;
+    for (size_t i = 0; i < n; i++)
+        calls += "atan(";
+    calls += "x" + std::string(n, ')');
+    std::string powers;
+    for (size_t i = 0; i < n; i++)
+        powers += "1**";
+    powers += "x";
+    for (const std::string* s : { &parens, &signs, &calls, &powers }) {
+        Expression e = createExpressionWithVariable(s->c_str(), 0.5);
+        double value = evaluateExpression(&e);
+        REQUIRE(e.result == RES_OK);
+        CHECK(e.currIdx == s->size());
+        Program prog = createProgram();
+        REQUIRE(compileExpression(s->c_str(), &prog).result == RES_OK);
+        CHECK(evaluateProgram(&prog, 0.5) == value);
+        freeProgram(&prog);
+    }
+
+    std::string open = std::string(n, '(') + "x";
+    Expression e = createExpression(open.c_str());
+    evaluateExpression(&e);
+    CHECK(e.result == RES_ERR_CLOSE_PARAN_MISSING);
+    CHECK(e.errIdx == open.size());
+    std::string zero = std::string(n, '(') + "1/" + std::string(n, '-') + "0" + std::string(n, ')');
+    e = createExpression(zero.c_str());
+    evaluateExpression(&e);
+    CHECK(e.result == RES_ERR_DIV_BY_ZERO);
+    CHECK(e.errIdx == n + 1);
+}
+
 TEST_CASE("Math functions", "[parser]")
 {
     SECTION("sin")
     {
-        Expression expr = { "sin(3.14159/2)", 0, RES_OK, 0, "" };
+        Expression expr = createExpression("sin(3.14159/2)");
         CHECK(round(evaluateExpression(&expr)) == 1.0);
     }
     SECTION("cos")
     {
-        Expression expr = { "cos(0)", 0, RES_OK, 0, "" };
+        Expression expr = createExpression("cos(0)");
         CHECK(round(evaluateExpression(&expr)) == 1.0);
     }
     SECTION("tan")
     {
-        Expression expr = { "tan(0)", 0, RES_OK, 0, "" };
+        Expression expr = createExpression("tan(0)");
         CHECK(round(evaluateExpression(&expr)) == 0.0);
     }
     SECTION("atan")
     {
-        Expression expr = { "atan(0)", 0, RES_OK, 0, "" };
+        Expression expr = createExpression("atan(0)");
         CHECK(round(evaluateExpression(&expr)) == 0.0);
+        Expression expr1 = createExpression("atan(1)");
+        CHECK(evaluateExpression(&expr1) == Approx(M_PI / 4));
     }
     SECTION("exp")
     {
-        Expression expr = { "exp(0)", 0, RES_OK, 0, "" };
+        Expression expr = createExpression("exp(0)");
         CHECK(round(evaluateExpression(&expr)) == 1.0);
     }
 }
+
+TEST_CASE("Compiled programs match the interpreter", "[program]")
+{
+    const char* exprs[] = { "553+3", "-3 * -2", "2*3+4", "x*x - 2", "--x + +x", "1/(x+10)",
+        "sin(x)*cos(x) - tan(x/4) + atan(x) - exp(-x*x) + sqrt(x*x+1)", "(x+1)*(x-1)/(x*x+1)",
+        "-x**2 + 2**x**2 - x**-1" };
+    double xs[] = { -2.5, -1, 0.25, 1, 3.75 };
+    for (const char* s : exprs) {
+        Program prog = createProgram();
+        Expression c = compileExpression(s, &prog);
+        REQUIRE(c.result == RES_OK);
+        CHECK(prog.depth == 1);
+        for (double x : xs) {
+            Expression e = createExpressionWithVariable(s, x);
+            double expected = evaluateExpression(&e);
+            REQUIRE(e.result == RES_OK);
+            CHECK(evaluateProgram(&prog, x) == expected);
+        }
+        freeProgram(&prog);
+    }
+}
+
+TEST_CASE("Compilation reports parsing errors", "[program]")
+{
+    Program prog = createProgram();
+    SECTION("invalid input")
+    {
+        CHECK(compileExpression("x+", &prog).result == RES_ERR_INVALID_INPUT);
+    }
+    SECTION("constant division by zero")
+    {
+        CHECK(compileExpression("x/(2-2)", &prog).result == RES_ERR_DIV_BY_ZERO);
+    }
+    SECTION("division by the variable")
+    {
+        CHECK(compileExpression("1/x", &prog).result == RES_OK);
+        CHECK(isinf(evaluateProgram(&prog, 0)));
+    }
+    freeProgram(&prog);
+}
+
+TEST_CASE("Dual evaluation returns exact derivatives", "[program]")
+{
+    struct {
+        const char* expr;
+        double (*df)(double);
+    } cases[] = {
+        { "x*x*x - 2*x", [](double x) { return 3 * x * x - 2; } },
+        { "1/(x*x+1)", [](double x) { return -2 * x / ((x * x + 1) * (x * x + 1)); } },
+        { "sin(x)*cos(x)", [](double x) { return cos(2 * x); } },
+        { "tan(x) + atan(x)", [](double x) { return 1 / (cos(x) * cos(x)) + 1 / (1 + x * x); } },
+        { "exp(-x) + sqrt(x*x+1)", [](double x) { return -exp(-x) + x / sqrt(x * x + 1); } },
+        { "x**3 - 2**x", [](double x) { return 3 * x * x - log(2.) * exp2(x); } },
+        { "(x*x + 1)**x",
+            [](double x) {
+                double w = x * x + 1;
+                return pow(w, x) * (log(w) + 2 * x * x / w);
+            } },
+    };
+    for (auto& c : cases) {
+        Program prog = createProgram();
+        REQUIRE(compileExpression(c.expr, &prog).result == RES_OK);
+        for (double x : { -1.5, -0.25, 0.5, 1.25 }) {
+            double dfdx;
+            double f = evaluateProgramDual(&prog, x, &dfdx);
+            CHECK(f == evaluateProgram(&prog, x));
+            CHECK(dfdx == Approx(c.df(x)).epsilon(1e-12));
+        }
+        freeProgram(&prog);
+    }
+}
+
+// Compiles S at run time as well and compares values, derivatives and error reports
+template <fr::FixedString S> void checkStaticExpression()
+{
+    Program prog = createProgram();
+    Expression e = compileExpression(S.text, &prog);
+    constexpr fr::Diagnostic d = fr::diagnose<S>();
+    INFO(S.text);
+    CHECK(d.result == e.result);
+    if constexpr (d.result != RES_OK) {
+        CHECK(d.errIdx == e.errIdx);
+    } else {
+        constexpr auto f = fr::expression<S>;
+        // the same operations in the same order, so even NaNs agree
+        auto same = [](double a, double b) { return a == b || (isnan(a) && isnan(b)); };
+        for (double x : { -2.5, -1., 0., 0.25, 1., 3.75 }) {
+            double dfdx, expected = evaluateProgramDual(&prog, x, &dfdx);
+            double dual;
+            CHECK(same(f(x), evaluateProgram(&prog, x)));
+            CHECK(same(f.evaluateDual(x, &dual), expected));
+            CHECK(same(dual, dfdx));
+        }
+    }
+    freeProgram(&prog);
+}
+
+TEST_CASE("Compile-time expressions match the runtime parser", "[static]")
+{
+    static_assert(fr::expression<"(1+2)*3 - 4/8">(0.) == 8.5);
+    static_assert(fr::expression<"x*x - 2">.variable() == "x");
+    static_assert(!fr::expression<"-2.5e1">.hasVariable);
+    static_assert(fr::diagnose<"sin5)">().result == RES_ERR_OPEN_PARAN_MISSING);
+    static_assert(fr::diagnose<"a+b">().errIdx == 2);
+
+    checkStaticExpression<"553+3">();
+    checkStaticExpression<"--x + +x">();
+    checkStaticExpression<"sin(x)*cos(x) - tan(x/4) + atan(x) - exp(-x*x) + sqrt(x*x+1)">();
+    checkStaticExpression<"(x+1)*(x-1)/(x*x+1)">();
+    checkStaticExpression<"tangent">();
+    checkStaticExpression<"12345678901234567890123e-30 * x + 0.1e-3">();
+    checkStaticExpression<"1) + 2">();
+    checkStaticExpression<"1/(x-x)">();
+    checkStaticExpression<"-x**2 + 2**x**2 - x**-1">();
+    checkStaticExpression<"(x*x + 1)**1.5 + x**x">();
+    // every error, including divisions by constants the parser folds
+    checkStaticExpression<":">();
+    checkStaticExpression<"">();
+    checkStaticExpression<"sin5)">();
+    checkStaticExpression<"sin(5">();
+    checkStaticExpression<"(x">();
+    checkStaticExpression<"x + 2 *">();
+    checkStaticExpression<"aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa">();
+    checkStaticExpression<"x+y">();
+    checkStaticExpression<"x/(1 - 0.1e1)">();
+    checkStaticExpression<"1/sin(0)">();
+    checkStaticExpression<"1/exp(-800)">();
+    checkStaticExpression<"1/(1e-320*1e-10)">();
+    checkStaticExpression<"1e200*1e200/(1e-300*1e-300)">();
+    checkStaticExpression<"1/0**2">();
+    checkStaticExpression<"1/(2**-1080)">();
+    checkStaticExpression<"1/(0.5**-2000 - 10**400)">();
+    checkStaticExpression<"x/(-1)**0.5 + 1/(-8)**3">();
+    checkStaticExpression<"2***3">();
+    checkStaticExpression<"1/0 $">();
+
+    SECTION("solvers")
+    {
+        constexpr auto f = fr::expression<"x*x - 2">;
+        SolveResult r = fr::newton(f, 1., 1e-12, 50);
+        CHECK(r.status == SOLVE_OK);
+        CHECK(r.x == Approx(sqrt(2.)));
+        r = fr::bracket(fr::expression<"exp(x) - 3">, METHOD_BRENT, 0., 2., 1e-12, 100);
+        CHECK(r.status == SOLVE_OK);
+        CHECK(r.x == Approx(log(3.)));
+        double roots[16];
+        size_t nroots;
+        REQUIRE(newtonMultiStart(fr::objective(fr::expression<"sin(x)">), -4., 4., 16, 1e-12, 50,
+            1, roots, &nroots));
+        CHECK(nroots == 3);
+    }
+}
+
+TEST_CASE("Taylor evaluation returns exact higher derivatives", "[program]")
+{
+    struct {
+        const char* expr;
+        double (*d[3])(double);
+    } cases[] = {
+        { "x*x*x - 2*x",
+            { [](double x) { return 3 * x * x - 2; }, [](double x) { return 6 * x; },
+                [](double) { return 6.; } } },
+        { "1/x",
+            { [](double x) { return -1 / (x * x); }, [](double x) { return 2 / (x * x * x); },
+                [](double x) { return -6 / (x * x * x * x); } } },
+        { "sin(x)*sin(x)", //< a register once optimized
+            { [](double x) { return sin(2 * x); }, [](double x) { return 2 * cos(2 * x); },
+                [](double x) { return -4 * sin(2 * x); } } },
+        { "cos(2*x)",
+            { [](double x) { return -2 * sin(2 * x); }, [](double x) { return -4 * cos(2 * x); },
+                [](double x) { return 8 * sin(2 * x); } } },
+        { "tan(x)",
+            { [](double x) { return 1 + tan(x) * tan(x); },
+                [](double x) { return 2 * tan(x) * (1 + tan(x) * tan(x)); },
+                [](double x) {
+                    double t = tan(x);
+                    return (1 + t * t) * (2 + 6 * t * t);
+                } } },
+        { "atan(x)",
+            { [](double x) { return 1 / (1 + x * x); },
+                [](double x) { return -2 * x / ((1 + x * x) * (1 + x * x)); },
+                [](double x) {
+                    double w = 1 + x * x;
+                    return (6 * x * x - 2) / (w * w * w);
+                } } },
+        { "exp(-x)",
+            { [](double x) { return -exp(-x); }, [](double x) { return exp(-x); },
+                [](double x) { return -exp(-x); } } },
+        { "sqrt(x*x)", //< |x|
+            { [](double x) { return x < 0 ? -1. : 1.; }, [](double) { return 0.; },
+                [](double) { return 0.; } } },
+        { "x**-2",
+            { [](double x) { return -2 / (x * x * x); }, [](double x) { return 6 / pow(x, 4); },
+                [](double x) { return -24 / pow(x, 5); } } },
+        { "(x*x + 1)**1.5",
+            { [](double x) { return 3 * x * sqrt(x * x + 1); },
+                [](double x) { return 3 * sqrt(x * x + 1) + 3 * x * x / sqrt(x * x + 1); },
+                [](double x) {
+                    double w = x * x + 1;
+                    return 9 * x / sqrt(w) - 3 * x * x * x / (w * sqrt(w));
+                } } },
+        { "2**x",
+            { [](double x) { return log(2.) * exp2(x); },
+                [](double x) { return log(2.) * log(2.) * exp2(x); },
+                [](double x) { return log(2.) * log(2.) * log(2.) * exp2(x); } } },
+    };
+    for (auto& c : cases) {
+        Program prog = createProgram();
+        REQUIRE(compileExpression(c.expr, &prog).result == RES_OK);
+        optimizeProgram(&prog);
+        INFO(c.expr);
+        for (double x : { -1.5, -0.25, 0.5, 1.25 }) {
+            double d[TAYLOR_MAX_ORDER];
+            double f = evaluateProgramDerivatives(&prog, x, 3, d);
+            CHECK(f == Approx(evaluateProgram(&prog, x)).epsilon(1e-15));
+            for (int k = 0; k < 3; k++)
+                CHECK(d[k] == Approx(c.d[k](x)).epsilon(1e-12).margin(1e-12));
+            double dfdx;
+            evaluateProgramDual(&prog, x, &dfdx);
+            CHECK(evaluateProgramDerivatives(&prog, x, 1, d) == f);
+            CHECK(d[0] == Approx(dfdx).epsilon(1e-15));
+        }
+        freeProgram(&prog);
+    }
+}
+
+TEST_CASE("Interval evaluation encloses every point of the interval", "[interval]")
+{
+    const char* exprs[] = { "x*x*x - 2*x", "1/(x - 0.3)", "sin(x)*cos(x)", "tan(x) + atan(x)",
+        "exp(-x) + sqrt(x + 1)", "x/(x*x + 1) - 3*x", "sqrt(x*x) - cos(3*x)",
+        "x**3 - 2**-x + x**-2", "x**x + x**0.5" };
+    const Interval boxes[] = { { -1.5, -1.4 }, { -0.5, 2. }, { 0.29, 0.31 }, { 1., 1. },
+        { -3., 3. }, { 0.3, 5. }, { 1.5, 1.6 } };
+    for (const char* expr : exprs) {
+        Program prog = createProgram();
+        REQUIRE(compileExpression(expr, &prog).result == RES_OK);
+        optimizeProgram(&prog);
+        for (Interval box : boxes) {
+            Interval d;
+            Interval f = evaluateProgramInterval(&prog, box, &d);
+            for (int i = 0; i <= 100; i++) {
+                double x = box.lo + (box.hi - box.lo) * (i / 100.);
+                double dfdx;
+                double fx = evaluateProgramDual(&prog, x, &dfdx);
+                if (!isfinite(fx) || !isfinite(dfdx))
+                    continue;
+                INFO(expr << " at " << x);
+                CHECK(f.lo <= fx);
+                CHECK(fx <= f.hi);
+                CHECK(d.lo <= dfdx);
+                CHECK(dfdx <= d.hi);
+            }
+        }
+        freeProgram(&prog);
+    }
+}
+
+TEST_CASE("Interval evaluation handles domains, poles and periods", "[interval]")
+{
+    auto range = [](const char* expr, double lo, double hi) {
+        Program prog = createProgram();
+        REQUIRE(compileExpression(expr, &prog).result == RES_OK);
+        Interval d;
+        Interval f = evaluateProgramInterval(&prog, Interval { lo, hi }, &d);
+        freeProgram(&prog);
+        return f;
+    };
+    Interval f = range("sqrt(x)", -4., -1.);
+    CHECK((isnan(f.lo) && isnan(f.hi))); //< defined nowhere
+    f = range("sqrt(x)", -4., 4.);
+    CHECK(f.lo == 0);
+    CHECK(f.hi == Approx(2.));
+    f = range("1/x", 0., 2.);
+    CHECK(f.lo == Approx(0.5));
+    CHECK(f.hi == INFINITY);
+    f = range("1/x", -1., 2.);
+    CHECK(f.lo == -INFINITY);
+    CHECK(f.hi == INFINITY);
+    f = range("tan(x)", 1., 2.);
+    CHECK(f.lo == -INFINITY); //< pole at pi/2
+    f = range("tan(x)", -1., 1.);
+    CHECK(f.lo == Approx(tan(-1.)));
+    CHECK(f.lo < tan(-1.));
+    CHECK(f.hi > tan(1.));
+    f = range("sin(x)", 1., 2.);
+    CHECK(f.hi == 1);
+    CHECK(f.lo == Approx(sin(1.)));
+    f = range("cos(x)", 3., 4.);
+    CHECK(f.lo == -1);
+    f = range("x**0.5", -4., -1.);
+    CHECK((isnan(f.lo) && isnan(f.hi)));
+    f = range("x**0.5", -4., 4.);
+    CHECK(f.lo == 0);
+    CHECK(f.hi == Approx(2.));
+    f = range("x**2", -1., 2.);
+    CHECK(f.lo == 0);
+    CHECK(f.hi == Approx(4.));
+    f = range("x**3", -2., 1.);
+    CHECK(f.lo == Approx(-8.));
+    f = range("x**-1", 0., 2.);
+    CHECK(f.lo == Approx(0.5));
+    CHECK(f.hi == INFINITY);
+    f = range("x**x", -2., -1.); //< defined at -2 and -1 only
+    CHECK(f.lo == -INFINITY);
+    f = range("x - 1", 1., 1.);
+    CHECK(f.lo == 0); //< exact results are not widened
+    CHECK(f.hi == 0);
+}
+
+TEST_CASE("Batch evaluation matches scalar evaluation", "[program]")
+{
+    const char* exprs[] = { "x", "2.5", "-x*x + 3*x - 1/(x+100)",
+        "sin(x)*cos(x) - tan(x/4) + atan(x) - exp(-x*x) + sqrt(x*x+1)", "x**3 - 2**-x" };
+    std::vector<double> xs(1000), out(xs.size());
+    for (size_t i = 0; i < xs.size(); i++)
+        xs[i] = -5. + 0.01 * i;
+    for (const char* s : exprs) {
+        Program prog = createProgram();
+        REQUIRE(compileExpression(s, &prog).result == RES_OK);
+        for (SimdLevel level : { SIMD_SCALAR, SIMD_SSE2, SIMD_AVX2, SIMD_AVX512 }) {
+            for (size_t n : { (size_t)1, (size_t)63, xs.size() }) {
+                std::fill(out.begin(), out.end(), 0.);
+                evaluateBatchSimd(&prog, xs.data(), out.data(), n, level);
+                for (size_t i = 0; i < n; i++)
+                    CHECK(out[i] == evaluateProgram(&prog, xs[i]));
+            }
+        }
+        freeProgram(&prog);
+    }
+}
+
+// Distance of y from the exact result in units in the last place of the double nearest to it
+static double ulpError(double y, long double exact)
+{
+    double nearest = (double)exact;
+    if (y == nearest || (isnan(y) && isnan(nearest)))
+        return 0.;
+    double ulp = nextafter(fabs(nearest), INFINITY) - fabs(nearest);
+    return (double)(fabsl((long double)y - exact) / ulp);
+}
+
+TEST_CASE("Vector math stays within its ulp bound", "[vecmath]")
+{
+    struct {
+        const char* expr;
+        long double (*exact)(long double);
+        double lo, hi;
+    } functions[] = { { "sin(x)", sinl, -100., 100. }, { "cos(x)", cosl, -100., 100. },
+        { "tan(x)", tanl, -100., 100. }, { "atan(x)", atanl, -1e3, 1e3 },
+        { "exp(x)", expl, -745., 709. } };
+    std::vector<double> xs;
+    for (int i = 0; i <= 100000; i++)
+        xs.push_back(i / 100000.);
+    for (int k = -1000; k <= 1000; k++) //< multiples of pi/2, where the reduction cancels
+        xs.push_back((double)(k * 1.5707963267948966192313216916397514L));
+    const double specials[] = { 0., -0., 1e-310, 1e5, -1e5, 1e5 + 1, 1e10, 1e300, 710., -746.,
+        1e3, -1e3, INFINITY, -INFINITY, NAN };
+    std::vector<double> out(xs.size() + std::size(specials));
+    for (const auto& f : functions) {
+        std::vector<double> in = xs;
+        for (size_t i = 0; i <= 100000; i++)
+            in[i] = f.lo + (f.hi - f.lo) * in[i];
+        in.insert(in.end(), std::begin(specials), std::end(specials));
+        Program prog = createProgram();
+        REQUIRE(compileExpression(f.expr, &prog).result == RES_OK);
+        for (MathAccuracy accuracy : { ACCURACY_1ULP, ACCURACY_FAST }) {
+            prog.accuracy = accuracy;
+            double bound = accuracy == ACCURACY_1ULP ? 1. : 4.;
+            for (SimdLevel level : { SIMD_SSE2, SIMD_AVX2, SIMD_AVX512 }) {
+                evaluateBatchSimd(&prog, in.data(), out.data(), in.size(), level);
+                double worst = 0.;
+                size_t at = 0;
+                for (size_t i = 0; i < in.size(); i++) {
+                    double e = ulpError(out[i], f.exact(in[i]));
+                    if (!(e <= worst)) {
+                        worst = e;
+                        at = i;
+                    }
+                }
+                INFO(f.expr << " at " << in[at] << " accuracy " << accuracy << " level " << level);
+                CHECK(worst <= bound);
+            }
+        }
+        freeProgram(&prog);
+    }
+}
+
+TEST_CASE("JIT-compiled functions match the interpreter", "[jit]")
+{
+    const char* exprs[] = { "x", "2.5", "-x*x + 3*x - 1/(x+100)", "(x-1)/(x+2) - x/3",
+        "sin(x)*cos(x) - tan(x/4) + atan(x) - exp(-x*x) + sqrt(x*x+1)",
+        "(x*x + 1)**x - 2**x**2 + x**3" };
+    for (const char* s : exprs) {
+        Program prog = createProgram();
+        REQUIRE(compileExpression(s, &prog).result == RES_OK);
+        JitFunction f = jitCompile(&prog);
+        JitDualFunction f1 = jitCompileDual(&prog);
+#if defined(__x86_64__)
+        REQUIRE(f);
+        REQUIRE(f1);
+#endif
+        for (double x : { -2.5, -1., 0.25, 1., 3.75 }) {
+            double dfdx;
+            double expected = evaluateProgramDual(&prog, x, &dfdx);
+            if (f)
+                CHECK(f(x) == expected);
+            if (f1) {
+                double jitDfdx;
+                CHECK(f1(x, &jitDfdx) == expected);
+                CHECK(jitDfdx == dfdx);
+            }
+        }
+        jitFree((void*)f);
+        jitFree((void*)f1);
+        freeProgram(&prog);
+    }
+    // an operand stack deeper than a page of frame is left to the interpreter
+    std::string deep;
+    for (int i = 0; i < 600; i++)
+        deep += "x+(";
+    deep += "x" + std::string(600, ')');
+    Program prog = createProgram();
+    REQUIRE(compileExpression(deep.c_str(), &prog).result == RES_OK);
+    CHECK(jitCompile(&prog) == nullptr);
+    CHECK(jitCompileDual(&prog) == nullptr);
+    freeProgram(&prog);
+}
+
+TEST_CASE("Optimized programs match the original tape", "[optimize]")
+{
+    const char* exprs[] = { "x", "2*3 + 4", "x*1 + 0 - 0/1", "--x * -(-1)", "(2*3+1)*x*1 + 0",
+        "sin(x)*sin(x) + cos(x)*cos(x)", "(x+1)*(x+1) - (1+x)/(x+2)", "-x*-x + x - -x",
+        "exp(-x*x) * exp(-x*x) + sqrt(x*x+1) / sqrt(x*x+1) + atan(tan(x/4))",
+        "x**1 + 2**3*x**2 - (x*x)**x" };
+    for (const char* s : exprs) {
+        Program prog = createProgram();
+        Program opt = createProgram();
+        REQUIRE(compileExpression(s, &prog).result == RES_OK);
+        REQUIRE(compileExpression(s, &opt).result == RES_OK);
+        REQUIRE(optimizeProgram(&opt));
+        CHECK(opt.depth == 1);
+        CHECK(opt.len <= prog.len);
+        JitDualFunction jit = jitCompileDual(&opt);
+        std::vector<double> xs = { -2.5, -1., -0.25, 0.5, 1., 3.75 }, out(xs.size());
+        evaluateBatch(&opt, xs.data(), out.data(), xs.size());
+        for (size_t i = 0; i < xs.size(); i++) {
+            double dfdx, optDfdx;
+            double expected = evaluateProgramDual(&prog, xs[i], &dfdx);
+            CHECK(evaluateProgram(&opt, xs[i]) == expected);
+            CHECK(evaluateProgramDual(&opt, xs[i], &optDfdx) == expected);
+            CHECK(optDfdx == Approx(dfdx).epsilon(1e-14));
+            CHECK(out[i] == expected);
+            if (jit)
+                CHECK(jit(xs[i], &optDfdx) == expected);
+        }
+        jitFree((void*)jit);
+        freeProgram(&prog);
+        freeProgram(&opt);
+    }
+
+    Program prog = createProgram();
+    SECTION("constants are folded")
+    {
+        REQUIRE(compileExpression("(2*3+1)*x*1 + 0", &prog).result == RES_OK);
+        REQUIRE(optimizeProgram(&prog));
+        CHECK(prog.len == 3); //< 7 x *
+        clearProgram(&prog);
+        REQUIRE(compileExpression("2**3*x**1", &prog).result == RES_OK);
+        REQUIRE(optimizeProgram(&prog));
+        CHECK(prog.len == 3); //< 8 x *
+    }
+    SECTION("common subexpressions are computed once")
+    {
+        REQUIRE(compileExpression("sin(x+1)*sin(1+x) + sin(x+1)", &prog).result == RES_OK);
+        REQUIRE(optimizeProgram(&prog));
+        CHECK(prog.nregs == 1);
+        CHECK(prog.len == 9); //< x 1 + sin store load * load +
+        REQUIRE(optimizeProgram(&prog)); //< optimizing again keeps the program intact
+        CHECK(prog.len == 9);
+        CHECK(evaluateProgram(&prog, 0.5) == sin(1.5) * sin(1.5) + sin(1.5));
+    }
+    SECTION("unsafe identities are kept")
+    {
+        REQUIRE(compileExpression("0*x + x/x", &prog).result == RES_OK);
+        REQUIRE(optimizeProgram(&prog));
+        CHECK(isnan(evaluateProgram(&prog, INFINITY)));
+    }
+    freeProgram(&prog);
+}
+
+TEST_CASE("parallelFor visits every index exactly once", "[pool]")
+{
+    std::vector<std::atomic<int>> visits(10007);
+    auto body = [](void* ctx, size_t begin, size_t end, unsigned) {
+        auto& v = *static_cast<std::vector<std::atomic<int>>*>(ctx);
+        for (size_t i = begin; i < end; i++)
+            v[i]++;
+    };
+    for (unsigned threads : { 1u, 3u, 8u }) {
+        for (auto& v : visits)
+            v = 0;
+        parallelFor(visits.size(), 7, threads, body, &visits);
+        for (auto& v : visits)
+            REQUIRE(v == 1);
+    }
+}
+
+TEST_CASE("parallelFor called from a body runs while the outer call holds the threads", "[pool]")
+{
+    std::vector<std::atomic<int>> visits(4 * 1000);
+    auto outer = [](void* ctx, size_t begin, size_t end, unsigned) {
+        auto inner = [](void* ctx, size_t begin, size_t end, unsigned) {
+            auto& v = *static_cast<std::vector<std::atomic<int>>*>(ctx);
+            for (size_t i = begin; i < end; i++)
+                v[i]++;
+        };
+        auto& v = *static_cast<std::vector<std::atomic<int>>*>(ctx);
+        for (size_t k = begin; k < end; k++) {
+            std::vector<std::atomic<int>> part(1000);
+            parallelFor(part.size(), 10, 3, inner, &part);
+            for (size_t i = 0; i < part.size(); i++)
+                v[k * 1000 + i] += part[i];
+        }
+    };
+    for (int round = 0; round < 3; round++) {
+        for (auto& v : visits)
+            v = 0;
+        parallelFor(4, 1, 4, outer, &visits);
+        for (auto& v : visits)
+            REQUIRE(v == 1);
+    }
+}
+
+TEST_CASE("Newton solver statuses", "[solver]")
+{
+    Program prog = createProgram();
+    SECTION("converges")
+    {
+        REQUIRE(compileExpression("x*x - 2", &prog).result == RES_OK);
+        SolveResult r = newtonSolve(programObjective(&prog), 1., 1e-12, 50);
+        CHECK(r.status == SOLVE_OK);
+        CHECK(r.x == Approx(sqrt(2.)));
+    }
+    SECTION("zero derivative")
+    {
+        REQUIRE(compileExpression("x*x + 1", &prog).result == RES_OK);
+        CHECK(newtonSolve(programObjective(&prog), 0., 1e-12, 50).status == SOLVE_ZERO_DERIVATIVE);
+    }
+    SECTION("no convergence")
+    {
+        REQUIRE(compileExpression("x*x + 1", &prog).result == RES_OK);
+        CHECK(newtonSolve(programObjective(&prog), 0.5, 1e-12, 20).status == SOLVE_MAXITER);
+    }
+    SECTION("not finite")
+    {
+        REQUIRE(compileExpression("1/x", &prog).result == RES_OK);
+        CHECK(newtonSolve(programObjective(&prog), 0., 1e-12, 20).status == SOLVE_NOT_FINITE);
+    }
+    freeProgram(&prog);
+}
+
+TEST_CASE("Symbol tables number variables across expressions", "[program]")
+{
+    SymbolTable symbols;
+    symbols.count = 0;
+    Program p = createProgram();
+    Program q = createProgram();
+    REQUIRE(compileExpressionWithSymbols("y*sin(x) + y/x", &p, &symbols).result == RES_OK);
+    symbols.vars[0].value = 4.;
+    REQUIRE(compileExpressionWithSymbols("z - x*exp(y)", &q, &symbols).result == RES_OK);
+    REQUIRE(symbols.count == 3);
+    CHECK(symbols.vars[0].value == 4.); //< the caller's values survive compilation
+    CHECK(symbols.vars[2].value == 0.);
+    CHECK(std::string(symbols.vars[0].name) == "y");
+    CHECK(std::string(symbols.vars[1].name) == "x");
+    CHECK(std::string(symbols.vars[2].name) == "z");
+    CHECK(p.nvars == 2);
+    CHECK(q.nvars == 3);
+    REQUIRE(optimizeProgram(&p));
+
+    double vars[] = { 1.5, 0.75, -2. };
+    double grad[3];
+    CHECK(evaluateProgramGradient(&p, vars, 3, grad) == Approx(1.5 * sin(0.75) + 1.5 / 0.75));
+    CHECK(grad[0] == Approx(sin(0.75) + 1 / 0.75));
+    CHECK(grad[1] == Approx(1.5 * cos(0.75) - 1.5 / (0.75 * 0.75)));
+    CHECK(grad[2] == 0);
+    CHECK(evaluateProgramGradient(&q, vars, 3, grad) == Approx(-2. - 0.75 * exp(1.5)));
+    CHECK(grad[0] == Approx(-0.75 * exp(1.5)));
+    CHECK(grad[1] == Approx(-exp(1.5)));
+    CHECK(grad[2] == 1);
+
+    symbols.vars[0].value = 2.;
+    symbols.vars[1].value = 4.;
+    Expression e = createExpressionWithSymbols("x*y - y", &symbols, 0.);
+    CHECK(evaluateExpression(&e) == 6.);
+
+    clearProgram(&p);
+    REQUIRE(compileExpressionWithSymbols("x**y", &p, &symbols).result == RES_OK);
+    CHECK(evaluateProgramGradient(&p, vars, 3, grad) == pow(0.75, 1.5));
+    CHECK(grad[0] == Approx(pow(0.75, 1.5) * log(0.75)));
+    CHECK(grad[1] == Approx(1.5 * pow(0.75, 0.5)));
+    freeProgram(&p);
+    freeProgram(&q);
+}
+
+TEST_CASE("Newton solves nonlinear systems", "[solver]")
+{
+    const char* eqs[] = { "x*x + y*y + z*z - 14", "x*y - 2", "exp(z - 3) - 1 + x - 1" };
+    SymbolTable symbols;
+    symbols.count = 0;
+    Program progs[3];
+    for (int i = 0; i < 3; i++) {
+        progs[i] = createProgram();
+        REQUIRE(compileExpressionWithSymbols(eqs[i], &progs[i], &symbols).result == RES_OK);
+    }
+    double x[] = { 1.2, 1.8, 2.5 };
+    SystemResult r;
+    REQUIRE(newtonSystemSolve(programSystemObjective(progs, 3), x, 1e-12, 50, &r));
+    CHECK(r.status == SOLVE_OK);
+    CHECK(r.residual <= 1e-12);
+    CHECK(x[0] == Approx(1.));
+    CHECK(x[1] == Approx(2.));
+    CHECK(x[2] == Approx(3.));
+
+    double y[] = { 0., 0., 0. }; //< x*y - 2 and the first equation are flat in x and y here
+    REQUIRE(newtonSystemSolve(programSystemObjective(progs, 3), y, 1e-12, 50, &r));
+    CHECK(r.status == SOLVE_ZERO_DERIVATIVE);
+    for (Program& p : progs)
+        freeProgram(&p);
+}
+
+TEST_CASE("Continuation follows a root over a parameter sweep", "[solver]")
+{
+    SymbolTable symbols;
+    symbols.count = 0;
+    Program prog = createProgram();
+    REQUIRE(compileExpressionWithSymbols("-p*x + x*x*x - 1", &prog, &symbols).result == RES_OK);
+    ParameterizedProgram family = { &prog, 1, 0 }; //< p is numbered first
+    const size_t steps = 301;
+    for (unsigned nthreads : { 1u, 4u }) {
+        std::vector<SolveResult> results(steps);
+        REQUIRE(continuationSolve(programFamilyObjective(&family), 1., 0., 3., steps, 1e-12, 50,
+            nthreads, results.data()));
+        unsigned iterations = 0;
+        for (size_t i = 0; i < steps; i++) {
+            double p = 3. * i / (steps - 1);
+            double x = results[i].x;
+            INFO("p = " << p);
+            REQUIRE(results[i].status == SOLVE_OK);
+            CHECK(std::fabs(x * x * x - p * x - 1) <= 1e-12);
+            CHECK(x >= 1.); //< stays on the branch through x0, the only real root for p < 1.89
+            iterations += results[i].iterations;
+        }
+        CHECK(iterations <= 2 * steps); //< a cold start from x0 = 1 finds f' = 0 at p = 3
+    }
+    freeProgram(&prog);
+}
+
+TEST_CASE("Halley and Householder converge faster than Newton", "[solver]")
+{
+    Program prog = createProgram();
+    REQUIRE(compileExpression("exp(x) - 3*x*x + sin(x)", &prog).result == RES_OK);
+    Objective f = programObjective(&prog);
+    SolveResult newton = newtonSolve(f, 1., 1e-15, 50);
+    REQUIRE(newton.status == SOLVE_OK);
+    for (unsigned order : { 2u, 3u }) {
+        INFO("order " << order);
+        SolveResult r = householderSolve(f, order, 1., 1e-15, 50);
+        REQUIRE(r.status == SOLVE_OK);
+        CHECK(r.x == Approx(newton.x).epsilon(1e-14));
+        CHECK(r.iterations < newton.iterations);
+    }
+    freeProgram(&prog);
+
+    // plain Newton diverges from |x0| > 1.39 on atan, the damped fallback does not
+    prog = createProgram();
+    REQUIRE(compileExpression("atan(x)", &prog).result == RES_OK);
+    CHECK(newtonSolve(programObjective(&prog), 3., 1e-12, 50).status != SOLVE_OK);
+    for (unsigned order : { 1u, 2u, 3u }) {
+        SolveResult r = householderSolve(programObjective(&prog), order, 3., 1e-12, 50);
+        CHECK(r.status == SOLVE_OK);
+        CHECK(r.x == Approx(0.).margin(1e-12));
+    }
+    std::vector<double> roots(100);
+    size_t n = 0;
+    REQUIRE(householderMultiStart(
+        programObjective(&prog), 2, -10., 10., 100, 1e-12, 50, 2, roots.data(), &n));
+    REQUIRE(n == 1);
+    CHECK(roots[0] == Approx(0.).margin(1e-12));
+    freeProgram(&prog);
+}
+
+TEST_CASE("Multi-start Newton reports every root in the range", "[solver]")
+{
+    Program prog = createProgram();
+    REQUIRE(compileExpression("sin(x)", &prog).result == RES_OK);
+    std::vector<double> roots(200);
+    size_t n = 0;
+    REQUIRE(newtonMultiStart(
+        programObjective(&prog), -10., 10., 200, 1e-10, 50, 4, roots.data(), &n));
+    REQUIRE(n == 7);
+    for (size_t i = 0; i < n; i++)
+        CHECK(roots[i] == Approx((double(i) - 3.) * M_PI));
+    freeProgram(&prog);
+}
+
+TEST_CASE("Bracketing solvers converge on a sign change", "[solver]")
+{
+    Program prog = createProgram();
+    REQUIRE(compileExpression("atan(x - 1.5) * 10", &prog).result == RES_OK);
+    for (SolveMethod m : { METHOD_BISECT, METHOD_BRENT, METHOD_ILLINOIS, METHOD_HYBRID }) {
+        SolveResult r = bracketSolve(programObjective(&prog), m, -100., 100., 1e-12, 200);
+        CHECK(r.status == SOLVE_OK);
+        CHECK(r.x == Approx(1.5).margin(1e-12));
+    }
+    CHECK(bracketSolve(programObjective(&prog), METHOD_BRENT, 2., 3., 1e-12, 200).status
+        == SOLVE_NO_BRACKET);
+    clearProgram(&prog);
+    REQUIRE(compileExpression("x - 1 + 0*sqrt(x*x - 0.01)", &prog).result == RES_OK);
+    CHECK(bracketSolve(programObjective(&prog), METHOD_HYBRID, -1.1, 1.1, 1e-12, 200).status
+        == SOLVE_NOT_FINITE); //< NaN at the first midpoint
+    freeProgram(&prog);
+}
+
+TEST_CASE("Bracketing solvers skip poles while scanning", "[solver]")
+{
+    Program prog = createProgram();
+    REQUIRE(compileExpression("tan(x)", &prog).result == RES_OK);
+    for (SolveMethod m : { METHOD_BISECT, METHOD_BRENT, METHOD_ILLINOIS, METHOD_HYBRID }) {
+        std::vector<double> roots(101);
+        size_t n = 0;
+        REQUIRE(bracketMultiSolve(
+            programObjective(&prog), m, -4., 4., 100, 1e-10, 200, 2, roots.data(), &n));
+        REQUIRE(n == 3);
+        for (size_t i = 0; i < n; i++)
+            CHECK(roots[i] == Approx((double(i) - 1.) * M_PI).margin(1e-9));
+    }
+    freeProgram(&prog);
+}
+
+TEST_CASE("Interval Newton finds every root in the range", "[solver]")
+{
+    struct {
+        const char* expr;
+        double a;
+        double b;
+        std::vector<double> roots;
+    } cases[] = {
+        { "sin(x)", -10., 10., { -3 * M_PI, -2 * M_PI, -M_PI, 0., M_PI, 2 * M_PI, 3 * M_PI } },
+        { "(x - 1)*(x - 1.0001)", -4., 4., { 1., 1.0001 } }, //< missed by a coarse scan
+        { "tan(x) - 1", -4., 4., { -3 * M_PI / 4, M_PI / 4, 5 * M_PI / 4 } },
+        { "sqrt(x) - 2", -10., 10., { 4. } },
+        { "x*x + 1", -10., 10., {} },
+        { "1/(x - 1)", -10., 10., {} },
+    };
+    for (auto& c : cases) {
+        Program prog = createProgram();
+        REQUIRE(compileExpression(c.expr, &prog).result == RES_OK);
+        optimizeProgram(&prog);
+        double* roots;
+        size_t n = 0;
+        INFO(c.expr);
+        REQUIRE(intervalMultiSolve(
+            programObjective(&prog), c.a, c.b, 4, 1e-10, 60, 2, &roots, &n));
+        REQUIRE(n == c.roots.size());
+        for (size_t i = 0; i < n; i++)
+            CHECK(roots[i] == Approx(c.roots[i]).margin(1e-9));
+        free(roots);
+        freeProgram(&prog);
+    }
+    // a double root where |f| > tol a little off the root, so the box must not be dropped when
+    // it becomes too narrow to split
+    Program prog = createProgram();
+    REQUIRE(compileExpression("1e8*(x-0.3)*(x-0.3)", &prog).result == RES_OK);
+    for (double tol : { 1e-3, 1e-5, 1e-10 }) {
+        double* roots;
+        size_t n = 0;
+        INFO("tol " << tol);
+        REQUIRE(intervalMultiSolve(programObjective(&prog), 0., 1., 4, tol, 60, 2, &roots, &n));
+        REQUIRE(n == 1);
+        CHECK(roots[0] == Approx(0.3).margin(1e-9));
+        free(roots);
+    }
+    freeProgram(&prog);
+}
+
+TEST_CASE("Polynomials are expanded into their coefficients", "[polynomial]")
+{
+    struct {
+        const char* expr;
+        std::vector<double> coeffs;
+    } cases[] = {
+        { "(x - 1)*(x + 2)*3 - x/2", { -6., 2.5, 3. } },
+        { "-(x*x*x) + 2*x*x*x + sqrt(4)", { 2., 0., 0., 1. } },
+        { "(x + 1)*(x + 1) - x*x", { 1., 2. } }, //< the leading terms cancel
+        { "x - x", { 0. } },
+        { "(2*x - 3)/4", { -0.75, 0.5 } },
+        { "(x + 1)**3 - x**2 + 4**0.5", { 3., 3., 2., 1. } },
+    };
+    for (auto& c : cases) {
+        INFO(c.expr);
+        for (bool optimize : { false, true }) {
+            Program prog = createProgram();
+            REQUIRE(compileExpression(c.expr, &prog).result == RES_OK);
+            if (optimize)
+                optimizeProgram(&prog);
+            Polynomial p;
+            REQUIRE(expandPolynomial(&prog, &p));
+            REQUIRE(p.degree + 1 == c.coeffs.size());
+            for (unsigned i = 0; i <= p.degree; i++)
+                CHECK(p.coeffs[i] == Approx(c.coeffs[i]).margin(1e-15));
+            CHECK(evaluatePolynomial(&p, 1.5) == Approx(evaluateProgram(&prog, 1.5)));
+            freePolynomial(&p);
+            freeProgram(&prog);
+        }
+    }
+    for (const char* expr : { "sin(x)", "1/x", "sqrt(x*x)", "x/(x - x)", "x**0.5", "2**x" }) {
+        INFO(expr);
+        Program prog = createProgram();
+        REQUIRE(compileExpression(expr, &prog).result == RES_OK);
+        Polynomial p = { nullptr, 0 };
+        CHECK_FALSE(expandPolynomial(&prog, &p));
+        CHECK(p.coeffs == nullptr);
+        freeProgram(&prog);
+    }
+}
+
+TEST_CASE("Aberth iteration finds all complex roots", "[polynomial]")
+{
+    struct {
+        const char* expr;
+        std::vector<Complex> roots;
+        size_t real; //< distinct real roots in [-2, 4]
+    } cases[] = {
+        { "x*x + 1", { { 0., -1. }, { 0., 1. } }, 0 },
+        { "(x - 1)*(x - 2)*(x - 3)", { { 1., 0. }, { 2., 0. }, { 3., 0. } }, 3 },
+        { "x*x*x*(x - 5)", { { 0., 0. }, { 0., 0. }, { 0., 0. }, { 5., 0. } }, 1 },
+        { "(x*x - 2*x + 5)*(x + 1e3)", { { -1e3, 0. }, { 1., -2. }, { 1., 2. } }, 0 },
+        { "(x*x - 2*x + 5)*(x - 1)", { { 1., -2. }, { 1., 0. }, { 1., 2. } }, 1 },
+        { "(x-1)*(x-2)*(x-3)*(x-4)*(x-5)*(x-6)*(x-7)*(x-8)*(x-9)*(x-10)",
+            { { 1., 0. }, { 2., 0. }, { 3., 0. }, { 4., 0. }, { 5., 0. }, { 6., 0. }, { 7., 0. },
+                { 8., 0. }, { 9., 0. }, { 10., 0. } },
+            4 },
+    };
+    for (auto& c : cases) {
+        INFO(c.expr);
+        Program prog = createProgram();
+        REQUIRE(compileExpression(c.expr, &prog).result == RES_OK);
+        Polynomial p;
+        REQUIRE(expandPolynomial(&prog, &p));
+        REQUIRE(p.degree == c.roots.size());
+        std::vector<Complex> roots(p.degree);
+        unsigned iterations;
+        REQUIRE(aberthSolve(&p, 100, true, roots.data(), &iterations) == SOLVE_OK);
+        for (unsigned k = 0; k < p.degree; k++) {
+            // conjugates share their real part up to rounding, so their order is not fixed
+            auto near = [&](const Complex& z) {
+                return hypot(z.re - c.roots[k].re, z.im - c.roots[k].im) <= 1e-9;
+            };
+            CHECK(std::count_if(roots.begin(), roots.end(), near)
+                == std::count_if(c.roots.begin(), c.roots.end(), near));
+            CHECK(roots[k].re <= roots[k + 1 < p.degree ? k + 1 : k].re + 1e-12);
+        }
+        std::vector<double> xs(p.degree);
+        CHECK(selectRealRoots(&p, roots.data(), p.degree, -2., 4., 1e-9, xs.data()) == c.real);
+        freePolynomial(&p);
+        freeProgram(&prog);
+    }
+}
+
+TEST_CASE("Statistics count the work of the installed thread", "[stats]")
+{
+    Program prog = createProgram();
+    REQUIRE(compileExpression("x*x - 2", &prog).result == RES_OK); //< not collected
+    StatsSink sink = {};
+    std::vector<TraceEvent> events;
+    sink.trace = [](void* ctx, const TraceEvent* e) {
+        static_cast<std::vector<TraceEvent>*>(ctx)->push_back(*e);
+    };
+    sink.traceCtx = &events;
+    REQUIRE(setStatsSink(&sink) == nullptr);
+    clearProgram(&prog);
+    REQUIRE(compileExpression("x*x - 2", &prog).result == RES_OK);
+    CHECK(sink.tokens == 5);
+    CHECK(sink.parseNanos > 0);
+    SolveResult r = newtonSolve(programObjective(&prog), 1., 1e-12, 50);
+    REQUIRE(r.status == SOLVE_OK);
+    CHECK(sink.evals == r.iterations + 1);
+    REQUIRE(events.size() == r.iterations + 1);
+    CHECK(sink.iterations == events.size());
+    for (size_t i = 0; i < events.size(); i++) {
+        CHECK(events[i].iteration == i);
+        CHECK(strcmp(events[i].solver, "newton") == 0);
+    }
+    CHECK(events[0].step == 0.);
+    CHECK(events[1].step == Approx(0.5)); //< 1 - (1 - 2) / 2
+    CHECK(fabs(events.back().f) <= 1e-12);
+
+    // workers of the multi-start solvers report to the same sink
+    sink = {};
+    std::vector<double> roots(8);
+    size_t n = 0;
+    REQUIRE(newtonMultiStart(
+        programObjective(&prog), -3., 3., 8, 1e-12, 50, 4, roots.data(), &n));
+    CHECK(n == 2);
+    CHECK(sink.iterations >= 8);
+    CHECK(sink.evals >= sink.iterations);
+    REQUIRE(setStatsSink(nullptr) == &sink);
+    uint64_t evals = sink.evals;
+    newtonSolve(programObjective(&prog), 1., 1e-12, 50);
+    CHECK(sink.evals == evals);
+    freeProgram(&prog);
+}
+
+TEST_CASE("Arena hands out aligned memory and reuses it after a reset", "[arena]")
+{
+    Arena arena = createArena();
+    char* first = static_cast<char*>(arenaAlloc(&arena, 3));
+    REQUIRE(first != nullptr);
+    char* second = static_cast<char*>(arenaAlloc(&arena, 8));
+    CHECK(reinterpret_cast<uintptr_t>(second) % alignof(max_align_t) == 0);
+    CHECK(second > first);
+    // the most recent allocation grows in place, an older one moves
+    CHECK(arenaRealloc(&arena, second, 8, 64) == second);
+    memset(first, 'x', 3);
+    char* moved = static_cast<char*>(arenaRealloc(&arena, first, 3, 16));
+    CHECK(moved != first);
+    CHECK(memcmp(moved, "xxx", 3) == 0);
+    std::vector<char*> big;
+    for (int i = 0; i < 4; i++) //< beyond a block
+        big.push_back(static_cast<char*>(arenaAlloc(&arena, 100000)));
+    for (char* p : big) {
+        REQUIRE(p != nullptr);
+        memset(p, 0, 100000);
+    }
+    resetArena(&arena);
+    CHECK(arenaAlloc(&arena, 3) == first);
+    for (int i = 0; i < 4; i++) //< the blocks are kept
+        CHECK(std::find(big.begin(), big.end(), arenaAlloc(&arena, 100000)) != big.end());
+    freeArena(&arena);
+    CHECK(arena.first == nullptr);
+}
+
+TEST_CASE("Programs compiled in an arena match heap programs", "[arena]")
+{
+    Arena arena = createArena();
+    for (const char* expr : { "x*x - 2", "sin(x)*sin(x) + cos(x)*cos(x) - x/3",
+             "x/1 + x/2 + x/3 + x/4 + x/5 + x/6 + x/7 + x/8 + x/9 + x/10 + x/11 + x/12 - 1",
+             "1/0", "x +" }) {
+        INFO(expr);
+        Program heap = createProgram();
+        Program inArena = createProgramInArena(&arena);
+        Expression e = compileExpression(expr, &heap);
+        Expression f = compileExpression(expr, &inArena);
+        REQUIRE(e.result == f.result);
+        CHECK(e.errIdx == f.errIdx);
+        if (e.result == RES_OK) {
+            CHECK(optimizeProgram(&heap) == optimizeProgram(&inArena));
+            CHECK(inArena.arena == &arena);
+            REQUIRE(heap.len == inArena.len);
+            for (unsigned i = 0; i < heap.len; i++) {
+                CHECK(heap.code[i].op == inArena.code[i].op);
+                CHECK(heap.code[i].arg == inArena.code[i].arg);
+            }
+            CHECK(evaluateProgram(&heap, 0.7) == evaluateProgram(&inArena, 0.7));
+        }
+        freeProgram(&heap);
+        resetArena(&arena);
+    }
+    freeArena(&arena);
+}
+
+TEST_CASE("Batch stream keeps the input order", "[stream]")
+{
+    std::string input, expected;
+    for (int i = 1; i <= 20000; i++) {
+        char line[64];
+        snprintf(line, sizeof(line), "x - %d;%d\n", i, i % 7);
+        input += line;
+        snprintf(line, sizeof(line), "x = %f\n", double(i));
+        expected += line;
+    }
+    input += "1/0\n\n \t\r\nx*x+1\n2*3"; //< blank lines are skipped, the last has no newline
+    expected += "error: Division by zero at 1\nerror: f'(x=0.000000) = 0\n6.000000\n";
+    FILE* in = fmemopen(&input[0], input.size(), "r");
+    char* buf = nullptr;
+    size_t len = 0;
+    FILE* out = open_memstream(&buf, &len);
+    StreamOptions opts = { 0., 1e-9, 50, 4, nullptr };
+    CHECK(solveStream(in, out, &opts) == 2);
+    fclose(in);
+    fclose(out);
+    CHECK(std::string(buf, len) == expected);
+    free(buf);
+}
+
+TEST_CASE("Mapped batch files are solved like streamed input", "[stream]")
+{
+    std::string input;
+    for (int i = 1; i <= 20000; i++)
+        input += "x - " + std::to_string(i) + (i % 3 ? ";1\n" : ";1\r\n");
+    input += "1/0\nx;0;-1\n2*3"; //< last line without a newline
+    StreamOptions opts = { 0., 1e-9, 50, 4, nullptr };
+    auto solve = [&](auto run) {
+        char* buf = nullptr;
+        size_t len = 0;
+        FILE* out = open_memstream(&buf, &len);
+        long failures = run(out);
+        fclose(out);
+        std::string text(buf, len);
+        free(buf);
+        return std::make_pair(failures, text);
+    };
+    auto expected = solve([&](FILE* out) {
+        FILE* in = fmemopen(&input[0], input.size(), "r");
+        long failures = solveStream(in, out, &opts);
+        fclose(in);
+        return failures;
+    });
+    CHECK(expected.first == 2);
+
+    char path[] = "/tmp/fr-test-XXXXXX";
+    int fd = mkstemp(path);
+    REQUIRE(fd >= 0);
+    unlink(path);
+    REQUIRE(write(fd, input.data(), input.size()) == (ssize_t)input.size());
+    REQUIRE(lseek(fd, 0, SEEK_SET) == 0);
+    CHECK(solve([&](FILE* out) { return solveMappedStream(fd, out, &opts); }) == expected);
+    CHECK(lseek(fd, 0, SEEK_CUR) == (off_t)input.size());
+    // lines already taken by another reader are not solved again
+    size_t line = input.find("x - 10001;");
+    REQUIRE(lseek(fd, line, SEEK_SET) == (off_t)line);
+    auto rest = solve([&](FILE* out) { return solveMappedStream(fd, out, &opts); });
+    CHECK(rest.first == 2);
+    CHECK(rest.second == expected.second.substr(expected.second.find("x = 10001.")));
+    close(fd);
+
+    int fds[2]; //< a pipe cannot be mapped and is read like any stream
+    REQUIRE(pipe(fds) == 0);
+    std::string small = "x - 1\n1/0\n";
+    REQUIRE(write(fds[1], small.data(), small.size()) == (ssize_t)small.size());
+    close(fds[1]);
+    auto piped = solve([&](FILE* out) { return solveMappedStream(fds[0], out, &opts); });
+    CHECK(piped.first == 1);
+    CHECK(piped.second == "x = 1.000000\nerror: Division by zero at 1\n");
+    close(fds[0]);
+}
+
+static std::string formatted(double x)
+{
+    char buf[FORMAT_DOUBLE_MAX];
+    return std::string(buf, formatDouble(x, buf));
+}
+
+TEST_CASE("Doubles are formatted as the shortest text that reads back", "[format]")
+{
+    CHECK(formatted(0.) == "0");
+    CHECK(formatted(-0.) == "-0");
+    CHECK(formatted(0.1) == "0.1");
+    CHECK(formatted(0.1 + 0.2) == "0.30000000000000004");
+    CHECK(formatted(123456) == "123456");
+    CHECK(formatted(100000) == "1e+05"); //< the shorter notation
+    CHECK(formatted(1.5e-7) == "1.5e-07");
+    CHECK(formatted(1e22) == "1e+22");
+    CHECK(formatted(1e23) == "1e+23");
+    CHECK(formatted(9007199254740993.) == "9007199254740992");
+    CHECK(formatted(5e-324) == "5e-324");
+    CHECK(formatted(-2.2250738585072014e-308) == "-2.2250738585072014e-308");
+    CHECK(formatted(1.7976931348623157e308) == "1.7976931348623157e+308");
+    CHECK(formatted(INFINITY) == "inf");
+    CHECK(formatted(-INFINITY) == "-inf");
+    CHECK(formatted(NAN) == "nan");
+    uint64_t state = 88172645463325252u;
+    for (int i = 0; i < 200000; i++) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        uint64_t bits = i % 2 ? state : state % 4096; //< subnormals too
+        double x;
+        memcpy(&x, &bits, sizeof(x));
+        if (isnan(x))
+            continue;
+        std::string s = formatted(x);
+        double y = strtod(s.c_str(), nullptr);
+        INFO(s);
+        CHECK(memcmp(&x, &y, sizeof(x)) == 0);
+        int digits = 0; //< the fewest printf needs to read back
+        char shortest[32];
+        do
+            snprintf(shortest, sizeof(shortest), "%.*e", digits++, x);
+        while (strtod(shortest, nullptr) != x);
+        std::string significand = s.substr(s[0] == '-', s.find('e') - (s[0] == '-'));
+        significand.erase(std::remove(significand.begin(), significand.end(), '.'),
+            significand.end());
+        significand.erase(0, significand.find_first_not_of('0'));
+        significand.erase(significand.find_last_not_of('0') + 1);
+        CHECK(significand.size() <= (size_t)digits);
+    }
+}
+
+TEST_CASE("Tables are written in grid order in every format", "[table]")
+{
+    Program prog = createProgram();
+    REQUIRE(compileExpression("sin(x)*exp(-x/4)", &prog).result == RES_OK);
+    const size_t n = 3 * 8192 + 5; //< several chunks and a partial one
+    auto table = [&](TableFormat format) {
+        char* buf = nullptr;
+        size_t len = 0;
+        FILE* out = open_memstream(&buf, &len);
+        TableOptions opts = { -3., 7., n, format, 4 };
+        CHECK(writeTable(&prog, &opts, out));
+        fclose(out);
+        std::string s(buf, len);
+        free(buf);
+        return s;
+    };
+    std::string text = table(TABLE_TEXT);
+    std::vector<double> xs, fs;
+    for (const char* p = text.c_str(); *p;) {
+        char* end;
+        xs.push_back(strtod(p, &end));
+        REQUIRE(*end == ' ');
+        fs.push_back(strtod(end + 1, &end));
+        REQUIRE(*end == '\n');
+        p = end + 1;
+    }
+    REQUIRE(xs.size() == n);
+    CHECK(xs.front() == -3.);
+    CHECK(xs.back() == 7.);
+    for (size_t i = 0; i < n; i++) {
+        CHECK(xs[i] == -3. * (1. - (double)i / (n - 1)) + 7. * ((double)i / (n - 1)));
+        CHECK(fs[i] == evaluateProgram(&prog, xs[i]));
+    }
+    std::string raw = table(TABLE_RAW);
+    REQUIRE(raw.size() == 2 * n * sizeof(double));
+    for (size_t i = 0; i < n; i++) { //< the host is little-endian
+        double pair[2];
+        memcpy(pair, &raw[2 * i * sizeof(double)], sizeof(pair));
+        CHECK(pair[0] == xs[i]);
+        CHECK(pair[1] == fs[i]);
+    }
+    std::string npy = table(TABLE_NPY);
+    REQUIRE(npy.size() > raw.size());
+    size_t header = npy.size() - raw.size();
+    CHECK(header % 64 == 0);
+    CHECK(npy.compare(0, 8, std::string("\x93NUMPY\x01\x00", 8)) == 0);
+    CHECK(npy.find("'shape': (" + std::to_string(n) + ", 2)") < header);
+    CHECK(npy[header - 1] == '\n');
+    CHECK(npy.compare(header, raw.size(), raw) == 0);
+    freeProgram(&prog);
+}
+
+TEST_CASE("Tokenized parsing matches on-the-fly scanning", "[parser]")
+{
+    const char* exprs[] = { "553+3", "  (  553   +   3  )   ", "sin(x)*cos(x)/tan(x) - atan(x)",
+        "exp(-x) + sqrt(x)", "singlevar * 2", "x*y", ":", "", "sin5)", "sin(5", "x +", "1/0",
+        "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa", "1) + 2", "2 * (x + 1 @", "-x**-2**x",
+        "1/0 @", "2***3", "((((x", "2)x", "x+y)z", "x*xy", "x*x2", "xy*x", "x*xsin(x)",
+        "x*(x*xy + 1)", "y + 1) + x" };
+    for (const char* s : exprs) {
+        INFO(s);
+        Expression lazy = createExpressionWithVariable(s, 0.75);
+        double expected = evaluateExpression(&lazy);
+
+        std::vector<Token_t> tokens(strlen(s) + 1);
+        Expression e = createExpressionWithVariable(s, 0.75);
+        REQUIRE(tokenizeExpression(&e, tokens.data(), tokens.size()));
+        double value = evaluateExpression(&e);
+        CHECK(e.result == lazy.result);
+        CHECK(e.errIdx == lazy.errIdx);
+        CHECK(e.currIdx == lazy.currIdx);
+        CHECK(std::string(e.var.name, e.var.len) == std::string(lazy.var.name, lazy.var.len));
+        if (lazy.result == RES_OK)
+            CHECK(value == expected);
+
+        // variables past the end of the parse are not registered either
+        SymbolTable lazySymbols, symbols;
+        lazySymbols.count = symbols.count = 0;
+        lazy = createExpressionWithSymbols(s, &lazySymbols, 0.75);
+        expected = evaluateExpression(&lazy);
+        e = createExpressionWithSymbols(s, &symbols, 0.75);
+        REQUIRE(tokenizeExpression(&e, tokens.data(), tokens.size()));
+        value = evaluateExpression(&e);
+        CHECK(e.result == lazy.result);
+        CHECK(e.errIdx == lazy.errIdx);
+        CHECK(symbols.count == lazySymbols.count);
+        if (lazy.result == RES_OK)
+            CHECK(value == expected);
+    }
+}
+
+TEST_CASE("Expression views are parsed up to their length", "[parser]")
+{
+    const char* exprs[] = { "553+3", "x*x - 2", "sin(x) + 1.5e", "2.5e+", "12", "si", "x*x",
+        "(x + 1", "1/0", "x y", "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa", "" };
+    ExprCache* cache = createExprCache(16);
+    REQUIRE(cache);
+    for (const char* s : exprs) {
+        INFO(s);
+        std::string copy(s);
+        std::string text = copy + "3)*n(x;"; //< would change the parse if read
+        Expression whole = createExpressionWithVariable(copy.c_str(), 0.5);
+        double expected = evaluateExpression(&whole);
+        Expression view = createExpressionView(text.data(), copy.size());
+        view.var.value = 0.5;
+        double value = evaluateExpression(&view);
+        CHECK(view.result == whole.result);
+        CHECK(view.errIdx == whole.errIdx);
+        CHECK(view.currIdx == whole.currIdx);
+        if (whole.result == RES_OK)
+            CHECK(value == expected);
+
+        Program p = createProgram();
+        Program q = createProgram();
+        Expression compiled = compileExpression(copy.c_str(), &p);
+        Expression compiledView = compileExpressionView(text.data(), copy.size(), &q, nullptr);
+        CHECK(compiledView.result == compiled.result);
+        CHECK(compiledView.errIdx == compiled.errIdx);
+        CHECK(std::string(compiledView.var.name, compiledView.var.len)
+            == std::string(compiled.var.name, compiled.var.len));
+        if (compiled.result == RES_OK)
+            CHECK(evaluateProgram(&q, 0.5) == evaluateProgram(&p, 0.5));
+        for (int round = 0; round < 2; round++) { //< a miss, then a hit
+            Expression cached = compileExpressionCachedView(cache, text.data(), copy.size(), &q);
+            CHECK(cached.result == compiled.result);
+            CHECK(cached.errIdx == compiled.errIdx);
+        }
+        freeProgram(&p);
+        freeProgram(&q);
+    }
+    freeExprCache(cache);
+}
+
+TEST_CASE("Numbers are parsed in a single pass", "[parser]")
+{
+    const char* numbers[] = { "0", "7", "553.2", "0.1", "3.14159265358979323846", "1e5", "2.5E-3",
+        "1e+22", "123456789012345678901234567890", "0.000000000000000000000000123", "1e308",
+        "4.9e-324", "9007199254740993" };
+    for (const char* s : numbers) {
+        Expression e = createExpression(s);
+        CHECK(readNonNegativeNumber(&e) == strtod(s, nullptr));
+        CHECK(e.currIdx == strlen(s));
+    }
+    Expression e = createExpression("2e");
+    CHECK(readNonNegativeNumber(&e) == 2);
+    CHECK(e.currIdx == 1); //< 'e' without digits is not an exponent
+}
+
+TEST_CASE("Library contexts report results instead of exiting", "[fr]")
+{
+    FrContext* ctx = frCreateContext(nullptr);
+    REQUIRE(ctx);
+    FrOptions opts = frDefaultOptions();
+    opts.x0 = 1.;
+    opts.tol = 1e-12;
+    frSetOptions(ctx, &opts);
+
+    FrResult r = frSolve(ctx, "x*x - 2");
+    CHECK(r.parsing == RES_OK);
+    CHECK(r.status == SOLVE_OK);
+    CHECK(std::string(r.var) == "x");
+    CHECK(r.x == Approx(sqrt(2.)));
+    CHECK(frSolve(ctx, "x*x - 2").x == r.x); //< served from the compiled expression
+
+    r = frSolve(ctx, "2*3 + 1");
+    CHECK(r.status == SOLVE_OK);
+    CHECK(r.f == 7);
+    CHECK(std::string(r.var).empty());
+
+    r = frSolve(ctx, "sin(");
+    CHECK(r.parsing == RES_ERR_INVALID_INPUT);
+    CHECK(r.errMsg != nullptr);
+
+    r = frEvaluate(ctx, "1/(x-1)", 1.);
+    CHECK(r.status == SOLVE_NOT_FINITE);
+    CHECK(r.parsing == RES_ERR_DIV_BY_ZERO);
+    CHECK(r.errIdx == 1);
+
+    double roots[8];
+    size_t nroots;
+    opts.method = METHOD_BRENT;
+    frSetOptions(ctx, &opts);
+    r = frFindRoots(ctx, "sin(x)", -4., 4., roots, 2, &nroots);
+    CHECK(r.parsing == RES_OK);
+    REQUIRE(nroots == 3);
+    CHECK(roots[0] == Approx(-M_PI));
+    CHECK(roots[1] == Approx(0.).margin(1e-12));
+    frDestroyContext(ctx);
+}
+
+TEST_CASE("Library contexts can be used from several threads", "[fr]")
+{
+    std::vector<std::thread> threads;
+    std::atomic<int> failures { 0 };
+    for (int t = 0; t < 8; t++) {
+        threads.emplace_back([t, &failures] {
+            FrOptions opts = frDefaultOptions();
+            opts.x0 = 1.;
+            opts.tol = 1e-12;
+            opts.jit = t % 2 == 1;
+            FrContext* ctx = frCreateContext(&opts);
+            for (int i = 1; i <= 200; i++) {
+                std::string expr = "x*x - " + std::to_string(i % 7 + t + 1);
+                FrResult r = frSolve(ctx, expr.c_str());
+                if (r.status != SOLVE_OK || fabs(r.x * r.x - (i % 7 + t + 1)) > 1e-9)
+                    failures++;
+            }
+            frDestroyContext(ctx);
+        });
+    }
+    for (std::thread& t : threads)
+        t.join();
+    CHECK(failures == 0);
+}
+
+TEST_CASE("Cached compilation matches a fresh parse", "[cache]")
+{
+    ExprCache* cache = createExprCache(64);
+    REQUIRE(cache);
+    // the second of each pair differs in whitespace only and is served from the cache
+    const char* pairs[][2] = { { "x*x - 2", "x*x  -\t2" }, { "sin(x) + 1", "sin(x)  + 1" },
+        { "2*3 + 1", "2*3\t+ 1" }, { "1 + (x", "1 +  (x" }, { "sin x", "sin\t\tx" },
+        { "x + y", "x  +   y" }, { "1/(2-2) + x", "1/(2-2)  +  x" }, { "x + #", "x +\t #" },
+        { "(x + 1  ", "(x + 1 " } };
+    for (auto& pair : pairs) {
+        for (const char* expr : pair) {
+            Program expected = createProgram();
+            Expression e = compileExpression(expr, &expected);
+            if (e.result == RES_OK && hasVariable(&e))
+                optimizeProgram(&expected);
+            Program prog = createProgram();
+            Expression c = compileExpressionCached(cache, expr, &prog);
+            CHECK(c.result == e.result);
+            CHECK(c.errIdx == e.errIdx);
+            CHECK(std::string(c.var.name, c.var.len) == std::string(e.var.name, e.var.len));
+            if (e.result == RES_OK) {
+                REQUIRE(prog.len == expected.len);
+                for (double x : { -1.5, 0.5, 3. })
+                    CHECK(evaluateProgram(&prog, x) == evaluateProgram(&expected, x));
+            }
+            freeProgram(&prog);
+            freeProgram(&expected);
+        }
+    }
+    ExprCacheStats stats = exprCacheStats(cache);
+    CHECK(stats.misses == 9);
+    CHECK(stats.hits == 9);
+    CHECK(stats.evictions == 0);
+    CHECK(stats.entries == 9);
+    freeExprCache(cache);
+}
+
+TEST_CASE("Expression cache evicts the least recently used entries", "[cache]")
+{
+    ExprCache* cache = createExprCache(16); //< one entry per shard
+    REQUIRE(cache);
+    Program prog = createProgram();
+    for (int i = 0; i < 200; i++) {
+        std::string expr = "x - " + std::to_string(i);
+        CHECK(compileExpressionCached(cache, expr.c_str(), &prog).result == RES_OK);
+        CHECK(evaluateProgram(&prog, i) == 0);
+        CHECK(compileExpressionCached(cache, expr.c_str(), &prog).result == RES_OK);
+    }
+    ExprCacheStats stats = exprCacheStats(cache);
+    CHECK(stats.hits == 200); //< the most recent entry of a shard is never evicted
+    CHECK(stats.misses == 200);
+    CHECK(stats.entries <= 16);
+    CHECK(stats.evictions == 200 - stats.entries);
+    freeProgram(&prog);
+    freeExprCache(cache);
+}
+
+TEST_CASE("Expressions differing in a trailing constant spread over the shards", "[cache]")
+{
+    ExprCache* cache = createExprCache(160); //< ten entries per shard
+    REQUIRE(cache);
+    Program prog = createProgram();
+    for (int i = 0; i < 2000; i++) {
+        std::string expr = "x*x - " + std::to_string(i % 40);
+        CHECK(compileExpressionCached(cache, expr.c_str(), &prog).result == RES_OK);
+    }
+    ExprCacheStats stats = exprCacheStats(cache);
+    CHECK(stats.misses == 40); //< every key fits, so only the first sight of each misses
+    CHECK(stats.hits == 1960);
+    CHECK(stats.evictions == 0);
+    freeProgram(&prog);
+    freeExprCache(cache);
+}
+
+TEST_CASE("Expression cache can be shared by several threads", "[cache]")
+{
+    ExprCache* cache = createExprCache(8);
+    REQUIRE(cache);
+    std::vector<std::thread> threads;
+    std::atomic<int> failures { 0 };
+    for (int t = 0; t < 4; t++) {
+        threads.emplace_back([&, t] {
+            FrOptions opts = frDefaultOptions();
+            opts.x0 = 1.;
+            opts.tol = 1e-12;
+            opts.cache = cache;
+            FrContext* ctx = frCreateContext(&opts);
+            for (int i = 0; i < 400; i++) {
+                int k = (i * 7 + t) % 24 + 1;
+                std::string expr = "x*x - " + std::to_string(k);
+                FrResult r = frSolve(ctx, expr.c_str());
+                if (r.status != SOLVE_OK || fabs(r.x - sqrt(k)) > 1e-9)
+                    failures++;
+            }
+            frDestroyContext(ctx);
+        });
+    }
+    for (std::thread& t : threads)
+        t.join();
+    CHECK(failures == 0);
+    ExprCacheStats stats = exprCacheStats(cache);
+    CHECK(stats.hits + stats.misses == 1600);
+    CHECK(stats.entries + stats.evictions <= stats.misses); //< racing misses insert once
+    freeExprCache(cache);
+}
+
+TEST_CASE("Server answers pipelined requests in order", "[serve]")
+{
+    std::string path = "/tmp/fr-test-" + std::to_string(getpid()) + ".sock";
+    int listenFd = serveListen(path.c_str());
+    REQUIRE(listenFd >= 0);
+    int stopFd = eventfd(0, EFD_CLOEXEC);
+    REQUIRE(stopFd >= 0);
+    ServeOptions opts = { 1., 1e-10, 50, 2, nullptr };
+    int rc = -1;
+    std::thread server([&] { rc = serveLoop(listenFd, stopFd, &opts); });
+
+    const char* requests[] = { "x*x - 2", "2*3+1", "1/(x-1);1", "sin(", "x*x - 9;5;1e-12",
+        "x;abc" };
+    std::vector<std::thread> clients;
+    std::atomic<int> failures { 0 };
+    for (int t = 0; t < 4; t++) {
+        clients.emplace_back([&] {
+            int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            sockaddr_un addr {};
+            addr.sun_family = AF_UNIX;
+            strcpy(addr.sun_path, path.c_str());
+            if (connect(fd, (const sockaddr*)&addr, sizeof(addr)) != 0) {
+                failures++;
+                return;
+            }
+            std::string frames;
+            for (const char* r : requests) {
+                uint32_t len = strlen(r);
+                frames.append((const char*)&len, sizeof(len)).append(r, len);
+            }
+            if (write(fd, frames.data(), frames.size()) != (ssize_t)frames.size())
+                failures++;
+            shutdown(fd, SHUT_WR); //< the server still answers everything it has read
+            std::vector<ServeResponse> responses;
+            for (;;) {
+                uint32_t len;
+                ServeResponse r;
+                if (read(fd, &len, sizeof(len)) != sizeof(len) || len != sizeof(r))
+                    break;
+                size_t got = 0;
+                while (got < len) {
+                    ssize_t n = read(fd, (char*)&r + got, len - got);
+                    if (n <= 0)
+                        break;
+                    got += n;
+                }
+                responses.push_back(r);
+            }
+            close(fd);
+            bool ok = responses.size() == 6;
+            ok = ok && responses[0].result == RES_OK && responses[0].status == SOLVE_OK
+                && fabs(responses[0].x - sqrt(2.)) < 1e-9;
+            ok = ok && responses[1].result == RES_OK && responses[1].x == 7;
+            ok = ok && responses[2].result == RES_ERR_DIV_BY_ZERO && responses[2].errIdx == 1;
+            ok = ok && responses[3].result == RES_ERR_INVALID_INPUT;
+            ok = ok && responses[4].status == SOLVE_OK && fabs(responses[4].x - 3) < 1e-12;
+            ok = ok && responses[5].result == RES_ERR_INVALID_INPUT;
+            if (!ok)
+                failures++;
+        });
+    }
+    for (std::thread& t : clients)
+        t.join();
+    uint64_t one = 1;
+    CHECK(write(stopFd, &one, sizeof(one)) == sizeof(one));
+    server.join();
+    CHECK(rc == 0);
+    CHECK(failures == 0);
+    close(listenFd);
+    close(stopFd);
+    unlink(path.c_str());
+}
+
+TEST_CASE("Server stops reading a client that does not take its responses", "[serve]")
+{
+    std::string path = "/tmp/fr-test-" + std::to_string(getpid()) + ".sock";
+    int listenFd = serveListen(path.c_str());
+    REQUIRE(listenFd >= 0);
+    int stopFd = eventfd(0, EFD_CLOEXEC);
+    REQUIRE(stopFd >= 0);
+    ServeOptions opts = { 1., 1e-10, 50, 2, nullptr };
+    int rc = -1;
+    std::thread server([&] { rc = serveLoop(listenFd, stopFd, &opts); });
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    sockaddr_un addr {};
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path.c_str());
+    REQUIRE(connect(fd, (const sockaddr*)&addr, sizeof(addr)) == 0);
+    // more requests than SERVE_MAX_PENDING, whose responses overflow the socket buffer
+    const int n = 8 * SERVE_MAX_PENDING;
+    std::string frames;
+    for (int i = 0; i < n; i++) {
+        std::string r = std::to_string(i);
+        uint32_t len = r.size();
+        frames.append((const char*)&len, sizeof(len)).append(r);
+    }
+    REQUIRE(write(fd, frames.data(), frames.size()) == (ssize_t)frames.size());
+    shutdown(fd, SHUT_WR);
+    std::this_thread::sleep_for(std::chrono::milliseconds(50)); //< lets the server stall
+    int answered = 0;
+    for (;;) {
+        char frame[sizeof(uint32_t) + sizeof(ServeResponse)];
+        size_t got = 0;
+        while (got < sizeof(frame)) {
+            ssize_t m = read(fd, frame + got, sizeof(frame) - got);
+            if (m <= 0)
+                break;
+            got += m;
+        }
+        ServeResponse r;
+        memcpy(&r, frame + sizeof(uint32_t), sizeof(r));
+        if (got < sizeof(frame) || r.result != RES_OK || r.x != answered)
+            break;
+        answered++;
+    }
+    close(fd);
+    CHECK(answered == n);
+    uint64_t one = 1;
+    CHECK(write(stopFd, &one, sizeof(one)) == sizeof(one));
+    server.join();
+    CHECK(rc == 0);
+    close(listenFd);
+    close(stopFd);
+    unlink(path.c_str());
+}
@@ -0,0 +1,299 @@
+#include "fr.h"
+#include "jit.h"
+#include "polynomial.h"
+#include "program.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct FrContext {
+    struct FrOptions opts;
+    struct Program prog;
+    struct Expression compiled; //< parsing result of `expr`
+    char* expr; //< text compiled into prog, NULL before the first call
+    size_t exprCap;
+    JitDualFunction jit; //< compiled lazily when opts.jit is set
+    double* roots;
+    size_t rootsCap;
+};
+
+struct FrOptions frDefaultOptions(void)
+{
+    struct FrOptions opts;
+    opts.tol = 1e-5;
+    opts.x0 = 0.;
+    opts.maxiter = 50;
+    opts.method = METHOD_NEWTON;
+    opts.starts = 64;
+    opts.nthreads = 1;
+    opts.jit = false;
+    opts.cache = NULL;
+    return opts;
+}
+
+struct FrContext* frCreateContext(const struct FrOptions* opts)
+{
+    struct FrContext* ctx = calloc(1, sizeof(*ctx));
+    if (!ctx)
+        return NULL;
+    ctx->opts = opts ? *opts : frDefaultOptions();
+    ctx->prog = createProgram();
+    return ctx;
+}
+
+void frDestroyContext(struct FrContext* ctx)
+{
+    if (!ctx)
+        return;
+    jitFree((void*)ctx->jit);
+    freeProgram(&ctx->prog);
+    free(ctx->expr);
+    free(ctx->roots);
+    free(ctx);
+}
+
+void frSetOptions(struct FrContext* ctx, const struct FrOptions* opts)
+{
+    if (!opts->jit) {
+        jitFree((void*)ctx->jit);
+        ctx->jit = NULL;
+    }
+    ctx->opts = *opts;
+}
+
+static struct FrResult createResult(void)
+{
+    struct FrResult r;
+    memset(&r, 0, sizeof(r));
+    r.parsing = RES_OK;
+    r.errMsg = NULL;
+    r.status = SOLVE_OK;
+    return r;
+}
+
+static void setParsingError(struct FrResult* r, const struct Expression* e)
+{
+    r->parsing = e->result;
+    r->errIdx = e->errIdx;
+    r->errMsg = e->errMsg;
+}
+
+static void setOutOfMemory(struct FrResult* r)
+{
+    r->parsing = RES_ERR_INTERNAL;
+    r->errIdx = 0;
+    r->errMsg = "Out of memory";
+}
+
+// Compiles expr unless it is the expression compiled by the previous call
+static bool prepare(struct FrContext* ctx, const char* expr, struct FrResult* r)
+{
+    if (!ctx->expr || strcmp(ctx->expr, expr) != 0) {
+        size_t len = strlen(expr) + 1;
+        if (len > ctx->exprCap) {
+            char* copy = realloc(ctx->expr, len);
+            if (!copy) {
+                setOutOfMemory(r);
+                return false; //< the previous expression is still intact
+            }
+            ctx->expr = copy;
+            ctx->exprCap = len;
+        }
+        memcpy(ctx->expr, expr, len);
+        jitFree((void*)ctx->jit);
+        ctx->jit = NULL;
+        clearProgram(&ctx->prog);
+        if (ctx->opts.cache) {
+            ctx->compiled = compileExpressionCached(ctx->opts.cache, ctx->expr, &ctx->prog);
+        } else {
+            ctx->compiled = compileExpression(ctx->expr, &ctx->prog);
+            if (ctx->compiled.result == RES_OK && hasVariable(&ctx->compiled))
+                optimizeProgram(&ctx->prog);
+        }
+    }
+    if (ctx->compiled.result != RES_OK) {
+        setParsingError(r, &ctx->compiled);
+        return false;
+    }
+    memcpy(r->var, ctx->compiled.var.name, ctx->compiled.var.len);
+    r->var[ctx->compiled.var.len] = '\0';
+    if (ctx->opts.jit && !ctx->jit && hasVariable(&ctx->compiled))
+        ctx->jit = jitCompileDual(&ctx->prog); //< stays NULL without a JIT on this host
+    return true;
+}
+
+static double evaluateJitObjective(const void* ctx, double x, double* dfdx)
+{
+    const JitDualFunction* f = ctx;
+    return (*f)(x, dfdx);
+}
+
+static struct Objective contextObjective(const struct FrContext* ctx)
+{
+    struct Objective f = programObjective(&ctx->prog);
+    if (ctx->jit) {
+        f.eval = evaluateJitObjective;
+        f.evalBatch = NULL;
+        f.ctx = &ctx->jit;
+        f.evalInterval = NULL;
+        f.evalDerivatives = NULL;
+    }
+    return f;
+}
+
+// Re-parses at x to tell a division by zero apart from an overflow or a NaN
+static void diagnoseNotFinite(const char* expr, struct FrResult* r)
+{
+    struct Expression e = createExpressionWithVariable(expr, r->x);
+    evaluateExpression(&e);
+    if (e.result != RES_OK)
+        setParsingError(r, &e);
+}
+
+struct FrResult frEvaluate(struct FrContext* ctx, const char* expr, double x)
+{
+    struct FrResult r = createResult();
+    if (!prepare(ctx, expr, &r))
+        return r;
+    r.x = x;
+    r.f = evaluateProgramDual(&ctx->prog, x, &r.fprime);
+    if (!isfinite(r.f)) {
+        r.status = SOLVE_NOT_FINITE;
+        diagnoseNotFinite(expr, &r);
+    }
+    return r;
+}
+
+struct FrResult frSolve(struct FrContext* ctx, const char* expr)
+{
+    struct FrResult r = createResult();
+    if (!prepare(ctx, expr, &r))
+        return r;
+    if (!hasVariable(&ctx->compiled))
+        return frEvaluate(ctx, expr, 0.);
+    struct SolveResult s
+        = newtonSolve(contextObjective(ctx), ctx->opts.x0, ctx->opts.tol, ctx->opts.maxiter);
+    r.status = s.status;
+    r.x = s.x;
+    r.f = s.f;
+    r.fprime = s.fprime;
+    r.iterations = s.iterations;
+    if (s.status == SOLVE_NOT_FINITE)
+        diagnoseNotFinite(expr, &r);
+    return r;
+}
+
+// Unlike the seeds of the other methods, the starts do not bound the number of roots, so the
+// list sized by the search replaces ctx->roots
+static bool findIntervalRoots(
+    struct FrContext* ctx, struct Objective f, double a, double b, size_t* n)
+{
+    const struct FrOptions* o = &ctx->opts;
+    unsigned starts = o->starts ? o->starts : 1;
+    double* roots;
+    if (!intervalMultiSolve(f, a, b, starts, o->tol, o->maxiter, o->nthreads, &roots, n))
+        return false;
+    free(ctx->roots);
+    ctx->roots = roots;
+    ctx->rootsCap = *n;
+    return true;
+}
+
+// The distinct real roots of a polynomial in [a, b] out of all its complex roots
+static enum SolveStatus findPolynomialRoots(
+    struct FrContext* ctx, double a, double b, size_t* n, bool* ok)
+{
+    struct Polynomial p;
+    *ok = true;
+    if (!expandPolynomial(&ctx->prog, &p))
+        return SOLVE_NOT_POLYNOMIAL; //< also taken when memory runs out while expanding
+    enum SolveStatus status = SOLVE_OK;
+    struct Complex* zs = malloc(((size_t)p.degree + 1) * sizeof(*zs));
+    if (zs && ctx->rootsCap < (size_t)p.degree + 1) {
+        double* buf = realloc(ctx->roots, ((size_t)p.degree + 1) * sizeof(*buf));
+        if (buf) {
+            ctx->roots = buf;
+            ctx->rootsCap = (size_t)p.degree + 1;
+        }
+    }
+    *ok = zs && ctx->rootsCap >= (size_t)p.degree + 1;
+    if (*ok) {
+        unsigned iterations;
+        status = aberthSolve(&p, ctx->opts.maxiter, true, zs, &iterations);
+        *n = selectRealRoots(&p, zs, p.degree, a, b, ctx->opts.tol, ctx->roots);
+    }
+    free(zs);
+    freePolynomial(&p);
+    return status;
+}
+
+struct FrResult frFindRoots(struct FrContext* ctx, const char* expr, double a, double b,
+    double* roots, size_t cap, size_t* nroots)
+{
+    *nroots = 0;
+    struct FrResult r = createResult();
+    if (!prepare(ctx, expr, &r))
+        return r;
+    if (!hasVariable(&ctx->compiled))
+        return frEvaluate(ctx, expr, 0.);
+    if (!(a < b)) {
+        r.status = SOLVE_NO_BRACKET;
+        return r;
+    }
+    unsigned starts = ctx->opts.starts ? ctx->opts.starts : 1;
+    if (ctx->rootsCap < (size_t)starts + 1) {
+        double* buf = realloc(ctx->roots, ((size_t)starts + 1) * sizeof(*buf));
+        if (!buf) {
+            setOutOfMemory(&r);
+            return r;
+        }
+        ctx->roots = buf;
+        ctx->rootsCap = (size_t)starts + 1;
+    }
+    const struct FrOptions* o = &ctx->opts;
+    if (o->method == METHOD_ABERTH) {
+        size_t n = 0;
+        bool ok;
+        r.status = findPolynomialRoots(ctx, a, b, &n, &ok);
+        if (!ok) {
+            setOutOfMemory(&r);
+            return r;
+        }
+        memcpy(roots, ctx->roots, (n < cap ? n : cap) * sizeof(*roots));
+        *nroots = n;
+        if (n > 0) {
+            r.x = ctx->roots[0];
+            r.f = evaluateProgramDual(&ctx->prog, r.x, &r.fprime);
+        }
+        return r;
+    }
+    // interval and higher-order evaluation always run on the program
+    unsigned order = o->method == METHOD_HALLEY ? 2 : o->method == METHOD_HOUSEHOLDER3 ? 3 : 0;
+    struct Objective f = o->method == METHOD_INTERVAL || order
+        ? programObjective(&ctx->prog)
+        : contextObjective(ctx);
+    size_t n = 0;
+    bool ok;
+    if (o->method == METHOD_NEWTON)
+        ok = newtonMultiStart(f, a, b, starts, o->tol, o->maxiter, o->nthreads, ctx->roots, &n);
+    else if (order)
+        ok = householderMultiStart(
+            f, order, a, b, starts, o->tol, o->maxiter, o->nthreads, ctx->roots, &n);
+    else if (o->method == METHOD_INTERVAL)
+        ok = findIntervalRoots(ctx, f, a, b, &n);
+    else
+        ok = bracketMultiSolve(
+            f, o->method, a, b, starts, o->tol, o->maxiter, o->nthreads, ctx->roots, &n);
+    if (!ok) {
+        setOutOfMemory(&r);
+        return r;
+    }
+    memcpy(roots, ctx->roots, (n < cap ? n : cap) * sizeof(*roots));
+    *nroots = n;
+    if (n > 0) {
+        r.x = ctx->roots[0];
+        r.f = f.eval(f.ctx, r.x, &r.fprime);
+    }
+    return r;
+}
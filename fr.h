@@ -0,0 +1,68 @@
+#ifndef FR_H
+#define FR_H
+
+#include "cache.h"
+#include "parser.h"
+#include "solver.h"
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Embeddable interface of the root finder. Nothing is printed and the process is never exited;
+// every outcome is reported in a struct FrResult.
+//
+// Thread safety: the library has no global state. A context must not be used by two threads at
+// the same time, but any number of contexts can be used concurrently, typically one per thread.
+
+struct FrContext;
+
+struct FrOptions {
+    double tol; //< converged means |f(x)| <= tol
+    double x0; //< start of frSolve()
+    unsigned maxiter;
+    enum SolveMethod method; //< used by frFindRoots(), frSolve() always runs Newton
+    unsigned starts; //< Newton seeds, or scan intervals of the bracketing and interval methods
+    unsigned nthreads; //< threads of frFindRoots(), 0 means one per core
+    bool jit; //< evaluate through machine code where the host supports it
+    struct ExprCache* cache; //< may be shared by any number of contexts, NULL parses every text
+};
+
+struct FrResult {
+    enum ParsingResult parsing; //< also reports a division by zero met while solving
+    unsigned errIdx;
+    const char* errMsg; //< static string, NULL when parsing is RES_OK
+    enum SolveStatus status; //< meaningful when parsing is RES_OK
+    char var[32]; //< name of the variable, empty for an expression without one
+    double x; //< root, or the last iterate on failure
+    double f; //< f(x), the value of an expression without a variable
+    double fprime;
+    unsigned iterations;
+};
+
+struct FrOptions frDefaultOptions(void); //< tol 1e-5, x0 0, maxiter 50, Newton, 64 starts
+// NULL options select the defaults. Returns NULL if memory could not be allocated.
+struct FrContext* frCreateContext(const struct FrOptions* opts);
+void frDestroyContext(struct FrContext* ctx); //< NULL is ignored
+void frSetOptions(struct FrContext* ctx, const struct FrOptions* opts);
+
+// The context keeps the compiled form of the last expression, so repeated calls with the same
+// text skip parsing.
+struct FrResult frEvaluate(struct FrContext* ctx, const char* expr, double x);
+// Newton from x0. An expression without a variable is evaluated instead, with SOLVE_OK.
+struct FrResult frSolve(struct FrContext* ctx, const char* expr);
+// Finds the distinct roots in [a, b] with the configured method and stores the first `cap` of
+// them in ascending order. *nroots receives the number found, which may exceed cap, and the
+// result describes the smallest root. An allocation failure is reported as RES_ERR_INTERNAL.
+// METHOD_ABERTH keeps the real roots among all roots of a polynomial and reports any other
+// expression with SOLVE_NOT_POLYNOMIAL.
+struct FrResult frFindRoots(struct FrContext* ctx, const char* expr, double a, double b,
+    double* roots, size_t cap, size_t* nroots);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,675 @@
+#ifndef FR_HPP
+#define FR_HPP
+
+#include "parser.h"
+#include "solver.h"
+
+#include <cmath>
+#include <cstddef>
+#include <limits>
+#include <string_view>
+
+// Expressions known when the program is written, parsed by the C++ compiler (C++20). The text
+// is a template argument, e.g. fr::expression<"x*x - 2">, and is read with the grammar of
+// parser.c: numbers, one variable, + - * / ** with unary signs and sin cos tan atan exp sqrt.
+// A text the runtime parser rejects fails to compile, the static_assert names its ParsingResult.
+// The parse becomes a tree of types, so every evaluation is inlined code without a tape; it
+// computes the same operations in the same order as evaluateProgram() and evaluateProgramDual().
+//
+//     constexpr auto f = fr::expression<"x*x - 2">;
+//     struct SolveResult r = fr::newton(f, 1., 1e-12, 50);
+//     static_assert(fr::diagnose<"sin5">().result == RES_ERR_OPEN_PARAN_MISSING);
+
+namespace fr {
+
+// String literal passed as a template argument
+template <std::size_t N> struct FixedString {
+    char text[N] = {};
+    constexpr FixedString(const char (&s)[N])
+    {
+        for (std::size_t i = 0; i < N; i++)
+            text[i] = s[i];
+    }
+    static constexpr unsigned size() { return N - 1; } //< without the terminator
+};
+
+// Outcome of a parse like struct Expression reports it, errIdx is meaningful unless RES_OK
+struct Diagnostic {
+    ParsingResult result;
+    unsigned errIdx;
+};
+
+namespace detail {
+
+enum class Op { Const, Var, Neg, Add, Sub, Mul, Div, Pow, Sin, Cos, Tan, Atan, Exp, Sqrt };
+
+struct Node {
+    Op op;
+    double value; //< the constant, or the value for a NaN variable as compileExpression() has it
+    int lhs; //< operand of unary nodes
+    int rhs;
+};
+
+// Every token adds at most one node, so a text of N characters needs no more than N nodes
+template <std::size_t N> struct Parsed {
+    Node nodes[N] = {};
+    int count = 0;
+    int root = -1; //< -1 unless result is RES_OK
+    ParsingResult result = RES_OK;
+    unsigned errIdx = 0;
+    char var[32] = {};
+    unsigned varLen = 0;
+};
+
+constexpr double qnan = std::numeric_limits<double>::quiet_NaN();
+constexpr double inf = std::numeric_limits<double>::infinity();
+constexpr double dmax = std::numeric_limits<double>::max();
+constexpr double pi2 = 1.5707963267948966; //< atan(inf)
+
+constexpr bool isNan(double a) { return a != a; }
+constexpr bool isInf(double a) { return a == inf || a == -inf; }
+constexpr double abs(double a) { return a < 0 ? -a : a; }
+constexpr double withSign(double a, bool negative) { return negative ? -a : a; }
+
+// The parser evaluates the expression while reading it to catch divisions by a constant zero.
+// A constant expression must not overflow or raise an invalid operation, so those results are
+// produced here; the rest is plain IEEE arithmetic. Products and quotients are checked for
+// overflow at a scale of 2^-600, where the rounding is the same as at full scale.
+constexpr double scaleDown = 0x1p-600;
+
+constexpr double sum(double a, double b)
+{
+    if (isNan(a) || isNan(b) || (isInf(a) && isInf(b) && a != b))
+        return qnan;
+    if (isInf(a) || isInf(b))
+        return isInf(a) ? a : b;
+    double half = a / 2 + b / 2;
+    return abs(half) > dmax / 2 ? withSign(inf, half < 0) : a + b;
+}
+
+constexpr double product(double a, double b)
+{
+    if (isNan(a) || isNan(b) || (isInf(a) && b == 0) || (isInf(b) && a == 0))
+        return qnan;
+    if (isInf(a) || isInf(b))
+        return withSign(inf, (a < 0) != (b < 0));
+    if (abs(a) > 1 && abs(b) > 1 && abs(a * scaleDown * b) > dmax * scaleDown)
+        return withSign(inf, (a < 0) != (b < 0));
+    return a * b;
+}
+
+constexpr double quotient(double a, double b) //< b is not zero, the parser rejects that
+{
+    if (isNan(a) || isNan(b) || (isInf(a) && isInf(b)))
+        return qnan;
+    if (isInf(a))
+        return withSign(inf, (a < 0) != (b < 0));
+    if (abs(b) < 1 && abs(a) >= 0x1p-400 && abs(a * scaleDown / b) > dmax * scaleDown)
+        return withSign(inf, (a < 0) != (b < 0));
+    return a / b;
+}
+
+constexpr bool isInteger(double a) { return abs(a) >= 0x1p52 || a == (double)(long long)a; }
+constexpr bool isOddInteger(double a)
+{
+    return abs(a) < 0x1p53 && a == (double)(long long)a && (long long)a % 2 != 0;
+}
+
+// GCC folds <cmath> calls in constant expressions as long as they raise no floating-point
+// exception. Other compilers do not, and functions of constants are NaN to them, which is
+// never zero: a division by such a constant is then only seen at run time, like 1/(x-x).
+constexpr double apply(Op op, double a)
+{
+#if defined(__GNUC__) && !defined(__clang__)
+    if (isNan(a))
+        return qnan;
+    switch (op) {
+    case Op::Sin:
+        return isInf(a) ? qnan : std::sin(a);
+    case Op::Cos:
+        return isInf(a) ? qnan : std::cos(a);
+    case Op::Tan:
+        return isInf(a) ? qnan : std::tan(a);
+    case Op::Atan:
+        return isInf(a) ? withSign(pi2, a < 0) : std::atan(a);
+    case Op::Exp:
+        if (a > 709.782712893384) //< log(DBL_MAX)
+            return inf;
+        if (a < -746) //< below half the smallest subnormal
+            return 0.;
+        // a subnormal result underflows, which is an exception as well
+        return a < -708 ? std::exp(a + 64) * std::exp(-64.) : std::exp(a);
+    default:
+        if (a < 0)
+            return qnan;
+        return a == inf ? inf : std::sqrt(a);
+    }
+#else
+    (void)op;
+    (void)a;
+    return qnan;
+#endif
+}
+
+// pow() with the special cases of C99 Annex F spelled out, the signs of zeros aside. The rest is
+// folded unless it overflows or underflows, which log2 of the result tells in advance; within a
+// hair of those limits the result stays NaN and a division by it is only seen at run time.
+constexpr double power(double a, double b)
+{
+#if defined(__GNUC__) && !defined(__clang__)
+    if (b == 0 || a == 1)
+        return 1.;
+    if (isNan(a) || isNan(b))
+        return qnan;
+    if (a == 0)
+        return b < 0 ? inf : 0.;
+    if (isInf(b))
+        return a == -1 ? 1. : (abs(a) < 1) == (b < 0) ? inf : 0.;
+    if (isInf(a))
+        return b < 0 ? 0. : withSign(inf, a < 0 && isOddInteger(b));
+    if (a < 0 && !isInteger(b))
+        return qnan;
+    double log2 = b * std::log2(abs(a));
+    if (log2 > 1024.5)
+        return withSign(inf, a < 0 && isOddInteger(b));
+    if (log2 < -1075.5)
+        return 0.;
+    if (log2 > 1023.5 || log2 < -1021.5)
+        return qnan;
+    return std::pow(a, b);
+#else
+    (void)a;
+    (void)b;
+    return qnan;
+#endif
+}
+
+constexpr bool isSpace(char c) { return c == ' ' || (c >= '\t' && c <= '\r'); }
+constexpr bool isDigit(char c) { return c >= '0' && c <= '9'; }
+constexpr bool isAlpha(char c) { return (c | 0x20) >= 'a' && (c | 0x20) <= 'z'; }
+constexpr bool isAlnum(char c) { return isAlpha(c) || isDigit(c); }
+
+// parser.c with the token functions inlined, building nodes instead of emitting instructions.
+// Errors and their indices are reported exactly as it does.
+template <std::size_t N> class Parser {
+public:
+    constexpr Parser(const char* text, unsigned len)
+        : text(text)
+        , len(len)
+    {
+    }
+
+    constexpr Parsed<N> run()
+    {
+        int root = expression();
+        if (ok())
+            out.root = root;
+        return out;
+    }
+
+private:
+    const char* text;
+    unsigned len;
+    unsigned curr = 0;
+    Parsed<N> out;
+
+    constexpr char at(unsigned i) const { return i < len ? text[i] : '\0'; }
+    constexpr bool ok() const { return out.result == RES_OK; }
+    constexpr void fail(ParsingResult result, unsigned idx)
+    {
+        out.result = result;
+        out.errIdx = idx;
+    }
+    constexpr double value(int node) const { return out.nodes[node].value; }
+    constexpr int add(Op op, double value, int lhs = -1, int rhs = -1)
+    {
+        out.nodes[out.count] = { op, value, lhs, rhs };
+        return out.count++;
+    }
+
+    constexpr TokenType matchKeyword(unsigned* n) const
+    {
+        char s[4] = { at(curr), at(curr + 1), at(curr + 2), at(curr + 3) };
+        switch (s[0]) {
+        case 's':
+            if (s[1] == 'i' && s[2] == 'n')
+                return *n = 3, TOK_SINE;
+            if (s[1] == 'q' && s[2] == 'r' && s[3] == 't')
+                return *n = 4, TOK_SQRT;
+            break;
+        case 'c':
+            if (s[1] == 'o' && s[2] == 's')
+                return *n = 3, TOK_COSINE;
+            break;
+        case 't':
+            if (s[1] == 'a' && s[2] == 'n')
+                return *n = 3, TOK_TAN;
+            break;
+        case 'a':
+            if (s[1] == 't' && s[2] == 'a' && s[3] == 'n')
+                return *n = 4, TOK_ATAN;
+            break;
+        case 'e':
+            if (s[1] == 'x' && s[2] == 'p')
+                return *n = 3, TOK_EXP;
+            break;
+        }
+        return TOK_NONE;
+    }
+
+    constexpr void readVariable()
+    {
+        if (out.varLen > 0) {
+            for (unsigned i = 0; i < out.varLen; i++) {
+                if (at(curr + i) != out.var[i])
+                    return fail(RES_ERR_MULTIPLE_VARIABLES, curr);
+            }
+            curr += out.varLen;
+            return;
+        }
+        unsigned n = 0;
+        for (; isAlnum(at(curr)); n++, curr++) {
+            if (n < sizeof(out.var))
+                out.var[n] = at(curr);
+        }
+        if (n >= sizeof(out.var))
+            return fail(RES_ERR_VAR_TOO_LONG, curr);
+        out.varLen = n;
+    }
+
+    // readNonNegativeNumber() takes strtod() off Clinger's fast path, which is not available
+    // here. Such numbers are scaled in long double instead, which rounds to the same double
+    // except for inputs within a hair of a tie.
+    constexpr double readNumber()
+    {
+        unsigned long long mantissa = 0;
+        int exp10 = 0;
+        bool exact = true;
+        auto digit = [&](char c, bool fractional) {
+            unsigned d = c - '0';
+            if (mantissa <= (~0ull - 9) / 10) {
+                mantissa = mantissa * 10 + d;
+                exp10 -= fractional;
+                return;
+            }
+            exact &= d == 0;
+            exp10 += !fractional;
+        };
+        for (; isDigit(at(curr)); curr++)
+            digit(at(curr), false);
+        if (at(curr) == '.') {
+            for (curr++; isDigit(at(curr)); curr++)
+                digit(at(curr), true);
+        }
+        char e1 = at(curr + 1);
+        if ((at(curr) == 'e' || at(curr) == 'E')
+            && (isDigit(e1) || ((e1 == '+' || e1 == '-') && isDigit(at(curr + 2))))) {
+            bool negative = e1 == '-';
+            curr += isDigit(e1) ? 1 : 2;
+            int e = 0;
+            for (; isDigit(at(curr)); curr++) {
+                if (e < 100000)
+                    e = e * 10 + (at(curr) - '0');
+            }
+            exp10 += negative ? -e : e;
+        }
+        if (mantissa == 0)
+            return 0.;
+        if (exact && mantissa <= (1ull << 53) && exp10 >= -22 && exp10 <= 22) {
+            double m = (double)mantissa, p = 1;
+            for (int i = 0; i < (exp10 < 0 ? -exp10 : exp10); i++)
+                p *= 10; //< exact up to 1e22
+            return exp10 < 0 ? m / p : m * p;
+        }
+        if (exp10 > 400) //< the mantissa has at most 20 digits
+            return inf;
+        if (exp10 < -400)
+            return 0.;
+        long double v = mantissa, p = 1, base = 10;
+        for (unsigned e = exp10 < 0 ? -exp10 : exp10; e; e >>= 1, base *= base) {
+            if (e & 1)
+                p *= base;
+        }
+        v = exp10 < 0 ? v / p : v * p;
+        return v > dmax ? inf : (double)v;
+    }
+
+    constexpr Token_t readToken()
+    {
+        while (isSpace(at(curr)))
+            curr++;
+        Token_t t = { TOK_NONE, curr, 0, 0., 0 };
+        char c = at(curr);
+        unsigned keywordLen = 0;
+        TokenType keyword = isAlpha(c) ? matchKeyword(&keywordLen) : TOK_NONE;
+        if (keyword != TOK_NONE) {
+            t.type = keyword;
+            curr += keywordLen;
+        } else if (isAlpha(c)) {
+            t.type = TOK_VARIABLE;
+            readVariable();
+        } else if (isDigit(c)) {
+            t.type = TOK_NUMBER;
+            t.value = readNumber();
+        } else {
+            switch (c) {
+            case '(':
+                t.type = TOK_OPEN_PARAN;
+                break;
+            case ')':
+                t.type = TOK_CLOSE_PARAN;
+                break;
+            case '+':
+                t.type = TOK_PLUS;
+                break;
+            case '-':
+                t.type = TOK_MINUS;
+                break;
+            case '*':
+                t.type = at(curr + 1) == '*' ? TOK_POWER : TOK_MULTIPLY;
+                curr += t.type == TOK_POWER;
+                break;
+            case '/':
+                t.type = TOK_DIVIDE;
+                break;
+            case '\0':
+                return t;
+            default:
+                fail(RES_ERR_INVALID_CHAR, curr);
+                break;
+            }
+            curr++;
+        }
+        t.len = curr - t.idx;
+        return t;
+    }
+
+    constexpr int primary(Token_t t)
+    {
+        switch (t.type) {
+        case TOK_NUMBER:
+            return add(Op::Const, t.value);
+        case TOK_VARIABLE:
+            return add(Op::Var, qnan);
+        case TOK_SINE:
+        case TOK_COSINE:
+        case TOK_TAN:
+        case TOK_ATAN:
+        case TOK_EXP:
+        case TOK_SQRT: {
+            Op op = t.type == TOK_SINE ? Op::Sin
+                : t.type == TOK_COSINE ? Op::Cos
+                : t.type == TOK_TAN    ? Op::Tan
+                : t.type == TOK_ATAN   ? Op::Atan
+                : t.type == TOK_EXP    ? Op::Exp
+                                       : Op::Sqrt;
+            t = readToken();
+            if (!ok())
+                return -1;
+            if (t.type != TOK_OPEN_PARAN)
+                return fail(RES_ERR_OPEN_PARAN_MISSING, curr), -1;
+            int a = expression();
+            if (!ok())
+                return -1;
+            int node = add(op, apply(op, value(a)), a);
+            t = readToken();
+            if (ok() && t.type != TOK_CLOSE_PARAN)
+                fail(RES_ERR_CLOSE_PARAN_MISSING, curr);
+            return node;
+        }
+        case TOK_OPEN_PARAN: {
+            int node = expression();
+            if (!ok())
+                return -1;
+            t = readToken();
+            if (ok() && t.type != TOK_CLOSE_PARAN)
+                fail(RES_ERR_CLOSE_PARAN_MISSING, curr);
+            return node;
+        }
+        default:
+            return fail(RES_ERR_INVALID_INPUT, t.idx), -1;
+        }
+    }
+
+    // A sign applies to a whole power, whose exponent may be signed in turn. The token after the
+    // base is only looked at: a lexical error there is reported after the caller checked its
+    // division, as parser.c does.
+    constexpr int factor()
+    {
+        Token_t t = readToken();
+        if (!ok())
+            return -1;
+        if (t.type == TOK_PLUS)
+            return factor();
+        if (t.type == TOK_MINUS) {
+            int a = factor();
+            return ok() ? add(Op::Neg, -value(a), a) : -1;
+        }
+        int base = primary(t);
+        if (!ok())
+            return -1;
+        unsigned next = curr;
+        t = readToken();
+        if (!ok() || t.type != TOK_POWER) {
+            out.result = RES_OK;
+            curr = next;
+            return base;
+        }
+        int exponent = factor();
+        if (!ok())
+            return -1;
+        return add(Op::Pow, power(value(base), value(exponent)), base, exponent);
+    }
+
+    constexpr int term()
+    {
+        int left = factor();
+        if (!ok())
+            return -1;
+        for (Token_t t = readToken(); ok() && t.type != TOK_NONE; t = readToken()) {
+            if (t.type != TOK_MULTIPLY && t.type != TOK_DIVIDE) {
+                curr = t.idx;
+                return left;
+            }
+            int right = factor();
+            if (!ok())
+                return -1;
+            if (t.type == TOK_MULTIPLY) {
+                left = add(Op::Mul, product(value(left), value(right)), left, right);
+                continue;
+            }
+            if (value(right) == 0)
+                return fail(RES_ERR_DIV_BY_ZERO, t.idx), -1;
+            left = add(Op::Div, quotient(value(left), value(right)), left, right);
+        }
+        return left;
+    }
+
+    constexpr int expression()
+    {
+        int left = term();
+        if (!ok())
+            return -1;
+        for (Token_t t = readToken(); ok() && t.type != TOK_NONE; t = readToken()) {
+            if (t.type != TOK_PLUS && t.type != TOK_MINUS) {
+                curr = t.idx;
+                return left;
+            }
+            int right = term();
+            if (!ok())
+                return -1;
+            double r = t.type == TOK_PLUS ? value(right) : -value(right); //< a - b is a + -b
+            left = add(t.type == TOK_PLUS ? Op::Add : Op::Sub, sum(value(left), r), left, right);
+        }
+        return left;
+    }
+};
+
+template <FixedString S> constexpr auto parse()
+{
+    return Parser<S.size() + 1>(S.text, S.size()).run();
+}
+
+// Value and derivative, combined like evaluateProgramDual() does
+struct Dual {
+    double v;
+    double d;
+    constexpr Dual(double v = 0., double d = 0.)
+        : v(v)
+        , d(d)
+    {
+    }
+};
+
+constexpr Dual operator-(Dual a) { return { -a.v, -a.d }; }
+constexpr Dual operator+(Dual a, Dual b) { return { a.v + b.v, a.d + b.d }; }
+constexpr Dual operator-(Dual a, Dual b) { return { a.v - b.v, a.d - b.d }; }
+constexpr Dual operator*(Dual a, Dual b) { return { a.v * b.v, a.d * b.v + a.v * b.d }; }
+constexpr Dual operator/(Dual a, Dual b)
+{
+    double v = a.v / b.v;
+    return { v, (a.d - v * b.d) / b.v };
+}
+// The terms of a' and b' are left out when those are zero, as in evaluateProgramDual()
+inline Dual pow(Dual a, Dual b)
+{
+    Dual r(std::pow(a.v, b.v));
+    if (a.d != 0)
+        r.d += b.v * std::pow(a.v, b.v - 1.) * a.d;
+    if (b.d != 0)
+        r.d += r.v * std::log(a.v) * b.d;
+    return r;
+}
+inline Dual sin(Dual a) { return { std::sin(a.v), std::cos(a.v) * a.d }; }
+inline Dual cos(Dual a) { return { std::cos(a.v), -std::sin(a.v) * a.d }; }
+inline Dual tan(Dual a)
+{
+    double v = std::tan(a.v);
+    return { v, (1. + v * v) * a.d };
+}
+inline Dual atan(Dual a) { return { std::atan(a.v), a.d / (1. + a.v * a.v) }; }
+inline Dual exp(Dual a)
+{
+    double v = std::exp(a.v);
+    return { v, v * a.d };
+}
+inline Dual sqrt(Dual a)
+{
+    double v = std::sqrt(a.v);
+    return { v, a.d / (2. * v) };
+}
+
+// Node I of the tree P, for any T with the arithmetic operators, pow and the six functions
+template <const auto& P, int I, class T> constexpr T evaluate(const T& x)
+{
+    using std::atan, std::cos, std::exp, std::pow, std::sin, std::sqrt, std::tan;
+    if constexpr (I < 0) {
+        return T(qnan); //< unreachable, the parse failed to compile
+    } else {
+        constexpr Node n = P.nodes[I];
+        if constexpr (n.op == Op::Const)
+            return T(n.value);
+        else if constexpr (n.op == Op::Var)
+            return x;
+        else if constexpr (n.op == Op::Neg)
+            return -evaluate<P, n.lhs>(x);
+        else if constexpr (n.op == Op::Add)
+            return evaluate<P, n.lhs>(x) + evaluate<P, n.rhs>(x);
+        else if constexpr (n.op == Op::Sub)
+            return evaluate<P, n.lhs>(x) - evaluate<P, n.rhs>(x);
+        else if constexpr (n.op == Op::Mul)
+            return evaluate<P, n.lhs>(x) * evaluate<P, n.rhs>(x);
+        else if constexpr (n.op == Op::Div)
+            return evaluate<P, n.lhs>(x) / evaluate<P, n.rhs>(x);
+        else if constexpr (n.op == Op::Pow)
+            return pow(evaluate<P, n.lhs>(x), evaluate<P, n.rhs>(x));
+        else if constexpr (n.op == Op::Sin)
+            return sin(evaluate<P, n.lhs>(x));
+        else if constexpr (n.op == Op::Cos)
+            return cos(evaluate<P, n.lhs>(x));
+        else if constexpr (n.op == Op::Tan)
+            return tan(evaluate<P, n.lhs>(x));
+        else if constexpr (n.op == Op::Atan)
+            return atan(evaluate<P, n.lhs>(x));
+        else if constexpr (n.op == Op::Exp)
+            return exp(evaluate<P, n.lhs>(x));
+        else
+            return sqrt(evaluate<P, n.lhs>(x));
+    }
+}
+
+} // namespace detail
+
+// Parses S without requiring it to be valid, e.g. to test error reporting at compile time
+template <FixedString S> constexpr Diagnostic diagnose()
+{
+    constexpr auto parsed = detail::parse<S>();
+    return { parsed.result, parsed.errIdx };
+}
+
+template <FixedString S> struct StaticExpression {
+    static constexpr auto parsed = detail::parse<S>();
+    static_assert(parsed.result != RES_ERR_INVALID_CHAR, "RES_ERR_INVALID_CHAR: invalid character");
+    static_assert(parsed.result != RES_ERR_INVALID_INPUT, "RES_ERR_INVALID_INPUT: invalid input");
+    static_assert(parsed.result != RES_ERR_DIV_BY_ZERO, "RES_ERR_DIV_BY_ZERO: division by zero");
+    static_assert(parsed.result != RES_ERR_OPEN_PARAN_MISSING,
+        "RES_ERR_OPEN_PARAN_MISSING: open parenthesis missing after function");
+    static_assert(parsed.result != RES_ERR_CLOSE_PARAN_MISSING,
+        "RES_ERR_CLOSE_PARAN_MISSING: close parenthesis missing");
+    static_assert(parsed.result != RES_ERR_VAR_TOO_LONG, "RES_ERR_VAR_TOO_LONG: variable too long");
+    static_assert(parsed.result != RES_ERR_MULTIPLE_VARIABLES,
+        "RES_ERR_MULTIPLE_VARIABLES: multiple variables not allowed");
+
+    static constexpr bool hasVariable = parsed.varLen > 0;
+    static constexpr std::string_view variable() { return { parsed.var, parsed.varLen }; }
+
+    template <class T> static constexpr T evaluate(const T& x)
+    {
+        return detail::evaluate<parsed, parsed.root>(x);
+    }
+    constexpr double operator()(double x) const { return evaluate(x); }
+    static double evaluateDual(double x, double* dfdx)
+    {
+        detail::Dual r = evaluate(detail::Dual(x, 1.));
+        *dfdx = r.d;
+        return r.v;
+    }
+
+    // Callbacks of objective()
+    static double evalObjective(const void*, double x, double* dfdx)
+    {
+        return evaluateDual(x, dfdx);
+    }
+    static void evalObjectiveBatch(const void*, const double* xs, double* out, size_t n)
+    {
+        for (size_t i = 0; i < n; i++)
+            out[i] = evaluate(xs[i]);
+    }
+};
+
+template <FixedString S> inline constexpr StaticExpression<S> expression {};
+
+// Hands the expression to the solvers of solver.h. It has no interval extension, so it is not
+// for METHOD_INTERVAL, and householderSolve() runs Newton on it.
+template <FixedString S> constexpr Objective objective(StaticExpression<S>)
+{
+    using E = StaticExpression<S>;
+    return { &E::evalObjective, &E::evalObjectiveBatch, nullptr, nullptr, nullptr };
+}
+
+template <FixedString S>
+SolveResult newton(StaticExpression<S> f, double x0, double tol, unsigned maxiter)
+{
+    return newtonSolve(objective(f), x0, tol, maxiter);
+}
+
+template <FixedString S>
+SolveResult bracket(
+    StaticExpression<S> f, SolveMethod method, double a, double b, double tol, unsigned maxiter)
+{
+    return bracketSolve(objective(f), method, a, b, tol, maxiter);
+}
+
+} // namespace fr
+
+#endif
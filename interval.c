@@ -0,0 +1,334 @@
+#include "program.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+#define INTERVAL_STACK_SIZE 64 //< entries kept on the C stack, deeper programs use the heap
+// Period counts computed in double are off by far less than this for |x| below
+// INTERVAL_PERIODIC_LIMIT; a closer extremum or pole is assumed to be inside the interval.
+#define INTERVAL_PHASE_SLACK 1e-9
+#define INTERVAL_PERIODIC_LIMIT 1e6
+
+// Bounds are computed in round-to-nearest and then moved outwards: by one ulp for the correctly
+// rounded + - * / and sqrt, by two for libm's sin, cos, tan, atan, exp, log and pow, which stay
+// within one ulp of the exact result.
+static double down(double x) { return nextafter(x, -INFINITY); }
+
+static double up(double x) { return nextafter(x, INFINITY); }
+
+// A sum or a difference that rounds to zero is exactly zero and stays in place
+static double sumDown(double x) { return x == 0 ? 0. : down(x); }
+
+static double sumUp(double x) { return x == 0 ? 0. : up(x); }
+
+static double down2(double x) { return down(down(x)); }
+
+static double up2(double x) { return up(up(x)); }
+
+static struct Interval interval(double lo, double hi)
+{
+    struct Interval r = { lo, hi };
+    return r;
+}
+
+static struct Interval point(double x) { return interval(x, x); }
+
+static struct Interval entire(void) { return interval(-INFINITY, INFINITY); }
+
+static struct Interval empty(void) { return interval(NAN, NAN); }
+
+static bool isEmpty(struct Interval x) { return isnan(x.lo) || isnan(x.hi); }
+
+static struct Interval negate(struct Interval x) { return interval(-x.hi, -x.lo); }
+
+static struct Interval add(struct Interval x, struct Interval y)
+{
+    return interval(sumDown(x.lo + y.lo), sumUp(x.hi + y.hi));
+}
+
+static struct Interval subtract(struct Interval x, struct Interval y)
+{
+    return interval(sumDown(x.lo - y.hi), sumUp(x.hi - y.lo));
+}
+
+// Rounded products of two bounds. A zero factor gives an exact zero, also times infinity, which
+// is the limit seen from inside the interval.
+static double productDown(double x, double y) { return x == 0 || y == 0 ? 0. : down(x * y); }
+
+static double productUp(double x, double y) { return x == 0 || y == 0 ? 0. : up(x * y); }
+
+static double min4(double a, double b, double c, double d) { return fmin(fmin(a, b), fmin(c, d)); }
+
+static double max4(double a, double b, double c, double d) { return fmax(fmax(a, b), fmax(c, d)); }
+
+static struct Interval multiply(struct Interval x, struct Interval y)
+{
+    if (isEmpty(x) || isEmpty(y))
+        return empty();
+    return interval(min4(productDown(x.lo, y.lo), productDown(x.lo, y.hi),
+                        productDown(x.hi, y.lo), productDown(x.hi, y.hi)),
+        max4(productUp(x.lo, y.lo), productUp(x.lo, y.hi), productUp(x.hi, y.lo),
+            productUp(x.hi, y.hi)));
+}
+
+// Rounded quotients of two bounds of a divisor without zero. Two infinite bounds stand for any
+// positive ratio, whose extremes are covered by the other three quotients.
+static double quotientDown(double x, double y)
+{
+    return x == 0 || (isinf(x) && isinf(y)) ? 0. : down(x / y);
+}
+
+static double quotientUp(double x, double y)
+{
+    return x == 0 || (isinf(x) && isinf(y)) ? 0. : up(x / y);
+}
+
+static struct Interval divide(struct Interval x, struct Interval y)
+{
+    if (isEmpty(x) || isEmpty(y) || (y.lo == 0 && y.hi == 0))
+        return empty();
+    if (y.lo > 0 || y.hi < 0) {
+        return interval(min4(quotientDown(x.lo, y.lo), quotientDown(x.lo, y.hi),
+                            quotientDown(x.hi, y.lo), quotientDown(x.hi, y.hi)),
+            max4(quotientUp(x.lo, y.lo), quotientUp(x.lo, y.hi), quotientUp(x.hi, y.lo),
+                quotientUp(x.hi, y.hi)));
+    }
+    // a divisor touching zero from one side has a reciprocal unbounded on that side only
+    if (y.lo == 0)
+        return multiply(x, interval(quotientDown(1., y.hi), INFINITY));
+    if (y.hi == 0)
+        return multiply(x, interval(-INFINITY, quotientUp(1., y.lo)));
+    return entire();
+}
+
+static struct Interval square(struct Interval x)
+{
+    if (x.lo >= 0)
+        return interval(productDown(x.lo, x.lo), productUp(x.hi, x.hi));
+    if (x.hi <= 0)
+        return interval(productDown(x.hi, x.hi), productUp(x.lo, x.lo));
+    return isEmpty(x) ? empty() : interval(0., productUp(fmax(-x.lo, x.hi), fmax(-x.lo, x.hi)));
+}
+
+static struct Interval squareRoot(struct Interval x)
+{
+    if (isEmpty(x) || x.hi < 0)
+        return empty(); //< no point of x is in the domain
+    return interval(fmax(down(sqrt(fmax(x.lo, 0.))), 0.), up(sqrt(x.hi)));
+}
+
+static struct Interval exponential(struct Interval x)
+{
+    return interval(fmax(down2(exp(x.lo)), 0.), up2(exp(x.hi)));
+}
+
+static struct Interval logarithm(struct Interval x)
+{
+    if (isEmpty(x) || x.hi < 0)
+        return empty();
+    return interval(down2(log(fmax(x.lo, 0.))), up2(log(x.hi))); //< log(0) is -inf
+}
+
+static bool isInteger(double x) { return x == nearbyint(x) && !isinf(x); }
+
+// x^n for a whole n > 0: increasing for an odd n, even in x otherwise. Bounds keep the sign of
+// x, so that a reciprocal sees a power of x >= 0 touch zero from one side only.
+static struct Interval integerPower(struct Interval x, double n)
+{
+    if (fmod(n, 2.) != 0) {
+        double lo = down2(pow(x.lo, n)), hi = up2(pow(x.hi, n));
+        return interval(x.lo >= 0 ? fmax(lo, 0.) : lo, x.hi <= 0 ? fmin(hi, 0.) : hi);
+    }
+    double lo = x.lo >= 0 ? x.lo : x.hi <= 0 ? -x.hi : 0.;
+    return interval(fmax(down2(pow(lo, n)), 0.), up2(pow(fmax(-x.lo, x.hi), n)));
+}
+
+// A negative base only has powers with integer exponents. For a constant one they are exact,
+// otherwise the result gives up on such a base unless y holds no integer at all. On x >= 0 the
+// power is monotonic in each argument, so its extremes are at the corners.
+static struct Interval power(struct Interval x, struct Interval y)
+{
+    if (isEmpty(x) || isEmpty(y))
+        return empty();
+    if (y.lo == y.hi && isInteger(y.lo)) {
+        if (y.lo == 0)
+            return point(1.);
+        struct Interval r = integerPower(x, fabs(y.lo));
+        return y.lo > 0 ? r : divide(point(1.), r);
+    }
+    if (x.lo < 0 && floor(y.hi) >= y.lo)
+        return entire();
+    if (x.hi < 0)
+        return empty();
+    x.lo = fmax(x.lo, 0.);
+    double a = pow(x.lo, y.lo), b = pow(x.lo, y.hi), c = pow(x.hi, y.lo), d = pow(x.hi, y.hi);
+    return interval(fmax(down2(min4(a, b, c, d)), 0.), up2(max4(a, b, c, d)));
+}
+
+// d(x^y) = y x^(y-1) dx + x^y log(x) dy with v = x^y
+static struct Interval powerDerivative(struct Interval x, struct Interval y, struct Interval v,
+    struct Interval dx, struct Interval dy)
+{
+    // keeps an integer exponent a point, subtract() would round y - 1 outwards
+    struct Interval ym1 = y.lo == y.hi && isInteger(y.lo) && fabs(y.lo) <= 0x1p53
+        ? point(y.lo - 1.)
+        : subtract(y, point(1.));
+    struct Interval d = multiply(multiply(y, power(x, ym1)), dx);
+    if (dy.lo == 0 && dy.hi == 0)
+        return d;
+    if (x.lo < 0)
+        return entire(); //< no derivative in y where the base is negative
+    return add(d, multiply(multiply(v, logarithm(x)), dy));
+}
+
+static struct Interval arcTangent(struct Interval x)
+{
+    return interval(down2(atan(x.lo)), up2(atan(x.hi)));
+}
+
+static bool isPeriodicReducible(struct Interval x, double period)
+{
+    return x.hi - x.lo < period && fabs(x.lo) < INTERVAL_PERIODIC_LIMIT
+        && fabs(x.hi) < INTERVAL_PERIODIC_LIMIT;
+}
+
+// Whether x may contain phase + k*period for an integer k, true when in doubt
+static bool containsPhase(struct Interval x, double phase, double period)
+{
+    double k = ceil((x.lo - phase) / period - INTERVAL_PHASE_SLACK);
+    return k <= (x.hi - phase) / period + INTERVAL_PHASE_SLACK;
+}
+
+// Range of sin or cos, whose maxima are at maxPhase + 2k*pi and minima half a period later
+static struct Interval sinusoid(struct Interval x, double (*f)(double), double maxPhase)
+{
+    if (isEmpty(x))
+        return empty();
+    if (!isPeriodicReducible(x, 2 * M_PI))
+        return interval(-1., 1.);
+    double flo = f(x.lo);
+    double fhi = f(x.hi);
+    struct Interval r = interval(fmax(down2(fmin(flo, fhi)), -1.), fmin(up2(fmax(flo, fhi)), 1.));
+    if (containsPhase(x, maxPhase, 2 * M_PI))
+        r.hi = 1.;
+    if (containsPhase(x, maxPhase + M_PI, 2 * M_PI))
+        r.lo = -1.;
+    return r;
+}
+
+static struct Interval tangent(struct Interval x)
+{
+    if (isEmpty(x))
+        return empty();
+    if (!isPeriodicReducible(x, M_PI) || containsPhase(x, M_PI_2, M_PI))
+        return entire(); //< tan is unbounded around its poles
+    return interval(down2(tan(x.lo)), up2(tan(x.hi))); //< increasing between two poles
+}
+
+struct IntervalDual {
+    struct Interval v;
+    struct Interval d;
+};
+
+struct Interval evaluateProgramInterval(
+    const struct Program* prog, struct Interval x, struct Interval* dfdx)
+{
+    // slot 0 is a sentinel like in evaluateProgramDual()
+    struct IntervalDual buf[INTERVAL_STACK_SIZE + 1];
+    struct IntervalDual* stack = buf;
+    size_t slots = (size_t)prog->maxDepth + 1 + prog->nregs;
+    if (slots > INTERVAL_STACK_SIZE + 1) {
+        stack = malloc(slots * sizeof(*stack));
+        if (!stack) {
+            *dfdx = entire();
+            return entire(); //< encloses everything, so nothing is wrongly ruled out
+        }
+    }
+    struct IntervalDual* regs = stack + prog->maxDepth + 1;
+    const double* consts = prog->consts;
+    struct IntervalDual* top = stack;
+    const struct Instruction* ip = prog->code;
+    const struct Instruction* end = ip + prog->len;
+    for (; ip != end; ++ip) {
+        switch (ip->op) {
+        case OP_CONST:
+            ++top;
+            top->v = point(consts[ip->arg]);
+            top->d = point(0.);
+            break;
+        case OP_VAR:
+            ++top;
+            top->v = x;
+            top->d = point(1.);
+            break;
+        case OP_NEG:
+            top->v = negate(top->v);
+            top->d = negate(top->d);
+            break;
+        case OP_ADD:
+            top[-1].v = add(top[-1].v, top->v);
+            top[-1].d = add(top[-1].d, top->d);
+            --top;
+            break;
+        case OP_SUB:
+            top[-1].v = subtract(top[-1].v, top->v);
+            top[-1].d = subtract(top[-1].d, top->d);
+            --top;
+            break;
+        case OP_MUL:
+            top[-1].d = add(multiply(top[-1].d, top->v), multiply(top[-1].v, top->d));
+            top[-1].v = multiply(top[-1].v, top->v);
+            --top;
+            break;
+        case OP_DIV:
+            top[-1].v = divide(top[-1].v, top->v);
+            top[-1].d = divide(subtract(top[-1].d, multiply(top[-1].v, top->d)), top->v);
+            --top;
+            break;
+        case OP_POW: {
+            struct Interval v = power(top[-1].v, top->v);
+            top[-1].d = powerDerivative(top[-1].v, top->v, v, top[-1].d, top->d);
+            top[-1].v = v;
+            --top;
+            break;
+        }
+        case OP_SIN:
+            top->d = multiply(sinusoid(top->v, cos, 0.), top->d);
+            top->v = sinusoid(top->v, sin, M_PI_2);
+            break;
+        case OP_COS:
+            top->d = multiply(negate(sinusoid(top->v, sin, M_PI_2)), top->d);
+            top->v = sinusoid(top->v, cos, 0.);
+            break;
+        case OP_TAN:
+            top->v = tangent(top->v);
+            top->d = multiply(add(point(1.), square(top->v)), top->d);
+            break;
+        case OP_ATAN:
+            top->d = divide(top->d, add(point(1.), square(top->v)));
+            top->v = arcTangent(top->v);
+            break;
+        case OP_EXP:
+            top->v = exponential(top->v);
+            top->d = multiply(top->v, top->d);
+            break;
+        case OP_SQRT:
+            top->v = squareRoot(top->v);
+            top->d = divide(top->d, multiply(point(2.), top->v));
+            break;
+        case OP_LOAD:
+            *++top = regs[ip->arg];
+            break;
+        case OP_STORE:
+            regs[ip->arg] = *top;
+            break;
+        }
+    }
+    struct IntervalDual result = { empty(), empty() };
+    if (top > stack)
+        result = *top;
+    if (stack != buf)
+        free(stack);
+    *dfdx = result.d;
+    return result.v;
+}
@@ -0,0 +1,483 @@
+#include "jit.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define JIT_HEADER 16 //< the mapping size is stored in front of the code
+#define JIT_MAX_FRAME 4096 //< one page, so the frame never skips the guard page of a thread stack
+
+struct CodeBuffer {
+    unsigned char* data;
+    size_t len;
+    size_t cap;
+    bool failed;
+};
+
+static void emitBytes(struct CodeBuffer* buf, const void* bytes, size_t n)
+{
+    if (buf->failed)
+        return;
+    if (buf->len + n > buf->cap) {
+        size_t cap = buf->cap ? 2 * buf->cap : 256;
+        while (cap < buf->len + n)
+            cap *= 2;
+        unsigned char* data = realloc(buf->data, cap);
+        if (!data) {
+            buf->failed = true;
+            return;
+        }
+        buf->data = data;
+        buf->cap = cap;
+    }
+    memcpy(buf->data + buf->len, bytes, n);
+    buf->len += n;
+}
+
+enum SseOp {
+    SSE_MOV_LOAD = 0x10, //< movsd xmm, m64
+    SSE_MOV_STORE = 0x11, //< movsd m64, xmm
+    SSE_SQRT = 0x51,
+    SSE_ADD = 0x58,
+    SSE_MUL = 0x59,
+    SSE_SUB = 0x5C,
+    SSE_DIV = 0x5E,
+};
+
+// <op>sd xmm, [rbp + disp]
+static void emitSseMem(struct CodeBuffer* buf, enum SseOp op, unsigned xmm, int32_t disp)
+{
+    unsigned char code[] = { 0xF2, 0x0F, op, 0x85 | (xmm << 3) };
+    emitBytes(buf, code, sizeof(code));
+    emitBytes(buf, &disp, sizeof(disp));
+}
+
+// <op>sd dst, src
+static void emitSseReg(struct CodeBuffer* buf, enum SseOp op, unsigned dst, unsigned src)
+{
+    unsigned char code[] = { 0xF2, 0x0F, op, 0xC0 | (dst << 3) | src };
+    emitBytes(buf, code, sizeof(code));
+}
+
+static void emitMovapd(struct CodeBuffer* buf, unsigned dst, unsigned src)
+{
+    unsigned char code[] = { 0x66, 0x0F, 0x28, 0xC0 | (dst << 3) | src };
+    emitBytes(buf, code, sizeof(code));
+}
+
+static void emitXorpd(struct CodeBuffer* buf, unsigned dst, unsigned src)
+{
+    unsigned char code[] = { 0x66, 0x0F, 0x57, 0xC0 | (dst << 3) | src };
+    emitBytes(buf, code, sizeof(code));
+}
+
+// mov rax, imm64; movq xmm, rax
+static void emitLoadImmediate(struct CodeBuffer* buf, unsigned xmm, uint64_t bits)
+{
+    emitBytes(buf, (unsigned char[]) { 0x48, 0xB8 }, 2);
+    emitBytes(buf, &bits, sizeof(bits));
+    unsigned char movq[] = { 0x66, 0x48, 0x0F, 0x6E, 0xC0 | (xmm << 3) };
+    emitBytes(buf, movq, sizeof(movq));
+}
+
+static void emitLoadDouble(struct CodeBuffer* buf, unsigned xmm, double value)
+{
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    emitLoadImmediate(buf, xmm, bits);
+}
+
+static void emitNegate(struct CodeBuffer* buf, unsigned xmm, unsigned scratch)
+{
+    emitLoadImmediate(buf, scratch, 0x8000000000000000ull);
+    emitXorpd(buf, xmm, scratch);
+}
+
+// mov rax, addr; call rax
+static void emitCallAddress(struct CodeBuffer* buf, uint64_t addr)
+{
+    emitBytes(buf, (unsigned char[]) { 0x48, 0xB8 }, 2);
+    emitBytes(buf, &addr, sizeof(addr));
+    emitBytes(buf, (unsigned char[]) { 0xFF, 0xD0 }, 2);
+}
+
+// The argument and the result are in xmm0
+static void emitCall(struct CodeBuffer* buf, double (*fn)(double))
+{
+    emitCallAddress(buf, (uint64_t)(uintptr_t)fn);
+}
+
+// lea rdi, [rbp + disp] and lea rsi, [rbp + disp]: the first two integer arguments
+static void emitArgumentAddresses(struct CodeBuffer* buf, int32_t rdiDisp, int32_t rsiDisp)
+{
+    emitBytes(buf, (unsigned char[]) { 0x48, 0x8D, 0xBD }, 3);
+    emitBytes(buf, &rdiDisp, sizeof(rdiDisp));
+    emitBytes(buf, (unsigned char[]) { 0x48, 0x8D, 0xB5 }, 3);
+    emitBytes(buf, &rsiDisp, sizeof(rsiDisp));
+}
+
+// push rbp; mov rbp, rsp; sub rsp, frame
+static void emitPrologue(struct CodeBuffer* buf, uint32_t frame)
+{
+    emitBytes(buf, (unsigned char[]) { 0x55, 0x48, 0x89, 0xE5, 0x48, 0x81, 0xEC }, 7);
+    emitBytes(buf, &frame, sizeof(frame));
+}
+
+// leave; ret
+static void emitEpilogue(struct CodeBuffer* buf)
+{
+    emitBytes(buf, (unsigned char[]) { 0xC9, 0xC3 }, 2);
+}
+
+static double (*getLibmFunction(enum OpCode op))(double)
+{
+    switch (op) {
+    case OP_SIN:
+        return &sin;
+    case OP_COS:
+        return &cos;
+    case OP_TAN:
+        return &tan;
+    case OP_ATAN:
+        return &atan;
+    case OP_EXP:
+        return &exp;
+    default:
+        return NULL;
+    }
+}
+
+static size_t alignFrame(size_t bytes) { return (bytes + 15) & ~(size_t)15; }
+
+static size_t valueFrame(const struct Program* prog)
+{
+    return alignFrame(8 + 8 * ((size_t)prog->maxDepth + prog->nregs));
+}
+
+static size_t dualFrame(const struct Program* prog)
+{
+    return alignFrame(16 + 16 * ((size_t)prog->maxDepth + prog->nregs));
+}
+
+// Value mode keeps the top of the operand stack in xmm0, the entries below it live in the frame.
+// [rbp-8] holds x, entry i is spilled to [rbp-16-8*i] and register r follows the maxDepth entries.
+#define VALUE_X (-8)
+#define VALUE_SLOT(i) (-16 - 8 * (int32_t)(i))
+
+static void generateValue(struct CodeBuffer* buf, const struct Program* prog)
+{
+    emitPrologue(buf, (uint32_t)valueFrame(prog));
+    emitSseMem(buf, SSE_MOV_STORE, 0, VALUE_X);
+    unsigned depth = 0;
+    for (unsigned i = 0; i < prog->len; i++) {
+        const struct Instruction* ins = &prog->code[i];
+        switch (ins->op) {
+        case OP_CONST:
+        case OP_VAR:
+            if (depth > 0)
+                emitSseMem(buf, SSE_MOV_STORE, 0, VALUE_SLOT(depth - 1));
+            if (ins->op == OP_CONST)
+                emitLoadDouble(buf, 0, prog->consts[ins->arg]);
+            else
+                emitSseMem(buf, SSE_MOV_LOAD, 0, VALUE_X);
+            depth++;
+            break;
+        case OP_LOAD:
+            if (depth > 0)
+                emitSseMem(buf, SSE_MOV_STORE, 0, VALUE_SLOT(depth - 1));
+            emitSseMem(buf, SSE_MOV_LOAD, 0, VALUE_SLOT(prog->maxDepth + ins->arg));
+            depth++;
+            break;
+        case OP_STORE:
+            emitSseMem(buf, SSE_MOV_STORE, 0, VALUE_SLOT(prog->maxDepth + ins->arg));
+            break;
+        case OP_NEG:
+            emitNegate(buf, 0, 1);
+            break;
+        case OP_ADD:
+        case OP_MUL:
+            emitSseMem(buf, ins->op == OP_ADD ? SSE_ADD : SSE_MUL, 0, VALUE_SLOT(depth - 2));
+            depth--;
+            break;
+        case OP_SUB:
+        case OP_DIV:
+            emitSseMem(buf, SSE_MOV_LOAD, 1, VALUE_SLOT(depth - 2));
+            emitSseReg(buf, ins->op == OP_SUB ? SSE_SUB : SSE_DIV, 1, 0);
+            emitMovapd(buf, 0, 1);
+            depth--;
+            break;
+        case OP_SQRT:
+            emitSseReg(buf, SSE_SQRT, 0, 0);
+            break;
+        case OP_POW: // pow(xmm0, xmm1)
+            emitMovapd(buf, 1, 0);
+            emitSseMem(buf, SSE_MOV_LOAD, 0, VALUE_SLOT(depth - 2));
+            emitCallAddress(buf, (uint64_t)(uintptr_t)&pow);
+            depth--;
+            break;
+        default:
+            emitCall(buf, getLibmFunction(ins->op));
+            break;
+        }
+    }
+    emitEpilogue(buf);
+}
+
+// Dual mode keeps every (value, derivative) pair in the frame: [rbp-8] holds x, [rbp-16] the
+// dfdx pointer, entry i is at [rbp-32-16*i] (value) and [rbp-24-16*i] (derivative). Register r
+// is stored like entry maxDepth + r.
+#define DUAL_X (-8)
+#define DUAL_OUT (-16)
+#define DUAL_V(i) (-32 - 16 * (int32_t)(i))
+#define DUAL_D(i) (-24 - 16 * (int32_t)(i))
+
+// v = f(v), d = g(a) * d where g is the derivative expressed with another libm call
+static void emitDualCall(struct CodeBuffer* buf, unsigned top, double (*f)(double),
+    double (*g)(double), bool negateDerivative)
+{
+    emitSseMem(buf, SSE_MOV_LOAD, 0, DUAL_V(top));
+    emitCall(buf, g);
+    emitSseMem(buf, SSE_MUL, 0, DUAL_D(top));
+    if (negateDerivative)
+        emitNegate(buf, 0, 1);
+    emitSseMem(buf, SSE_MOV_STORE, 0, DUAL_D(top));
+    emitSseMem(buf, SSE_MOV_LOAD, 0, DUAL_V(top));
+    emitCall(buf, f);
+    emitSseMem(buf, SSE_MOV_STORE, 0, DUAL_V(top));
+}
+
+// Entry `left` becomes (a, a') ** (b, b') with the terms of evaluateProgramDual(). Both point to
+// the value of an entry, which the derivative follows.
+static void powDual(double* left, const double* right)
+{
+    double v = pow(left[0], right[0]);
+    double d = 0.;
+    if (left[1] != 0)
+        d += right[0] * pow(left[0], right[0] - 1.) * left[1];
+    if (right[1] != 0)
+        d += v * log(left[0]) * right[1];
+    left[0] = v;
+    left[1] = d;
+}
+
+static void generateDual(struct CodeBuffer* buf, const struct Program* prog)
+{
+    emitPrologue(buf, (uint32_t)dualFrame(prog));
+    emitSseMem(buf, SSE_MOV_STORE, 0, DUAL_X);
+    emitBytes(buf, (unsigned char[]) { 0x48, 0x89, 0xBD }, 3); //< mov [rbp+disp32], rdi
+    emitBytes(buf, &(int32_t) { DUAL_OUT }, 4);
+    unsigned depth = 0;
+    for (unsigned i = 0; i < prog->len; i++) {
+        const struct Instruction* ins = &prog->code[i];
+        unsigned top = depth - 1;
+        unsigned left = depth - 2;
+        switch (ins->op) {
+        case OP_CONST:
+            emitLoadDouble(buf, 0, prog->consts[ins->arg]);
+            emitSseMem(buf, SSE_MOV_STORE, 0, DUAL_V(depth));
+            emitXorpd(buf, 1, 1);
+            emitSseMem(buf, SSE_MOV_STORE, 1, DUAL_D(depth));
+            depth++;
+            break;
+        case OP_VAR:
+            emitSseMem(buf, SSE_MOV_LOAD, 0, DUAL_X);
+            emitSseMem(buf, SSE_MOV_STORE, 0, DUAL_V(depth));
+            emitLoadDouble(buf, 1, 1.);
+            emitSseMem(buf, SSE_MOV_STORE, 1, DUAL_D(depth));
+            depth++;
+            break;
+        case OP_LOAD:
+        case OP_STORE: {
+            unsigned reg = prog->maxDepth + ins->arg;
+            unsigned src = ins->op == OP_LOAD ? reg : top;
+            unsigned dst = ins->op == OP_LOAD ? depth : reg;
+            emitSseMem(buf, SSE_MOV_LOAD, 0, DUAL_V(src));
+            emitSseMem(buf, SSE_MOV_LOAD, 1, DUAL_D(src));
+            emitSseMem(buf, SSE_MOV_STORE, 0, DUAL_V(dst));
+            emitSseMem(buf, SSE_MOV_STORE, 1, DUAL_D(dst));
+            if (ins->op == OP_LOAD)
+                depth++;
+            break;
+        }
+        case OP_NEG:
+            emitLoadImmediate(buf, 2, 0x8000000000000000ull);
+            emitSseMem(buf, SSE_MOV_LOAD, 0, DUAL_V(top));
+            emitXorpd(buf, 0, 2);
+            emitSseMem(buf, SSE_MOV_STORE, 0, DUAL_V(top));
+            emitSseMem(buf, SSE_MOV_LOAD, 1, DUAL_D(top));
+            emitXorpd(buf, 1, 2);
+            emitSseMem(buf, SSE_MOV_STORE, 1, DUAL_D(top));
+            break;
+        case OP_ADD:
+        case OP_SUB: {
+            enum SseOp op = ins->op == OP_ADD ? SSE_ADD : SSE_SUB;
+            emitSseMem(buf, SSE_MOV_LOAD, 0, DUAL_V(left));
+            emitSseMem(buf, op, 0, DUAL_V(top));
+            emitSseMem(buf, SSE_MOV_STORE, 0, DUAL_V(left));
+            emitSseMem(buf, SSE_MOV_LOAD, 1, DUAL_D(left));
+            emitSseMem(buf, op, 1, DUAL_D(top));
+            emitSseMem(buf, SSE_MOV_STORE, 1, DUAL_D(left));
+            depth--;
+            break;
+        }
+        case OP_MUL: // (a, a') * (b, b') = (ab, a'b + ab')
+            emitSseMem(buf, SSE_MOV_LOAD, 0, DUAL_V(left));
+            emitSseMem(buf, SSE_MOV_LOAD, 1, DUAL_D(left));
+            emitMovapd(buf, 4, 0);
+            emitSseMem(buf, SSE_MUL, 4, DUAL_V(top));
+            emitSseMem(buf, SSE_MUL, 1, DUAL_V(top));
+            emitSseMem(buf, SSE_MUL, 0, DUAL_D(top));
+            emitSseReg(buf, SSE_ADD, 1, 0);
+            emitSseMem(buf, SSE_MOV_STORE, 4, DUAL_V(left));
+            emitSseMem(buf, SSE_MOV_STORE, 1, DUAL_D(left));
+            depth--;
+            break;
+        case OP_DIV: // (a, a') / (b, b') = (v, (a' - vb') / b) with v = a/b
+            emitSseMem(buf, SSE_MOV_LOAD, 0, DUAL_V(left));
+            emitSseMem(buf, SSE_DIV, 0, DUAL_V(top));
+            emitSseMem(buf, SSE_MOV_LOAD, 1, DUAL_D(top));
+            emitSseReg(buf, SSE_MUL, 1, 0);
+            emitSseMem(buf, SSE_MOV_LOAD, 2, DUAL_D(left));
+            emitSseReg(buf, SSE_SUB, 2, 1);
+            emitSseMem(buf, SSE_DIV, 2, DUAL_V(top));
+            emitSseMem(buf, SSE_MOV_STORE, 0, DUAL_V(left));
+            emitSseMem(buf, SSE_MOV_STORE, 2, DUAL_D(left));
+            depth--;
+            break;
+        case OP_POW: // rdi is reloaded from DUAL_OUT at the end
+            emitArgumentAddresses(buf, DUAL_V(left), DUAL_V(top));
+            emitCallAddress(buf, (uint64_t)(uintptr_t)&powDual);
+            depth--;
+            break;
+        case OP_SQRT: // (s, a' / 2s)
+            emitSseMem(buf, SSE_SQRT, 0, DUAL_V(top));
+            emitSseMem(buf, SSE_MOV_STORE, 0, DUAL_V(top));
+            emitMovapd(buf, 1, 0);
+            emitSseReg(buf, SSE_ADD, 1, 0);
+            emitSseMem(buf, SSE_MOV_LOAD, 2, DUAL_D(top));
+            emitSseReg(buf, SSE_DIV, 2, 1);
+            emitSseMem(buf, SSE_MOV_STORE, 2, DUAL_D(top));
+            break;
+        case OP_SIN:
+            emitDualCall(buf, top, &sin, &cos, false);
+            break;
+        case OP_COS:
+            emitDualCall(buf, top, &cos, &sin, true);
+            break;
+        case OP_EXP: // (e, e * a')
+            emitSseMem(buf, SSE_MOV_LOAD, 0, DUAL_V(top));
+            emitCall(buf, &exp);
+            emitSseMem(buf, SSE_MOV_STORE, 0, DUAL_V(top));
+            emitSseMem(buf, SSE_MUL, 0, DUAL_D(top));
+            emitSseMem(buf, SSE_MOV_STORE, 0, DUAL_D(top));
+            break;
+        case OP_TAN: // (t, (1 + t*t) * a')
+            emitSseMem(buf, SSE_MOV_LOAD, 0, DUAL_V(top));
+            emitCall(buf, &tan);
+            emitSseMem(buf, SSE_MOV_STORE, 0, DUAL_V(top));
+            emitMovapd(buf, 1, 0);
+            emitSseReg(buf, SSE_MUL, 1, 0);
+            emitLoadDouble(buf, 2, 1.);
+            emitSseReg(buf, SSE_ADD, 1, 2);
+            emitSseMem(buf, SSE_MUL, 1, DUAL_D(top));
+            emitSseMem(buf, SSE_MOV_STORE, 1, DUAL_D(top));
+            break;
+        case OP_ATAN: // (atan(a), a' / (1 + a*a))
+            emitSseMem(buf, SSE_MOV_LOAD, 1, DUAL_V(top));
+            emitSseReg(buf, SSE_MUL, 1, 1);
+            emitLoadDouble(buf, 2, 1.);
+            emitSseReg(buf, SSE_ADD, 2, 1);
+            emitSseMem(buf, SSE_MOV_LOAD, 0, DUAL_D(top));
+            emitSseReg(buf, SSE_DIV, 0, 2);
+            emitSseMem(buf, SSE_MOV_STORE, 0, DUAL_D(top));
+            emitSseMem(buf, SSE_MOV_LOAD, 0, DUAL_V(top));
+            emitCall(buf, &atan);
+            emitSseMem(buf, SSE_MOV_STORE, 0, DUAL_V(top));
+            break;
+        }
+    }
+    emitBytes(buf, (unsigned char[]) { 0x48, 0x8B, 0xBD }, 3); //< mov rdi, [rbp+disp32]
+    emitBytes(buf, &(int32_t) { DUAL_OUT }, 4);
+    emitSseMem(buf, SSE_MOV_LOAD, 1, DUAL_D(0));
+    emitBytes(buf, (unsigned char[]) { 0xF2, 0x0F, 0x11, 0x0F }, 4); //< movsd [rdi], xmm1
+    emitSseMem(buf, SSE_MOV_LOAD, 0, DUAL_V(0));
+    emitEpilogue(buf);
+}
+
+static void* finalize(struct CodeBuffer* buf)
+{
+    void* fn = NULL;
+    if (!buf->failed) {
+        size_t page = (size_t)sysconf(_SC_PAGESIZE);
+        size_t size = (JIT_HEADER + buf->len + page - 1) / page * page;
+        unsigned char* mem
+            = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mem != MAP_FAILED) {
+            memcpy(mem, &size, sizeof(size));
+            memcpy(mem + JIT_HEADER, buf->data, buf->len);
+            if (mprotect(mem, size, PROT_READ | PROT_EXEC) == 0)
+                fn = mem + JIT_HEADER;
+            else
+                munmap(mem, size);
+        }
+    }
+    free(buf->data);
+    return fn;
+}
+
+// Deeper programs would need stack probes for their frame and are left to the interpreter
+static bool isCompilable(const struct Program* prog, size_t frame)
+{
+    return prog->len > 0 && prog->depth == 1 && prog->nvars <= 1 && frame <= JIT_MAX_FRAME;
+}
+
+JitFunction jitCompile(const struct Program* prog)
+{
+    if (!isCompilable(prog, valueFrame(prog)))
+        return NULL;
+    struct CodeBuffer buf = { NULL, 0, 0, false };
+    generateValue(&buf, prog);
+    return (JitFunction)finalize(&buf);
+}
+
+JitDualFunction jitCompileDual(const struct Program* prog)
+{
+    if (!isCompilable(prog, dualFrame(prog)))
+        return NULL;
+    struct CodeBuffer buf = { NULL, 0, 0, false };
+    generateDual(&buf, prog);
+    return (JitDualFunction)finalize(&buf);
+}
+
+void jitFree(void* fn)
+{
+    if (!fn)
+        return;
+    unsigned char* mem = (unsigned char*)fn - JIT_HEADER;
+    size_t size;
+    memcpy(&size, mem, sizeof(size));
+    munmap(mem, size);
+}
+
+#else
+
+JitFunction jitCompile(const struct Program* prog)
+{
+    (void)prog;
+    return NULL;
+}
+
+JitDualFunction jitCompileDual(const struct Program* prog)
+{
+    (void)prog;
+    return NULL;
+}
+
+void jitFree(void* fn) { (void)fn; }
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include "program.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef double (*JitFunction)(double x);
+typedef double (*JitDualFunction)(double x, double* dfdx);
+
+// Translates the program into x86-64 SSE2 machine code in its own executable mapping. The
+// generated functions give bit-identical results to evaluateProgram()/evaluateProgramDual().
+// Return NULL when the host is not x86-64, memory cannot be mapped or the operand stack and
+// registers need a frame larger than a page, in which case the interpreter should be used.
+JitFunction jitCompile(const struct Program* prog);
+JitDualFunction jitCompileDual(const struct Program* prog);
+void jitFree(void* fn); //< accepts either function kind, NULL is ignored
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
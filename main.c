@@ -1,16 +1,197 @@
+#include "cache.h"
+#include "jit.h"
 #include "parser.h"
+#include "polynomial.h"
+#include "program.h"
+#include "serve.h"
+#include "solver.h"
+#include "stats.h"
+#include "stream.h"
+#include "table.h"
+#include <fcntl.h>
 #include <getopt.h>
 #include <math.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
 static const char* usage()
 {
-    return "Usage: fr [--tol <tol>] [--x0 <x0>] [--maxiter <maxiter>] [--deltax <deltax>] <expr>";
+    return "Usage: fr [--stats[=json]] [--trace] <any of the forms below>\n"
+           "       fr [--tol <tol>] [--x0 <x0>] [--maxiter <maxiter>] [--jit] "
+           "[--range <a>:<b> [--starts <n>]] "
+           "[--method newton|bisect|brent|illinois|hybrid|interval|aberth|halley|householder3] "
+           "[--accuracy exact|1ulp|fast] <expr>\n"
+           "       fr [--tol <tol>] [--x0 <x0>] [--maxiter <maxiter>] [--cache <n>] "
+           "--batch [<file>|-]\n"
+           "       fr [--tol <tol>] [--x0 <x0>] [--maxiter <maxiter>] --system <expr>...\n"
+           "       fr [--tol <tol>] [--x0 <x0>] [--maxiter <maxiter>] "
+           "--param <p>=<start>:<stop>:<steps> <expr>\n"
+           "       fr [--accuracy exact|1ulp|fast] [--format text|raw|npy] "
+           "--table <a>:<b>:<n> <expr>\n"
+           "       fr [--tol <tol>] [--x0 <x0>] [--maxiter <maxiter>] [--cache <n>] "
+           "--serve <socket>";
 }
 
-static void parseArgs(int argc, char* const* argv, double* argTol, double* argX0, double* argDeltax,
-    unsigned* argNiter)
+enum StatsFormat {
+    STATS_NONE,
+    STATS_HUMAN,
+    STATS_JSON,
+};
+
+struct Options {
+    double tol;
+    double x0;
+    unsigned maxiter;
+    bool jit;
+    bool range; //< find all roots in [rangeA, rangeB] instead of one root from x0
+    double rangeA;
+    double rangeB;
+    unsigned starts; //< Newton seeds, or scan intervals for the bracketing and interval methods
+    enum SolveMethod method;
+    enum MathAccuracy accuracy; //< of the batch evaluations scanning --range and for --table
+    bool batch; //< expr is the input file (NULL or "-" for stdin) with one expression per line
+    bool system; //< exprs are the equations of a system, x0 is the start for every unknown
+    bool param; //< solve for every value of the variable paramName swept over the steps below
+    char paramName[sizeof(((struct Variable*)0)->name)];
+    double paramStart;
+    double paramStop;
+    unsigned long paramSteps;
+    bool table; //< print f at tableSteps points from tableA to tableB instead of solving
+    double tableA;
+    double tableB;
+    unsigned long tableSteps;
+    enum TableFormat format;
+    const char* socket; //< serve requests on this Unix domain socket
+    unsigned long cacheSize; //< compiled expressions kept by --batch and --serve, 0 disables
+    enum StatsFormat stats; //< printed to stderr on exit
+    bool trace; //< print every solver iteration to stderr
+    const char* expr;
+    char* const* exprs;
+    unsigned nexprs;
+};
+
+static enum SolveMethod parseMethod(const char* arg)
+{
+    const char* names[] = { "newton", "bisect", "brent", "illinois", "hybrid", "interval", "aberth",
+        "halley", "householder3" };
+    for (unsigned i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        if (strcmp(arg, names[i]) == 0)
+            return (enum SolveMethod)i;
+    }
+    fprintf(stderr,
+        "--method must be one of "
+        "newton|bisect|brent|illinois|hybrid|interval|aberth|halley|householder3. Got '%s'\n",
+        arg);
+    exit(EXIT_FAILURE);
+}
+
+static enum TableFormat parseFormat(const char* arg)
+{
+    const char* names[] = { "text", "raw", "npy" };
+    for (unsigned i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        if (strcmp(arg, names[i]) == 0)
+            return (enum TableFormat)i;
+    }
+    fprintf(stderr, "--format must be one of text|raw|npy. Got '%s'\n", arg);
+    exit(EXIT_FAILURE);
+}
+
+static enum MathAccuracy parseAccuracy(const char* arg)
+{
+    const char* names[] = { "exact", "1ulp", "fast" };
+    for (unsigned i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        if (strcmp(arg, names[i]) == 0)
+            return (enum MathAccuracy)i;
+    }
+    fprintf(stderr, "--accuracy must be one of exact|1ulp|fast. Got '%s'\n", arg);
+    exit(EXIT_FAILURE);
+}
+
+// Methods iterating from a single start, which --range spreads over the range
+static bool isOpenMethod(enum SolveMethod method)
+{
+    return method == METHOD_NEWTON || method == METHOD_HALLEY || method == METHOD_HOUSEHOLDER3;
+}
+
+// Order of the derivatives householderSolve() uses for the open methods
+static unsigned householderOrder(enum SolveMethod method)
+{
+    return method == METHOD_HALLEY ? 2 : method == METHOD_HOUSEHOLDER3 ? 3 : 1;
+}
+
+static void parseRange(const char* arg, double* a, double* b)
+{
+    char* end;
+    *a = strtod(arg, &end);
+    if (end == arg || *end != ':') {
+        fprintf(stderr, "--range must be <a>:<b>. Got '%s'\n", arg);
+        exit(EXIT_FAILURE);
+    }
+    const char* second = end + 1;
+    *b = strtod(second, &end);
+    if (end == second || *end != '\0' || !(*a < *b)) {
+        fprintf(stderr, "--range must be <a>:<b> with a < b. Got '%s'\n", arg);
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void parseParam(const char* arg, struct Options* opts)
+{
+    const char* eq = strchr(arg, '=');
+    size_t len = eq ? (size_t)(eq - arg) : 0;
+    char* end = NULL;
+    bool ok = len > 0 && len < sizeof(opts->paramName);
+    if (ok) {
+        memcpy(opts->paramName, arg, len);
+        opts->paramName[len] = '\0';
+        const char* start = eq + 1;
+        opts->paramStart = strtod(start, &end);
+        ok = end != start && *end == ':';
+    }
+    if (ok) {
+        const char* stop = end + 1;
+        opts->paramStop = strtod(stop, &end);
+        ok = end != stop && *end == ':';
+    }
+    if (ok) {
+        const char* steps = end + 1;
+        opts->paramSteps = strtoul(steps, &end, 10);
+        ok = end != steps && *end == '\0' && steps[0] != '-' && opts->paramSteps > 0;
+    }
+    if (!ok) {
+        fprintf(stderr, "--param must be <p>=<start>:<stop>:<steps> with steps > 0. Got '%s'\n",
+            arg);
+        exit(EXIT_FAILURE);
+    }
+    opts->param = true;
+}
+
+static void parseTable(const char* arg, struct Options* opts)
+{
+    char* end;
+    opts->tableA = strtod(arg, &end);
+    bool ok = end != arg && *end == ':';
+    if (ok) {
+        const char* b = end + 1;
+        opts->tableB = strtod(b, &end);
+        ok = end != b && *end == ':';
+    }
+    if (ok) {
+        const char* steps = end + 1;
+        opts->tableSteps = strtoul(steps, &end, 10);
+        ok = end != steps && *end == '\0' && steps[0] != '-' && opts->tableSteps > 0;
+    }
+    if (!ok) {
+        fprintf(stderr, "--table must be <a>:<b>:<n> with n > 0. Got '%s'\n", arg);
+        exit(EXIT_FAILURE);
+    }
+    opts->table = true;
+}
+
+static void parseArgs(int argc, char* const* argv, struct Options* opts)
 {
     if (argc < 2) {
         fprintf(stderr, "%s\n", usage());
@@ -18,7 +199,15 @@ static void parseArgs(int argc, char* const* argv, double* argTol, double* argX0
     }
     const struct option long_options[] = { { "x0", required_argument, 0, 'a' },
         { "tol", required_argument, 0, 'b' }, { "maxiter", required_argument, 0, 'c' },
-        { "deltax", required_argument, 0, 'd' }, { 0, 0, 0, 0 } };
+        { "deltax", required_argument, 0, 'd' }, { "jit", no_argument, 0, 'j' },
+        { "range", required_argument, 0, 'r' }, { "starts", required_argument, 0, 's' },
+        { "method", required_argument, 0, 'm' }, { "batch", no_argument, 0, 'B' },
+        { "system", no_argument, 0, 'S' }, { "serve", required_argument, 0, 'V' },
+        { "cache", required_argument, 0, 'C' }, { "stats", optional_argument, 0, 'T' },
+        { "trace", no_argument, 0, 'R' }, { "param", required_argument, 0, 'P' },
+        { "accuracy", required_argument, 0, 'A' }, { "table", required_argument, 0, 'L' },
+        { "format", required_argument, 0, 'F' },
+        { 0, 0, 0, 0 } };
     for (;;) {
         int option_index = 0;
         int c = getopt_long(argc, argv, "a:b:", long_options, &option_index);
@@ -26,102 +215,725 @@ static void parseArgs(int argc, char* const* argv, double* argTol, double* argX0
             break; //< all options have been parsed
         switch (c) {
         case 'a':
-            *argX0 = atof(optarg);
+            opts->x0 = atof(optarg);
             break;
         case 'b':
-            *argTol = atof(optarg);
-            if (*argTol <= 0) {
-                fprintf(stderr, "--tol must be >0. Got %f\n", *argTol);
+            opts->tol = atof(optarg);
+            if (opts->tol <= 0) {
+                fprintf(stderr, "--tol must be >0. Got %f\n", opts->tol);
                 exit(EXIT_FAILURE);
             }
             break;
         case 'c':
-            *argNiter = atol(optarg);
-            if (*argNiter <= 0) {
-                fprintf(stderr, "--maxiter must be >0. Got %d\n", *argNiter);
+            opts->maxiter = atol(optarg);
+            if (opts->maxiter <= 0) {
+                fprintf(stderr, "--maxiter must be >0. Got %d\n", opts->maxiter);
                 exit(EXIT_FAILURE);
             }
             break;
         case 'd':
-            *argDeltax = atof(optarg);
-            if (*argDeltax <= 0) {
-                fprintf(stderr, "--deltax must be >0. Got %f\n", *argDeltax);
+            // derivatives are exact now, --deltax is accepted for backward compatibility only
+            if (atof(optarg) <= 0) {
+                fprintf(stderr, "--deltax must be >0. Got %f\n", atof(optarg));
                 exit(EXIT_FAILURE);
             }
             break;
+        case 'j':
+            opts->jit = true;
+            break;
+        case 'r':
+            opts->range = true;
+            parseRange(optarg, &opts->rangeA, &opts->rangeB);
+            break;
+        case 's':
+            if (atol(optarg) <= 0) {
+                fprintf(stderr, "--starts must be >0. Got %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            opts->starts = atol(optarg);
+            break;
+        case 'm':
+            opts->method = parseMethod(optarg);
+            break;
+        case 'A':
+            opts->accuracy = parseAccuracy(optarg);
+            break;
+        case 'B':
+            opts->batch = true;
+            break;
+        case 'S':
+            opts->system = true;
+            break;
+        case 'V':
+            opts->socket = optarg;
+            break;
+        case 'C': {
+            char* end;
+            opts->cacheSize = strtoul(optarg, &end, 10);
+            if (end == optarg || *end != '\0' || optarg[0] == '-') {
+                fprintf(stderr, "--cache must be a number of expressions. Got '%s'\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        }
+        case 'T':
+            if (!optarg || strcmp(optarg, "human") == 0) {
+                opts->stats = STATS_HUMAN;
+            } else if (strcmp(optarg, "json") == 0) {
+                opts->stats = STATS_JSON;
+            } else {
+                fprintf(stderr, "--stats must be human or json. Got '%s'\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'R':
+            opts->trace = true;
+            break;
+        case 'P':
+            parseParam(optarg, opts);
+            break;
+        case 'L':
+            parseTable(optarg, opts);
+            break;
+        case 'F':
+            opts->format = parseFormat(optarg);
+            break;
         default:
             exit(EXIT_FAILURE); // getopt printed error already
         }
     }
-    if ((argc - optind) == 0) {
+    if ((argc - optind) == 0 && !opts->batch && !opts->socket) {
         fprintf(stderr, "Missing expression. %s\n", usage());
         exit(EXIT_FAILURE);
     }
-    if ((argc - optind) > 1) {
+    if ((argc - optind) > 1 && !opts->system) {
         fprintf(stderr, "Too many arguments: ");
         while (optind < argc)
             fprintf(stderr, "'%s' ", argv[optind++]);
         fprintf(stderr, "%s\n", usage());
         exit(EXIT_FAILURE);
     }
+    if (!isOpenMethod(opts->method) && opts->method != METHOD_ABERTH && !opts->range) {
+        fprintf(stderr, "Bracketing methods need --range. %s\n", usage());
+        exit(EXIT_FAILURE);
+    }
+    if (opts->system && (opts->batch || opts->range || opts->jit)) {
+        fprintf(stderr, "--system cannot be combined with --batch, --range or --jit\n");
+        exit(EXIT_FAILURE);
+    }
+    if (opts->param && (opts->batch || opts->system || opts->range || opts->socket)) {
+        fprintf(stderr, "--param cannot be combined with --batch, --system, --range or --serve\n");
+        exit(EXIT_FAILURE);
+    }
+    if (opts->table
+        && (opts->batch || opts->system || opts->range || opts->param || opts->socket)) {
+        fprintf(stderr,
+            "--table cannot be combined with --batch, --system, --range, --param or --serve\n");
+        exit(EXIT_FAILURE);
+    }
+    opts->expr = optind < argc ? argv[optind] : NULL;
+    opts->exprs = argv + optind;
+    opts->nexprs = argc - optind;
 }
 
-static void newton(const char* expr, double x0, double tol, double deltax, unsigned maxiter)
+static void checkFinite(const char* expr, double x, double f)
 {
-    for (int i = 0;; i++) {
-        struct Expression e = createExpressionWithVariable(expr, x0);
-        double f = evaluateExpression(&e);
+    if (!isfinite(f)) {
+        // slow path: re-parse to report the offending token (e.g. division by zero)
+        struct Expression e = createExpressionWithVariable(expr, x);
+        evaluateExpression(&e);
         if (e.result != RES_OK) {
             printParsingError(&e);
             exit(EXIT_FAILURE);
         }
-        if (!hasVariable(&e)) {
-            // program used as a calculator
-            fprintf(stdout, "%f\n", f);
-            exit(EXIT_SUCCESS);
+    }
+}
+
+static double evaluateJitObjective(const void* ctx, double x, double* dfdx)
+{
+    const JitDualFunction* f = ctx;
+    return (*f)(x, dfdx);
+}
+
+#define STATS_MAX_EVENTS 4096 //< iterations kept for the --stats report, later ones are counted
+#define STATS_THREAD_EVENTS 64 //< iterations buffered by each thread before taking the lock
+
+// Collected for --stats and --trace and reported at exit, which ends every path of the program
+static struct {
+    struct StatsSink sink;
+    enum StatsFormat format;
+    bool trace;
+    uint64_t start;
+    pthread_mutex_t lock; //< the multi-start solvers report iterations concurrently
+    pthread_key_t buffer; //< struct EventBuffer of the thread, flushed when it exits
+    struct EventBuffer* buffers; //< of all threads, for the pool threads that never exit
+    struct TraceEvent events[STATS_MAX_EVENTS];
+    size_t nevents; //< the ones that did not fit are counted by sink.iterations
+    bool hasCache;
+    struct ExprCacheStats cache;
+} report;
+
+struct EventBuffer {
+    struct TraceEvent events[STATS_THREAD_EVENTS];
+    size_t len;
+    struct EventBuffer* next;
+};
+
+// With report.lock held
+static void flushEventsLocked(struct EventBuffer* buf)
+{
+    size_t n = STATS_MAX_EVENTS - report.nevents;
+    if (n > buf->len)
+        n = buf->len;
+    memcpy(report.events + report.nevents, buf->events, n * sizeof(*buf->events));
+    __atomic_store_n(&report.nevents, report.nevents + n, __ATOMIC_RELAXED);
+    buf->len = 0;
+}
+
+static void flushEvents(struct EventBuffer* buf)
+{
+    pthread_mutex_lock(&report.lock);
+    flushEventsLocked(buf);
+    pthread_mutex_unlock(&report.lock);
+}
+
+static void freeEventBuffer(void* buf)
+{
+    pthread_mutex_lock(&report.lock);
+    flushEventsLocked(buf);
+    struct EventBuffer** p = &report.buffers;
+    while (*p != buf)
+        p = &(*p)->next;
+    *p = (*p)->next;
+    pthread_mutex_unlock(&report.lock);
+    free(buf);
+}
+
+static void recordIteration(void* ctx, const struct TraceEvent* event)
+{
+    (void)ctx;
+    if (report.trace) { //< one call, so the lines of concurrent solvers do not interleave
+        fprintf(stderr, "trace %s iteration=%u x=%.17g f=%.17g step=%.17g\n", event->solver,
+            event->iteration, event->x, event->f, event->step);
+    }
+    if (report.format == STATS_NONE
+        || __atomic_load_n(&report.nevents, __ATOMIC_RELAXED) == STATS_MAX_EVENTS)
+        return; //< the common case of long runs only counts
+    struct EventBuffer* buf = pthread_getspecific(report.buffer);
+    if (!buf) {
+        buf = calloc(1, sizeof(*buf));
+        if (!buf || pthread_setspecific(report.buffer, buf) != 0) {
+            free(buf);
+            return;
+        }
+        pthread_mutex_lock(&report.lock);
+        buf->next = report.buffers;
+        report.buffers = buf;
+        pthread_mutex_unlock(&report.lock);
+    }
+    buf->events[buf->len++] = *event;
+    if (buf->len == STATS_THREAD_EVENTS)
+        flushEvents(buf);
+}
+
+static void recordCacheStats(struct ExprCache* cache)
+{
+    if (cache) {
+        report.hasCache = true;
+        report.cache = exprCacheStats(cache);
+    }
+}
+
+static double millis(uint64_t nanos) { return nanos / 1e6; }
+
+// JSON has no inf or NaN
+static void printJsonNumber(FILE* out, double x)
+{
+    if (isfinite(x))
+        fprintf(out, "%.17g", x);
+    else
+        fprintf(out, "null");
+}
+
+static void printStatsJson(FILE* out, const struct StatsSink* s, uint64_t wall)
+{
+    fprintf(out,
+        "{\"parse_ms\":%.6f,\"tokens\":%llu,\"evals\":%llu,\"interval_evals\":%llu,"
+        "\"iterations\":%llu,\"wall_ms\":%.6f",
+        millis(s->parseNanos), (unsigned long long)s->tokens, (unsigned long long)s->evals,
+        (unsigned long long)s->intervalEvals, (unsigned long long)s->iterations, millis(wall));
+    if (report.hasCache) {
+        fprintf(out,
+            ",\"cache\":{\"hits\":%llu,\"misses\":%llu,\"evictions\":%llu,\"entries\":%zu}",
+            (unsigned long long)report.cache.hits, (unsigned long long)report.cache.misses,
+            (unsigned long long)report.cache.evictions, report.cache.entries);
+    }
+    size_t kept = report.nevents;
+    fprintf(out, ",\"trace\":[");
+    for (size_t i = 0; i < kept; i++) {
+        const struct TraceEvent* e = &report.events[i];
+        fprintf(out, "%s{\"solver\":\"%s\",\"iteration\":%u,\"x\":", i ? "," : "", e->solver,
+            e->iteration);
+        printJsonNumber(out, e->x);
+        fprintf(out, ",\"f\":");
+        printJsonNumber(out, e->f);
+        fprintf(out, ",\"step\":");
+        printJsonNumber(out, e->step);
+        fprintf(out, "}");
+    }
+    fprintf(out, "],\"trace_dropped\":%llu}\n", (unsigned long long)(s->iterations - kept));
+}
+
+static void printStatsHuman(FILE* out, const struct StatsSink* s, uint64_t wall)
+{
+    fprintf(out, "parse time:     %.3f ms\n", millis(s->parseNanos));
+    fprintf(out, "tokens lexed:   %llu\n", (unsigned long long)s->tokens);
+    fprintf(out, "evaluations:    %llu point, %llu interval\n", (unsigned long long)s->evals,
+        (unsigned long long)s->intervalEvals);
+    fprintf(out, "iterations:     %llu\n", (unsigned long long)s->iterations);
+    fprintf(out, "wall time:      %.3f ms\n", millis(wall));
+    if (report.hasCache) {
+        fprintf(out, "cache:          %llu hits, %llu misses, %llu evictions, %zu entries\n",
+            (unsigned long long)report.cache.hits, (unsigned long long)report.cache.misses,
+            (unsigned long long)report.cache.evictions, report.cache.entries);
+    }
+    size_t kept = report.nevents;
+    if (kept > 0)
+        fprintf(out, "%-8s %9s %24s %24s %24s\n", "solver", "iteration", "x", "|f|", "step");
+    for (size_t i = 0; i < kept; i++) {
+        const struct TraceEvent* e = &report.events[i];
+        fprintf(out, "%-8s %9u %24.17g %24.17g %24.17g\n", e->solver, e->iteration, e->x,
+            fabs(e->f), e->step);
+    }
+    if (s->iterations > kept)
+        fprintf(out, "... %llu more iterations\n", (unsigned long long)(s->iterations - kept));
+}
+
+static void printStats(void)
+{
+    uint64_t wall = monotonicNanos() - report.start;
+    // only this thread's pointer is cleared; by the time exit() runs this, worker threads have
+    // been joined or, for the resident ones of parallelFor(), are parked without a sink
+    setStatsSink(NULL);
+    struct StatsSink s = report.sink;
+    pthread_mutex_lock(&report.lock);
+    for (struct EventBuffer* buf = report.buffers; buf; buf = buf->next)
+        flushEventsLocked(buf); //< the threads that exited flushed and unlinked theirs
+    if (report.format == STATS_JSON)
+        printStatsJson(stderr, &s, wall);
+    else
+        printStatsHuman(stderr, &s, wall);
+    pthread_mutex_unlock(&report.lock);
+}
+
+static void startStats(const struct Options* opts)
+{
+    report.format = opts->stats;
+    report.trace = opts->trace;
+    report.start = monotonicNanos();
+    pthread_mutex_init(&report.lock, NULL);
+    if (report.format != STATS_NONE && pthread_key_create(&report.buffer, freeEventBuffer) != 0)
+        report.format = STATS_NONE; //< no report rather than one missing iterations
+    report.sink.trace = recordIteration;
+    setStatsSink(&report.sink);
+    if (report.format != STATS_NONE)
+        atexit(printStats);
+}
+
+// NULL if the cache is disabled
+static struct ExprCache* createCache(const struct Options* opts)
+{
+    if (opts->cacheSize == 0)
+        return NULL;
+    struct ExprCache* cache = createExprCache(opts->cacheSize);
+    if (!cache) {
+        fprintf(stderr, "Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    return cache;
+}
+
+static void solveBatch(const struct Options* opts)
+{
+    int fd = STDIN_FILENO; //< mapped as well when redirected from a file
+    if (opts->expr && strcmp(opts->expr, "-") != 0) {
+        fd = open(opts->expr, O_RDONLY);
+        if (fd < 0) {
+            perror(opts->expr);
+            exit(EXIT_FAILURE);
+        }
+    }
+    struct StreamOptions sopts = { opts->x0, opts->tol, opts->maxiter, 0, createCache(opts) };
+    long failures = solveMappedStream(fd, stdout, &sopts);
+    recordCacheStats(sopts.cache);
+    freeExprCache(sopts.cache);
+    if (fd != STDIN_FILENO)
+        close(fd);
+    if (failures < 0) {
+        fprintf(stderr, "Batch processing failed\n");
+        exit(EXIT_FAILURE);
+    }
+    exit(failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+static void runServer(const struct Options* opts)
+{
+    struct ServeOptions sopts = { opts->x0, opts->tol, opts->maxiter, 0, createCache(opts) };
+    int rc = serve(opts->socket, &sopts);
+    recordCacheStats(sopts.cache);
+    freeExprCache(sopts.cache);
+    if (rc != 0) {
+        perror(opts->socket);
+        exit(EXIT_FAILURE);
+    }
+    exit(EXIT_SUCCESS);
+}
+
+// Re-parses every equation at x to report the offending token of a non-finite system
+static void checkSystemFinite(
+    const struct Options* opts, struct SymbolTable* symbols, const double* x)
+{
+    for (unsigned i = 0; i < symbols->count; i++)
+        symbols->vars[i].value = x[i];
+    for (unsigned i = 0; i < opts->nexprs; i++) {
+        struct Expression e = createExpressionWithSymbols(opts->exprs[i], symbols, 0.);
+        evaluateExpression(&e);
+        if (e.result != RES_OK) {
+            printParsingError(&e);
+            exit(EXIT_FAILURE);
         }
-        // program used as a root finder
-        double absErr = fabs(f);
-        if (absErr <= tol) {
-            fprintf(stdout, "%s = %f\n", e.var.name, x0);
-            exit(EXIT_SUCCESS);
+    }
+}
+
+static void printSystemPoint(FILE* out, const struct SymbolTable* symbols, const double* x)
+{
+    for (unsigned i = 0; i < symbols->count; i++)
+        fprintf(out, "%s%s=%f", i ? ", " : "", symbols->vars[i].name, x[i]);
+}
+
+static void solveSystem(const struct Options* opts)
+{
+    unsigned n = opts->nexprs;
+    struct SymbolTable symbols;
+    symbols.count = 0;
+    struct Program* eqs = malloc(n * sizeof(*eqs));
+    if (!eqs) {
+        fprintf(stderr, "Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    for (unsigned i = 0; i < n; i++) {
+        eqs[i] = createProgram();
+        struct Expression e = compileExpressionWithSymbols(opts->exprs[i], &eqs[i], &symbols);
+        if (e.result != RES_OK) {
+            printParsingError(&e);
+            exit(EXIT_FAILURE);
         }
-        if (i == maxiter) {
-            fprintf(stderr, "Failed to converge after %d iterations. |f(%s=%f)| = %f > %f\n",
-                maxiter, e.var.name, x0, absErr, tol);
+        optimizeProgram(&eqs[i]);
+    }
+    if (symbols.count != n) {
+        fprintf(stderr, "The system has %u equations in %u unknowns\n", n, symbols.count);
+        exit(EXIT_FAILURE);
+    }
+    double x[MAX_VARIABLES];
+    for (unsigned i = 0; i < n; i++)
+        x[i] = opts->x0;
+    struct SystemResult r;
+    if (!newtonSystemSolve(programSystemObjective(eqs, n), x, opts->tol, opts->maxiter, &r)) {
+        fprintf(stderr, "Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    switch (r.status) {
+    case SOLVE_OK:
+        for (unsigned i = 0; i < n; i++)
+            fprintf(stdout, "%s = %f\n", symbols.vars[i].name, x[i]);
+        exit(EXIT_SUCCESS);
+    case SOLVE_NOT_FINITE:
+        checkSystemFinite(opts, &symbols, x);
+        fprintf(stderr, "System is not finite at ");
+        break;
+    case SOLVE_ZERO_DERIVATIVE:
+        fprintf(stderr, "Newton algorithm resulted in a singular Jacobian at ");
+        break;
+    default:
+        fprintf(stderr, "Failed to converge after %d iterations. max |f| = %f > %f at ",
+            opts->maxiter, r.residual, opts->tol);
+        break;
+    }
+    printSystemPoint(stderr, &symbols, x);
+    fprintf(stderr, "\n");
+    exit(EXIT_FAILURE);
+}
+
+// Solves the expression for its other variable at every step of the --param sweep. The program
+// is compiled once with the parameter as a second variable.
+static void solveSweep(const struct Options* opts)
+{
+    struct SymbolTable symbols;
+    symbols.count = 0;
+    struct Program prog = createProgram();
+    struct Expression e = compileExpressionWithSymbols(opts->expr, &prog, &symbols);
+    if (e.result != RES_OK) {
+        printParsingError(&e);
+        exit(EXIT_FAILURE);
+    }
+    struct ParameterizedProgram family = { &prog, symbols.count, symbols.count };
+    for (unsigned i = 0; i < symbols.count; i++) {
+        if (strcmp(symbols.vars[i].name, opts->paramName) == 0)
+            family.p = i;
+        else
+            family.x = i;
+    }
+    if (symbols.count > 2 || family.x == symbols.count) {
+        fprintf(stderr, "--param needs an expression of one unknown besides %s\n",
+            opts->paramName);
+        exit(EXIT_FAILURE);
+    }
+    if (family.p == symbols.count) {
+        if (symbols.count > 1) {
+            fprintf(stderr, "--param %s is not a variable of the expression\n", opts->paramName);
             exit(EXIT_FAILURE);
         }
-        // compute central derivative
-        struct Expression e2 = createExpressionWithVariable(expr, x0 + deltax);
-        struct Expression e1 = createExpressionWithVariable(expr, x0 - deltax);
-        double f2 = evaluateExpression(&e2);
-        if (e2.result != RES_OK) {
-            printParsingError(&e2);
+        family.p = 1 - family.x; //< f of its single variable does not depend on the parameter
+    }
+    optimizeProgram(&prog);
+    size_t steps = opts->paramSteps;
+    struct SolveResult* results = malloc(steps * sizeof(*results));
+    if (!results
+        || !continuationSolve(programFamilyObjective(&family), opts->x0, opts->paramStart,
+            opts->paramStop, steps, opts->tol, opts->maxiter, 0, results)) {
+        fprintf(stderr, "Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    const char* x = symbols.vars[family.x].name;
+    size_t failures = 0;
+    for (size_t i = 0; i < steps; i++) {
+        double p = steps > 1
+            ? opts->paramStart + (opts->paramStop - opts->paramStart) * ((double)i / (steps - 1))
+            : opts->paramStart;
+        const struct SolveResult* r = &results[i];
+        switch (r->status) {
+        case SOLVE_OK:
+            fprintf(stdout, "%s = %f, %s = %f\n", opts->paramName, p, x, r->x);
+            continue;
+        case SOLVE_NOT_FINITE:
+            fprintf(stdout, "%s = %f, error: f(%s=%f) = %f is not finite\n", opts->paramName, p,
+                x, r->x, r->f);
+            break;
+        case SOLVE_ZERO_DERIVATIVE:
+            fprintf(stdout, "%s = %f, error: f'(%s=%f) = 0\n", opts->paramName, p, x, r->x);
+            break;
+        default:
+            fprintf(stdout, "%s = %f, error: failed to converge after %u iterations, "
+                            "|f(%s=%f)| = %f\n",
+                opts->paramName, p, r->iterations, x, r->x, fabs(r->f));
+            break;
+        }
+        failures++;
+    }
+    exit(failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+// Prints f over the --table grid; an expression without a variable gives a constant column
+static void tabulate(const struct Options* opts)
+{
+    struct Program prog = createProgram();
+    struct Expression e = compileExpression(opts->expr, &prog);
+    if (e.result != RES_OK) {
+        printParsingError(&e);
+        exit(EXIT_FAILURE);
+    }
+    optimizeProgram(&prog);
+    prog.accuracy = opts->accuracy;
+    struct TableOptions table = { opts->tableA, opts->tableB, opts->tableSteps, opts->format, 0 };
+    if (!writeTable(&prog, &table, stdout)) {
+        fprintf(stderr, "Failed to write the table\n");
+        exit(EXIT_FAILURE);
+    }
+    exit(EXIT_SUCCESS);
+}
+
+// Prints every complex root of a polynomial, repeated by multiplicity, or only its distinct real
+// roots in the range with --range
+static void solvePolynomial(
+    const struct Options* opts, const struct Program* prog, const struct Expression* e)
+{
+    struct Polynomial p;
+    if (!expandPolynomial(prog, &p)) {
+        fprintf(stderr, "--method aberth needs a polynomial in %s of degree 1 to %d\n",
+            e->var.name, POLYNOMIAL_MAX_DEGREE);
+        exit(EXIT_FAILURE);
+    }
+    if (p.degree == 0) {
+        fprintf(stderr, "The polynomial is constant\n");
+        exit(EXIT_FAILURE);
+    }
+    struct Complex* roots = malloc(p.degree * sizeof(*roots));
+    double* xs = malloc(p.degree * sizeof(*xs));
+    if (!roots || !xs) {
+        fprintf(stderr, "Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    unsigned iterations;
+    if (aberthSolve(&p, opts->maxiter, true, roots, &iterations) != SOLVE_OK) {
+        fprintf(stderr, "Failed to converge after %d iterations\n", opts->maxiter);
+        exit(EXIT_FAILURE);
+    }
+    if (opts->range) {
+        size_t n = selectRealRoots(&p, roots, p.degree, opts->rangeA, opts->rangeB, opts->tol, xs);
+        if (n == 0) {
+            fprintf(stderr, "No roots found in [%f, %f]\n", opts->rangeA, opts->rangeB);
             exit(EXIT_FAILURE);
         }
-        double f1 = evaluateExpression(&e1);
-        if (e1.result != RES_OK) {
-            printParsingError(&e1);
+        for (size_t i = 0; i < n; i++)
+            fprintf(stdout, "%s = %f\n", e->var.name, xs[i]);
+        exit(EXIT_SUCCESS);
+    }
+    for (unsigned k = 0; k < p.degree; k++) {
+        if (isRealRoot(&p, roots[k], opts->tol)) {
+            fprintf(stdout, "%s = %f\n", e->var.name, roots[k].re);
+        } else {
+            fprintf(stdout, "%s = %f %c %fi\n", e->var.name, roots[k].re,
+                roots[k].im < 0 ? '-' : '+', fabs(roots[k].im));
+        }
+    }
+    exit(EXIT_SUCCESS);
+}
+
+static void solve(const struct Options* opts)
+{
+    const char* expr = opts->expr;
+    struct Program prog = createProgram();
+    struct Expression e = compileExpression(expr, &prog);
+    if (e.result != RES_OK) {
+        printParsingError(&e);
+        exit(EXIT_FAILURE);
+    }
+    if (!hasVariable(&e)) {
+        // program used as a calculator
+        double f = evaluateProgram(&prog, 0.);
+        checkFinite(expr, 0., f);
+        fprintf(stdout, "%f\n", f);
+        exit(EXIT_SUCCESS);
+    }
+    // program used as a root finder, worth optimizing since it is evaluated many times
+    optimizeProgram(&prog); //< the unoptimized program is still valid if this fails
+    prog.accuracy = opts->accuracy;
+    if (opts->method == METHOD_ABERTH)
+        solvePolynomial(opts, &prog, &e);
+    struct Objective objective = programObjective(&prog);
+    // NULL if the host has no JIT; interval and higher-order evaluation always run on the program
+    bool dual = opts->method != METHOD_INTERVAL && householderOrder(opts->method) == 1;
+    JitDualFunction jit = opts->jit && dual ? jitCompileDual(&prog) : NULL;
+    if (jit) {
+        objective.eval = evaluateJitObjective;
+        objective.evalBatch = NULL;
+        objective.ctx = &jit;
+        objective.evalInterval = NULL;
+        objective.evalDerivatives = NULL;
+    }
+    if (opts->range) {
+        size_t cap = (size_t)opts->starts + 1;
+        double* roots = malloc(cap * sizeof(*roots));
+        size_t nroots = 0;
+        bool ok = roots != NULL;
+        if (ok && opts->method == METHOD_NEWTON) {
+            ok = newtonMultiStart(objective, opts->rangeA, opts->rangeB, opts->starts, opts->tol,
+                opts->maxiter, 0, roots, &nroots);
+        } else if (ok && isOpenMethod(opts->method)) {
+            ok = householderMultiStart(objective, householderOrder(opts->method), opts->rangeA,
+                opts->rangeB, opts->starts, opts->tol, opts->maxiter, 0, roots, &nroots);
+        } else if (ok && opts->method == METHOD_INTERVAL) {
+            free(roots); //< the search sizes its own list, there may be more roots than seeds
+            ok = intervalMultiSolve(objective, opts->rangeA, opts->rangeB, opts->starts,
+                opts->tol, opts->maxiter, 0, &roots, &nroots);
+        } else if (ok) {
+            ok = bracketMultiSolve(objective, opts->method, opts->rangeA, opts->rangeB,
+                opts->starts, opts->tol, opts->maxiter, 0, roots, &nroots);
+        }
+        if (!ok) {
+            fprintf(stderr, "Out of memory\n");
             exit(EXIT_FAILURE);
         }
-        double fprime = (f2 - f1) / (2. * deltax);
-        if (fprime == 0) {
-            fprintf(stderr,
-                "Newton algorithm resulted in division by zero: f(%s=%f)=%f - f(%s=%f)=%f = 0\n",
-                e.var.name, x0 + deltax, f2, e.var.name, x0 - deltax, f1);
+        if (nroots == 0) {
+            fprintf(stderr, "No roots found in [%f, %f]\n", opts->rangeA, opts->rangeB);
             exit(EXIT_FAILURE);
         }
-        x0 -= f / fprime;
+        for (size_t i = 0; i < nroots; i++)
+            fprintf(stdout, "%s = %f\n", e.var.name, roots[i]);
+        exit(EXIT_SUCCESS);
+    }
+    struct SolveResult r = opts->method == METHOD_NEWTON
+        ? newtonSolve(objective, opts->x0, opts->tol, opts->maxiter)
+        : householderSolve(objective, householderOrder(opts->method), opts->x0, opts->tol,
+            opts->maxiter);
+    switch (r.status) {
+    case SOLVE_OK:
+        fprintf(stdout, "%s = %f\n", e.var.name, r.x);
+        exit(EXIT_SUCCESS);
+    case SOLVE_NOT_FINITE:
+        checkFinite(expr, r.x, r.f);
+        fprintf(stderr, "f(%s=%f) = %f is not finite\n", e.var.name, r.x, r.f);
+        break;
+    case SOLVE_MAXITER:
+        fprintf(stderr, "Failed to converge after %d iterations. |f(%s=%f)| = %f > %f\n",
+            opts->maxiter, e.var.name, r.x, fabs(r.f), opts->tol);
+        break;
+    case SOLVE_ZERO_DERIVATIVE:
+        fprintf(stderr, "Newton algorithm resulted in division by zero: f'(%s=%f) = 0\n",
+            e.var.name, r.x);
+        break;
+    default:
+        fprintf(stderr, "Solver failed at %s=%f\n", e.var.name, r.x); //< bracketing statuses
+        break;
     }
+    exit(EXIT_FAILURE);
 }
 
 int main(int argc, char* const* argv)
 {
-    double tol = 1e-5;
-    double deltax = 1e-5; // for derivative calculation
-    double x0 = 0.;
-    unsigned maxiter = 50;
-    parseArgs(argc, argv, &tol, &x0, &deltax, &maxiter);
-    newton(argv[optind], x0, tol, deltax, maxiter);
+    struct Options opts;
+    opts.tol = 1e-5;
+    opts.x0 = 0.;
+    opts.maxiter = 50;
+    opts.jit = false;
+    opts.range = false;
+    opts.rangeA = 0.;
+    opts.rangeB = 0.;
+    opts.starts = 64;
+    opts.method = METHOD_NEWTON;
+    opts.accuracy = ACCURACY_EXACT;
+    opts.batch = false;
+    opts.system = false;
+    opts.param = false;
+    opts.paramName[0] = '\0';
+    opts.paramStart = 0.;
+    opts.paramStop = 0.;
+    opts.paramSteps = 0;
+    opts.table = false;
+    opts.tableA = 0.;
+    opts.tableB = 0.;
+    opts.tableSteps = 0;
+    opts.format = TABLE_TEXT;
+    opts.socket = NULL;
+    opts.cacheSize = 4096;
+    opts.stats = STATS_NONE;
+    opts.trace = false;
+    opts.expr = NULL;
+    opts.exprs = NULL;
+    opts.nexprs = 0;
+    parseArgs(argc, argv, &opts);
+    if (opts.stats != STATS_NONE || opts.trace)
+        startStats(&opts);
+    if (opts.socket)
+        runServer(&opts);
+    if (opts.batch)
+        solveBatch(&opts);
+    if (opts.system)
+        solveSystem(&opts);
+    if (opts.param)
+        solveSweep(&opts);
+    if (opts.table)
+        tabulate(&opts);
+    solve(&opts);
     return EXIT_SUCCESS;
 }
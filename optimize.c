@@ -0,0 +1,321 @@
+#include "program.h"
+#include "arena.h"
+
+#include <limits.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The tape is replayed symbolically into a DAG whose nodes are hash-consed: creating a node that
+// already exists returns the existing one, so repeated subexpressions collapse into a single
+// node. Operands are always created before the nodes using them, which keeps the node array in
+// topological order and lets every pass below run as a plain loop.
+
+#define NO_NODE UINT_MAX
+
+struct Node {
+    enum OpCode op; //< never OP_LOAD or OP_STORE
+    unsigned a; //< operands, NO_NODE when unused
+    unsigned b;
+    double value; //< constant of OP_CONST, slot of OP_VAR
+};
+
+struct Dag {
+    struct Node* nodes;
+    unsigned len;
+    unsigned* table; //< open addressing hash table of node indices
+    unsigned mask;
+};
+
+static bool isBinary(enum OpCode op)
+{
+    return op == OP_ADD || op == OP_SUB || op == OP_MUL || op == OP_DIV || op == OP_POW;
+}
+
+static uint64_t valueBits(double value)
+{
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+static unsigned hashNode(enum OpCode op, unsigned a, unsigned b, double value)
+{
+    uint64_t h = ((uint64_t)op * 0x9E3779B97F4A7C15ull) ^ valueBits(value);
+    h = (h ^ a) * 0xFF51AFD7ED558CCDull;
+    h = (h ^ b) * 0xC4CEB9FE1A85EC53ull;
+    return (unsigned)(h ^ (h >> 32));
+}
+
+// Returns the node for (op, a, b, value), creating it on first use. Constants compare bitwise so
+// 0 and -0 stay distinct.
+static unsigned makeNode(struct Dag* dag, enum OpCode op, unsigned a, unsigned b, double value)
+{
+    if (op != OP_CONST && op != OP_VAR)
+        value = 0.;
+    unsigned slot = hashNode(op, a, b, value) & dag->mask;
+    for (; dag->table[slot] != NO_NODE; slot = (slot + 1) & dag->mask) {
+        const struct Node* n = &dag->nodes[dag->table[slot]];
+        if (n->op == op && n->a == a && n->b == b && valueBits(n->value) == valueBits(value))
+            return dag->table[slot];
+    }
+    struct Node* n = &dag->nodes[dag->len];
+    n->op = op;
+    n->a = a;
+    n->b = b;
+    n->value = value;
+    dag->table[slot] = dag->len;
+    return dag->len++;
+}
+
+static bool isConstant(const struct Dag* dag, unsigned n, double value)
+{
+    return dag->nodes[n].op == OP_CONST && dag->nodes[n].value == value;
+}
+
+// Same operations as evaluateProgram() so folded constants are bit-identical
+static double applyUnary(enum OpCode op, double a)
+{
+    switch (op) {
+    case OP_NEG:
+        return -a;
+    case OP_SIN:
+        return sin(a);
+    case OP_COS:
+        return cos(a);
+    case OP_TAN:
+        return tan(a);
+    case OP_ATAN:
+        return atan(a);
+    case OP_EXP:
+        return exp(a);
+    default:
+        return sqrt(a);
+    }
+}
+
+static double applyBinary(enum OpCode op, double a, double b)
+{
+    switch (op) {
+    case OP_ADD:
+        return a + b;
+    case OP_SUB:
+        return a - b;
+    case OP_MUL:
+        return a * b;
+    case OP_DIV:
+        return a / b;
+    default:
+        return pow(a, b);
+    }
+}
+
+static unsigned makeUnary(struct Dag* dag, enum OpCode op, unsigned a)
+{
+    const struct Node* na = &dag->nodes[a];
+    if (na->op == OP_CONST)
+        return makeNode(dag, OP_CONST, NO_NODE, NO_NODE, applyUnary(op, na->value));
+    if (op == OP_NEG && na->op == OP_NEG)
+        return na->a; //< -(-x)
+    return makeNode(dag, op, a, NO_NODE, 0.);
+}
+
+// Only rewrites that give the same bits for every input, the exception being x + 0 which turns
+// -0 into +0. In particular 0*x, x-x and x/x are kept since they differ for infinities and NaN.
+static unsigned makeBinary(struct Dag* dag, enum OpCode op, unsigned a, unsigned b)
+{
+    const struct Node* na = &dag->nodes[a];
+    const struct Node* nb = &dag->nodes[b];
+    if (na->op == OP_CONST && nb->op == OP_CONST && !(op == OP_DIV && nb->value == 0.))
+        return makeNode(dag, OP_CONST, NO_NODE, NO_NODE, applyBinary(op, na->value, nb->value));
+    switch (op) {
+    case OP_ADD:
+        if (isConstant(dag, b, 0.))
+            return a;
+        if (isConstant(dag, a, 0.))
+            return b;
+        if (nb->op == OP_NEG)
+            return makeBinary(dag, OP_SUB, a, nb->a); //< x + (-y) = x - y
+        if (na->op == OP_NEG)
+            return makeBinary(dag, OP_SUB, b, na->a); //< (-x) + y = y - x
+        break;
+    case OP_SUB:
+        if (isConstant(dag, b, 0.))
+            return a;
+        if (nb->op == OP_NEG)
+            return makeBinary(dag, OP_ADD, a, nb->a); //< x - (-y) = x + y
+        break;
+    case OP_MUL:
+        if (isConstant(dag, b, 1.))
+            return a;
+        if (isConstant(dag, a, 1.))
+            return b;
+        if (isConstant(dag, b, -1.))
+            return makeUnary(dag, OP_NEG, a);
+        if (isConstant(dag, a, -1.))
+            return makeUnary(dag, OP_NEG, b);
+        if (na->op == OP_NEG && nb->op == OP_NEG)
+            return makeBinary(dag, OP_MUL, na->a, nb->a);
+        break;
+    case OP_DIV:
+        if (isConstant(dag, b, 1.))
+            return a;
+        if (isConstant(dag, b, -1.))
+            return makeUnary(dag, OP_NEG, a);
+        if (na->op == OP_NEG && nb->op == OP_NEG)
+            return makeBinary(dag, OP_DIV, na->a, nb->a);
+        break;
+    default:
+        if (isConstant(dag, b, 1.))
+            return a; //< pow(x, 1) is x, NaN included
+        break;
+    }
+    if ((op == OP_ADD || op == OP_MUL) && a > b) { //< canonical order lets b+a share a+b
+        unsigned t = a;
+        a = b;
+        b = t;
+    }
+    return makeNode(dag, op, a, b, 0.);
+}
+
+// Replays the tape on a stack of node indices, returns the root or NO_NODE for a malformed tape
+static unsigned buildDag(struct Dag* dag, const struct Program* prog, unsigned* stack,
+    unsigned* regs)
+{
+    unsigned depth = 0;
+    for (unsigned i = 0; i < prog->len; i++) {
+        const struct Instruction* ins = &prog->code[i];
+        switch (ins->op) {
+        case OP_CONST:
+            stack[depth++] = makeNode(dag, OP_CONST, NO_NODE, NO_NODE, prog->consts[ins->arg]);
+            break;
+        case OP_VAR:
+            stack[depth++] = makeNode(dag, OP_VAR, NO_NODE, NO_NODE, ins->arg);
+            break;
+        case OP_LOAD:
+            if (ins->arg >= prog->nregs || regs[ins->arg] == NO_NODE)
+                return NO_NODE;
+            stack[depth++] = regs[ins->arg];
+            break;
+        case OP_STORE:
+            if (depth < 1 || ins->arg >= prog->nregs)
+                return NO_NODE;
+            regs[ins->arg] = stack[depth - 1];
+            break;
+        default:
+            if (isBinary(ins->op)) {
+                if (depth < 2)
+                    return NO_NODE;
+                depth--;
+                stack[depth - 1] = makeBinary(dag, ins->op, stack[depth - 1], stack[depth]);
+            } else {
+                if (depth < 1)
+                    return NO_NODE;
+                stack[depth - 1] = makeUnary(dag, ins->op, stack[depth - 1]);
+            }
+            break;
+        }
+    }
+    return depth == 1 ? stack[0] : NO_NODE;
+}
+
+struct Lowering {
+    unsigned node;
+    bool expanded; //< operands already scheduled
+};
+
+// Emits the nodes reachable from root in left-to-right postfix order. Nodes used more than once
+// are computed the first time and stored into a register, later uses load it back; constants and
+// the variable are cheap enough to push again.
+static bool lowerDag(const struct Dag* dag, unsigned root, struct Program* out, unsigned* uses,
+    unsigned* slot, struct Lowering* work)
+{
+    memset(uses, 0, (root + 1) * sizeof(*uses));
+    uses[root] = 1;
+    for (unsigned n = root + 1; n-- > 0;) {
+        const struct Node* node = &dag->nodes[n];
+        if (uses[n] == 0)
+            continue;
+        if (node->a != NO_NODE)
+            uses[node->a]++;
+        if (node->b != NO_NODE)
+            uses[node->b]++;
+    }
+    for (unsigned n = 0; n <= root; n++)
+        slot[n] = NO_NODE; //< register or constant pool index, once emitted
+
+    unsigned top = 0;
+    work[top++] = (struct Lowering) { root, false };
+    while (top > 0) {
+        struct Lowering w = work[--top];
+        const struct Node* node = &dag->nodes[w.node];
+        if (!w.expanded) {
+            if (slot[w.node] != NO_NODE && node->op != OP_CONST) {
+                if (!emitInstruction(out, OP_LOAD, slot[w.node]))
+                    return false;
+                continue;
+            }
+            work[top++] = (struct Lowering) { w.node, true };
+            if (node->b != NO_NODE)
+                work[top++] = (struct Lowering) { node->b, false };
+            if (node->a != NO_NODE)
+                work[top++] = (struct Lowering) { node->a, false };
+            continue;
+        }
+        bool ok;
+        if (node->op == OP_CONST && slot[w.node] != NO_NODE) {
+            ok = emitInstruction(out, OP_CONST, slot[w.node]);
+        } else if (node->op == OP_CONST) {
+            slot[w.node] = out->nconsts;
+            ok = emitConstant(out, node->value);
+        } else {
+            ok = emitInstruction(out, node->op, node->op == OP_VAR ? (unsigned)node->value : 0);
+            if (ok && node->op != OP_VAR && uses[w.node] > 1) {
+                slot[w.node] = out->nregs++;
+                ok = emitInstruction(out, OP_STORE, slot[w.node]);
+            }
+        }
+        if (!ok)
+            return false;
+    }
+    return true;
+}
+
+bool optimizeProgram(struct Program* prog)
+{
+    if (prog->len == 0 || prog->depth != 1)
+        return false;
+    unsigned tableSize = 16;
+    while (tableSize < 2 * (size_t)prog->len)
+        tableSize *= 2;
+    // every instruction creates at most one node
+    struct Arena* arena = prog->arena; //< NULL allocates from the heap
+    struct Dag dag = { arenaOrHeapAlloc(arena, prog->len * sizeof(*dag.nodes)), 0,
+        arenaOrHeapAlloc(arena, tableSize * sizeof(*dag.table)), tableSize - 1 };
+    unsigned* scratch
+        = arenaOrHeapAlloc(arena, ((size_t)2 * prog->len + prog->nregs) * sizeof(*scratch));
+    struct Lowering* work = arenaOrHeapAlloc(arena, (2 * (size_t)prog->len + 1) * sizeof(*work));
+    struct Program out = createProgramInArena(arena);
+    bool ok = dag.nodes && dag.table && scratch && work;
+    if (ok) {
+        memset(dag.table, 0xFF, tableSize * sizeof(*dag.table));
+        unsigned* regs = scratch + 2 * (size_t)prog->len;
+        for (unsigned r = 0; r < prog->nregs; r++)
+            regs[r] = NO_NODE;
+        unsigned root = buildDag(&dag, prog, scratch, regs);
+        ok = root != NO_NODE
+            && lowerDag(&dag, root, &out, scratch, scratch + prog->len, work) && out.depth == 1;
+    }
+    arenaOrHeapFree(arena, dag.nodes);
+    arenaOrHeapFree(arena, dag.table);
+    arenaOrHeapFree(arena, scratch);
+    arenaOrHeapFree(arena, work);
+    if (!ok) {
+        freeProgram(&out);
+        return false;
+    }
+    freeProgram(prog);
+    *prog = out;
+    return true;
+}
@@ -1,15 +1,26 @@
 #include "parser.h"
+#include "arena.h"
+#include "program.h"
+#include "stats.h"
 
-#include <ctype.h>
 #include <math.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#define PARSER_STACK_SIZE 64 //< pending operators and operands kept on the C stack
+
 struct Expression createExpression(const char* expr)
+{
+    return createExpressionView(expr, (unsigned)strlen(expr));
+}
+
+struct Expression createExpressionView(const char* expr, unsigned len)
 {
     struct Expression e;
     e.expr = expr;
+    e.len = len;
     e.currIdx = 0;
     e.result = RES_OK;
     e.errIdx = 0;
@@ -18,6 +29,11 @@ struct Expression createExpression(const char* expr)
     v.value = 0;
     v.len = 0;
     e.var = v;
+    e.prog = NULL;
+    e.tokens = NULL;
+    e.ntokens = 0;
+    e.tokIdx = 0;
+    e.symbols = NULL;
     return e;
 }
 
@@ -28,40 +44,119 @@ struct Expression createExpressionWithVariable(const char* expr, double varValue
     return e;
 }
 
+struct Expression createExpressionWithSymbols(
+    const char* expr, struct SymbolTable* symbols, double varValue)
+{
+    struct Expression e = createExpressionWithVariable(expr, varValue);
+    e.symbols = symbols;
+    return e;
+}
+
 void consumeCharacters(struct Expression* expr, unsigned n) { expr->currIdx += n; }
 
 void consumeCharacter(struct Expression* expr) { consumeCharacters(expr, 1); }
 
 const char* currentHead(struct Expression* expr) { return expr->expr + expr->currIdx; }
 
-char currentCharacter(struct Expression* expr) { return expr->expr[expr->currIdx]; }
+// Character i of the expression, '\0' past its end
+static char characterAt(const struct Expression* expr, unsigned i)
+{
+    return i < expr->len ? expr->expr[i] : '\0';
+}
+
+char currentCharacter(struct Expression* expr) { return characterAt(expr, expr->currIdx); }
+
+// ASCII classification (the C locale), cheaper than <ctype.h> and safe for negative chars
+static bool isSpace(char c) { return c == ' ' || (c >= '\t' && c <= '\r'); }
+
+static bool isDigit(char c) { return c >= '0' && c <= '9'; }
+
+static bool isAlpha(char c) { return (c | 0x20) >= 'a' && (c | 0x20) <= 'z'; }
+
+static bool isAlnum(char c) { return isAlpha(c) || isDigit(c); }
 
 void consumeWhitespace(struct Expression* expr)
 {
-    while (isspace(currentCharacter(expr)))
+    while (isSpace(currentCharacter(expr)))
         consumeCharacter(expr);
 }
 
+// Appends a digit to the mantissa; digits beyond its precision only scale the exponent
+static void accumulateDigit(
+    uint64_t* mantissa, int* exp10, bool* exact, char digit, bool fractional)
+{
+    unsigned d = digit - '0';
+    if (*mantissa <= (UINT64_MAX - 9) / 10) {
+        *mantissa = *mantissa * 10 + d;
+        *exp10 -= fractional;
+        return;
+    }
+    *exact &= d == 0;
+    *exp10 += !fractional;
+}
+
 double readNonNegativeNumber(struct Expression* expr)
 {
     // note: number is non-negative!
     consumeWhitespace(expr);
-    if (!isdigit(currentCharacter(expr))) {
+    if (!isDigit(currentCharacter(expr))) {
         expr->result = RES_ERR_INTERNAL;
         expr->errIdx = expr->currIdx;
         expr->errMsg = "Not a number";
         return 0;
     }
-    double num = atof(currentHead(expr));
-    while (isdigit(currentCharacter(expr)))
-        consumeCharacter(expr);
-    // consume all digits after '.'
-    if (currentCharacter(expr) == '.') {
-        consumeCharacter(expr);
-        while (isdigit(currentCharacter(expr)))
-            consumeCharacter(expr);
+    // single pass over digits[.digits][(e|E)[+|-]digits]
+    unsigned start = expr->currIdx;
+    unsigned i = start;
+    uint64_t mantissa = 0;
+    int exp10 = 0;
+    bool exact = true;
+    for (; isDigit(characterAt(expr, i)); i++)
+        accumulateDigit(&mantissa, &exp10, &exact, expr->expr[i], false);
+    if (characterAt(expr, i) == '.') {
+        for (i++; isDigit(characterAt(expr, i)); i++)
+            accumulateDigit(&mantissa, &exp10, &exact, expr->expr[i], true);
+    }
+    char e1 = characterAt(expr, i + 1);
+    if ((characterAt(expr, i) == 'e' || characterAt(expr, i) == 'E')
+        && (isDigit(e1) || ((e1 == '+' || e1 == '-') && isDigit(characterAt(expr, i + 2))))) {
+        bool negative = e1 == '-';
+        i += isDigit(e1) ? 1 : 2;
+        int e = 0;
+        for (; isDigit(characterAt(expr, i)); i++) {
+            if (e < 100000)
+                e = e * 10 + (expr->expr[i] - '0');
+        }
+        exp10 += negative ? -e : e;
+    }
+    consumeCharacters(expr, i - start);
+
+    // Both the mantissa and the power of ten are exact doubles, so a single multiplication or
+    // division is correctly rounded (Clinger's fast path). Everything else goes to strtod().
+    static const double powersOf10[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+        1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+    if (mantissa == 0)
+        return 0.;
+    if (exact && mantissa <= (1ull << 53) && exp10 >= -22 && exp10 <= 22) {
+        double m = (double)mantissa;
+        return exp10 < 0 ? m / powersOf10[-exp10] : m * powersOf10[exp10];
+    }
+    // strtod() needs a terminator and may look ahead of the number, so it reads a copy
+    char buf[64];
+    unsigned len = i - start;
+    char* copy = len < sizeof(buf) ? buf : malloc(len + 1);
+    if (!copy) {
+        expr->result = RES_ERR_INTERNAL;
+        expr->errIdx = start;
+        expr->errMsg = "Out of memory";
+        return 0;
     }
-    return num;
+    memcpy(copy, expr->expr + start, len);
+    copy[len] = '\0';
+    double value = strtod(copy, NULL);
+    if (copy != buf)
+        free(copy);
+    return value;
 }
 
 bool hasVariable(struct Expression* expr) { return expr->var.len > 0; }
@@ -69,7 +164,11 @@ bool hasVariable(struct Expression* expr) { return expr->var.len > 0; }
 void readVariable(struct Expression* expr)
 {
     if (hasVariable(expr)) {
-        if (strncmp(currentHead(expr), expr->var.name, expr->var.len) != 0) {
+        unsigned matched = 0;
+        while (matched < expr->var.len
+            && characterAt(expr, expr->currIdx + matched) == expr->var.name[matched])
+            matched++;
+        if (matched < expr->var.len) {
             expr->result = RES_ERR_MULTIPLE_VARIABLES;
             expr->errIdx = expr->currIdx;
             expr->errMsg = "Multiple variables not allowed";
@@ -79,8 +178,10 @@ void readVariable(struct Expression* expr)
         return;
     }
     size_t varLen = 0;
-    while (isalnum(currentCharacter(expr))) {
-        expr->var.name[varLen++] = currentCharacter(expr);
+    while (isAlnum(currentCharacter(expr))) {
+        if (varLen < sizeof(expr->var.name))
+            expr->var.name[varLen] = currentCharacter(expr);
+        varLen++;
         consumeCharacter(expr);
     }
     if (varLen >= sizeof(expr->var.name)) {
@@ -93,84 +194,231 @@ void readVariable(struct Expression* expr)
     expr->var.len = varLen;
 }
 
+// Returns the symbol table slot of the variable at the head, adding it if the name is new
+static unsigned readSymbol(struct Expression* expr)
+{
+    const char* name = currentHead(expr);
+    unsigned len = 0;
+    while (isAlnum(characterAt(expr, expr->currIdx + len)))
+        len++;
+    unsigned start = expr->currIdx;
+    consumeCharacters(expr, len);
+    if (len >= sizeof(expr->var.name)) {
+        expr->result = RES_ERR_VAR_TOO_LONG;
+        expr->errIdx = expr->currIdx;
+        expr->errMsg = "Variable name too long";
+        return 0;
+    }
+    struct SymbolTable* symbols = expr->symbols;
+    for (unsigned i = 0; i < symbols->count; i++) {
+        if (symbols->vars[i].len == len && memcmp(symbols->vars[i].name, name, len) == 0)
+            return i;
+    }
+    if (symbols->count == MAX_VARIABLES) {
+        expr->result = RES_ERR_MULTIPLE_VARIABLES;
+        expr->errIdx = start;
+        expr->errMsg = "Too many variables";
+        return 0;
+    }
+    struct Variable* v = &symbols->vars[symbols->count];
+    memcpy(v->name, name, len);
+    v->name[len] = '\0';
+    v->len = len;
+    v->value = expr->var.value;
+    return symbols->count++;
+}
+
+// Function names are told apart by their first character. The longest one has four characters,
+// which are read as '\0' past the end of the expression.
+static enum TokenType matchKeyword(const struct Expression* expr, unsigned* len)
+{
+    char s[4];
+    for (unsigned i = 0; i < 4; i++)
+        s[i] = characterAt(expr, expr->currIdx + i);
+    switch (s[0]) {
+    case 's':
+        if (s[1] == 'i' && s[2] == 'n') {
+            *len = 3;
+            return TOK_SINE;
+        }
+        if (s[1] == 'q' && s[2] == 'r' && s[3] == 't') {
+            *len = 4;
+            return TOK_SQRT;
+        }
+        break;
+    case 'c':
+        if (s[1] == 'o' && s[2] == 's') {
+            *len = 3;
+            return TOK_COSINE;
+        }
+        break;
+    case 't':
+        if (s[1] == 'a' && s[2] == 'n') {
+            *len = 3;
+            return TOK_TAN;
+        }
+        break;
+    case 'a':
+        if (s[1] == 't' && s[2] == 'a' && s[3] == 'n') {
+            *len = 4;
+            return TOK_ATAN;
+        }
+        break;
+    case 'e':
+        if (s[1] == 'x' && s[2] == 'p') {
+            *len = 3;
+            return TOK_EXP;
+        }
+        break;
+    }
+    return TOK_NONE;
+}
+
 #define RETURN_ON_ERROR(e, r)                                                                      \
     do {                                                                                           \
         if (e->result != RES_OK)                                                                   \
             return r;                                                                              \
     } while (0)
 
-struct Token_t readToken(struct Expression* expr)
+// Without `bind` a variable is only delimited, so that tokenizing ahead of the parser does not
+// register names the parser never reaches; readToken() binds it when it is consumed.
+static struct Token_t scanToken(struct Expression* expr, bool bind)
 {
     consumeWhitespace(expr);
     struct Token_t ret;
     ret.type = TOK_NONE;
     ret.value = 0.;
     ret.idx = expr->currIdx;
+    ret.len = 0;
+    ret.slot = 0;
     char c = currentCharacter(expr);
-    if (strncmp(currentHead(expr), "sin", 3) == 0) {
-        ret.type = TOK_SINE;
-        consumeCharacters(expr, 3);
-    } else if (strncmp(currentHead(expr), "cos", 3) == 0) {
-        ret.type = TOK_COSINE;
-        consumeCharacters(expr, 3);
-    } else if (strncmp(currentHead(expr), "tan", 3) == 0) {
-        ret.type = TOK_TAN;
-        consumeCharacters(expr, 3);
-    } else if (strncmp(currentHead(expr), "atan", 4) == 0) {
-        ret.type = TOK_ATAN;
-        consumeCharacters(expr, 4);
-    } else if (strncmp(currentHead(expr), "exp", 3) == 0) {
-        ret.type = TOK_EXP;
-        consumeCharacters(expr, 3);
-    } else if (strncmp(currentHead(expr), "sqrt", 4) == 0) {
-        ret.type = TOK_SQRT;
-        consumeCharacters(expr, 4);
-        // } else if (strncmp(currentHead(expr), "**", 2) == 0) {
-        // ret.type = TOK_POWER;
-        // consumeCharacters(expr, 2);
-        // ret.value = readNonNegativeNumber(expr);
-        // RETURN_ON_ERROR(expr, ret);
-    } else if (isalpha(c)) { //< for now only one variable is allowed
+    unsigned keywordLen = 0;
+    enum TokenType keyword = isAlpha(c) ? matchKeyword(expr, &keywordLen) : TOK_NONE;
+    if (keyword != TOK_NONE) {
+        ret.type = keyword;
+        consumeCharacters(expr, keywordLen);
+    } else if (isAlpha(c) && !bind) {
+        ret.type = TOK_VARIABLE;
+        while (isAlnum(currentCharacter(expr)))
+            consumeCharacter(expr);
+    } else if (isAlpha(c) && expr->symbols) {
+        ret.type = TOK_VARIABLE;
+        ret.slot = readSymbol(expr);
+        RETURN_ON_ERROR(expr, ret);
+        ret.value = expr->symbols->vars[ret.slot].value;
+    } else if (isAlpha(c)) { //< without a symbol table only one variable is allowed
         ret.type = TOK_VARIABLE;
         ret.value = expr->var.value;
-        // expr->nvars++;
         readVariable(expr);
         RETURN_ON_ERROR(expr, ret);
-    } else if (isdigit(c)) {
+    } else if (isDigit(c)) {
         ret.type = TOK_NUMBER;
         ret.value = readNonNegativeNumber(expr); //< consumes this and following digit characters
         RETURN_ON_ERROR(expr, ret); //< should never happen
-    } else if (c == '(') {
-        ret.type = TOK_OPEN_PARAN;
-        consumeCharacter(expr);
-    } else if (c == ')') {
-        ret.type = TOK_CLOSE_PARAN;
-        consumeCharacter(expr);
-    } else if (c == '+') {
-        ret.type = TOK_PLUS;
-        consumeCharacter(expr);
-    } else if (c == '-') {
-        ret.type = TOK_MINUS;
-        consumeCharacter(expr);
-    } else if (c == '*') {
-        ret.type = TOK_MULTIPLY;
-        consumeCharacter(expr);
-    } else if (c == '/') {
-        ret.type = TOK_DIVIDE;
-        consumeCharacter(expr);
-    } else if (c == '\0') {
     } else {
-        expr->result = RES_ERR_INVALID_CHAR;
-        expr->errIdx = expr->currIdx;
-        expr->errMsg = "Invalid character";
+        switch (c) {
+        case '(':
+            ret.type = TOK_OPEN_PARAN;
+            break;
+        case ')':
+            ret.type = TOK_CLOSE_PARAN;
+            break;
+        case '+':
+            ret.type = TOK_PLUS;
+            break;
+        case '-':
+            ret.type = TOK_MINUS;
+            break;
+        case '*':
+            if (characterAt(expr, expr->currIdx + 1) == '*') {
+                ret.type = TOK_POWER;
+                consumeCharacter(expr);
+            } else {
+                ret.type = TOK_MULTIPLY;
+            }
+            break;
+        case '/':
+            ret.type = TOK_DIVIDE;
+            break;
+        case '\0':
+            return ret;
+        default:
+            expr->result = RES_ERR_INVALID_CHAR;
+            expr->errIdx = expr->currIdx;
+            expr->errMsg = "Invalid character";
+            break;
+        }
         consumeCharacter(expr);
     }
+    ret.len = expr->currIdx - ret.idx;
     return ret;
 }
 
+struct Token_t readToken(struct Expression* expr)
+{
+    if (!expr->tokens) {
+        struct Token_t token = scanToken(expr, true);
+        if (token.type != TOK_NONE)
+            statsAddTokens(1);
+        return token;
+    }
+    struct Token_t token = expr->tokens[expr->tokIdx];
+    if (token.type == TOK_ERROR) {
+        expr->currIdx = token.idx;
+        return scanToken(expr, true); //< reports the error exactly as on-the-fly scanning does
+    }
+    if (token.type == TOK_VARIABLE) {
+        // bound now, with its errors, exactly as on-the-fly scanning does. A single variable may
+        // match a shorter prefix of the name; the rest is then scanned on the fly as well.
+        expr->tokIdx++;
+        expr->currIdx = token.idx;
+        struct Token_t bound = scanToken(expr, true);
+        if (expr->result != RES_OK || expr->currIdx != token.idx + token.len)
+            expr->tokens = NULL;
+        return bound;
+    }
+    if (token.type != TOK_NONE)
+        expr->tokIdx++;
+    expr->currIdx = token.idx + token.len;
+    return token;
+}
+
 void unreadToken(struct Expression* expr, struct Token_t* token)
 {
     expr->currIdx = token->idx; // roll back read pointer
+    if (expr->tokens && expr->tokIdx > 0 && expr->tokens[expr->tokIdx - 1].idx == token->idx)
+        expr->tokIdx--;
+}
+
+bool tokenizeExpression(struct Expression* expr, struct Token_t* tokens, unsigned cap)
+{
+    unsigned n = 0;
+    bool ok = true;
+    for (;;) {
+        if (n == cap) {
+            ok = false;
+            break;
+        }
+        struct Token_t token = scanToken(expr, false);
+        if (expr->result != RES_OK) {
+            // defer the error until the parser reaches this token
+            token.type = TOK_ERROR;
+            expr->result = RES_OK;
+            expr->errIdx = 0;
+            expr->errMsg = NULL;
+        }
+        tokens[n++] = token;
+        if (token.type == TOK_NONE || token.type == TOK_ERROR)
+            break;
+    }
+    expr->currIdx = 0;
+    statsAddTokens(n > 0 && tokens[n - 1].type == TOK_NONE ? n - 1 : n);
+    if (ok) {
+        expr->tokens = tokens;
+        expr->ntokens = n;
+        expr->tokIdx = 0;
+    }
+    return ok;
 }
 
 double (*getFunction(enum TokenType type))(double)
@@ -183,7 +431,7 @@ double (*getFunction(enum TokenType type))(double)
     case TOK_TAN:
         return &tan;
     case TOK_ATAN:
-        return &tan;
+        return &atan;
     case TOK_EXP:
         return &exp;
     case TOK_SQRT:
@@ -193,132 +441,271 @@ double (*getFunction(enum TokenType type))(double)
     }
 }
 
-double evaluatePrimary(struct Expression* expr)
+static enum OpCode getFunctionOpCode(enum TokenType type)
 {
-    struct Token_t token = readToken(expr);
-    RETURN_ON_ERROR(expr, 0);
+    switch (type) {
+    case TOK_SINE:
+        return OP_SIN;
+    case TOK_COSINE:
+        return OP_COS;
+    case TOK_TAN:
+        return OP_TAN;
+    case TOK_ATAN:
+        return OP_ATAN;
+    case TOK_EXP:
+        return OP_EXP;
+    default:
+        return OP_SQRT;
+    }
+}
 
-    if (token.type == TOK_NUMBER)
-        return token.value;
+// `value` is the constant of OP_CONST or the variable slot of OP_VAR
+static void emit(struct Expression* expr, enum OpCode op, double value)
+{
+    if (!expr->prog)
+        return;
+    bool ok = op == OP_CONST ? emitConstant(expr->prog, value)
+                             : emitInstruction(expr->prog, op, op == OP_VAR ? (unsigned)value : 0);
+    if (!ok) {
+        expr->result = RES_ERR_INTERNAL;
+        expr->errIdx = expr->currIdx;
+        expr->errMsg = "Out of memory";
+    }
+}
 
-    if (token.type == TOK_VARIABLE)
-        return token.value;
+// Binding power of the binary operators and of the unary minus, higher binds tighter. A sign takes
+// a whole power as its operand, so -2**2 is -4. ** groups to the right, the others to the left.
+enum Precedence {
+    PREC_NONE, //< ends the operands of all pending operators, like ')' does
+    PREC_SUM,
+    PREC_PRODUCT,
+    PREC_SIGN,
+    PREC_POWER,
+    PREC_PRIMARY, //< above every operator, a signed primary stands alone
+};
 
-    if (token.type == TOK_PLUS)
-        return evaluatePrimary(expr); // e.g. +42.43 or +++42.43
+static enum Precedence getPrecedence(enum TokenType type)
+{
+    switch (type) {
+    case TOK_PLUS:
+    case TOK_MINUS:
+        return PREC_SUM;
+    case TOK_MULTIPLY:
+    case TOK_DIVIDE:
+        return PREC_PRODUCT;
+    case TOK_POWER:
+        return PREC_POWER;
+    default:
+        return PREC_NONE;
+    }
+}
 
-    if (token.type == TOK_MINUS)
-        return -evaluatePrimary(expr); // e.g. -42.43 or ---42.43
+// An operator waiting for its right operand, or an open parenthesis or function call
+struct PendingOp {
+    enum TokenType type; //< the function of a call
+    enum Precedence prec; //< PREC_NONE for a parenthesis or a call, PREC_SIGN for a unary minus
+    unsigned idx; //< of the token, a division by zero is reported here
+};
 
-    if (token.type == TOK_SINE || token.type == TOK_COSINE || token.type == TOK_TAN
-        || token.type == TOK_ATAN || token.type == TOK_EXP || token.type == TOK_SQRT) {
-        double (*f)(double) = getFunction(token.type);
-        token = readToken(expr);
-        RETURN_ON_ERROR(expr, 0);
-        if (token.type != TOK_OPEN_PARAN) {
-            expr->result = RES_ERR_OPEN_PARAN_MISSING;
-            expr->errIdx = expr->currIdx;
-            expr->errMsg = "Open parenthesis missing after function";
-            return 0;
-        }
-        double fArg = evaluateExpression(expr);
-        RETURN_ON_ERROR(expr, fArg);
-        double result = f(fArg);
-        token = readToken(expr);
-        RETURN_ON_ERROR(expr, result);
-        if (token.type != TOK_CLOSE_PARAN) {
-            expr->result = RES_ERR_CLOSE_PARAN_MISSING;
-            expr->errIdx = expr->currIdx;
-            expr->errMsg = "Close parenthesis missing after function";
-        }
-        return result;
-    }
+// Both stacks grow by at most one entry per token, so they are allocated once for the whole text
+struct ParserStack {
+    struct PendingOp* ops;
+    double* values; //< operands computed so far
+    unsigned nops;
+    unsigned nvalues;
+    unsigned groups; //< parentheses and calls among ops
+};
 
-    if (token.type == TOK_OPEN_PARAN) {
-        double result = evaluateExpression(expr);
-        RETURN_ON_ERROR(expr, result);
-        token = readToken(expr);
-        RETURN_ON_ERROR(expr, result);
-        if (token.type != TOK_CLOSE_PARAN) {
-            expr->result = RES_ERR_CLOSE_PARAN_MISSING;
-            expr->errIdx = expr->currIdx;
-            expr->errMsg = "Close parenthesis missing";
+// Applies the pending operators that bind tighter than an operator of precedence `prec` coming
+// next, or as tight when they group to the left, down to the innermost open group
+static void reducePending(struct Expression* expr, struct ParserStack* s, enum Precedence prec)
+{
+    while (s->nops > 0) {
+        const struct PendingOp* op = &s->ops[s->nops - 1];
+        if (op->prec == PREC_NONE || op->prec < prec || (op->prec == prec && prec == PREC_POWER))
+            return;
+        double* left = &s->values[s->nvalues - 1];
+        if (op->prec == PREC_SIGN) {
+            *left = -*left;
+            emit(expr, OP_NEG, 0);
+        } else {
+            double right = *left--;
+            s->nvalues--;
+            switch (op->type) {
+            case TOK_PLUS:
+                *left += right;
+                emit(expr, OP_ADD, 0);
+                break;
+            case TOK_MINUS:
+                *left -= right;
+                emit(expr, OP_SUB, 0);
+                break;
+            case TOK_MULTIPLY:
+                *left *= right;
+                emit(expr, OP_MUL, 0);
+                break;
+            case TOK_DIVIDE:
+                if (right == 0) {
+                    expr->result = RES_ERR_DIV_BY_ZERO;
+                    expr->errMsg = "Division by zero";
+                    expr->errIdx = op->idx;
+                    return;
+                }
+                *left /= right;
+                emit(expr, OP_DIV, 0);
+                break;
+            default:
+                *left = pow(*left, right);
+                emit(expr, OP_POW, 0);
+                break;
+            }
         }
-        return result;
+        s->nops--;
+        if (expr->result != RES_OK)
+            return;
     }
-    expr->result = RES_ERR_INVALID_INPUT;
-    expr->errIdx = token.idx;
-    expr->errMsg = "Invalid input";
-    return 0;
 }
 
-double evaluateTerm(struct Expression* expr)
+static void pushPending(struct ParserStack* s, const struct Token_t* token, enum Precedence prec)
 {
-    double left = evaluatePrimary(expr);
-    RETURN_ON_ERROR(expr, left);
-
-    struct Token_t token = readToken(expr);
-    RETURN_ON_ERROR(expr, left);
+    struct PendingOp op = { token->type, prec, token->idx };
+    s->ops[s->nops++] = op;
+    s->groups += prec == PREC_NONE;
+}
 
-    while (token.type != TOK_NONE) {
+// Reads operands and operators in turn until a token ends the expression outside of all groups,
+// which is left unread. Operators below minPrec end it as well.
+static double parseTokens(struct Expression* expr, struct ParserStack* s, enum Precedence minPrec)
+{
+    for (;;) {
+        struct Token_t token = readToken(expr);
+        RETURN_ON_ERROR(expr, 0);
         switch (token.type) {
-        case TOK_MULTIPLY:
-            left *= evaluatePrimary(expr);
-            RETURN_ON_ERROR(expr, left);
+        case TOK_NUMBER:
+        case TOK_VARIABLE:
+            emit(expr, token.type == TOK_NUMBER ? OP_CONST : OP_VAR,
+                token.type == TOK_NUMBER ? token.value : token.slot);
+            RETURN_ON_ERROR(expr, 0);
+            s->values[s->nvalues++] = token.value;
             break;
-        case TOK_DIVIDE: {
-            double right = evaluatePrimary(expr);
-            RETURN_ON_ERROR(expr, left);
-            if (right == 0) {
-                expr->result = RES_ERR_DIV_BY_ZERO;
-                expr->errMsg = "Division by zero";
-                expr->errIdx = token.idx;
-                return left;
+        case TOK_PLUS:
+            continue; // e.g. +42.43 or +++42.43
+        case TOK_MINUS:
+            pushPending(s, &token, PREC_SIGN); // e.g. -42.43 or ---42.43
+            continue;
+        case TOK_OPEN_PARAN:
+            pushPending(s, &token, PREC_NONE);
+            continue;
+        case TOK_SINE:
+        case TOK_COSINE:
+        case TOK_TAN:
+        case TOK_ATAN:
+        case TOK_EXP:
+        case TOK_SQRT: {
+            struct Token_t paran = readToken(expr);
+            RETURN_ON_ERROR(expr, 0);
+            if (paran.type != TOK_OPEN_PARAN) {
+                expr->result = RES_ERR_OPEN_PARAN_MISSING;
+                expr->errIdx = expr->currIdx;
+                expr->errMsg = "Open parenthesis missing after function";
+                return 0;
             }
-            left /= right;
-            break;
+            pushPending(s, &token, PREC_NONE);
+            continue;
         }
-        // case TOK_POWER:
-        // left = pow(left, token.value);
-        // break;
         default:
-            unreadToken(expr, &token);
-            return left;
+            expr->result = RES_ERR_INVALID_INPUT;
+            expr->errIdx = token.idx;
+            expr->errMsg = "Invalid input";
+            return 0;
+        }
+
+        // the operand is complete, the next token either continues it with an operator or ends
+        // some of the pending ones
+        for (;;) {
+            token = readToken(expr);
+            if (expr->result != RES_OK) {
+                // the operand before is complete unless the bad token was a power, which it
+                // cannot be: a division by zero there comes first, as it does in the text
+                enum ParsingResult result = expr->result;
+                unsigned errIdx = expr->errIdx;
+                const char* errMsg = expr->errMsg;
+                expr->result = RES_OK;
+                reducePending(expr, s, PREC_PRODUCT);
+                if (expr->result == RES_OK) {
+                    expr->result = result;
+                    expr->errIdx = errIdx;
+                    expr->errMsg = errMsg;
+                }
+                return 0;
+            }
+            enum Precedence prec = getPrecedence(token.type);
+            if (prec < minPrec && s->groups == 0)
+                prec = PREC_NONE;
+            reducePending(expr, s, prec);
+            RETURN_ON_ERROR(expr, 0);
+            if (prec != PREC_NONE) {
+                pushPending(s, &token, prec);
+                break;
+            }
+            if (s->groups == 0) {
+                if (token.type != TOK_NONE)
+                    unreadToken(expr, &token);
+                return s->values[0];
+            }
+            struct PendingOp group = s->ops[--s->nops];
+            s->groups--;
+            bool call = group.type != TOK_OPEN_PARAN;
+            if (call) {
+                double* arg = &s->values[s->nvalues - 1];
+                *arg = getFunction(group.type)(*arg);
+                emit(expr, getFunctionOpCode(group.type), 0);
+                RETURN_ON_ERROR(expr, 0);
+            }
+            if (token.type != TOK_CLOSE_PARAN) {
+                expr->result = RES_ERR_CLOSE_PARAN_MISSING;
+                expr->errIdx = expr->currIdx;
+                expr->errMsg = call ? "Close parenthesis missing after function"
+                                    : "Close parenthesis missing";
+                return 0;
+            }
         }
-        token = readToken(expr);
-        RETURN_ON_ERROR(expr, left);
     }
-    return left;
 }
 
-double evaluateExpression(struct Expression* expr)
+static double parseWithPrecedence(struct Expression* expr, enum Precedence minPrec)
 {
-    double left = evaluateTerm(expr);
-    RETURN_ON_ERROR(expr, left);
-
-    struct Token_t token = readToken(expr);
-    RETURN_ON_ERROR(expr, left);
-
-    while (token.type != TOK_NONE) {
-        switch (token.type) {
-        case TOK_PLUS:
-            left += evaluateTerm(expr);
-            RETURN_ON_ERROR(expr, left);
-            break;
-        case TOK_MINUS:
-            left -= evaluateTerm(expr);
-            RETURN_ON_ERROR(expr, left);
-            break;
-        default:
-            unreadToken(expr, &token);
-            return left;
-        }
-        token = readToken(expr);
-        RETURN_ON_ERROR(expr, left);
+    struct PendingOp opsBuf[PARSER_STACK_SIZE];
+    double valuesBuf[PARSER_STACK_SIZE];
+    struct ParserStack s = { opsBuf, valuesBuf, 0, 0, 0 };
+    // one more than the tokens for a variable split by readToken(), whose rest is an error
+    size_t cap = expr->tokens ? (size_t)expr->ntokens + 1 : (size_t)expr->len + 1;
+    struct Arena* arena = expr->prog ? expr->prog->arena : NULL;
+    if (cap > PARSER_STACK_SIZE) {
+        s.ops = arenaOrHeapAlloc(arena, cap * sizeof(*s.ops));
+        s.values = arenaOrHeapAlloc(arena, cap * sizeof(*s.values));
+    }
+    double result = 0;
+    if (s.ops && s.values) {
+        result = parseTokens(expr, &s, minPrec);
+    } else {
+        expr->result = RES_ERR_INTERNAL;
+        expr->errIdx = expr->currIdx;
+        expr->errMsg = "Out of memory";
     }
-    return left;
+    if (s.ops != opsBuf) {
+        arenaOrHeapFree(arena, s.ops);
+        arenaOrHeapFree(arena, s.values);
+    }
+    return result;
 }
 
+double evaluatePrimary(struct Expression* expr) { return parseWithPrecedence(expr, PREC_PRIMARY); }
+
+double evaluateTerm(struct Expression* expr) { return parseWithPrecedence(expr, PREC_PRODUCT); }
+
+double evaluateExpression(struct Expression* expr) { return parseWithPrecedence(expr, PREC_SUM); }
+
 #undef RETURN_ON_ERROR
 
 void printParsingError(struct Expression* expr)
@@ -326,9 +713,12 @@ void printParsingError(struct Expression* expr)
     if (expr->result == RES_OK)
         return;
     fprintf(stderr, "Error: %s\n", expr->errMsg);
-    fprintf(stderr, "%s\n", expr->expr);
+    unsigned len = 0;
+    while (len < expr->len && expr->expr[len])
+        len++;
+    fprintf(stderr, "%.*s\n", (int)len, expr->expr);
     unsigned i = 0;
-    while (expr->expr[i]) {
+    while (i < len) {
         if (expr->errIdx == i)
             fprintf(stderr, "%c", '^');
         else
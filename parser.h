@@ -25,13 +25,29 @@ struct Variable {
     double value; //< if parser finds a variable, this value is assigned
 };
 
+#define MAX_VARIABLES 32
+
+// Variables of one or several expressions, numbered in order of first appearance
+struct SymbolTable {
+    struct Variable vars[MAX_VARIABLES];
+    unsigned count;
+};
+
+struct Program;
+
 struct Expression {
-    const char* expr;
+    const char* expr; //< needs no terminator, the parser reads no further than len characters
+    unsigned len; //< a NUL character before len ends the expression as well
     unsigned currIdx;
     enum ParsingResult result;
     unsigned errIdx;
     const char* errMsg;
     struct Variable var;
+    struct Program* prog; //< if set, the evaluator also records postfix instructions here
+    const struct Token_t* tokens; //< if set, tokens are read from here instead of being scanned
+    unsigned ntokens;
+    unsigned tokIdx;
+    struct SymbolTable* symbols; //< if set, variables are looked up here and `var` is unused
 };
 
 enum TokenType {
@@ -51,16 +67,25 @@ enum TokenType {
     TOK_SQRT,
     TOK_POWER,
     TOK_VARIABLE,
+    TOK_ERROR, //< tokenizer stopped here, reading this token reports the lexical error
 };
 
 struct Token_t {
     enum TokenType type;
     unsigned idx;
+    unsigned len; //< number of characters of the token
     double value;
+    unsigned slot; //< index of a TOK_VARIABLE in the symbol table, 0 without one
 };
 
 struct Expression createExpression(const char* expr); //< varValue is zero
+// Parses the first len characters of expr in place, e.g. a line of a larger buffer
+struct Expression createExpressionView(const char* expr, unsigned len);
 struct Expression createExpressionWithVariable(const char* expr, double varValue);
+// Accepts any number of variables. Names missing from `symbols` are added with the value
+// varValue, the values of known names are taken from the table.
+struct Expression createExpressionWithSymbols(
+    const char* expr, struct SymbolTable* symbols, double varValue);
 void consumeCharacter(struct Expression* expr);
 void consumeWhitespace(struct Expression* expr);
 const char* currentHead(struct Expression* expr);
@@ -70,9 +95,19 @@ void readVariable(struct Expression* expr);
 bool hasVariable(struct Expression* expr);
 struct Token_t readToken(struct Expression* expr);
 void unreadToken(struct Expression* expr, struct Token_t* token);
+// Scans the whole expression once into `tokens`, terminated by TOK_NONE or TOK_ERROR, and makes
+// readToken() consume the array. A lexical error is reported, and a variable is looked up or
+// registered, only when the parser reaches it, just like with on-the-fly scanning. len + 1
+// entries are always enough; returns false if `cap` was too small, the expression is then
+// scanned on the fly.
+bool tokenizeExpression(struct Expression* expr, struct Token_t* tokens, unsigned cap);
 
 // Grammar is a tiny subset of C Programming Language (see K&R 2nd Edition sec. A13 p.238)
 // See also Bjarne Stroustrup C++ Programming Language Second Edition sec 6.4 p.189
+// plus Python's right-associative power, which binds tighter than a sign: -2**2 is -4 and
+// 2**3**2 is 2**9. The parser runs on an explicit operator stack sized by the text instead of
+// recursing, so any nesting depth takes linear time and no C stack. A term stops at + and -, a
+// primary at every binary operator.
 double evaluatePrimary(struct Expression* expr);
 double evaluateTerm(struct Expression* expr);
 double evaluateExpression(struct Expression* expr);
@@ -0,0 +1,361 @@
+#include "polynomial.h"
+#include "stats.h"
+
+#include <complex.h>
+#include <float.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ABERTH_POLISH_STEPS 8 //< Newton steps per root at most
+#define ABERTH_START_ANGLE 0.4 //< rotates the initial circle off the real axis
+#define ABERTH_NOISE 4 //< |p| below this many rounding errors counts as zero
+// Rounding moves a real root of multiplicity m off the axis by about DBL_EPSILON^(1/m) relative
+#define ABERTH_REAL_SLACK 6e-6 //< cbrt(DBL_EPSILON), roots up to triple are recognized as real
+
+// Replaces p by the zero polynomial of the given degree
+static bool resetPolynomial(struct Polynomial* p, unsigned degree)
+{
+    double* coeffs = calloc((size_t)degree + 1, sizeof(*coeffs));
+    if (!coeffs)
+        return false;
+    free(p->coeffs);
+    p->coeffs = coeffs;
+    p->degree = degree;
+    return true;
+}
+
+static bool copyPolynomial(struct Polynomial* dst, const struct Polynomial* src)
+{
+    if (!resetPolynomial(dst, src->degree))
+        return false;
+    memcpy(dst->coeffs, src->coeffs, ((size_t)src->degree + 1) * sizeof(*src->coeffs));
+    return true;
+}
+
+static void trimPolynomial(struct Polynomial* p)
+{
+    while (p->degree > 0 && p->coeffs[p->degree] == 0)
+        p->degree--;
+}
+
+// l += sign * r, sign being 1 or -1
+static bool accumulatePolynomial(struct Polynomial* l, const struct Polynomial* r, double sign)
+{
+    if (r->degree > l->degree) {
+        double* coeffs = realloc(l->coeffs, ((size_t)r->degree + 1) * sizeof(*coeffs));
+        if (!coeffs)
+            return false;
+        memset(coeffs + l->degree + 1, 0, (r->degree - l->degree) * sizeof(*coeffs));
+        l->coeffs = coeffs;
+        l->degree = r->degree;
+    }
+    for (unsigned i = 0; i <= r->degree; i++)
+        l->coeffs[i] += sign * r->coeffs[i];
+    trimPolynomial(l); //< keeps the degree tight when terms cancel
+    return true;
+}
+
+static bool multiplyPolynomial(struct Polynomial* l, const struct Polynomial* r)
+{
+    if (l->degree + r->degree > POLYNOMIAL_MAX_DEGREE)
+        return false;
+    struct Polynomial product = { NULL, 0 };
+    if (!resetPolynomial(&product, l->degree + r->degree))
+        return false;
+    for (unsigned i = 0; i <= l->degree; i++) {
+        for (unsigned j = 0; j <= r->degree; j++)
+            product.coeffs[i + j] += l->coeffs[i] * r->coeffs[j];
+    }
+    free(l->coeffs);
+    *l = product;
+    trimPolynomial(l);
+    return true;
+}
+
+// l ** r for a constant r: a whole exponent is expanded by repeated squaring, any other one
+// needs a constant base, which gets the value of evaluateProgram()
+static bool powerPolynomial(struct Polynomial* l, const struct Polynomial* r)
+{
+    double e = r->coeffs[0];
+    if (r->degree > 0)
+        return false;
+    if (l->degree == 0) {
+        l->coeffs[0] = pow(l->coeffs[0], e);
+        return isfinite(l->coeffs[0]);
+    }
+    if (!(e >= 0 && e == floor(e) && e * l->degree <= POLYNOMIAL_MAX_DEGREE))
+        return false;
+    struct Polynomial base = { NULL, 0 };
+    bool ok = copyPolynomial(&base, l) && resetPolynomial(l, 0);
+    if (ok)
+        l->coeffs[0] = 1.;
+    for (unsigned long n = (unsigned long)e; ok && n; n >>= 1) {
+        if (n & 1)
+            ok = multiplyPolynomial(l, &base);
+        if (ok && n > 1)
+            ok = multiplyPolynomial(&base, &base);
+    }
+    free(base.coeffs);
+    return ok;
+}
+
+// Functions apply to constant polynomials only
+static bool applyFunction(struct Polynomial* p, enum OpCode op)
+{
+    if (p->degree > 0)
+        return false;
+    double c = p->coeffs[0];
+    switch (op) {
+    case OP_SIN:
+        c = sin(c);
+        break;
+    case OP_COS:
+        c = cos(c);
+        break;
+    case OP_TAN:
+        c = tan(c);
+        break;
+    case OP_ATAN:
+        c = atan(c);
+        break;
+    case OP_EXP:
+        c = exp(c);
+        break;
+    default:
+        c = sqrt(c);
+        break;
+    }
+    p->coeffs[0] = c;
+    return isfinite(c);
+}
+
+static bool applyInstruction(const struct Program* prog, const struct Instruction* ip,
+    struct Polynomial* stack, unsigned* top, struct Polynomial* regs)
+{
+    struct Polynomial* t = &stack[*top - 1]; //< top of the stack, invalid while it is empty
+    switch (ip->op) {
+    case OP_CONST:
+    case OP_VAR:
+        t = &stack[(*top)++];
+        if (!resetPolynomial(t, ip->op == OP_VAR))
+            return false;
+        t->coeffs[ip->op == OP_VAR] = ip->op == OP_VAR ? 1. : prog->consts[ip->arg];
+        return true;
+    case OP_NEG:
+        for (unsigned i = 0; i <= t->degree; i++)
+            t->coeffs[i] = -t->coeffs[i];
+        return true;
+    case OP_ADD:
+    case OP_SUB:
+        --*top;
+        return accumulatePolynomial(t - 1, t, ip->op == OP_ADD ? 1. : -1.);
+    case OP_MUL:
+        --*top;
+        return multiplyPolynomial(t - 1, t);
+    case OP_DIV:
+        --*top;
+        if (t->degree > 0 || t->coeffs[0] == 0)
+            return false;
+        for (unsigned i = 0; i <= t[-1].degree; i++)
+            t[-1].coeffs[i] /= t->coeffs[0];
+        return true;
+    case OP_POW:
+        --*top;
+        return powerPolynomial(t - 1, t);
+    case OP_LOAD:
+        return copyPolynomial(&stack[(*top)++], &regs[ip->arg]);
+    case OP_STORE:
+        return copyPolynomial(&regs[ip->arg], t);
+    default:
+        return applyFunction(t, ip->op);
+    }
+}
+
+bool expandPolynomial(const struct Program* prog, struct Polynomial* p)
+{
+    if (prog->nvars > 1 || prog->depth != 1)
+        return false;
+    size_t slots = (size_t)prog->maxDepth + prog->nregs;
+    struct Polynomial* stack = calloc(slots, sizeof(*stack));
+    if (!stack)
+        return false;
+    struct Polynomial* regs = stack + prog->maxDepth;
+    unsigned top = 0;
+    bool ok = true;
+    for (unsigned i = 0; ok && i < prog->len; i++)
+        ok = applyInstruction(prog, &prog->code[i], stack, &top, regs);
+    if (ok) {
+        *p = stack[0];
+        stack[0].coeffs = NULL;
+    }
+    for (size_t i = 0; i < slots; i++)
+        free(stack[i].coeffs);
+    free(stack);
+    return ok;
+}
+
+void freePolynomial(struct Polynomial* p)
+{
+    free(p->coeffs);
+    p->coeffs = NULL;
+    p->degree = 0;
+}
+
+double evaluatePolynomial(const struct Polynomial* p, double x)
+{
+    double y = p->coeffs[p->degree];
+    for (unsigned k = p->degree; k-- > 0;)
+        y = y * x + p->coeffs[k];
+    return y;
+}
+
+// Returns p'(z) / p(z) of a[0] + ... + a[n]*z^n and stores |p(z)| in *absp. *noisy tells whether
+// |p(z)| is within the rounding error of Horner's scheme, beyond which no iteration can improve z.
+// Outside the unit circle p(z) = z^n q(w) with w = 1/z and q(w) = a[n] + a[n-1]*w + ... + a[0]*w^n
+// is evaluated instead, so that z^n cannot overflow: p'(z) / p(z) = (n q(w) - w q'(w)) / (z q(w)).
+static double complex logDerivative(
+    const double* a, unsigned n, double complex z, double* absp, bool* noisy)
+{
+    double complex p;
+    double complex dp = 0;
+    double bound; //< sum of |a[k] z^k|, the rounding error is a small multiple of eps times it
+    if (cabs(z) <= 1) {
+        double r = cabs(z);
+        p = a[n];
+        bound = fabs(a[n]);
+        for (unsigned k = n; k-- > 0;) {
+            dp = dp * z + p;
+            p = p * z + a[k];
+            bound = bound * r + fabs(a[k]);
+        }
+        *absp = cabs(p);
+        *noisy = *absp <= ABERTH_NOISE * DBL_EPSILON * bound;
+        return dp / p;
+    }
+    double complex w = 1 / z;
+    double r = cabs(w);
+    p = a[0];
+    bound = fabs(a[0]);
+    for (unsigned k = 1; k <= n; k++) {
+        dp = dp * w + p;
+        p = p * w + a[k];
+        bound = bound * r + fabs(a[k]);
+    }
+    *noisy = cabs(p) <= ABERTH_NOISE * DBL_EPSILON * bound;
+    *absp = cabs(p) * pow(cabs(z), n);
+    return (n * p - w * dp) / (z * p);
+}
+
+static int compareComplex(const void* l, const void* r)
+{
+    const struct Complex* a = l;
+    const struct Complex* b = r;
+    if (a->re != b->re)
+        return (a->re > b->re) - (a->re < b->re);
+    return (a->im > b->im) - (a->im < b->im);
+}
+
+enum SolveStatus aberthSolve(const struct Polynomial* p, unsigned maxiter, bool polish,
+    struct Complex* roots, unsigned* iterations)
+{
+    *iterations = 0;
+    unsigned zeros = 0;
+    while (zeros < p->degree && p->coeffs[zeros] == 0)
+        zeros++;
+    for (unsigned k = 0; k < zeros; k++) {
+        roots[k].re = 0.;
+        roots[k].im = 0.;
+    }
+    const double* a = p->coeffs + zeros; //< a[0] != 0, so no root is at the origin
+    unsigned n = p->degree - zeros;
+    double complex z[POLYNOMIAL_MAX_DEGREE];
+    bool done[POLYNOMIAL_MAX_DEGREE];
+    // start on a circle whose radius is the geometric mean of the roots' moduli
+    double radius = pow(fabs(a[0] / a[n]), 1. / n);
+    for (unsigned k = 0; k < n; k++) {
+        z[k] = radius * cexp(I * (2. * M_PI * k / n + ABERTH_START_ANGLE));
+        done[k] = false;
+    }
+    unsigned active = n;
+    double lastStep = 0; //< largest correction of the previous sweep, for tracing
+    for (; active > 0 && *iterations < maxiter; ++*iterations) {
+        double maxp = 0;
+        double maxStep = 0;
+        statsAddEvals(active);
+        for (unsigned k = 0; k < n; k++) {
+            if (done[k])
+                continue;
+            double absp;
+            bool noisy;
+            double complex ratio = logDerivative(a, n, z[k], &absp, &noisy);
+            maxp = fmax(maxp, absp);
+            if (noisy) {
+                done[k] = true;
+                active--;
+                continue;
+            }
+            // Newton's correction p/p' deflated by the other approximations
+            double complex repulsion = 0;
+            for (unsigned j = 0; j < n; j++) {
+                if (j != k)
+                    repulsion += 1 / (z[k] - z[j]);
+            }
+            double complex w = 1 / (ratio - repulsion);
+            z[k] -= w;
+            maxStep = fmax(maxStep, cabs(w));
+            if (cabs(w) <= DBL_EPSILON * cabs(z[k])) {
+                done[k] = true;
+                active--;
+            }
+        }
+        statsTraceIteration("aberth", *iterations, NAN, maxp, lastStep);
+        lastStep = maxStep;
+    }
+    for (unsigned k = 0; polish && k < n; k++) {
+        double step = INFINITY;
+        for (unsigned i = 0; i < ABERTH_POLISH_STEPS; i++) {
+            double absp;
+            bool noisy;
+            double complex ratio = logDerivative(a, n, z[k], &absp, &noisy);
+            double complex dz = 1 / ratio;
+            if (absp == 0 || !(cabs(dz) < step))
+                break; //< an exact root, or the steps stopped shrinking
+            step = cabs(dz);
+            z[k] -= dz;
+        }
+    }
+    for (unsigned k = 0; k < n; k++) {
+        roots[zeros + k].re = creal(z[k]);
+        roots[zeros + k].im = cimag(z[k]);
+    }
+    qsort(roots, p->degree, sizeof(*roots), compareComplex);
+    return active == 0 ? SOLVE_OK : SOLVE_MAXITER;
+}
+
+bool isRealRoot(const struct Polynomial* p, struct Complex z, double tol)
+{
+    if (!(fabs(z.im) <= ABERTH_REAL_SLACK * fmax(fabs(z.re), 1.)))
+        return false;
+    double y = p->coeffs[p->degree];
+    double bound = fabs(y);
+    for (unsigned k = p->degree; k-- > 0;) {
+        y = y * z.re + p->coeffs[k];
+        bound = bound * fabs(z.re) + fabs(p->coeffs[k]);
+    }
+    return fabs(y) <= tol || fabs(y) <= ABERTH_NOISE * DBL_EPSILON * bound;
+}
+
+size_t selectRealRoots(const struct Polynomial* p, const struct Complex* roots, unsigned n,
+    double a, double b, double tol, double* xs)
+{
+    size_t count = 0;
+    for (unsigned k = 0; k < n; k++) {
+        double x = roots[k].re;
+        if (x < a || x > b || !isRealRoot(p, roots[k], tol))
+            continue;
+        if (count == 0 || x - xs[count - 1] > tol)
+            xs[count++] = x;
+    }
+    return count;
+}
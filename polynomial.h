@@ -0,0 +1,56 @@
+#ifndef POLYNOMIAL_H
+#define POLYNOMIAL_H
+
+#include "program.h"
+#include "solver.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define POLYNOMIAL_MAX_DEGREE 1024
+
+// coeffs[0] + coeffs[1]*x + ... + coeffs[degree]*x^degree
+struct Polynomial {
+    double* coeffs;
+    unsigned degree;
+};
+
+struct Complex {
+    double re;
+    double im;
+};
+
+// Expands a single-variable program built from + - *, constants and the variable into its
+// coefficients. Divisions by constant subexpressions and functions of constant subexpressions are
+// accepted too. Trailing zero coefficients are dropped, so the zero polynomial has degree 0.
+// Returns false, leaving p untouched, if the program is no such polynomial, its degree exceeds
+// POLYNOMIAL_MAX_DEGREE or memory runs out.
+bool expandPolynomial(const struct Program* prog, struct Polynomial* p);
+void freePolynomial(struct Polynomial* p);
+double evaluatePolynomial(const struct Polynomial* p, double x); //< Horner's scheme
+
+// Finds all p->degree complex roots of p, repeated by multiplicity, simultaneously with the
+// Aberth-Ehrlich iteration. Zeros at the origin are split off exactly. The iteration stops for a
+// root when its correction falls below machine precision relative to the root or |p| there is
+// within the rounding error of its evaluation, so simple roots come out to full precision. It
+// fails with SOLVE_MAXITER when some root still moves after maxiter sweeps. With `polish`, every
+// root is then refined by Newton steps as long as they shrink, which is cheaper than further
+// sweeps since the roots no longer interact. The roots are stored sorted by real, then imaginary
+// part; *iterations receives the number of sweeps.
+enum SolveStatus aberthSolve(const struct Polynomial* p, unsigned maxiter, bool polish,
+    struct Complex* roots, unsigned* iterations);
+// Whether a root z found by aberthSolve() is real: z is close to the real axis and |p(re z)| is at
+// most tol or within the rounding error of its evaluation
+bool isRealRoot(const struct Polynomial* p, struct Complex z, double tol);
+// Picks the real roots in [a, b] out of the n sorted roots of aberthSolve(), those passing
+// isRealRoot(). Roots closer than tol to each other are reported once. Stores their real parts in
+// ascending order in xs, which needs room for n entries, and returns their number.
+size_t selectRealRoots(const struct Polynomial* p, const struct Complex* roots, unsigned n,
+    double a, double b, double tol, double* xs);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
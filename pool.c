@@ -0,0 +1,214 @@
+#include "pool.h"
+#include "stats.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+struct WorkRange {
+    pthread_mutex_t lock;
+    size_t begin;
+    size_t end;
+};
+
+struct Pool {
+    struct WorkRange* ranges;
+    unsigned nworkers;
+    size_t grain;
+    void (*body)(void* ctx, size_t begin, size_t end, unsigned worker);
+    void* ctx;
+    struct StatsSink* stats; //< of the calling thread, the workers report to it as well
+};
+
+struct Worker {
+    struct Pool* pool;
+    unsigned id;
+};
+
+// Threads kept parked between calls, so that callers looping over parallelFor() do not pay a
+// thread creation and join per call. One call at a time uses them; a call made while they are
+// busy, from another thread or from inside a body, starts threads of its own.
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t wake; //< a new job was posted
+    pthread_cond_t done; //< the last worker of the job finished
+    unsigned nthreads; //< started so far, worker ids 1 to nthreads
+    bool busy;
+    struct Pool* job;
+    unsigned long generation; //< of the job, each thread runs it once
+    unsigned running; //< workers of the job that have not finished it yet
+} resident = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER,
+    0, false, NULL, 0, 0 };
+
+unsigned defaultThreadCount(void)
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (unsigned)n : 1;
+}
+
+// Takes the next chunk from the front of the worker's own range
+static bool popChunk(struct WorkRange* r, size_t grain, size_t* begin, size_t* end)
+{
+    pthread_mutex_lock(&r->lock);
+    bool ok = r->begin < r->end;
+    if (ok) {
+        *begin = r->begin;
+        *end = r->end - r->begin > grain ? r->begin + grain : r->end;
+        r->begin = *end;
+    }
+    pthread_mutex_unlock(&r->lock);
+    return ok;
+}
+
+// Moves the back half of a victim's range into the thief's (empty) range
+static bool steal(struct Pool* pool, unsigned thief)
+{
+    for (unsigned i = 1; i < pool->nworkers; i++) {
+        struct WorkRange* victim = &pool->ranges[(thief + i) % pool->nworkers];
+        pthread_mutex_lock(&victim->lock);
+        size_t left = victim->end - victim->begin;
+        if (left == 0) {
+            pthread_mutex_unlock(&victim->lock);
+            continue;
+        }
+        size_t mid = victim->end - (left + 1) / 2;
+        size_t end = victim->end;
+        victim->end = mid;
+        pthread_mutex_unlock(&victim->lock);
+
+        struct WorkRange* own = &pool->ranges[thief];
+        pthread_mutex_lock(&own->lock);
+        own->begin = mid;
+        own->end = end;
+        pthread_mutex_unlock(&own->lock);
+        return true;
+    }
+    return false;
+}
+
+static void runChunks(struct Pool* pool, unsigned id)
+{
+    size_t begin, end;
+    for (;;) {
+        while (popChunk(&pool->ranges[id], pool->grain, &begin, &end))
+            pool->body(pool->ctx, begin, end, id);
+        if (!steal(pool, id))
+            return; //< nothing left anywhere, chunks still running belong to their owners
+    }
+}
+
+static void* runWorker(void* arg)
+{
+    struct Worker* w = arg;
+    setStatsSink(w->pool->stats);
+    runChunks(w->pool, w->id);
+    return NULL;
+}
+
+static void* runResident(void* arg)
+{
+    unsigned id = (unsigned)(uintptr_t)arg;
+    unsigned long seen = 0;
+    pthread_mutex_lock(&resident.lock);
+    for (;;) {
+        while (resident.generation == seen)
+            pthread_cond_wait(&resident.wake, &resident.lock);
+        seen = resident.generation;
+        struct Pool* pool = resident.job;
+        if (id >= pool->nworkers)
+            continue; //< not needed for this job
+        pthread_mutex_unlock(&resident.lock);
+        setStatsSink(pool->stats);
+        runChunks(pool, id);
+        setStatsSink(NULL); //< parked threads do not hold on to the sink of the caller
+        pthread_mutex_lock(&resident.lock);
+        if (--resident.running == 0)
+            pthread_cond_signal(&resident.done);
+    }
+    return NULL;
+}
+
+// Runs the job on the resident threads, starting more of them if needed. False if they are busy.
+static bool runOnResident(struct Pool* pool)
+{
+    pthread_mutex_lock(&resident.lock);
+    if (resident.busy) {
+        pthread_mutex_unlock(&resident.lock);
+        return false;
+    }
+    resident.busy = true;
+    while (resident.nthreads + 1 < pool->nworkers) {
+        pthread_t thread;
+        void* id = (void*)(uintptr_t)(resident.nthreads + 1);
+        if (pthread_create(&thread, NULL, runResident, id) != 0)
+            break; //< the ranges of the missing workers get stolen by the running ones
+        pthread_detach(thread);
+        resident.nthreads++;
+    }
+    resident.job = pool;
+    resident.generation++;
+    resident.running = resident.nthreads + 1 < pool->nworkers ? resident.nthreads
+                                                              : pool->nworkers - 1;
+    pthread_cond_broadcast(&resident.wake);
+    pthread_mutex_unlock(&resident.lock);
+
+    runChunks(pool, 0);
+
+    pthread_mutex_lock(&resident.lock);
+    while (resident.running > 0)
+        pthread_cond_wait(&resident.done, &resident.lock);
+    resident.job = NULL;
+    resident.busy = false;
+    pthread_mutex_unlock(&resident.lock);
+    return true;
+}
+
+// Fallback for calls made while the resident threads are busy
+static void runOnNewThreads(struct Pool* pool)
+{
+    struct Worker* workers = malloc(pool->nworkers * sizeof(*workers));
+    pthread_t* threads = malloc(pool->nworkers * sizeof(*threads));
+    unsigned started = 1;
+    for (; workers && threads && started < pool->nworkers; started++) {
+        workers[started].pool = pool;
+        workers[started].id = started;
+        if (pthread_create(&threads[started], NULL, runWorker, &workers[started]) != 0)
+            break; //< the remaining ranges get stolen by the running workers
+    }
+    runChunks(pool, 0);
+    for (unsigned i = 1; workers && threads && i < started; i++)
+        pthread_join(threads[i], NULL);
+    free(workers);
+    free(threads);
+}
+
+void parallelFor(size_t n, size_t grain, unsigned nthreads,
+    void (*body)(void* ctx, size_t begin, size_t end, unsigned worker), void* ctx)
+{
+    if (n == 0)
+        return;
+    if (grain == 0)
+        grain = 1;
+    if (nthreads == 0)
+        nthreads = defaultThreadCount();
+    if (nthreads > (n + grain - 1) / grain)
+        nthreads = (unsigned)((n + grain - 1) / grain);
+
+    struct WorkRange* ranges = malloc(nthreads * sizeof(*ranges));
+    if (!ranges) {
+        body(ctx, 0, n, 0); //< degrade to a serial loop
+        return;
+    }
+    struct Pool pool = { ranges, nthreads, grain, body, ctx, currentStatsSink() };
+    for (unsigned i = 0; i < nthreads; i++) {
+        pthread_mutex_init(&ranges[i].lock, NULL);
+        ranges[i].begin = n * i / nthreads;
+        ranges[i].end = n * (i + 1) / nthreads;
+    }
+    if (!runOnResident(&pool))
+        runOnNewThreads(&pool);
+    for (unsigned i = 0; i < nthreads; i++)
+        pthread_mutex_destroy(&ranges[i].lock);
+    free(ranges);
+}
@@ -0,0 +1,26 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+unsigned defaultThreadCount(void); //< number of online cores, at least 1
+
+// Calls body(ctx, begin, end, worker) for disjoint chunks of at most `grain` indices until
+// [0, n) is covered. Every worker starts with an even share of the range and steals half of the
+// remaining range of another worker when it runs dry. The calling thread is worker 0; nthreads=0
+// means one worker per core. The other workers are threads kept parked between calls, started
+// on first use; a call made while they serve another one starts and joins threads of its own.
+// Returns once all chunks are done.
+void parallelFor(size_t n, size_t grain, unsigned nthreads,
+    void (*body)(void* ctx, size_t begin, size_t end, unsigned worker), void* ctx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
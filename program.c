@@ -0,0 +1,786 @@
+#include "program.h"
+#include "arena.h"
+#include "stats.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PROGRAM_STACK_SIZE 64 //< operand stack kept on the C stack, deeper programs use the heap
+#define TOKEN_BUFFER_SIZE 256 //< tokens of short expressions are kept on the C stack
+#define GRADIENT_BUFFER_SIZE 1024 //< doubles of gradient evaluation kept on the C stack
+#define TAYLOR_POW_INTEGER_MAX 0x1p31 //< integer exponents up to this are applied by squaring
+
+struct Program createProgram(void)
+{
+    struct Program p;
+    p.code = NULL;
+    p.len = 0;
+    p.cap = 0;
+    p.consts = NULL;
+    p.nconsts = 0;
+    p.constsCap = 0;
+    p.depth = 0;
+    p.maxDepth = 0;
+    p.nregs = 0;
+    p.nvars = 0;
+    p.arena = NULL;
+    p.accuracy = ACCURACY_EXACT;
+    return p;
+}
+
+struct Program createProgramInArena(struct Arena* arena)
+{
+    struct Program p = createProgram();
+    p.arena = arena;
+    return p;
+}
+
+void freeProgram(struct Program* prog)
+{
+    arenaOrHeapFree(prog->arena, prog->code);
+    arenaOrHeapFree(prog->arena, prog->consts);
+    *prog = createProgramInArena(prog->arena);
+}
+
+void clearProgram(struct Program* prog)
+{
+    prog->len = 0;
+    prog->nconsts = 0;
+    prog->depth = 0;
+    prog->maxDepth = 0;
+    prog->nregs = 0;
+    prog->nvars = 0;
+}
+
+bool copyProgram(struct Program* dst, const struct Program* src)
+{
+    if (dst->cap < src->len) {
+        struct Instruction* code = arenaOrHeapRealloc(dst->arena, dst->code,
+            dst->cap * sizeof(*code), src->len * sizeof(*code));
+        if (!code)
+            return false;
+        dst->code = code;
+        dst->cap = src->len;
+    }
+    if (dst->constsCap < src->nconsts) {
+        double* consts = arenaOrHeapRealloc(dst->arena, dst->consts,
+            dst->constsCap * sizeof(*consts), src->nconsts * sizeof(*consts));
+        if (!consts)
+            return false;
+        dst->consts = consts;
+        dst->constsCap = src->nconsts;
+    }
+    if (src->len)
+        memcpy(dst->code, src->code, src->len * sizeof(*src->code));
+    if (src->nconsts)
+        memcpy(dst->consts, src->consts, src->nconsts * sizeof(*src->consts));
+    dst->len = src->len;
+    dst->nconsts = src->nconsts;
+    dst->depth = src->depth;
+    dst->maxDepth = src->maxDepth;
+    dst->nregs = src->nregs;
+    dst->nvars = src->nvars;
+    return true;
+}
+
+static int stackEffect(enum OpCode op)
+{
+    switch (op) {
+    case OP_CONST:
+    case OP_VAR:
+    case OP_LOAD:
+        return 1;
+    case OP_ADD:
+    case OP_SUB:
+    case OP_MUL:
+    case OP_DIV:
+    case OP_POW:
+        return -1;
+    default:
+        return 0; //< unary operators, functions and OP_STORE
+    }
+}
+
+bool emitInstruction(struct Program* prog, enum OpCode op, unsigned arg)
+{
+    if (prog->len == prog->cap) {
+        unsigned cap = prog->cap ? 2 * prog->cap : 16;
+        struct Instruction* code = arenaOrHeapRealloc(
+            prog->arena, prog->code, prog->cap * sizeof(*code), cap * sizeof(*code));
+        if (!code)
+            return false;
+        prog->code = code;
+        prog->cap = cap;
+    }
+    prog->code[prog->len].op = op;
+    prog->code[prog->len].arg = arg;
+    prog->len++;
+    prog->depth += stackEffect(op);
+    if (op == OP_VAR && arg >= prog->nvars)
+        prog->nvars = arg + 1;
+    if (prog->depth > prog->maxDepth)
+        prog->maxDepth = prog->depth;
+    return true;
+}
+
+bool emitConstant(struct Program* prog, double value)
+{
+    if (prog->nconsts == prog->constsCap) {
+        unsigned cap = prog->constsCap ? 2 * prog->constsCap : 8;
+        double* consts = arenaOrHeapRealloc(
+            prog->arena, prog->consts, prog->constsCap * sizeof(*consts), cap * sizeof(*consts));
+        if (!consts)
+            return false;
+        prog->consts = consts;
+        prog->constsCap = cap;
+    }
+    prog->consts[prog->nconsts] = value;
+    return emitInstruction(prog, OP_CONST, prog->nconsts++);
+}
+
+struct Expression compileExpression(const char* expr, struct Program* prog)
+{
+    return compileExpressionWithSymbols(expr, prog, NULL);
+}
+
+struct Expression compileExpressionWithSymbols(
+    const char* expr, struct Program* prog, struct SymbolTable* symbols)
+{
+    return compileExpressionView(expr, (unsigned)strlen(expr), prog, symbols);
+}
+
+struct Expression compileExpressionView(
+    const char* expr, unsigned len, struct Program* prog, struct SymbolTable* symbols)
+{
+    uint64_t start = statsStartTimer();
+    // NaN poisons every value depending on a variable, so the parser's division check only
+    // fires for divisors that are zero regardless of the variables. The caller's values are kept
+    // out of it by parsing against a copy of the table.
+    struct Expression e = createExpressionView(expr, len);
+    e.var.value = NAN;
+    struct SymbolTable scratch;
+    if (symbols) {
+        scratch = *symbols;
+        for (unsigned i = 0; i < scratch.count; i++)
+            scratch.vars[i].value = NAN;
+        e.symbols = &scratch;
+    }
+    e.prog = prog;
+    struct Token_t buf[TOKEN_BUFFER_SIZE];
+    size_t ntokens = (size_t)len + 1;
+    struct Token_t* tokens = ntokens <= TOKEN_BUFFER_SIZE
+        ? buf
+        : arenaOrHeapAlloc(prog->arena, ntokens * sizeof(*tokens));
+    if (tokens)
+        tokenizeExpression(&e, tokens, (unsigned)ntokens);
+    evaluateExpression(&e);
+    if (tokens != buf)
+        arenaOrHeapFree(prog->arena, tokens);
+    e.tokens = NULL;
+    if (e.result == RES_OK && prog->depth != 1) {
+        e.result = RES_ERR_INTERNAL;
+        e.errIdx = e.currIdx;
+        e.errMsg = "Malformed program";
+    }
+    if (symbols) {
+        for (unsigned i = symbols->count; i < scratch.count; i++) {
+            symbols->vars[i] = scratch.vars[i];
+            symbols->vars[i].value = 0.;
+        }
+        symbols->count = scratch.count;
+        e.symbols = symbols;
+    }
+    e.prog = NULL;
+    statsAddParseTime(start);
+    return e;
+}
+
+double evaluateProgram(const struct Program* prog, double x)
+{
+    // registers live right above the operand stack
+    double buf[PROGRAM_STACK_SIZE];
+    double* stack = buf;
+    size_t slots = (size_t)prog->maxDepth + prog->nregs;
+    if (slots > PROGRAM_STACK_SIZE) {
+        stack = malloc(slots * sizeof(*stack));
+        if (!stack)
+            return NAN;
+    }
+    double* regs = stack + prog->maxDepth;
+    const double* consts = prog->consts;
+    double* top = stack - 1;
+    const struct Instruction* ip = prog->code;
+    const struct Instruction* end = ip + prog->len;
+    for (; ip != end; ++ip) {
+        switch (ip->op) {
+        case OP_CONST:
+            *++top = consts[ip->arg];
+            break;
+        case OP_VAR:
+            *++top = x;
+            break;
+        case OP_NEG:
+            *top = -*top;
+            break;
+        case OP_ADD:
+            top[-1] += top[0];
+            --top;
+            break;
+        case OP_SUB:
+            top[-1] -= top[0];
+            --top;
+            break;
+        case OP_MUL:
+            top[-1] *= top[0];
+            --top;
+            break;
+        case OP_DIV:
+            top[-1] /= top[0];
+            --top;
+            break;
+        case OP_POW:
+            top[-1] = pow(top[-1], top[0]);
+            --top;
+            break;
+        case OP_SIN:
+            *top = sin(*top);
+            break;
+        case OP_COS:
+            *top = cos(*top);
+            break;
+        case OP_TAN:
+            *top = tan(*top);
+            break;
+        case OP_ATAN:
+            *top = atan(*top);
+            break;
+        case OP_EXP:
+            *top = exp(*top);
+            break;
+        case OP_SQRT:
+            *top = sqrt(*top);
+            break;
+        case OP_LOAD:
+            *++top = regs[ip->arg];
+            break;
+        case OP_STORE:
+            regs[ip->arg] = *top;
+            break;
+        }
+    }
+    double result = top >= stack ? *top : NAN;
+    if (stack != buf)
+        free(stack);
+    return result;
+}
+
+struct Dual {
+    double v; //< value
+    double d; //< derivative with respect to the variable
+};
+
+// d(a^b) = b a^(b-1) a' + a^b log(a) b', leaving out a term whose derivative is zero: a constant
+// exponent is fine with a negative base and a constant base with a zero exponent
+static struct Dual dualPow(struct Dual a, struct Dual b)
+{
+    struct Dual r = { pow(a.v, b.v), 0. };
+    if (a.d != 0)
+        r.d += b.v * pow(a.v, b.v - 1.) * a.d;
+    if (b.d != 0)
+        r.d += r.v * log(a.v) * b.d;
+    return r;
+}
+
+double evaluateProgramDual(const struct Program* prog, double x, double* dfdx)
+{
+    // slot 0 is a sentinel so the operands can be loaded before dispatching on the opcode
+    struct Dual buf[PROGRAM_STACK_SIZE + 1];
+    struct Dual* stack = buf;
+    size_t slots = (size_t)prog->maxDepth + 1 + prog->nregs;
+    if (slots > PROGRAM_STACK_SIZE + 1) {
+        stack = malloc(slots * sizeof(*stack));
+        if (!stack) {
+            *dfdx = NAN;
+            return NAN;
+        }
+    }
+    struct Dual* regs = stack + prog->maxDepth + 1;
+    const double* consts = prog->consts;
+    struct Dual* top = stack;
+    top->v = 0.;
+    top->d = 0.;
+    const struct Instruction* ip = prog->code;
+    const struct Instruction* end = ip + prog->len;
+    for (; ip != end; ++ip) {
+        double a = top->v;
+        double da = top->d;
+        switch (ip->op) {
+        case OP_CONST:
+            ++top;
+            top->v = consts[ip->arg];
+            top->d = 0.;
+            break;
+        case OP_VAR:
+            ++top;
+            top->v = x;
+            top->d = 1.;
+            break;
+        case OP_NEG:
+            top->v = -a;
+            top->d = -da;
+            break;
+        case OP_ADD:
+            top[-1].v += a;
+            top[-1].d += da;
+            --top;
+            break;
+        case OP_SUB:
+            top[-1].v -= a;
+            top[-1].d -= da;
+            --top;
+            break;
+        case OP_MUL:
+            top[-1].d = top[-1].d * a + top[-1].v * da;
+            top[-1].v *= a;
+            --top;
+            break;
+        case OP_DIV:
+            top[-1].v /= a;
+            top[-1].d = (top[-1].d - top[-1].v * da) / a;
+            --top;
+            break;
+        case OP_POW:
+            top[-1] = dualPow(top[-1], top[0]);
+            --top;
+            break;
+        case OP_SIN:
+            top->v = sin(a);
+            top->d = cos(a) * da;
+            break;
+        case OP_COS:
+            top->v = cos(a);
+            top->d = -sin(a) * da;
+            break;
+        case OP_TAN:
+            top->v = tan(a);
+            top->d = (1. + top->v * top->v) * da;
+            break;
+        case OP_ATAN:
+            top->v = atan(a);
+            top->d = da / (1. + a * a);
+            break;
+        case OP_EXP:
+            top->v = exp(a);
+            top->d = top->v * da;
+            break;
+        case OP_SQRT:
+            top->v = sqrt(a);
+            top->d = da / (2. * top->v);
+            break;
+        case OP_LOAD:
+            *++top = regs[ip->arg];
+            break;
+        case OP_STORE:
+            regs[ip->arg] = *top;
+            break;
+        }
+    }
+    struct Dual result = { NAN, NAN };
+    if (top > stack)
+        result = *top;
+    if (stack != buf)
+        free(stack);
+    *dfdx = result.d;
+    return result.v;
+}
+
+// Truncated Taylor series around the point of evaluation, c[k] = f^(k)(x) / k!. Only the first
+// `n` coefficients are computed; the recurrences follow from differentiating u = f(a) once, e.g.
+// exp: u' = u a', so k u_k = sum_j j a_j u_(k-j).
+struct Taylor {
+    double c[TAYLOR_MAX_ORDER + 1];
+};
+
+static struct Taylor taylorMul(const struct Taylor* a, const struct Taylor* b, unsigned n)
+{
+    struct Taylor r = { { 0. } };
+    for (unsigned k = 0; k < n; k++) {
+        r.c[k] = 0.;
+        for (unsigned j = 0; j <= k; j++)
+            r.c[k] += a->c[j] * b->c[k - j];
+    }
+    return r;
+}
+
+static struct Taylor taylorDiv(const struct Taylor* a, const struct Taylor* b, unsigned n)
+{
+    struct Taylor r = { { 0. } };
+    for (unsigned k = 0; k < n; k++) {
+        double sum = a->c[k];
+        for (unsigned j = 1; j <= k; j++)
+            sum -= b->c[j] * r.c[k - j];
+        r.c[k] = sum / b->c[0];
+    }
+    return r;
+}
+
+// u' = g a' for a series g known up to the previous coefficient when u_k is computed
+static double taylorChain(const struct Taylor* a, const struct Taylor* g, unsigned k)
+{
+    double sum = 0.;
+    for (unsigned j = 1; j <= k; j++)
+        sum += j * a->c[j] * g->c[k - j];
+    return sum / k;
+}
+
+static void taylorSinCos(const struct Taylor* a, struct Taylor* s, struct Taylor* c, unsigned n)
+{
+    s->c[0] = sin(a->c[0]);
+    c->c[0] = cos(a->c[0]);
+    for (unsigned k = 1; k < n; k++) {
+        s->c[k] = taylorChain(a, c, k);
+        c->c[k] = -taylorChain(a, s, k);
+    }
+}
+
+static struct Taylor taylorTan(const struct Taylor* a, unsigned n)
+{
+    struct Taylor t;
+    struct Taylor sec2; //< 1 + t^2
+    t.c[0] = tan(a->c[0]);
+    sec2.c[0] = 1. + t.c[0] * t.c[0];
+    for (unsigned k = 1; k < n; k++) {
+        t.c[k] = taylorChain(a, &sec2, k);
+        sec2.c[k] = 0.;
+        for (unsigned j = 0; j <= k; j++)
+            sec2.c[k] += t.c[j] * t.c[k - j];
+    }
+    return t;
+}
+
+static struct Taylor taylorAtan(const struct Taylor* a, unsigned n)
+{
+    // atan(a)' = a' / (1 + a^2), integrated term by term
+    struct Taylor da = { { 0. } };
+    for (unsigned k = 0; k + 1 < n; k++)
+        da.c[k] = (k + 1) * a->c[k + 1];
+    struct Taylor w = taylorMul(a, a, n);
+    w.c[0] += 1.;
+    struct Taylor q = taylorDiv(&da, &w, n - 1);
+    struct Taylor r;
+    r.c[0] = atan(a->c[0]);
+    for (unsigned k = 1; k < n; k++)
+        r.c[k] = q.c[k - 1] / k;
+    return r;
+}
+
+static struct Taylor taylorExp(const struct Taylor* a, unsigned n)
+{
+    struct Taylor e;
+    e.c[0] = exp(a->c[0]);
+    for (unsigned k = 1; k < n; k++)
+        e.c[k] = taylorChain(a, &e, k);
+    return e;
+}
+
+static struct Taylor taylorSqrt(const struct Taylor* a, unsigned n)
+{
+    struct Taylor s;
+    s.c[0] = sqrt(a->c[0]);
+    for (unsigned k = 1; k < n; k++) {
+        double sum = a->c[k];
+        for (unsigned j = 1; j < k; j++)
+            sum -= s.c[j] * s.c[k - j];
+        s.c[k] = sum / (2. * s.c[0]);
+    }
+    return s;
+}
+
+static struct Taylor taylorLog(const struct Taylor* a, unsigned n)
+{
+    // a l' = a', so k a_0 l_k = k a_k - sum j l_j a_(k-j)
+    struct Taylor l;
+    l.c[0] = log(a->c[0]);
+    for (unsigned k = 1; k < n; k++) {
+        double sum = k * a->c[k];
+        for (unsigned j = 1; j < k; j++)
+            sum -= j * l.c[j] * a->c[k - j];
+        l.c[k] = sum / (k * a->c[0]);
+    }
+    return l;
+}
+
+static bool isConstantSeries(const struct Taylor* a, unsigned n)
+{
+    for (unsigned k = 1; k < n; k++) {
+        if (a->c[k] != 0)
+            return false;
+    }
+    return true;
+}
+
+// An integer exponent is applied by repeated squaring, which also holds at a zero base. Any
+// other constant one follows a u' = e u a' like the functions above, and a varying exponent
+// goes through exp(b log a).
+static struct Taylor taylorPow(const struct Taylor* a, const struct Taylor* b, unsigned n)
+{
+    double e = b->c[0];
+    struct Taylor u = { { 0. } };
+    if (isConstantSeries(b, n) && e == nearbyint(e) && fabs(e) <= TAYLOR_POW_INTEGER_MAX) {
+        struct Taylor base = *a;
+        u.c[0] = 1.;
+        for (unsigned long m = (unsigned long)fabs(e); m; m >>= 1) {
+            if (m & 1)
+                u = taylorMul(&u, &base, n);
+            if (m > 1)
+                base = taylorMul(&base, &base, n);
+        }
+        if (e < 0) {
+            struct Taylor one = { { 1. } };
+            u = taylorDiv(&one, &u, n);
+        }
+        u.c[0] = pow(a->c[0], e); //< the value evaluateProgram() has
+    } else if (isConstantSeries(b, n)) {
+        // a_0 k u_k = sum (e j - (k - j)) a_j u_(k-j)
+        u.c[0] = pow(a->c[0], e);
+        for (unsigned k = 1; k < n; k++) {
+            double sum = 0.;
+            for (unsigned j = 1; j <= k; j++)
+                sum += (e * j - (k - j)) * a->c[j] * u.c[k - j];
+            u.c[k] = sum / (k * a->c[0]);
+        }
+    } else {
+        struct Taylor l = taylorLog(a, n);
+        struct Taylor m = taylorMul(b, &l, n);
+        u.c[0] = pow(a->c[0], e);
+        for (unsigned k = 1; k < n; k++)
+            u.c[k] = taylorChain(&m, &u, k);
+    }
+    return u;
+}
+
+double evaluateProgramDerivatives(
+    const struct Program* prog, double x, unsigned order, double* derivs)
+{
+    if (order > TAYLOR_MAX_ORDER)
+        order = TAYLOR_MAX_ORDER;
+    unsigned n = order + 1;
+    // slot 0 is a sentinel that tells an empty program apart
+    struct Taylor buf[PROGRAM_STACK_SIZE + 1];
+    struct Taylor* stack = buf;
+    size_t slots = (size_t)prog->maxDepth + 1 + prog->nregs;
+    if (slots > PROGRAM_STACK_SIZE + 1)
+        stack = malloc(slots * sizeof(*stack));
+    if (!stack) {
+        for (unsigned k = 0; k < order; k++)
+            derivs[k] = NAN;
+        return NAN;
+    }
+    struct Taylor* regs = stack + prog->maxDepth + 1;
+    struct Taylor* top = stack;
+    const struct Instruction* ip = prog->code;
+    const struct Instruction* end = ip + prog->len;
+    for (; ip != end; ++ip) {
+        switch (ip->op) {
+        case OP_CONST:
+        case OP_VAR:
+            ++top;
+            memset(top, 0, sizeof(*top));
+            top->c[0] = ip->op == OP_CONST ? prog->consts[ip->arg] : x;
+            top->c[1] = ip->op == OP_VAR;
+            break;
+        case OP_LOAD:
+            *++top = regs[ip->arg];
+            break;
+        case OP_STORE:
+            regs[ip->arg] = *top;
+            break;
+        case OP_NEG:
+            for (unsigned k = 0; k < n; k++)
+                top->c[k] = -top->c[k];
+            break;
+        case OP_ADD:
+            for (unsigned k = 0; k < n; k++)
+                top[-1].c[k] += top->c[k];
+            --top;
+            break;
+        case OP_SUB:
+            for (unsigned k = 0; k < n; k++)
+                top[-1].c[k] -= top->c[k];
+            --top;
+            break;
+        case OP_MUL:
+            top[-1] = taylorMul(&top[-1], top, n);
+            --top;
+            break;
+        case OP_DIV:
+            top[-1] = taylorDiv(&top[-1], top, n);
+            --top;
+            break;
+        case OP_POW:
+            top[-1] = taylorPow(&top[-1], top, n);
+            --top;
+            break;
+        case OP_SIN:
+        case OP_COS: {
+            struct Taylor s;
+            struct Taylor c;
+            taylorSinCos(top, &s, &c, n);
+            *top = ip->op == OP_SIN ? s : c;
+            break;
+        }
+        case OP_TAN:
+            *top = taylorTan(top, n);
+            break;
+        case OP_ATAN:
+            *top = taylorAtan(top, n);
+            break;
+        case OP_EXP:
+            *top = taylorExp(top, n);
+            break;
+        case OP_SQRT:
+            *top = taylorSqrt(top, n);
+            break;
+        }
+    }
+    double result = NAN;
+    double factorial = 1.;
+    for (unsigned k = 0; k < order; k++) {
+        factorial *= k + 1;
+        derivs[k] = top > stack ? top->c[k + 1] * factorial : NAN;
+    }
+    if (top > stack)
+        result = top->c[0];
+    if (stack != buf)
+        free(stack);
+    return result;
+}
+
+static void scaleGradient(double* grad, unsigned n, double s)
+{
+    for (unsigned k = 0; k < n; k++)
+        grad[k] = s * grad[k];
+}
+
+static void divideGradient(double* grad, unsigned n, double s)
+{
+    for (unsigned k = 0; k < n; k++)
+        grad[k] = grad[k] / s;
+}
+
+double evaluateProgramGradient(
+    const struct Program* prog, const double* vars, unsigned nvars, double* grad)
+{
+    // every entry is a value followed by its nvars partial derivatives, registers follow the stack
+    size_t width = (size_t)nvars + 1;
+    size_t size = ((size_t)prog->maxDepth + prog->nregs) * width;
+    double buf[GRADIENT_BUFFER_SIZE];
+    double* stack = buf;
+    if (size > GRADIENT_BUFFER_SIZE)
+        stack = malloc(size * sizeof(*stack));
+    if (!stack || prog->nvars > nvars) {
+        for (unsigned k = 0; k < nvars; k++)
+            grad[k] = NAN;
+        if (stack != buf)
+            free(stack);
+        return NAN;
+    }
+    double* regs = stack + prog->maxDepth * width;
+    unsigned depth = 0;
+    const struct Instruction* ip = prog->code;
+    const struct Instruction* end = ip + prog->len;
+    for (; ip != end; ++ip) {
+        double* top = stack + (depth > 0 ? depth - 1 : 0) * width;
+        double* left = depth > 1 ? top - width : top; //< left operand of binary operators
+        double a = depth > 0 ? top[0] : 0.;
+        switch (ip->op) {
+        case OP_CONST:
+        case OP_VAR:
+            top = stack + depth++ * width;
+            memset(top + 1, 0, nvars * sizeof(*top));
+            top[0] = ip->op == OP_CONST ? prog->consts[ip->arg] : vars[ip->arg];
+            if (ip->op == OP_VAR)
+                top[1 + ip->arg] = 1.;
+            break;
+        case OP_LOAD:
+            top = stack + depth++ * width;
+            memcpy(top, regs + ip->arg * width, width * sizeof(*top));
+            break;
+        case OP_STORE:
+            memcpy(regs + ip->arg * width, top, width * sizeof(*top));
+            break;
+        case OP_NEG:
+            for (size_t k = 0; k < width; k++)
+                top[k] = -top[k];
+            break;
+        case OP_ADD:
+            for (size_t k = 0; k < width; k++)
+                left[k] += top[k];
+            depth--;
+            break;
+        case OP_SUB:
+            for (size_t k = 0; k < width; k++)
+                left[k] -= top[k];
+            depth--;
+            break;
+        case OP_MUL:
+            for (size_t k = 1; k < width; k++)
+                left[k] = left[k] * a + left[0] * top[k];
+            left[0] *= a;
+            depth--;
+            break;
+        case OP_DIV:
+            left[0] /= a;
+            for (size_t k = 1; k < width; k++)
+                left[k] = (left[k] - left[0] * top[k]) / a;
+            depth--;
+            break;
+        case OP_POW: // like dualPow() for every variable
+            for (size_t k = 1; k < width; k++) {
+                struct Dual base = { left[0], left[k] };
+                struct Dual exponent = { a, top[k] };
+                left[k] = dualPow(base, exponent).d;
+            }
+            left[0] = pow(left[0], a);
+            depth--;
+            break;
+        case OP_SIN:
+            top[0] = sin(a);
+            scaleGradient(top + 1, nvars, cos(a));
+            break;
+        case OP_COS:
+            top[0] = cos(a);
+            scaleGradient(top + 1, nvars, -sin(a));
+            break;
+        case OP_TAN:
+            top[0] = tan(a);
+            scaleGradient(top + 1, nvars, 1. + top[0] * top[0]);
+            break;
+        case OP_ATAN:
+            top[0] = atan(a);
+            divideGradient(top + 1, nvars, 1. + a * a);
+            break;
+        case OP_EXP:
+            top[0] = exp(a);
+            scaleGradient(top + 1, nvars, top[0]);
+            break;
+        case OP_SQRT:
+            top[0] = sqrt(a);
+            divideGradient(top + 1, nvars, 2. * top[0]);
+            break;
+        }
+    }
+    double result = NAN;
+    if (depth > 0) {
+        const double* top = stack + (depth - 1) * width;
+        result = top[0];
+        memcpy(grad, top + 1, nvars * sizeof(*grad));
+    } else {
+        for (unsigned k = 0; k < nvars; k++)
+            grad[k] = NAN;
+    }
+    if (stack != buf)
+        free(stack);
+    return result;
+}
@@ -0,0 +1,142 @@
+#ifndef PROGRAM_H
+#define PROGRAM_H
+
+#include "parser.h"
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum OpCode {
+    OP_CONST, //< push consts[arg]
+    OP_VAR, //< push variable arg (always 0 in single-variable programs)
+    OP_NEG,
+    OP_ADD,
+    OP_SUB,
+    OP_MUL,
+    OP_DIV,
+    OP_POW, //< pow(), the exponent on top
+    OP_SIN,
+    OP_COS,
+    OP_TAN,
+    OP_ATAN,
+    OP_EXP,
+    OP_SQRT,
+    OP_LOAD, //< push register arg
+    OP_STORE, //< copy the top of the stack into register arg, leaving it in place
+};
+
+struct Instruction {
+    enum OpCode op;
+    unsigned arg;
+};
+
+struct Arena;
+
+// Accuracy of sin, cos, tan, atan and exp in evaluateBatch(), given as the largest error
+// against the exact result. The scalar evaluators always call libm.
+enum MathAccuracy {
+    ACCURACY_EXACT, //< libm, the same results as evaluateProgram()
+    ACCURACY_1ULP, //< vector kernels within 1 ulp, see vecmath.h
+    ACCURACY_FAST, //< shorter polynomials within 4 ulp
+};
+
+// Flat postfix instruction tape produced by the parser. Evaluation is a single pass over `code`
+// with an operand stack of at most `maxDepth` entries; no text is touched after compilation.
+struct Program {
+    struct Instruction* code;
+    unsigned len;
+    unsigned cap;
+    double* consts;
+    unsigned nconsts;
+    unsigned constsCap;
+    unsigned depth; //< operand stack depth at the end of the tape (1 for a complete program)
+    unsigned maxDepth;
+    unsigned nregs; //< registers holding shared subexpressions, see optimizeProgram()
+    unsigned nvars; //< one more than the highest variable slot used
+    struct Arena* arena; //< owns code, consts and the compiler's scratch memory when set
+    enum MathAccuracy accuracy; //< ACCURACY_EXACT unless set after compiling
+};
+
+struct Program createProgram(void);
+// The program's memory, and the temporary memory of compiling and optimizing it, comes from the
+// arena and is released by resetArena() instead of freeProgram()
+struct Program createProgramInArena(struct Arena* arena);
+void freeProgram(struct Program* prog); //< keeps the arena of an arena program
+void clearProgram(struct Program* prog); //< empties the program but keeps its buffers for reuse
+// Replaces the contents of dst, reusing its buffers. Returns false, with dst unchanged, when
+// memory runs out.
+bool copyProgram(struct Program* dst, const struct Program* src);
+bool emitInstruction(struct Program* prog, enum OpCode op, unsigned arg);
+bool emitConstant(struct Program* prog, double value);
+
+// Parses `expr` once and records it into `prog`. The returned expression carries the parsing
+// result and the variable name. Only division by a constant zero is reported at compile time;
+// divisions depending on the variable follow IEEE-754 in evaluateProgram().
+struct Expression compileExpression(const char* expr, struct Program* prog);
+// Same for expressions with several variables, OP_VAR refers to their slots in `symbols`. Several
+// expressions compiled with the same table share the slots. The values already in the table are
+// left as they were, variables added to it start at 0.
+struct Expression compileExpressionWithSymbols(
+    const char* expr, struct Program* prog, struct SymbolTable* symbols);
+// Compiles the first len characters of expr in place; symbols may be NULL
+struct Expression compileExpressionView(
+    const char* expr, unsigned len, struct Program* prog, struct SymbolTable* symbols);
+// The evaluators below take a single variable x, every OP_VAR pushes it
+double evaluateProgram(const struct Program* prog, double x);
+// Forward-mode automatic differentiation: returns f(x) and stores the exact f'(x) in *dfdx
+double evaluateProgramDual(const struct Program* prog, double x, double* dfdx);
+#define TAYLOR_MAX_ORDER 3 //< highest derivative of evaluateProgramDerivatives()
+
+// Higher-order forward-mode AD on truncated Taylor series: returns f(x) and stores the exact
+// derivatives f'(x), f''(x), ... up to the given order (at most TAYLOR_MAX_ORDER) in
+// derivs[0..order)
+double evaluateProgramDerivatives(
+    const struct Program* prog, double x, unsigned order, double* derivs);
+// Multi-variable forward-mode AD: returns f(vars) and stores the nvars partial derivatives in
+// grad, all of them computed in one pass over the tape. prog->nvars must not exceed nvars.
+double evaluateProgramGradient(
+    const struct Program* prog, const double* vars, unsigned nvars, double* grad);
+
+// Rebuilds the tape as a DAG and rewrites it in place: constant subexpressions are folded,
+// identities that hold exactly in IEEE-754 (x+0, x-0, x*1, x/1, -(-x), ...) are removed and
+// repeated subexpressions are computed once and kept in a register. Results are bit-identical to
+// the original tape except that x+0 may turn a -0 into +0. Division by a constant zero is never
+// folded. Returns false and leaves the program untouched when memory runs out.
+bool optimizeProgram(struct Program* prog);
+
+// Closed interval [lo, hi]; the bounds may be infinite. NaN bounds denote the empty interval.
+struct Interval {
+    double lo;
+    double hi;
+};
+
+// Interval extension with forward-mode derivatives: the result encloses f(t) and *dfdx encloses
+// f'(t) for every t in x where f is defined, despite rounding. Points where f is undefined (a
+// negative square root, a division by zero) are left out, so an empty result proves that f is
+// defined nowhere in x. Bounds are rounded outwards, sin/cos/tan are reduced over their periods
+// and a divisor containing zero yields a one-sided or unbounded quotient.
+struct Interval evaluateProgramInterval(
+    const struct Program* prog, struct Interval x, struct Interval* dfdx);
+
+enum SimdLevel {
+    SIMD_SCALAR,
+    SIMD_SSE2,
+    SIMD_AVX2,
+    SIMD_AVX512,
+};
+
+enum SimdLevel detectSimdLevel(void); //< best instruction set supported by this CPU
+// Evaluates the program at n points, out[i] = f(xs[i]). The kernel is picked at runtime from the
+// CPU features; evaluateBatchSimd() caps it at `level` (mostly useful for testing).
+void evaluateBatch(const struct Program* prog, const double* xs, double* out, size_t n);
+void evaluateBatchSimd(
+    const struct Program* prog, const double* xs, double* out, size_t n, enum SimdLevel level);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,552 @@
+#define _GNU_SOURCE //< accept4()
+#include "serve.h"
+#include "fr.h"
+#include "pool.h"
+#include "stream.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// One thread owns the sockets: it accepts, reads requests and writes responses from an epoll
+// loop. Solving happens on a pool of workers that live as long as the server, each with its own
+// library context. At most one batch is in flight; requests read meanwhile wait in `pending` and
+// go out together as the next batch, so a burst of small requests costs one hand-off instead of
+// one per request. Batches complete in order, which keeps responses in request order.
+// A connection is not read while it has SERVE_MAX_PENDING requests in flight or responses the
+// peer has not taken, so a client that sends without reading only fills its own socket buffer.
+
+#define MAX_EVENTS 64
+#define READ_SIZE 16384 //< minimum free space offered to read()
+// Per-connection cap of each buffer, the connection is closed rather than grown beyond it. The
+// input holds one maximal request plus a read; the output the responses of a full read of
+// empty requests on top of SERVE_MAX_PENDING.
+#define MAX_BUFFER ((size_t)SERVE_MAX_REQUEST + sizeof(uint32_t) + READ_SIZE)
+
+struct Connection {
+    int fd; //< -1 when the slot is unused
+    unsigned gen; //< bumped on close so responses for a previous connection are dropped
+    char* in;
+    size_t inLen;
+    size_t inCap;
+    char* out;
+    size_t outPos; //< bytes of out already sent
+    size_t outLen;
+    size_t outCap;
+    unsigned pending; //< requests in flight
+    uint32_t events; //< registered with epoll
+    bool eof; //< the peer stopped sending, close once every request is answered
+    bool writing; //< waiting for EPOLLOUT
+};
+
+struct Job {
+    int fd;
+    unsigned gen;
+    char* text;
+    struct ServeResponse response;
+};
+
+struct JobList {
+    struct Job* jobs;
+    size_t len;
+    size_t cap;
+};
+
+struct Server {
+    const struct ServeOptions* opts;
+    int epoll;
+    int doneFd; //< eventfd written by the worker that finishes a batch
+    struct Connection* conns; //< indexed by descriptor
+    size_t nconns;
+    struct JobList pending; //< requests for the next batch
+    struct JobList batch; //< requests being solved
+    bool busy;
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    size_t next; //< next job of the batch to hand out
+    size_t finished;
+    bool stop;
+};
+
+static void solveJob(struct FrContext* ctx, const struct ServeOptions* opts, struct Job* job)
+{
+    struct ServeResponse* r = &job->response;
+    memset(r, 0, sizeof(*r));
+    const char* expr;
+    double x0 = opts->x0;
+    double tol = opts->tol;
+    if (!ctx) {
+        r->result = RES_ERR_INTERNAL;
+        return;
+    }
+    if (!parseRequestLine(job->text, &expr, &x0, &tol)) {
+        r->result = RES_ERR_INVALID_INPUT;
+        return;
+    }
+    struct FrOptions o = frDefaultOptions();
+    o.x0 = x0;
+    o.tol = tol;
+    o.maxiter = opts->maxiter;
+    o.cache = opts->cache;
+    frSetOptions(ctx, &o);
+    struct FrResult fr = frSolve(ctx, expr);
+    r->result = fr.parsing;
+    r->status = fr.status;
+    r->errIdx = fr.errIdx;
+    r->iterations = fr.iterations;
+    r->x = fr.var[0] ? fr.x : fr.f;
+    r->f = fr.f;
+}
+
+static void* runWorker(void* arg)
+{
+    struct Server* s = arg;
+    struct FrContext* ctx = frCreateContext(NULL); //< keeps the last expression compiled
+    pthread_mutex_lock(&s->lock);
+    for (;;) {
+        while (!s->stop && s->next >= s->batch.len)
+            pthread_cond_wait(&s->work, &s->lock);
+        if (s->stop)
+            break;
+        struct Job* job = &s->batch.jobs[s->next++];
+        pthread_mutex_unlock(&s->lock);
+
+        solveJob(ctx, s->opts, job);
+
+        pthread_mutex_lock(&s->lock);
+        if (++s->finished == s->batch.len) {
+            uint64_t one = 1;
+            ssize_t rc = write(s->doneFd, &one, sizeof(one));
+            (void)rc; //< only fails when the counter overflows
+        }
+    }
+    pthread_mutex_unlock(&s->lock);
+    frDestroyContext(ctx);
+    return NULL;
+}
+
+static bool growBuffer(char** buf, size_t* cap, size_t needed)
+{
+    if (needed <= *cap)
+        return true;
+    if (needed > MAX_BUFFER)
+        return false;
+    size_t newCap = *cap ? *cap : READ_SIZE;
+    while (newCap < needed)
+        newCap *= 2;
+    if (newCap > MAX_BUFFER)
+        newCap = MAX_BUFFER;
+    char* p = realloc(*buf, newCap);
+    if (!p)
+        return false;
+    *buf = p;
+    *cap = newCap;
+    return true;
+}
+
+static bool isReadable(const struct Connection* c)
+{
+    return !c->eof && !c->writing && c->pending < SERVE_MAX_PENDING;
+}
+
+static void updateEvents(struct Server* s, struct Connection* c)
+{
+    uint32_t events = (isReadable(c) ? EPOLLIN : 0) | (c->writing ? EPOLLOUT : 0);
+    if (events == c->events)
+        return;
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.fd = c->fd;
+    epoll_ctl(s->epoll, EPOLL_CTL_MOD, c->fd, &ev);
+    c->events = events;
+}
+
+static void closeConnection(struct Server* s, struct Connection* c)
+{
+    epoll_ctl(s->epoll, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+    free(c->in);
+    free(c->out);
+    unsigned gen = c->gen + 1;
+    memset(c, 0, sizeof(*c));
+    c->fd = -1;
+    c->gen = gen;
+}
+
+static struct Connection* findConnection(struct Server* s, int fd, unsigned gen)
+{
+    if (fd < 0 || (size_t)fd >= s->nconns)
+        return NULL;
+    struct Connection* c = &s->conns[fd];
+    return c->fd == fd && c->gen == gen ? c : NULL;
+}
+
+static void flushConnection(struct Server* s, struct Connection* c)
+{
+    while (c->outPos < c->outLen) {
+        ssize_t n = send(c->fd, c->out + c->outPos, c->outLen - c->outPos, MSG_NOSIGNAL);
+        if (n > 0) {
+            c->outPos += n;
+        } else if (n < 0 && errno == EAGAIN) {
+            if (!c->writing) {
+                c->writing = true;
+                updateEvents(s, c);
+            }
+            return;
+        } else if (!(n < 0 && errno == EINTR)) {
+            closeConnection(s, c);
+            return;
+        }
+    }
+    c->outPos = 0;
+    c->outLen = 0;
+    if (c->eof && c->pending == 0) {
+        closeConnection(s, c);
+    } else if (c->writing) {
+        c->writing = false;
+        updateEvents(s, c);
+    }
+}
+
+static bool queueJob(struct Server* s, struct Connection* c, const char* text, uint32_t len)
+{
+    struct JobList* list = &s->pending;
+    if (list->len == list->cap) {
+        size_t cap = list->cap ? 2 * list->cap : 64;
+        struct Job* jobs = realloc(list->jobs, cap * sizeof(*jobs));
+        if (!jobs)
+            return false;
+        list->jobs = jobs;
+        list->cap = cap;
+    }
+    char* copy = malloc((size_t)len + 1);
+    if (!copy)
+        return false;
+    memcpy(copy, text, len);
+    copy[len] = '\0';
+    struct Job* job = &list->jobs[list->len++];
+    job->fd = c->fd;
+    job->gen = c->gen;
+    job->text = copy;
+    c->pending++;
+    return true;
+}
+
+// Queues every complete request of the input buffer, returns false on a protocol error
+static bool takeRequests(struct Server* s, struct Connection* c)
+{
+    size_t pos = 0;
+    while (c->inLen - pos >= sizeof(uint32_t)) {
+        uint32_t len;
+        memcpy(&len, c->in + pos, sizeof(len));
+        if (len > SERVE_MAX_REQUEST)
+            return false;
+        if (c->inLen - pos - sizeof(len) < len)
+            break;
+        if (!queueJob(s, c, c->in + pos + sizeof(len), len))
+            return false;
+        pos += sizeof(len) + len;
+    }
+    memmove(c->in, c->in + pos, c->inLen - pos);
+    c->inLen -= pos;
+    return true;
+}
+
+static void readConnection(struct Server* s, struct Connection* c)
+{
+    for (;;) {
+        if (!isReadable(c)) {
+            updateEvents(s, c); //< resumed once the responses are taken
+            return;
+        }
+        if (!growBuffer(&c->in, &c->inCap, c->inLen + READ_SIZE)) {
+            closeConnection(s, c);
+            return;
+        }
+        ssize_t n = read(c->fd, c->in + c->inLen, READ_SIZE); //< bounds the requests per read
+        if (n > 0) {
+            c->inLen += n;
+            if (!takeRequests(s, c)) {
+                closeConnection(s, c);
+                return;
+            }
+        } else if (n == 0) {
+            c->eof = true;
+            updateEvents(s, c);
+            if (c->pending == 0 && c->outLen == 0)
+                closeConnection(s, c);
+            return;
+        } else if (errno == EAGAIN) {
+            return;
+        } else if (errno != EINTR) {
+            closeConnection(s, c);
+            return;
+        }
+    }
+}
+
+static void acceptConnections(struct Server* s, int listenFd)
+{
+    for (;;) {
+        int fd = accept4(listenFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0)
+            return; //< EAGAIN, or a connection that went away before it was accepted
+        if ((size_t)fd >= s->nconns) {
+            size_t n = s->nconns ? 2 * s->nconns : 64;
+            while (n <= (size_t)fd)
+                n *= 2;
+            struct Connection* conns = realloc(s->conns, n * sizeof(*conns));
+            if (!conns) {
+                close(fd);
+                continue;
+            }
+            memset(conns + s->nconns, 0, (n - s->nconns) * sizeof(*conns));
+            for (size_t i = s->nconns; i < n; i++)
+                conns[i].fd = -1;
+            s->conns = conns;
+            s->nconns = n;
+        }
+        struct Connection* c = &s->conns[fd];
+        c->fd = fd;
+        c->events = EPOLLIN;
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = c->events;
+        ev.data.fd = fd;
+        if (epoll_ctl(s->epoll, EPOLL_CTL_ADD, fd, &ev) < 0)
+            closeConnection(s, c);
+    }
+}
+
+static void dispatchBatch(struct Server* s)
+{
+    pthread_mutex_lock(&s->lock);
+    struct JobList done = s->batch; //< empty, only its buffer is recycled
+    s->batch = s->pending;
+    s->pending = done;
+    s->pending.len = 0;
+    s->next = 0;
+    s->finished = 0;
+    s->busy = true;
+    pthread_cond_broadcast(&s->work);
+    pthread_mutex_unlock(&s->lock);
+}
+
+static void completeBatch(struct Server* s)
+{
+    uint64_t count;
+    if (read(s->doneFd, &count, sizeof(count)) < 0)
+        return;
+    pthread_mutex_lock(&s->lock); //< makes the workers' results visible
+    size_t n = s->batch.len;
+    pthread_mutex_unlock(&s->lock);
+    struct Job* jobs = s->batch.jobs;
+    for (size_t i = 0; i < n; i++) {
+        struct Connection* c = findConnection(s, jobs[i].fd, jobs[i].gen);
+        free(jobs[i].text);
+        if (!c)
+            continue; //< the client went away
+        c->pending--;
+        uint32_t len = sizeof(jobs[i].response);
+        if (!growBuffer(&c->out, &c->outCap, c->outLen + sizeof(len) + len)) {
+            closeConnection(s, c);
+            continue;
+        }
+        memcpy(c->out + c->outLen, &len, sizeof(len));
+        memcpy(c->out + c->outLen + sizeof(len), &jobs[i].response, len);
+        c->outLen += sizeof(len) + len;
+    }
+    for (size_t i = 0; i < n; i++) {
+        struct Connection* c = findConnection(s, jobs[i].fd, jobs[i].gen);
+        if (c && !c->writing)
+            flushConnection(s, c);
+        c = findConnection(s, jobs[i].fd, jobs[i].gen);
+        if (c)
+            updateEvents(s, c); //< reading resumes below SERVE_MAX_PENDING
+    }
+    pthread_mutex_lock(&s->lock);
+    s->batch.len = 0;
+    s->busy = false;
+    pthread_mutex_unlock(&s->lock);
+}
+
+static bool watch(int epoll, int fd)
+{
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    return epoll_ctl(epoll, EPOLL_CTL_ADD, fd, &ev) == 0;
+}
+
+static void runLoop(struct Server* s, int listenFd, int stopFd)
+{
+    struct epoll_event events[MAX_EVENTS];
+    for (;;) {
+        int n = epoll_wait(s->epoll, events, MAX_EVENTS, -1);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return;
+        for (int i = 0; i < n; i++) {
+            int fd = events[i].data.fd;
+            if (fd == stopFd)
+                return;
+            if (fd == listenFd) {
+                acceptConnections(s, listenFd);
+            } else if (fd == s->doneFd) {
+                completeBatch(s);
+            } else if ((size_t)fd < s->nconns && s->conns[fd].fd == fd) {
+                struct Connection* c = &s->conns[fd];
+                if (events[i].events & (EPOLLHUP | EPOLLERR)) {
+                    closeConnection(s, c); //< nothing can be sent back any more
+                    continue;
+                }
+                if (events[i].events & EPOLLIN)
+                    readConnection(s, c);
+                if (c->fd == fd && (events[i].events & EPOLLOUT))
+                    flushConnection(s, c);
+            }
+        }
+        if (!s->busy && s->pending.len > 0)
+            dispatchBatch(s);
+    }
+}
+
+int serveLoop(int listenFd, int stopFd, const struct ServeOptions* opts)
+{
+    struct Server s;
+    memset(&s, 0, sizeof(s));
+    s.opts = opts;
+    s.epoll = epoll_create1(EPOLL_CLOEXEC);
+    s.doneFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    int flags = fcntl(listenFd, F_GETFL);
+    bool ok = s.epoll >= 0 && s.doneFd >= 0 && flags >= 0
+        && fcntl(listenFd, F_SETFL, flags | O_NONBLOCK) == 0 && watch(s.epoll, listenFd)
+        && watch(s.epoll, stopFd) && watch(s.epoll, s.doneFd);
+    int err = errno;
+    pthread_mutex_init(&s.lock, NULL);
+    pthread_cond_init(&s.work, NULL);
+    unsigned nworkers = opts->nthreads ? opts->nthreads : defaultThreadCount();
+    pthread_t* workers = ok ? malloc(nworkers * sizeof(*workers)) : NULL;
+    unsigned started = 0;
+    while (workers && started < nworkers
+        && pthread_create(&workers[started], NULL, runWorker, &s) == 0)
+        started++;
+    if (ok && started == 0) {
+        ok = false;
+        err = ENOMEM;
+    }
+
+    if (ok)
+        runLoop(&s, listenFd, stopFd);
+
+    pthread_mutex_lock(&s.lock);
+    s.stop = true;
+    pthread_cond_broadcast(&s.work);
+    pthread_mutex_unlock(&s.lock);
+    for (unsigned i = 0; i < started; i++)
+        pthread_join(workers[i], NULL);
+    free(workers);
+    for (size_t i = 0; i < s.nconns; i++) {
+        if (s.conns[i].fd >= 0)
+            closeConnection(&s, &s.conns[i]);
+    }
+    free(s.conns);
+    for (size_t i = 0; i < s.pending.len; i++)
+        free(s.pending.jobs[i].text);
+    for (size_t i = 0; i < s.batch.len; i++)
+        free(s.batch.jobs[i].text);
+    free(s.pending.jobs);
+    free(s.batch.jobs);
+    pthread_mutex_destroy(&s.lock);
+    pthread_cond_destroy(&s.work);
+    if (s.doneFd >= 0)
+        close(s.doneFd);
+    if (s.epoll >= 0)
+        close(s.epoll);
+    errno = err;
+    return ok ? 0 : -1;
+}
+
+// True if nobody listens on the socket file any more
+static bool isStale(const struct sockaddr_un* addr)
+{
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return false;
+    bool stale = connect(fd, (const struct sockaddr*)addr, sizeof(*addr)) < 0
+        && errno == ECONNREFUSED;
+    close(fd);
+    return stale;
+}
+
+int serveListen(const char* path)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (fd < 0)
+        return -1;
+    int rc = bind(fd, (const struct sockaddr*)&addr, sizeof(addr));
+    if (rc < 0 && errno == EADDRINUSE && isStale(&addr)) {
+        unlink(path);
+        rc = bind(fd, (const struct sockaddr*)&addr, sizeof(addr));
+    }
+    if (rc < 0 || listen(fd, SOMAXCONN) < 0) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+    return fd;
+}
+
+int serve(const char* path, const struct ServeOptions* opts)
+{
+    // blocked before the workers start so that they inherit the mask
+    sigset_t signals;
+    sigset_t previous;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    if (pthread_sigmask(SIG_BLOCK, &signals, &previous) != 0)
+        return -1;
+    int rc = -1;
+    int stopFd = signalfd(-1, &signals, SFD_CLOEXEC | SFD_NONBLOCK);
+    int listenFd = stopFd >= 0 ? serveListen(path) : -1;
+    if (listenFd >= 0) {
+        rc = serveLoop(listenFd, stopFd, opts);
+        int err = errno;
+        close(listenFd);
+        unlink(path);
+        errno = err;
+    }
+    int err = errno;
+    if (stopFd >= 0) {
+        // takes the stop signal, which would otherwise be delivered once unblocked
+        struct signalfd_siginfo info;
+        while (read(stopFd, &info, sizeof(info)) == sizeof(info))
+            continue;
+        close(stopFd);
+    }
+    pthread_sigmask(SIG_SETMASK, &previous, NULL);
+    errno = err;
+    return rc;
+}
@@ -0,0 +1,50 @@
+#ifndef SERVE_H
+#define SERVE_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct ExprCache;
+
+// Protocol, all integers in host byte order since the socket is local:
+//   request:  uint32 length, then `length` bytes of text <expr>[;<x0>[;<tol>]] (no NUL needed)
+//   response: uint32 length (= sizeof(struct ServeResponse)), then the struct below
+// Responses on a connection come in request order. Requests may be pipelined.
+struct ServeResponse {
+    int32_t result; //< enum ParsingResult
+    int32_t status; //< enum SolveStatus, meaningful when result is RES_OK
+    uint32_t errIdx; //< index of the offending character when result is not RES_OK
+    uint32_t iterations;
+    double x; //< root, or the value of an expression without a variable
+    double f; //< f(x)
+};
+
+#define SERVE_MAX_REQUEST (1u << 20) //< longer requests close the connection
+#define SERVE_MAX_PENDING 1024 //< unanswered requests after which a connection is not read
+
+struct ServeOptions {
+    double x0; //< defaults for requests that do not set their own
+    double tol;
+    unsigned maxiter;
+    unsigned nthreads; //< workers, 0 means one per core
+    struct ExprCache* cache; //< compiled expressions shared by the workers, may be NULL
+};
+
+// Binds a listening Unix domain socket at path, replacing a stale socket file. Returns the
+// descriptor or -1 with errno set.
+int serveListen(const char* path);
+// Serves connections accepted on listenFd until stopFd becomes readable. Requests arriving while
+// the workers are busy are coalesced into the next batch. Returns 0, or -1 with errno set if the
+// server could not be set up.
+int serveLoop(int listenFd, int stopFd, const struct ServeOptions* opts);
+// serveListen() and serveLoop() until SIGINT or SIGTERM, then removes the socket file
+int serve(const char* path, const struct ServeOptions* opts);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,995 @@
+#include "solver.h"
+#include "pool.h"
+#include "stats.h"
+
+#include <float.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+static double evaluateProgramObjective(const void* ctx, double x, double* dfdx)
+{
+    return evaluateProgramDual(ctx, x, dfdx);
+}
+
+static void evaluateProgramObjectiveBatch(
+    const void* ctx, const double* xs, double* out, size_t n)
+{
+    evaluateBatch(ctx, xs, out, n);
+}
+
+static struct Interval evaluateProgramObjectiveInterval(
+    const void* ctx, struct Interval x, struct Interval* dfdx)
+{
+    return evaluateProgramInterval(ctx, x, dfdx);
+}
+
+static double evaluateProgramObjectiveDerivatives(
+    const void* ctx, double x, unsigned order, double* derivs)
+{
+    return evaluateProgramDerivatives(ctx, x, order, derivs);
+}
+
+// Every point evaluation of the solvers goes through here to be counted
+static double evaluateDual(struct Objective f, double x, double* dfdx)
+{
+    statsAddEvals(1);
+    return f.eval(f.ctx, x, dfdx);
+}
+
+static double evaluateDerivatives(struct Objective f, double x, unsigned order, double* derivs)
+{
+    statsAddEvals(1);
+    return f.evalDerivatives(f.ctx, x, order, derivs);
+}
+
+struct Objective programObjective(const struct Program* prog)
+{
+    struct Objective f = { evaluateProgramObjective, evaluateProgramObjectiveBatch, prog,
+        evaluateProgramObjectiveInterval, evaluateProgramObjectiveDerivatives };
+    return f;
+}
+
+struct SolveResult newtonSolve(struct Objective f, double x0, double tol, unsigned maxiter)
+{
+    struct SolveResult r;
+    r.x = x0;
+    double step = 0;
+    for (r.iterations = 0;; r.iterations++) {
+        r.f = evaluateDual(f, r.x, &r.fprime);
+        statsTraceIteration("newton", r.iterations, r.x, r.f, step);
+        if (!isfinite(r.f)) {
+            r.status = SOLVE_NOT_FINITE;
+            return r;
+        }
+        if (fabs(r.f) <= tol) {
+            r.status = SOLVE_OK;
+            return r;
+        }
+        if (r.iterations == maxiter) {
+            r.status = SOLVE_MAXITER;
+            return r;
+        }
+        if (r.fprime == 0) {
+            r.status = SOLVE_ZERO_DERIVATIVE;
+            return r;
+        }
+        double dx = r.f / r.fprime;
+        r.x -= dx;
+        step = fabs(dx);
+    }
+}
+
+#define DAMPING_STEPS 8 //< halvings of a Newton step that does not decrease |f|
+
+// Step of Householder's method written as a correction of the Newton step h = f / f', with
+// l = h f'' / f':
+//   Halley        h / (1 - l/2)
+//   Householder3  h (1 - l/2) / (1 - l + h^2 f''' / (6 f'))
+// The Newton step itself when the correction factor is outside (0, 2].
+static double householderStep(double f, const double* d, unsigned order)
+{
+    double h = f / d[0];
+    if (order < 2)
+        return h;
+    double l = h * d[1] / d[0];
+    double factor = order == 2 ? 1. / (1. - 0.5 * l)
+                               : (1. - 0.5 * l) / (1. - l + h * h * d[2] / (6. * d[0]));
+    return factor > 0. && factor <= 2. ? h * factor : h;
+}
+
+struct SolveResult householderSolve(
+    struct Objective f, unsigned order, double x0, double tol, unsigned maxiter)
+{
+    if (!f.evalDerivatives)
+        return newtonSolve(f, x0, tol, maxiter);
+    if (order < 1)
+        order = 1;
+    if (order > TAYLOR_MAX_ORDER)
+        order = TAYLOR_MAX_ORDER;
+    const char* name = order == 1 ? "newton" : order == 2 ? "halley" : "householder3";
+    double d[TAYLOR_MAX_ORDER];
+    double next[TAYLOR_MAX_ORDER];
+    struct SolveResult r;
+    r.x = x0;
+    r.f = evaluateDerivatives(f, r.x, order, d);
+    double step = 0;
+    for (r.iterations = 0;; r.iterations++) {
+        r.fprime = d[0];
+        statsTraceIteration(name, r.iterations, r.x, r.f, step);
+        if (!isfinite(r.f)) {
+            r.status = SOLVE_NOT_FINITE;
+            return r;
+        }
+        if (fabs(r.f) <= tol) {
+            r.status = SOLVE_OK;
+            return r;
+        }
+        if (r.iterations == maxiter) {
+            r.status = SOLVE_MAXITER;
+            return r;
+        }
+        if (r.fprime == 0) {
+            r.status = SOLVE_ZERO_DERIVATIVE;
+            return r;
+        }
+        double newton = r.f / r.fprime;
+        double dx = householderStep(r.f, d, order);
+        double fx = evaluateDerivatives(f, r.x - dx, order, next);
+        // damped Newton, the full step is skipped if it was tried above already
+        double t = dx == newton ? 0.5 : 1.;
+        for (unsigned k = 0; !(fabs(fx) < fabs(r.f)) && k < DAMPING_STEPS; k++, t *= 0.5) {
+            dx = t * newton;
+            fx = evaluateDerivatives(f, r.x - dx, order, next);
+        }
+        r.x -= dx;
+        r.f = fx;
+        memcpy(d, next, order * sizeof(*d));
+        step = fabs(dx);
+    }
+}
+
+struct MultiStart {
+    struct Objective f;
+    unsigned order; //< of householderSolve(), 0 for plain newtonSolve()
+    double a;
+    double b;
+    unsigned starts;
+    double tol;
+    unsigned maxiter;
+    struct SolveResult* results;
+};
+
+static void solveSeeds(void* ctx, size_t begin, size_t end, unsigned worker)
+{
+    (void)worker;
+    struct MultiStart* ms = ctx;
+    for (size_t i = begin; i < end; i++) {
+        double t = ms->starts > 1 ? (double)i / (ms->starts - 1) : 0.5;
+        double x0 = ms->a + (ms->b - ms->a) * t;
+        ms->results[i] = ms->order ? householderSolve(ms->f, ms->order, x0, ms->tol, ms->maxiter)
+                                   : newtonSolve(ms->f, x0, ms->tol, ms->maxiter);
+    }
+}
+
+static int compareResults(const void* l, const void* r)
+{
+    double a = ((const struct SolveResult*)l)->x;
+    double b = ((const struct SolveResult*)r)->x;
+    return (a > b) - (a < b);
+}
+
+// Sorts the converged results and stores one root per cluster of equivalent results
+static void collectRoots(struct Objective f, struct SolveResult* results, size_t n, double tol,
+    double* roots, size_t* nroots)
+{
+    qsort(results, n, sizeof(*results), compareResults);
+    // Neighbours are the same root when they are within tol of each other or when f stays within
+    // the tolerance between them (as around multiple roots); the smallest |f| represents them.
+    struct SolveResult* last = NULL;
+    *nroots = 0;
+    for (size_t i = 0; i < n; i++) {
+        struct SolveResult* r = &results[i];
+        if (last) {
+            bool same = r->x - last->x <= tol;
+            if (!same) { //< the midpoint is only evaluated for results the distance keeps apart
+                double dfdx;
+                same = fabs(evaluateDual(f, 0.5 * (last->x + r->x), &dfdx)) <= tol;
+            }
+            if (same) {
+                if (fabs(r->f) < fabs(last->f))
+                    *last = *r;
+                continue;
+            }
+        }
+        last = &results[(*nroots)++];
+        *last = *r;
+    }
+    for (size_t i = 0; i < *nroots; i++)
+        roots[i] = results[i].x;
+}
+
+static bool multiStart(struct Objective f, unsigned order, double a, double b, unsigned starts,
+    double tol, unsigned maxiter, unsigned nthreads, double* roots, size_t* nroots)
+{
+    *nroots = 0;
+    struct SolveResult* results = malloc(starts * sizeof(*results));
+    if (!results)
+        return false;
+    struct MultiStart ms = { f, order, a, b, starts, tol, maxiter, results };
+    parallelFor(starts, 1, nthreads, solveSeeds, &ms);
+    size_t n = 0;
+    for (unsigned i = 0; i < starts; i++) {
+        if (results[i].status == SOLVE_OK && results[i].x >= a && results[i].x <= b)
+            results[n++] = results[i];
+    }
+    collectRoots(f, results, n, tol, roots, nroots);
+    free(results);
+    return true;
+}
+
+bool newtonMultiStart(struct Objective f, double a, double b, unsigned starts, double tol,
+    unsigned maxiter, unsigned nthreads, double* roots, size_t* nroots)
+{
+    return multiStart(f, 0, a, b, starts, tol, maxiter, nthreads, roots, nroots);
+}
+
+bool householderMultiStart(struct Objective f, unsigned order, double a, double b,
+    unsigned starts, double tol, unsigned maxiter, unsigned nthreads, double* roots,
+    size_t* nroots)
+{
+    return multiStart(f, order ? order : 1, a, b, starts, tol, maxiter, nthreads, roots, nroots);
+}
+
+static double evaluate(struct Objective f, double x)
+{
+    double dfdx;
+    return evaluateDual(f, x, &dfdx);
+}
+
+static struct SolveResult bracketResult(
+    enum SolveStatus status, double x, double fx, unsigned iterations)
+{
+    struct SolveResult r = { status, x, fx, NAN, iterations };
+    return r;
+}
+
+static struct SolveResult bisect(
+    struct Objective f, double lo, double hi, double flo, double tol, unsigned maxiter)
+{
+    for (unsigned i = 0;; i++) {
+        double mid = lo + 0.5 * (hi - lo);
+        if (mid <= lo || mid >= hi)
+            return bracketResult(SOLVE_BRACKET_COLLAPSED, mid, evaluate(f, mid), i);
+        double fmid = evaluate(f, mid);
+        statsTraceIteration("bisect", i, mid, fmid, hi - lo);
+        if (fabs(fmid) <= tol)
+            return bracketResult(SOLVE_OK, mid, fmid, i);
+        if (i == maxiter)
+            return bracketResult(SOLVE_MAXITER, mid, fmid, i);
+        if ((fmid < 0) == (flo < 0)) {
+            lo = mid;
+            flo = fmid;
+        } else {
+            hi = mid;
+        }
+    }
+}
+
+// Regula falsi that halves the function value kept at an end point which survives twice in a row
+static struct SolveResult illinois(struct Objective f, double lo, double hi, double flo,
+    double fhi, double tol, unsigned maxiter)
+{
+    int side = 0; //< -1 if lo was retained by the previous step, +1 for hi
+    for (unsigned i = 0;; i++) {
+        double c = (lo * fhi - hi * flo) / (fhi - flo);
+        if (!(c > lo && c < hi))
+            c = lo + 0.5 * (hi - lo); //< rounding pushed the secant point out of the bracket
+        if (c <= lo || c >= hi)
+            return bracketResult(SOLVE_BRACKET_COLLAPSED, c, evaluate(f, c), i);
+        double fc = evaluate(f, c);
+        statsTraceIteration("illinois", i, c, fc, hi - lo);
+        if (fabs(fc) <= tol)
+            return bracketResult(SOLVE_OK, c, fc, i);
+        if (i == maxiter)
+            return bracketResult(SOLVE_MAXITER, c, fc, i);
+        if ((fc < 0) == (fhi < 0)) {
+            hi = c;
+            fhi = fc;
+            if (side == -1)
+                flo *= 0.5;
+            side = -1;
+        } else {
+            lo = c;
+            flo = fc;
+            if (side == 1)
+                fhi *= 0.5;
+            side = 1;
+        }
+    }
+}
+
+// Brent's method following R. P. Brent, "Algorithms for Minimization without Derivatives", ch. 4
+static struct SolveResult brent(struct Objective f, double a, double b, double fa, double fb,
+    double tol, unsigned maxiter)
+{
+    double c = b;
+    double fc = fb;
+    double d = b - a;
+    double e = d;
+    for (unsigned i = 0;; i++) {
+        if ((fb > 0) == (fc > 0)) {
+            c = a;
+            fc = fa;
+            d = b - a;
+            e = d;
+        }
+        if (fabs(fc) < fabs(fb)) {
+            a = b;
+            b = c;
+            c = a;
+            fa = fb;
+            fb = fc;
+            fc = fa;
+        }
+        double tol1 = 2. * DBL_EPSILON * fabs(b) + DBL_MIN;
+        double xm = 0.5 * (c - b);
+        statsTraceIteration("brent", i, b, fb, fabs(c - b));
+        if (fabs(fb) <= tol)
+            return bracketResult(SOLVE_OK, b, fb, i);
+        if (fabs(xm) <= tol1)
+            return bracketResult(SOLVE_BRACKET_COLLAPSED, b, fb, i);
+        if (i == maxiter)
+            return bracketResult(SOLVE_MAXITER, b, fb, i);
+        if (fabs(e) >= tol1 && fabs(fa) > fabs(fb)) {
+            // inverse quadratic interpolation, or secant when only two points are distinct
+            double s = fb / fa;
+            double p, q;
+            if (a == c) {
+                p = 2. * xm * s;
+                q = 1. - s;
+            } else {
+                double r = fb / fc;
+                q = fa / fc;
+                p = s * (2. * xm * q * (q - r) - (b - a) * (r - 1.));
+                q = (q - 1.) * (r - 1.) * (s - 1.);
+            }
+            if (p > 0)
+                q = -q;
+            p = fabs(p);
+            double min1 = 3. * xm * q - fabs(tol1 * q);
+            double min2 = fabs(e * q);
+            if (2. * p < (min1 < min2 ? min1 : min2)) {
+                e = d;
+                d = p / q;
+            } else {
+                d = xm; //< interpolation rejected, bisect
+                e = d;
+            }
+        } else {
+            d = xm;
+            e = d;
+        }
+        a = b;
+        fa = fb;
+        b += fabs(d) > tol1 ? d : copysign(tol1, xm);
+        fb = evaluate(f, b);
+    }
+}
+
+// Newton steps that fall outside the bracket or do not shrink it fast enough are replaced by
+// bisection (rtsafe in Numerical Recipes)
+static struct SolveResult hybrid(
+    struct Objective f, double lo, double hi, double flo, double tol, unsigned maxiter)
+{
+    if (flo > 0) { //< orient the bracket so that f(lo) < 0
+        double t = lo;
+        lo = hi;
+        hi = t;
+    }
+    double x = 0.5 * (lo + hi);
+    double dxold = fabs(hi - lo);
+    double dx = dxold;
+    struct SolveResult r;
+    r.x = x;
+    r.f = evaluateDual(f, x, &r.fprime);
+    for (r.iterations = 0;; r.iterations++) {
+        statsTraceIteration("hybrid", r.iterations, r.x, r.f, fabs(hi - lo));
+        if (fabs(r.f) <= tol) {
+            r.status = SOLVE_OK;
+            return r;
+        }
+        if (!isfinite(r.f)) { //< its sign cannot pick a side of the bracket
+            r.status = SOLVE_NOT_FINITE;
+            return r;
+        }
+        if (r.iterations == maxiter) {
+            r.status = SOLVE_MAXITER;
+            return r;
+        }
+        if (r.f < 0) //< shrink the bracket before bisecting it
+            lo = r.x;
+        else
+            hi = r.x;
+        double prev = r.x;
+        if (!isfinite(r.fprime) || ((r.x - hi) * r.fprime - r.f) * ((r.x - lo) * r.fprime - r.f) > 0
+            || fabs(2. * r.f) > fabs(dxold * r.fprime)) {
+            dxold = dx;
+            dx = 0.5 * (hi - lo);
+            r.x = lo + dx;
+        } else {
+            dxold = dx;
+            dx = r.f / r.fprime;
+            r.x -= dx;
+        }
+        if (r.x == prev) {
+            r.status = SOLVE_BRACKET_COLLAPSED;
+            return r;
+        }
+        r.f = evaluateDual(f, r.x, &r.fprime);
+    }
+}
+
+static struct SolveResult solveSignChange(struct Objective f, enum SolveMethod method, double a,
+    double b, double fa, double fb, double tol, unsigned maxiter)
+{
+    if (fabs(fa) <= tol)
+        return bracketResult(SOLVE_OK, a, fa, 0);
+    if (fabs(fb) <= tol)
+        return bracketResult(SOLVE_OK, b, fb, 0);
+    if (!isfinite(fa) || !isfinite(fb))
+        return bracketResult(SOLVE_NOT_FINITE, isfinite(fa) ? b : a, isfinite(fa) ? fb : fa, 0);
+    if ((fa < 0) == (fb < 0))
+        return bracketResult(SOLVE_NO_BRACKET, a, fa, 0);
+    switch (method) {
+    case METHOD_BISECT:
+        return bisect(f, a, b, fa, tol, maxiter);
+    case METHOD_ILLINOIS:
+        return illinois(f, a, b, fa, fb, tol, maxiter);
+    case METHOD_HYBRID:
+        return hybrid(f, a, b, fa, tol, maxiter);
+    default:
+        return brent(f, a, b, fa, fb, tol, maxiter);
+    }
+}
+
+struct SolveResult bracketSolve(
+    struct Objective f, enum SolveMethod method, double a, double b, double tol, unsigned maxiter)
+{
+    if (a > b) {
+        double t = a;
+        a = b;
+        b = t;
+    }
+    return solveSignChange(f, method, a, b, evaluate(f, a), evaluate(f, b), tol, maxiter);
+}
+
+struct BracketScan {
+    struct Objective f;
+    enum SolveMethod method;
+    const double* xs;
+    const double* fs;
+    const unsigned* brackets; //< grid index of the left end point of every sign change
+    double tol;
+    unsigned maxiter;
+    struct SolveResult* results;
+};
+
+static void solveBrackets(void* ctx, size_t begin, size_t end, unsigned worker)
+{
+    (void)worker;
+    struct BracketScan* scan = ctx;
+    for (size_t i = begin; i < end; i++) {
+        unsigned j = scan->brackets[i];
+        scan->results[i] = solveSignChange(scan->f, scan->method, scan->xs[j], scan->xs[j + 1],
+            scan->fs[j], scan->fs[j + 1], scan->tol, scan->maxiter);
+    }
+}
+
+bool bracketMultiSolve(struct Objective f, enum SolveMethod method, double a, double b,
+    unsigned intervals, double tol, unsigned maxiter, unsigned nthreads, double* roots,
+    size_t* nroots)
+{
+    *nroots = 0;
+    size_t npoints = (size_t)intervals + 1;
+    double* xs = malloc(npoints * sizeof(*xs));
+    double* fs = malloc(npoints * sizeof(*fs));
+    unsigned* brackets = malloc(intervals * sizeof(*brackets));
+    struct SolveResult* results = malloc(intervals * sizeof(*results));
+    if (!xs || !fs || !brackets || !results) {
+        free(xs);
+        free(fs);
+        free(brackets);
+        free(results);
+        return false;
+    }
+    for (size_t i = 0; i < npoints; i++)
+        xs[i] = i == intervals ? b : a + (b - a) * ((double)i / intervals);
+    if (f.evalBatch) {
+        statsAddEvals(npoints);
+        f.evalBatch(f.ctx, xs, fs, npoints);
+    } else {
+        for (size_t i = 0; i < npoints; i++)
+            fs[i] = evaluate(f, xs[i]);
+    }
+    unsigned nbrackets = 0;
+    for (unsigned i = 0; i < intervals; i++) {
+        if (fs[i] == 0 || (fs[i] < 0) != (fs[i + 1] < 0) || fs[i + 1] == 0)
+            brackets[nbrackets++] = i;
+    }
+    struct BracketScan scan = { f, method, xs, fs, brackets, tol, maxiter, results };
+    parallelFor(nbrackets, 1, nthreads, solveBrackets, &scan);
+    size_t n = 0;
+    for (unsigned i = 0; i < nbrackets; i++) {
+        if (results[i].status == SOLVE_OK)
+            results[n++] = results[i];
+    }
+    collectRoots(f, results, n, tol, roots, nroots);
+    free(xs);
+    free(fs);
+    free(brackets);
+    free(results);
+    return true;
+}
+
+struct Box {
+    double lo;
+    double hi;
+    unsigned depth; //< number of splits and contractions since the initial interval
+};
+
+struct RootList {
+    struct SolveResult* items;
+    size_t len;
+    size_t cap;
+    bool failed; //< a root could not be stored
+};
+
+struct IntervalSearch {
+    struct Objective f;
+    double a;
+    double b;
+    unsigned intervals;
+    double tol;
+    unsigned maxiter;
+    struct RootList* found; //< one list per initial interval
+};
+
+static void appendRoot(struct RootList* list, struct SolveResult r)
+{
+    if (list->len == list->cap) {
+        size_t cap = list->cap ? 2 * list->cap : 8;
+        struct SolveResult* items = realloc(list->items, cap * sizeof(*items));
+        if (!items) {
+            list->failed = true;
+            return;
+        }
+        list->items = items;
+        list->cap = cap;
+    }
+    list->items[list->len++] = r;
+}
+
+static struct Interval evaluateInterval(
+    struct Objective f, double lo, double hi, struct Interval* dfdx)
+{
+    struct Interval x = { lo, hi };
+    statsAddIntervalEval();
+    return f.evalInterval(f.ctx, x, dfdx);
+}
+
+static bool containsZero(struct Interval y) { return y.lo <= 0 && y.hi >= 0; } //< false if empty
+
+static bool isEmptyInterval(struct Interval y) { return isnan(y.lo) || isnan(y.hi); }
+
+static void pushBox(struct Box* stack, size_t* n, double lo, double hi, unsigned depth)
+{
+    struct Box box = { lo, hi, depth };
+    stack[(*n)++] = box;
+}
+
+// Solves a box where f is monotone, so it holds a root only if f changes sign between its ends.
+// Returns false when an end point is outside the domain of f and the box has to be split.
+static bool solveMonotone(const struct IntervalSearch* s, struct Box x, struct RootList* found)
+{
+    struct Interval d;
+    struct Interval flo = evaluateInterval(s->f, x.lo, x.lo, &d);
+    struct Interval fhi = evaluateInterval(s->f, x.hi, x.hi, &d);
+    if (isEmptyInterval(flo) || isEmptyInterval(fhi))
+        return false;
+    if ((flo.lo > 0 && fhi.lo > 0) || (flo.hi < 0 && fhi.hi < 0))
+        return true; //< proven to have the same sign at both ends
+    struct SolveResult r = bracketSolve(s->f, METHOD_HYBRID, x.lo, x.hi, s->tol, s->maxiter);
+    if (r.status == SOLVE_OK)
+        appendRoot(found, r);
+    return true;
+}
+
+// Intersects x with the interval Newton image m - fm / d, where fm excludes zero and encloses
+// f(m), and d encloses f' over x and contains zero. The extended division leaves a gap around m,
+// so up to two pieces remain; returns their number.
+static unsigned contractNewton(
+    struct Box x, double m, struct Interval fm, struct Interval d, struct Box* pieces)
+{
+    // fm / d is the union of (-inf, below] and [above, inf) for the parts of d on either side
+    // of zero; m minus these rays gives [m - below, inf) and (-inf, m - above]
+    double num = fm.lo > 0 ? fm.lo : fm.hi; //< the end of fm closest to zero
+    bool hasBelow = fm.lo > 0 ? d.lo < 0 : d.hi > 0;
+    bool hasAbove = fm.lo > 0 ? d.hi > 0 : d.lo < 0;
+    unsigned n = 0;
+    if (hasAbove) {
+        double above = nextafter(num / (fm.lo > 0 ? d.hi : d.lo), -INFINITY);
+        double hi = fmin(x.hi, nextafter(m - above, INFINITY));
+        if (x.lo <= hi) {
+            pieces[n] = x;
+            pieces[n++].hi = hi;
+        }
+    }
+    if (hasBelow) {
+        double below = nextafter(num / (fm.lo > 0 ? d.lo : d.hi), INFINITY);
+        double lo = fmax(x.lo, nextafter(m - below, -INFINITY));
+        if (lo <= x.hi) {
+            pieces[n] = x;
+            pieces[n++].lo = lo;
+        }
+    }
+    return n;
+}
+
+// Width, relative to the magnitude of its ends, below which a box is no longer split. It is
+// independent of tol, which bounds |f| and says nothing about the resolution in x.
+#define INTERVAL_X_RESOLUTION 0x1p-40
+
+static bool isResolved(struct Box x)
+{
+    double scale = fmax(1., fmax(fabs(x.lo), fabs(x.hi)));
+    return x.hi - x.lo <= INTERVAL_X_RESOLUTION * scale;
+}
+
+// A box that is not split any further while its enclosure still contains zero may hold a root
+// where f touches zero without changing sign, so it is reported at its end or midpoint of
+// smallest |f| rather than discarded on a single sample. Unbounded enclosures are left out unless
+// |f| <= tol there: they may come from a pole instead.
+static void reportCandidate(const struct IntervalSearch* s, struct Box x, double m, bool bounded,
+    struct RootList* found)
+{
+    double xs[3] = { m, x.lo, x.hi };
+    struct SolveResult r = { SOLVE_OK, NAN, NAN, NAN, x.depth };
+    for (unsigned i = 0; i < 3; i++) {
+        double fx = evaluate(s->f, xs[i]);
+        if (isfinite(fx) && !(fabs(fx) >= fabs(r.f))) {
+            r.x = xs[i];
+            r.f = fx;
+        }
+    }
+    if (isfinite(r.f) && (bounded || fabs(r.f) <= s->tol))
+        appendRoot(found, r);
+}
+
+// Branch-and-prune over [lo, hi]; the depth of a box bounds the stack to maxiter + 2 entries
+static void searchInterval(const struct IntervalSearch* s, double lo, double hi, struct Box* stack,
+    struct RootList* found)
+{
+    size_t n = 0;
+    pushBox(stack, &n, lo, hi, 0);
+    while (n > 0) {
+        struct Box x = stack[--n];
+        struct Interval d;
+        struct Interval fx = evaluateInterval(s->f, x.lo, x.hi, &d);
+        if (!containsZero(fx))
+            continue; //< no root, or f is defined nowhere in the box
+        // an unbounded enclosure may hide a pole, where f is neither continuous nor monotone and
+        // the Newton step is invalid, so such boxes are only bisected
+        bool bounded = isfinite(fx.lo) && isfinite(fx.hi);
+        if (bounded && !containsZero(d) && !isEmptyInterval(d) && solveMonotone(s, x, found))
+            continue;
+        double m = 0.5 * x.lo + 0.5 * x.hi;
+        if (x.depth >= s->maxiter || isResolved(x) || m <= x.lo || m >= x.hi) {
+            reportCandidate(s, x, m, bounded, found);
+            continue;
+        }
+        struct Box pieces[2] = { x, x };
+        unsigned npieces = 1;
+        struct Interval dm;
+        struct Interval fm = evaluateInterval(s->f, m, m, &dm);
+        if (bounded && !containsZero(fm) && !isEmptyInterval(fm) && containsZero(d))
+            npieces = contractNewton(x, m, fm, d, pieces);
+        if (npieces == 1 && pieces[0].hi - pieces[0].lo > 0.5 * (x.hi - x.lo)) {
+            // too little progress, bisect instead
+            double mid = 0.5 * pieces[0].lo + 0.5 * pieces[0].hi;
+            pieces[1] = pieces[0];
+            pieces[0].hi = mid;
+            pieces[1].lo = mid;
+            npieces = 2;
+        }
+        for (unsigned i = npieces; i-- > 0;) //< the left piece is searched first
+            pushBox(stack, &n, pieces[i].lo, pieces[i].hi, x.depth + 1);
+    }
+}
+
+static void searchIntervals(void* ctx, size_t begin, size_t end, unsigned worker)
+{
+    (void)worker;
+    struct IntervalSearch* s = ctx;
+    struct Box* stack = malloc(((size_t)s->maxiter + 2) * sizeof(*stack));
+    for (size_t i = begin; i < end; i++) {
+        if (!stack) {
+            s->found[i].failed = true;
+            continue;
+        }
+        double lo = s->a + (s->b - s->a) * ((double)i / s->intervals);
+        double hi = i + 1 == s->intervals
+            ? s->b
+            : s->a + (s->b - s->a) * ((double)(i + 1) / s->intervals);
+        searchInterval(s, lo, hi, stack, &s->found[i]);
+    }
+    free(stack);
+}
+
+bool intervalMultiSolve(struct Objective f, double a, double b, unsigned intervals, double tol,
+    unsigned maxiter, unsigned nthreads, double** roots, size_t* nroots)
+{
+    *roots = NULL;
+    *nroots = 0;
+    if (intervals == 0)
+        intervals = 1;
+    struct RootList* found = calloc(intervals, sizeof(*found));
+    if (!found)
+        return false;
+    struct IntervalSearch s = { f, a, b, intervals, tol, maxiter, found };
+    parallelFor(intervals, 1, nthreads, searchIntervals, &s);
+    size_t n = 0;
+    bool ok = true;
+    for (unsigned i = 0; i < intervals; i++) {
+        n += found[i].len;
+        ok &= !found[i].failed;
+    }
+    struct SolveResult* results = malloc((n ? n : 1) * sizeof(*results));
+    double* all = malloc((n ? n : 1) * sizeof(*all));
+    ok &= results && all;
+    if (ok) {
+        n = 0;
+        for (unsigned i = 0; i < intervals; i++) {
+            for (size_t j = 0; j < found[i].len; j++)
+                results[n++] = found[i].items[j];
+        }
+        collectRoots(f, results, n, tol, all, nroots);
+        *roots = all;
+    } else {
+        free(all);
+    }
+    for (unsigned i = 0; i < intervals; i++)
+        free(found[i].items);
+    free(found);
+    free(results);
+    return ok;
+}
+
+static void evaluateProgramSystem(
+    const void* ctx, unsigned n, const double* x, double* f, double* jacobian)
+{
+    const struct Program* eqs = ctx;
+    for (unsigned i = 0; i < n; i++)
+        f[i] = evaluateProgramGradient(&eqs[i], x, n, jacobian + (size_t)i * n);
+}
+
+struct SystemObjective programSystemObjective(const struct Program* eqs, unsigned n)
+{
+    struct SystemObjective f = { evaluateProgramSystem, eqs, n };
+    return f;
+}
+
+// Solves a y = b by Gaussian elimination with partial pivoting, which factors a into LU in place
+// while applying the same row operations to b. b receives y. Returns false if a is singular.
+static bool luSolve(double* a, double* b, unsigned n)
+{
+    for (unsigned k = 0; k < n; k++) {
+        unsigned pivot = k;
+        for (unsigned i = k + 1; i < n; i++) {
+            if (fabs(a[(size_t)i * n + k]) > fabs(a[(size_t)pivot * n + k]))
+                pivot = i;
+        }
+        if (a[(size_t)pivot * n + k] == 0)
+            return false;
+        if (pivot != k) {
+            for (unsigned j = 0; j < n; j++) {
+                double t = a[(size_t)k * n + j];
+                a[(size_t)k * n + j] = a[(size_t)pivot * n + j];
+                a[(size_t)pivot * n + j] = t;
+            }
+            double t = b[k];
+            b[k] = b[pivot];
+            b[pivot] = t;
+        }
+        const double* row = a + (size_t)k * n;
+        for (unsigned i = k + 1; i < n; i++) {
+            double* other = a + (size_t)i * n;
+            double m = other[k] / row[k];
+            other[k] = m;
+            for (unsigned j = k + 1; j < n; j++)
+                other[j] -= m * row[j];
+            b[i] -= m * b[k];
+        }
+    }
+    for (unsigned k = n; k-- > 0;) {
+        const double* row = a + (size_t)k * n;
+        double sum = b[k];
+        for (unsigned j = k + 1; j < n; j++)
+            sum -= row[j] * b[j];
+        b[k] = sum / row[k];
+    }
+    return true;
+}
+
+bool newtonSystemSolve(
+    struct SystemObjective f, double* x, double tol, unsigned maxiter, struct SystemResult* r)
+{
+    unsigned n = f.n;
+    double* fx = malloc(((size_t)n + (size_t)n * n) * sizeof(*fx));
+    if (!fx)
+        return false;
+    double* jacobian = fx + n;
+    double step = 0; //< max |dx_i| of the previous iteration
+    for (r->iterations = 0;; r->iterations++) {
+        f.eval(f.ctx, n, x, fx, jacobian);
+        statsAddEvals(1);
+        bool finite = true;
+        r->residual = 0;
+        for (unsigned i = 0; i < n; i++) {
+            finite &= isfinite(fx[i]);
+            r->residual = fmax(r->residual, fabs(fx[i]));
+        }
+        statsTraceIteration("system", r->iterations, NAN, r->residual, step);
+        if (!finite) {
+            r->status = SOLVE_NOT_FINITE;
+            break;
+        }
+        if (r->residual <= tol) {
+            r->status = SOLVE_OK;
+            break;
+        }
+        if (r->iterations == maxiter) {
+            r->status = SOLVE_MAXITER;
+            break;
+        }
+        for (size_t i = 0; i < (size_t)n * n; i++)
+            finite &= isfinite(jacobian[i]);
+        if (!finite) {
+            r->status = SOLVE_NOT_FINITE;
+            break;
+        }
+        if (!luSolve(jacobian, fx, n)) {
+            r->status = SOLVE_ZERO_DERIVATIVE;
+            break;
+        }
+        step = 0;
+        for (unsigned i = 0; i < n; i++) {
+            x[i] -= fx[i];
+            step = fmax(step, fabs(fx[i]));
+        }
+    }
+    free(fx);
+    return true;
+}
+
+static double evaluateProgramFamily(
+    const void* ctx, double x, double p, double* dfdx, double* dfdp)
+{
+    const struct ParameterizedProgram* family = ctx;
+    double vars[2] = { 0, 0 };
+    double grad[2];
+    vars[family->x] = x;
+    vars[family->p] = p;
+    double f = evaluateProgramGradient(family->prog, vars, 2, grad);
+    *dfdx = grad[family->x];
+    *dfdp = grad[family->p];
+    return f;
+}
+
+struct FamilyObjective programFamilyObjective(const struct ParameterizedProgram* family)
+{
+    struct FamilyObjective f = { evaluateProgramFamily, family };
+    return f;
+}
+
+// f(.; p) for newtonSolve(), keeping df/dp of the last evaluation for the predictor
+struct FixedParameter {
+    struct FamilyObjective f;
+    double p;
+    double dfdp;
+};
+
+static double evaluateFixedParameter(const void* ctx, double x, double* dfdx)
+{
+    struct FixedParameter* fixed = (struct FixedParameter*)ctx; //< owned by solveStep()
+    return fixed->f.eval(fixed->f.ctx, x, fixed->p, dfdx, &fixed->dfdp);
+}
+
+// Last root found along the continuation and the tangent there
+struct Predictor {
+    bool valid;
+    double x;
+    double p;
+    double slope; //< dx/dp
+};
+
+struct Continuation {
+    struct FamilyObjective f;
+    double x0;
+    double p0;
+    double p1;
+    size_t steps;
+    size_t chunk; //< steps per chunk
+    double tol;
+    unsigned maxiter;
+    struct Predictor* seeds; //< state after the first step of every chunk
+    struct SolveResult* results;
+};
+
+static double parameterAt(const struct Continuation* c, size_t i)
+{
+    return c->steps > 1 ? c->p0 + (c->p1 - c->p0) * ((double)i / (c->steps - 1)) : c->p0;
+}
+
+// Solves step i from the predicted root and moves the predictor on success. A failed step leaves
+// it alone, so the next one predicts from the last root found.
+static void solveStep(const struct Continuation* c, size_t i, struct Predictor* predictor)
+{
+    double p = parameterAt(c, i);
+    double x = c->x0;
+    if (predictor->valid) {
+        x = predictor->x + predictor->slope * (p - predictor->p);
+        if (!isfinite(x))
+            x = predictor->x;
+    }
+    struct FixedParameter fixed = { c->f, p, NAN };
+    struct Objective g = { evaluateFixedParameter, NULL, &fixed, NULL, NULL };
+    struct SolveResult r = newtonSolve(g, x, c->tol, c->maxiter);
+    if (r.status == SOLVE_OK) {
+        double slope = -fixed.dfdp / r.fprime;
+        predictor->valid = true;
+        predictor->x = r.x;
+        predictor->p = p;
+        predictor->slope = isfinite(slope) ? slope : 0;
+    }
+    c->results[i] = r;
+}
+
+static void continueChunks(void* ctx, size_t begin, size_t end, unsigned worker)
+{
+    (void)worker;
+    const struct Continuation* c = ctx;
+    for (size_t k = begin; k < end; k++) {
+        struct Predictor predictor = c->seeds[k];
+        size_t last = (k + 1) * c->chunk < c->steps ? (k + 1) * c->chunk : c->steps;
+        for (size_t i = k * c->chunk + 1; i < last; i++)
+            solveStep(c, i, &predictor);
+    }
+}
+
+bool continuationSolve(struct FamilyObjective f, double x0, double p0, double p1, size_t steps,
+    double tol, unsigned maxiter, unsigned nthreads, struct SolveResult* results)
+{
+    if (steps == 0)
+        return true;
+    if (nthreads == 0)
+        nthreads = defaultThreadCount();
+    // A few chunks per thread balance the load; each one costs a long jump in the sweep
+    size_t chunks = nthreads > 1 ? (size_t)nthreads * 4 : 1;
+    if (chunks > steps)
+        chunks = steps;
+    size_t chunk = (steps + chunks - 1) / chunks;
+    chunks = (steps + chunk - 1) / chunk;
+    struct Predictor* seeds = malloc(chunks * sizeof(*seeds));
+    if (!seeds)
+        return false;
+    struct Continuation c = { f, x0, p0, p1, steps, chunk, tol, maxiter, seeds, results };
+    struct Predictor predictor = { false, x0, p0, 0 };
+    for (size_t k = 0; k < chunks; k++) {
+        solveStep(&c, k * chunk, &predictor);
+        seeds[k] = predictor;
+    }
+    parallelFor(chunks, 1, nthreads, continueChunks, &c);
+    free(seeds);
+    return true;
+}
@@ -0,0 +1,166 @@
+#ifndef SOLVER_H
+#define SOLVER_H
+
+#include "program.h"
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Function whose root is searched for. eval() returns f(x) and stores f'(x) in *dfdx; it must be
+// reentrant because the multi-start solvers call it from several threads at once. The optional
+// evalBatch() stores f(xs[i]) in out[i] and is used for scanning; NULL falls back to eval().
+// evalInterval() encloses f and f' over an interval like evaluateProgramInterval(); only
+// METHOD_INTERVAL needs it. evalDerivatives() returns f(x) and stores f', f'', ... up to `order`
+// like evaluateProgramDerivatives(); householderSolve() runs Newton without it.
+struct Objective {
+    double (*eval)(const void* ctx, double x, double* dfdx);
+    void (*evalBatch)(const void* ctx, const double* xs, double* out, size_t n);
+    const void* ctx;
+    struct Interval (*evalInterval)(const void* ctx, struct Interval x, struct Interval* dfdx);
+    double (*evalDerivatives)(const void* ctx, double x, unsigned order, double* derivs);
+};
+
+struct Objective programObjective(const struct Program* prog); //< forward-mode derivatives
+
+enum SolveStatus {
+    SOLVE_OK,
+    SOLVE_MAXITER, //< |f| still above the tolerance after maxiter iterations
+    SOLVE_ZERO_DERIVATIVE,
+    SOLVE_NOT_FINITE, //< f(x) evaluated to inf or NaN
+    SOLVE_NO_BRACKET, //< f has the same sign at both ends of the interval
+    SOLVE_BRACKET_COLLAPSED, //< interval shrank to adjacent doubles with |f| > tol (e.g. a pole)
+    SOLVE_NOT_POLYNOMIAL, //< METHOD_ABERTH needs a polynomial, see expandPolynomial()
+};
+
+enum SolveMethod {
+    METHOD_NEWTON,
+    METHOD_BISECT,
+    METHOD_BRENT,
+    METHOD_ILLINOIS,
+    METHOD_HYBRID, //< Newton steps safeguarded by bisection
+    METHOD_INTERVAL, //< interval Newton branch-and-prune, see intervalMultiSolve()
+    METHOD_ABERTH, //< all complex roots of a polynomial at once, see aberthSolve()
+    METHOD_HALLEY, //< cubic convergence from f'', see householderSolve()
+    METHOD_HOUSEHOLDER3, //< quartic convergence from f'''
+};
+
+struct SolveResult {
+    enum SolveStatus status;
+    double x; //< root, or the last iterate on failure
+    double f; //< f(x)
+    double fprime; //< f'(x)
+    unsigned iterations;
+};
+
+// Converged means |f(x)| <= tol
+struct SolveResult newtonSolve(struct Objective f, double x0, double tol, unsigned maxiter);
+
+// Runs Newton from `starts` seeds spread evenly over [a, b] on `nthreads` threads (0 means one
+// per core). Roots outside [a, b] are dropped. Roots closer than tol to each other, or with
+// |f| <= tol half-way between them, are reported once. The distinct roots are stored in
+// ascending order in roots[0..*nroots), which must have room for `starts` entries. Returns false
+// if memory could not be allocated.
+bool newtonMultiStart(struct Objective f, double a, double b, unsigned starts, double tol,
+    unsigned maxiter, unsigned nthreads, double* roots, size_t* nroots);
+
+// Householder's method of the given order (1 Newton, 2 Halley, 3 up to TAYLOR_MAX_ORDER) from
+// exact derivatives of f.evalDerivatives. A step of order d converges with order d + 1 near a
+// simple root, at the price of d derivatives per evaluation. The Newton step is taken instead
+// where the higher-order correction would reverse or more than double it, and any step that does
+// not decrease |f| is replaced by a Newton step halved until it does, so the method also
+// converges from starts where plain Newton overshoots. Without f.evalDerivatives this is
+// newtonSolve().
+struct SolveResult householderSolve(
+    struct Objective f, unsigned order, double x0, double tol, unsigned maxiter);
+
+// newtonMultiStart() running householderSolve() from every seed
+bool householderMultiStart(struct Objective f, unsigned order, double a, double b,
+    unsigned starts, double tol, unsigned maxiter, unsigned nthreads, double* roots,
+    size_t* nroots);
+
+// Solves on a bracket [a, b] where f(a) and f(b) have opposite signs. Every iteration costs one
+// evaluation, so the number of evaluations is bounded by maxiter + 2. Not for METHOD_NEWTON.
+struct SolveResult bracketSolve(
+    struct Objective f, enum SolveMethod method, double a, double b, double tol, unsigned maxiter);
+
+// Splits [a, b] into `intervals` equal parts evaluated in one batch and solves every part whose
+// end points have opposite signs with `method`. Roots are reported like newtonMultiStart();
+// roots[] must have room for intervals + 1 entries.
+bool bracketMultiSolve(struct Objective f, enum SolveMethod method, double a, double b,
+    unsigned intervals, double tol, unsigned maxiter, unsigned nthreads, double* roots,
+    size_t* nroots);
+
+// Finds every root in [a, b] by branch-and-prune over `intervals` equal parts solved on `nthreads`
+// threads. A box is discarded when the interval enclosure of f excludes zero, which proves that
+// it holds no root. A box where f is monotone holds at most one root, which is solved by
+// METHOD_HYBRID when f changes sign. Other boxes are contracted by an interval Newton step,
+// m - f(m) / f'(box) with extended division, or bisected. Boxes narrower than 2^-40 relative to
+// their ends, or split maxiter times, are not split further; while their enclosure is bounded
+// and still contains zero they report the point of smallest |f| among their ends and midpoint.
+// The starts do not bound the number of roots, so *roots receives a malloc()'d array of all the
+// distinct roots in ascending order, which the caller releases with free(), and *nroots their
+// number. f.evalInterval must be set. Returns false, with *roots NULL, if memory could not be
+// allocated.
+bool intervalMultiSolve(struct Objective f, double a, double b, unsigned intervals, double tol,
+    unsigned maxiter, unsigned nthreads, double** roots, size_t* nroots);
+
+// System of n equations in n unknowns. eval() stores f_i(x) in f[i] and the Jacobian
+// df_i/dx_j in jacobian[i*n + j].
+struct SystemObjective {
+    void (*eval)(const void* ctx, unsigned n, const double* x, double* f, double* jacobian);
+    const void* ctx;
+    unsigned n;
+};
+
+// Equation i is eqs[i], every program uses the variable slots 0..n-1 of a shared symbol table.
+// Each Jacobian row comes from one forward-mode sweep over its program.
+struct SystemObjective programSystemObjective(const struct Program* eqs, unsigned n);
+
+struct SystemResult {
+    enum SolveStatus status; //< SOLVE_ZERO_DERIVATIVE stands for a singular Jacobian
+    double residual; //< max |f_i(x)|
+    unsigned iterations;
+};
+
+// Newton's method for systems: every step solves J dx = f with a dense LU decomposition. x holds
+// the start on entry and the root (or the last iterate) on return. Converged means every
+// |f_i(x)| <= tol. Returns false if memory could not be allocated.
+bool newtonSystemSolve(
+    struct SystemObjective f, double* x, double tol, unsigned maxiter, struct SystemResult* r);
+
+// One-parameter family of functions f(x; p). eval() returns f and stores df/dx in *dfdx and
+// df/dp in *dfdp; it must be reentrant like Objective::eval().
+struct FamilyObjective {
+    double (*eval)(const void* ctx, double x, double p, double* dfdx, double* dfdp);
+    const void* ctx;
+};
+
+// Program of the unknown in variable slot x and the parameter in slot p (at most slots 0 and 1,
+// the parameter slot may be unused by the program). Must outlive the objective.
+struct ParameterizedProgram {
+    const struct Program* prog;
+    unsigned x;
+    unsigned p;
+};
+
+// Both partial derivatives come from one forward-mode sweep, see evaluateProgramGradient()
+struct FamilyObjective programFamilyObjective(const struct ParameterizedProgram* family);
+
+// Solves f(x; p) = 0 for `steps` parameters spread evenly over [p0, p1] by continuation: Newton
+// for each parameter starts from the root of the previous one moved along the tangent
+// dx/dp = -f_p / f_x, or from x0 until a first root is found. The steps are cut into consecutive
+// chunks solved on `nthreads` threads (0 means one per core); the first step of every chunk is
+// solved beforehand in one sequential sweep so that all chunks follow the same branch of roots.
+// results[i] receives the outcome for parameter i. Returns false if memory could not be
+// allocated.
+bool continuationSolve(struct FamilyObjective f, double x0, double p0, double p1, size_t steps,
+    double tol, unsigned maxiter, unsigned nthreads, struct SolveResult* results);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
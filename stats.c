@@ -0,0 +1,29 @@
+#include "stats.h"
+
+#include <stddef.h>
+#include <time.h>
+
+_Thread_local struct StatsSink* statsSink;
+
+struct StatsSink* setStatsSink(struct StatsSink* s)
+{
+    struct StatsSink* previous = statsSink;
+    statsSink = s;
+    return previous;
+}
+
+struct StatsSink* currentStatsSink(void) { return statsSink; }
+
+uint64_t monotonicNanos(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+void statsReportIteration(const struct TraceEvent* event)
+{
+    statsAdd(&statsSink->iterations, 1);
+    if (statsSink->trace)
+        statsSink->trace(statsSink->traceCtx, event);
+}
@@ -0,0 +1,101 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// One solver iteration: the iterate x and f(x). Solvers moving several unknowns at once report x
+// as NaN and the largest |f| among them. `step` is the length of the step that led to x (the
+// largest one for several unknowns), 0 for the start, or the width of the bracket searched by a
+// bracketing method.
+struct TraceEvent {
+    // "newton", "halley", "householder3", "bisect", "illinois", "brent", "hybrid", "system" or
+    // "aberth"
+    const char* solver;
+    unsigned iteration;
+    double x;
+    double f;
+    double step;
+};
+
+// Counters of the work done by the parser and the solvers. They are only collected on threads
+// that have a sink installed; everywhere else a probe costs one test of a thread-local pointer.
+// Worker threads of parallelFor() and solveStream() report to the sink of the thread that started
+// them, so the counters are updated atomically.
+struct StatsSink {
+    uint64_t tokens; //< tokens lexed
+    uint64_t parseNanos; //< time spent compiling expressions
+    uint64_t evals; //< point evaluations of f by the solvers, every point of a batch counts
+    uint64_t intervalEvals;
+    uint64_t iterations; //< iterates visited over all solves, one trace event each
+    // Called for every iteration when set, concurrently by the multi-start solvers
+    void (*trace)(void* ctx, const struct TraceEvent* event);
+    void* traceCtx;
+};
+
+// Installs `sink` for the calling thread, NULL stops collecting. Returns the previous sink.
+struct StatsSink* setStatsSink(struct StatsSink* sink);
+struct StatsSink* currentStatsSink(void);
+uint64_t monotonicNanos(void);
+
+// The sink of the calling thread, read inline by the probes below
+#ifdef __cplusplus
+extern __thread struct StatsSink* statsSink; //< same TLS object as C11 _Thread_local
+#else
+extern _Thread_local struct StatsSink* statsSink;
+#endif
+
+// Probes compiled into the library, inlined so that without a sink they cost the pointer test
+static inline void statsAdd(uint64_t* counter, uint64_t n)
+{
+    __atomic_fetch_add(counter, n, __ATOMIC_RELAXED);
+}
+
+static inline void statsAddTokens(unsigned n)
+{
+    if (statsSink)
+        statsAdd(&statsSink->tokens, n);
+}
+
+static inline void statsAddEvals(uint64_t n)
+{
+    if (statsSink)
+        statsAdd(&statsSink->evals, n);
+}
+
+static inline void statsAddIntervalEval(void)
+{
+    if (statsSink)
+        statsAdd(&statsSink->intervalEvals, 1);
+}
+
+static inline uint64_t statsStartTimer(void) //< 0 without a sink, saving the clock read
+{
+    return statsSink ? monotonicNanos() : 0;
+}
+
+static inline void statsAddParseTime(uint64_t start)
+{
+    if (statsSink && start)
+        statsAdd(&statsSink->parseNanos, monotonicNanos() - start);
+}
+
+void statsReportIteration(const struct TraceEvent* event); //< the slow path of the probe below
+
+static inline void statsTraceIteration(
+    const char* solver, unsigned iteration, double x, double f, double step)
+{
+    if (statsSink) {
+        struct TraceEvent event = { solver, iteration, x, f, step };
+        statsReportIteration(&event);
+    }
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
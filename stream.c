@@ -0,0 +1,482 @@
+#include "stream.h"
+#include "arena.h"
+#include "cache.h"
+#include "pool.h"
+#include "program.h"
+#include "solver.h"
+#include "stats.h"
+
+#include <limits.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define CHUNK_BYTES (64 * 1024) //< input handed to a worker at once
+#define CHUNKS_PER_WORKER 4 //< bounds the memory held by chunks in flight
+
+struct Chunk {
+    size_t seq;
+    const char* text; //< complete lines, parsed in place
+    size_t len;
+    char* buffer; //< holds text when it was read from a FILE, NULL for a mapped file
+    char* out;
+    size_t outLen;
+    size_t outCap;
+    long failures;
+    bool failed; //< output could not be allocated
+    struct Chunk* next;
+};
+
+struct Stream {
+    const struct StreamOptions* opts;
+    FILE* out;
+    pthread_mutex_t lock;
+    pthread_cond_t workAvailable;
+    pthread_cond_t chunkDone;
+    pthread_cond_t slotFree;
+    struct Chunk* todoHead; //< FIFO of chunks waiting for a worker
+    struct Chunk* todoTail;
+    struct Chunk* done; //< solved chunks waiting for their turn to be written
+    size_t nextWrite;
+    unsigned inflight;
+    unsigned maxInflight;
+    bool eof;
+    long failures;
+    bool ioError;
+    struct StatsSink* stats; //< of the thread calling solveStream(), shared by the workers
+};
+
+static void appendOutput(struct Chunk* c, const char* fmt, ...)
+{
+    for (;;) {
+        va_list args;
+        va_start(args, fmt);
+        size_t room = c->outCap - c->outLen;
+        int n = vsnprintf(c->out ? c->out + c->outLen : NULL, room, fmt, args);
+        va_end(args);
+        if (n < 0) {
+            c->failed = true;
+            return;
+        }
+        if ((size_t)n < room) {
+            c->outLen += n;
+            return;
+        }
+        size_t cap = c->outCap ? 2 * c->outCap : 4096;
+        while (cap < c->outLen + n + 1)
+            cap *= 2;
+        char* buf = realloc(c->out, cap);
+        if (!buf) {
+            c->failed = true;
+            return;
+        }
+        c->out = buf;
+        c->outCap = cap;
+    }
+}
+
+static bool parseField(const char* field, size_t len, double* value)
+{
+    // strtod() needs a terminator, so the field is copied
+    char buf[64];
+    char* copy = len < sizeof(buf) ? buf : malloc(len + 1);
+    if (!copy)
+        return false;
+    memcpy(copy, field, len);
+    copy[len] = '\0';
+    char* end;
+    double v = strtod(copy, &end);
+    bool ok = end != copy;
+    while (*end == ' ' || *end == '\t')
+        end++;
+    ok &= *end == '\0';
+    if (copy != buf)
+        free(copy);
+    if (ok)
+        *value = v;
+    return ok;
+}
+
+static void reportNotFinite(struct Chunk* c, const char* expr, unsigned len, double x, double f)
+{
+    // re-parse to tell a division by zero apart from an overflow or a NaN
+    struct Expression e = createExpressionView(expr, len);
+    e.var.value = x;
+    evaluateExpression(&e);
+    if (e.result != RES_OK)
+        appendOutput(c, "error: %s at %u\n", e.errMsg, e.errIdx);
+    else
+        appendOutput(c, "error: f(%f) = %f is not finite\n", x, f);
+}
+
+bool parseRequestView(const char* line, size_t len, const char** expr, unsigned* exprLen,
+    double* x0, double* tol)
+{
+    const char* fields[3] = { line, NULL, NULL };
+    size_t lens[3] = { len, 0, 0 };
+    for (unsigned i = 1; i < 3; i++) {
+        const char* sep = memchr(fields[i - 1], ';', lens[i - 1]);
+        if (!sep)
+            break;
+        fields[i] = sep + 1;
+        lens[i] = lens[i - 1] - (size_t)(fields[i] - fields[i - 1]);
+        lens[i - 1] = (size_t)(sep - fields[i - 1]);
+    }
+    if ((fields[1] && !parseField(fields[1], lens[1], x0))
+        || (fields[2] && !parseField(fields[2], lens[2], tol)) || !(*tol > 0)
+        || lens[0] >= UINT_MAX)
+        return false;
+    *expr = fields[0];
+    *exprLen = (unsigned)lens[0];
+    return true;
+}
+
+bool parseRequestLine(char* line, const char** expr, double* x0, double* tol)
+{
+    unsigned len;
+    if (!parseRequestView(line, strlen(line), expr, &len, x0, tol))
+        return false;
+    line[len] = '\0'; //< the expression starts the line
+    return true;
+}
+
+// Everything compiled for the line lives in the worker's arena, which is reset at the end
+static void solveLine(struct Chunk* c, const char* line, size_t len,
+    const struct StreamOptions* opts, struct Arena* arena)
+{
+    const char* expr;
+    unsigned exprLen;
+    double x0 = opts->x0;
+    double tol = opts->tol;
+    if (!parseRequestView(line, len, &expr, &exprLen, &x0, &tol)) {
+        appendOutput(c, "error: expected <expr>[;<x0>[;<tol>]]\n");
+        c->failures++;
+        return;
+    }
+    struct Program prog = createProgramInArena(arena);
+    struct Expression e = opts->cache
+        ? compileExpressionCachedView(opts->cache, expr, exprLen, &prog)
+        : compileExpressionView(expr, exprLen, &prog, NULL);
+    bool ok = false;
+    if (e.result != RES_OK) {
+        appendOutput(c, "error: %s at %u\n", e.errMsg, e.errIdx);
+    } else if (!hasVariable(&e)) {
+        double f = evaluateProgram(&prog, 0.);
+        ok = isfinite(f);
+        if (ok)
+            appendOutput(c, "%f\n", f);
+        else
+            reportNotFinite(c, expr, exprLen, 0., f);
+    } else {
+        if (!opts->cache)
+            optimizeProgram(&prog); //< cached programs are optimized already
+        struct SolveResult r = newtonSolve(programObjective(&prog), x0, tol, opts->maxiter);
+        ok = r.status == SOLVE_OK;
+        switch (r.status) {
+        case SOLVE_OK:
+            appendOutput(c, "%s = %f\n", e.var.name, r.x);
+            break;
+        case SOLVE_NOT_FINITE:
+            reportNotFinite(c, expr, exprLen, r.x, r.f);
+            break;
+        case SOLVE_ZERO_DERIVATIVE:
+            appendOutput(c, "error: f'(%s=%f) = 0\n", e.var.name, r.x);
+            break;
+        default:
+            appendOutput(c, "error: failed to converge after %u iterations, |f(%s=%f)| = %f\n",
+                r.iterations, e.var.name, r.x, fabs(r.f));
+            break;
+        }
+    }
+    resetArena(arena);
+    if (!ok)
+        c->failures++;
+}
+
+static bool isBlank(const char* line, size_t len)
+{
+    for (size_t i = 0; i < len; i++) {
+        if (line[i] != ' ' && line[i] != '\t')
+            return false;
+    }
+    return true;
+}
+
+static void solveChunk(struct Chunk* c, const struct StreamOptions* opts, struct Arena* arena)
+{
+    const char* line = c->text;
+    const char* end = c->text + c->len;
+    while (line < end) {
+        const char* nl = memchr(line, '\n', end - line);
+        const char* next = nl ? nl + 1 : end;
+        const char* stop = nl ? nl : end;
+        if (stop > line && stop[-1] == '\r')
+            stop--;
+        if (!isBlank(line, (size_t)(stop - line)))
+            solveLine(c, line, (size_t)(stop - line), opts, arena);
+        line = next;
+    }
+}
+
+static void* runWorker(void* arg)
+{
+    struct Stream* s = arg;
+    setStatsSink(s->stats);
+    struct Arena arena = createArena();
+    pthread_mutex_lock(&s->lock);
+    for (;;) {
+        while (!s->todoHead && !s->eof)
+            pthread_cond_wait(&s->workAvailable, &s->lock);
+        struct Chunk* c = s->todoHead;
+        if (!c)
+            break; //< end of input and nothing queued
+        s->todoHead = c->next;
+        if (!s->todoHead)
+            s->todoTail = NULL;
+        pthread_mutex_unlock(&s->lock);
+
+        solveChunk(c, s->opts, &arena);
+
+        pthread_mutex_lock(&s->lock);
+        c->next = s->done;
+        s->done = c;
+        pthread_cond_signal(&s->chunkDone);
+    }
+    pthread_mutex_unlock(&s->lock);
+    freeArena(&arena);
+    return NULL;
+}
+
+static void* runWriter(void* arg)
+{
+    struct Stream* s = arg;
+    pthread_mutex_lock(&s->lock);
+    for (;;) {
+        struct Chunk** link = &s->done;
+        while (*link && (*link)->seq != s->nextWrite)
+            link = &(*link)->next;
+        struct Chunk* c = *link;
+        if (!c) {
+            if (s->eof && s->inflight == 0)
+                break;
+            pthread_cond_wait(&s->chunkDone, &s->lock);
+            continue;
+        }
+        *link = c->next;
+        pthread_mutex_unlock(&s->lock);
+
+        bool ok = !c->failed && fwrite(c->out, 1, c->outLen, s->out) == c->outLen;
+        long failures = c->failures;
+        free(c->buffer);
+        free(c->out);
+        free(c);
+
+        pthread_mutex_lock(&s->lock);
+        s->failures += failures;
+        s->ioError |= !ok;
+        s->nextWrite++;
+        s->inflight--;
+        pthread_cond_signal(&s->slotFree);
+    }
+    pthread_mutex_unlock(&s->lock);
+    return NULL;
+}
+
+static void submitChunk(struct Stream* s, struct Chunk* c)
+{
+    pthread_mutex_lock(&s->lock);
+    while (s->inflight >= s->maxInflight)
+        pthread_cond_wait(&s->slotFree, &s->lock);
+    c->next = NULL;
+    if (s->todoTail)
+        s->todoTail->next = c;
+    else
+        s->todoHead = c;
+    s->todoTail = c;
+    s->inflight++;
+    pthread_cond_signal(&s->workAvailable);
+    pthread_mutex_unlock(&s->lock);
+}
+
+// Reads the input and cuts it into chunks of whole lines
+static bool readChunks(struct Stream* s, void* input)
+{
+    FILE* in = input;
+    char* carry = NULL; //< incomplete last line of the previous read
+    size_t carryLen = 0;
+    size_t seq = 0;
+    bool ok = true;
+    for (bool eof = false; !eof;) {
+        char* text = malloc(carryLen + CHUNK_BYTES);
+        if (!text) {
+            ok = false;
+            break;
+        }
+        if (carryLen)
+            memcpy(text, carry, carryLen);
+        size_t len = carryLen + fread(text + carryLen, 1, CHUNK_BYTES, in);
+        eof = len < carryLen + CHUNK_BYTES;
+        if (eof && ferror(in))
+            ok = false;
+        size_t cut = len;
+        if (!eof) {
+            while (cut > 0 && text[cut - 1] != '\n')
+                cut--;
+        }
+        free(carry);
+        carry = NULL;
+        carryLen = 0;
+        if (cut == 0 && !eof) { //< a single line longer than the chunk, keep reading it
+            carry = text;
+            carryLen = len;
+            continue;
+        }
+        if (cut < len) {
+            carryLen = len - cut;
+            carry = malloc(carryLen);
+            if (!carry) {
+                free(text);
+                ok = false;
+                break;
+            }
+            memcpy(carry, text + cut, carryLen);
+        }
+        if (cut == 0) {
+            free(text);
+            continue;
+        }
+        struct Chunk* c = calloc(1, sizeof(*c));
+        if (!c) {
+            free(text);
+            ok = false;
+            break;
+        }
+        c->seq = seq++;
+        c->text = text;
+        c->len = cut;
+        c->buffer = text;
+        submitChunk(s, c);
+    }
+    free(carry);
+    return ok;
+}
+
+struct MappedInput {
+    const char* data;
+    size_t len;
+};
+
+// Cuts a mapped file into chunks of whole lines that point into the mapping
+static bool submitMappedChunks(struct Stream* s, void* input)
+{
+    const struct MappedInput* m = input;
+    size_t seq = 0;
+    for (size_t pos = 0; pos < m->len;) {
+        size_t end = m->len;
+        if (m->len - pos > CHUNK_BYTES) {
+            const char* nl = memchr(m->data + pos + CHUNK_BYTES - 1, '\n',
+                m->len - (pos + CHUNK_BYTES - 1));
+            end = nl ? (size_t)(nl - m->data) + 1 : m->len;
+        }
+        struct Chunk* c = calloc(1, sizeof(*c));
+        if (!c)
+            return false;
+        c->seq = seq++;
+        c->text = m->data + pos;
+        c->len = end - pos;
+        submitChunk(s, c);
+        pos = end;
+    }
+    return true;
+}
+
+// Runs the workers and the writer while `produce` submits the chunks of the input
+static long runStream(FILE* out, const struct StreamOptions* opts,
+    bool (*produce)(struct Stream* s, void* input), void* input)
+{
+    struct Stream s;
+    memset(&s, 0, sizeof(s));
+    s.opts = opts;
+    s.out = out;
+    s.stats = currentStatsSink();
+    unsigned nworkers = opts->nthreads ? opts->nthreads : defaultThreadCount();
+    s.maxInflight = CHUNKS_PER_WORKER * nworkers;
+    pthread_mutex_init(&s.lock, NULL);
+    pthread_cond_init(&s.workAvailable, NULL);
+    pthread_cond_init(&s.chunkDone, NULL);
+    pthread_cond_init(&s.slotFree, NULL);
+
+    pthread_t* workers = malloc(nworkers * sizeof(*workers));
+    pthread_t writer;
+    unsigned started = 0;
+    bool writerStarted = false;
+    if (workers) {
+        while (started < nworkers
+            && pthread_create(&workers[started], NULL, runWorker, &s) == 0)
+            started++;
+        writerStarted = pthread_create(&writer, NULL, runWriter, &s) == 0;
+    }
+    bool ok = started > 0 && writerStarted && produce(&s, input);
+
+    pthread_mutex_lock(&s.lock);
+    s.eof = true;
+    pthread_cond_broadcast(&s.workAvailable);
+    pthread_cond_broadcast(&s.chunkDone);
+    pthread_mutex_unlock(&s.lock);
+    for (unsigned i = 0; i < started; i++)
+        pthread_join(workers[i], NULL);
+    if (writerStarted)
+        pthread_join(writer, NULL);
+    free(workers);
+
+    pthread_mutex_destroy(&s.lock);
+    pthread_cond_destroy(&s.workAvailable);
+    pthread_cond_destroy(&s.chunkDone);
+    pthread_cond_destroy(&s.slotFree);
+    if (!ok || s.ioError || fflush(out) != 0)
+        return -1;
+    return s.failures;
+}
+
+long solveStream(FILE* in, FILE* out, const struct StreamOptions* opts)
+{
+    return runStream(out, opts, readChunks, in);
+}
+
+long solveMappedStream(int fd, FILE* out, const struct StreamOptions* opts)
+{
+    // the input starts at the current offset, e.g. after lines a previous reader took
+    struct stat st;
+    void* data = MAP_FAILED;
+    off_t start = lseek(fd, 0, SEEK_CUR);
+    off_t base = start > 0 ? start & ~(off_t)(sysconf(_SC_PAGESIZE) - 1) : 0;
+    size_t size = 0;
+    if (start >= 0 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > start) {
+        size = (size_t)(st.st_size - base);
+        data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, base);
+    }
+    if (data == MAP_FAILED) {
+        int copy = dup(fd);
+        FILE* in = copy >= 0 ? fdopen(copy, "r") : NULL;
+        if (!in) {
+            if (copy >= 0)
+                close(copy);
+            return -1;
+        }
+        long failures = solveStream(in, out, opts);
+        fclose(in);
+        return failures;
+    }
+    madvise(data, size, MADV_SEQUENTIAL); //< only a hint, failure is harmless
+    size_t skip = (size_t)(start - base); //< mmap() needs an offset aligned to pages
+    struct MappedInput input = { (const char*)data + skip, size - skip };
+    long failures = runStream(out, opts, submitMappedChunks, &input);
+    munmap(data, size);
+    lseek(fd, st.st_size, SEEK_SET); //< consumed like the read loop does
+    return failures;
+}
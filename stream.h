@@ -0,0 +1,45 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct ExprCache;
+
+struct StreamOptions {
+    double x0; //< defaults for lines that do not set their own
+    double tol;
+    unsigned maxiter;
+    unsigned nthreads; //< 0 means one worker per core
+    struct ExprCache* cache; //< compiled expressions shared by the workers, may be NULL
+};
+
+// Solves one expression per input line, written as <expr>[;<x0>[;<tol>]]. Every input line
+// that is not blank produces exactly one output line, in input order: "<var> = <root>", the value
+// of an expression without a variable, or "error: <message>". The input is read in chunks that a
+// pool of workers solves while a writer thread emits finished chunks in order. Returns the number
+// of failed lines, or -1 on an I/O or allocation error.
+long solveStream(FILE* in, FILE* out, const struct StreamOptions* opts);
+// Same for the file open as fd from its current offset to the end. A regular file is mapped into
+// memory: the kernel reads ahead sequentially and the lines are parsed in place, without being
+// copied or terminated. It must not be truncated while it is solved, which would raise SIGBUS.
+// Other files, like pipes, are read through solveStream().
+long solveMappedStream(int fd, FILE* out, const struct StreamOptions* opts);
+
+// Splits a <expr>[;<x0>[;<tol>]] line of len characters without modifying it: the expression is
+// the first *exprLen characters of *expr. x0 and tol keep their values when the line does not
+// set them. Returns false if a field is not a number or tol is not positive.
+bool parseRequestView(const char* line, size_t len, const char** expr, unsigned* exprLen,
+    double* x0, double* tol);
+// Same for a NUL-terminated line, the expression is terminated in place
+bool parseRequestLine(char* line, const char** expr, double* x0, double* tol);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
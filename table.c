@@ -0,0 +1,117 @@
+#include "table.h"
+#include "format.h"
+#include "pool.h"
+#include "program.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TABLE_CHUNK 8192 //< points a worker evaluates and formats at once
+#define CHUNKS_PER_WORKER 4 //< chunks per round, written out before the next round starts
+
+struct TableChunk {
+    double xs[TABLE_CHUNK];
+    double fs[TABLE_CHUNK];
+    char* out;
+    size_t outLen;
+};
+
+struct Table {
+    const struct Program* prog;
+    const struct TableOptions* opts;
+    size_t first; //< index of the first point of the round
+    struct TableChunk* chunks;
+};
+
+// Evenly spaced, with a and b reproduced exactly and no overflow for a wide range
+static double gridPoint(const struct TableOptions* opts, size_t i)
+{
+    if (opts->n == 1)
+        return opts->a;
+    double t = (double)i / (double)(opts->n - 1);
+    return (1. - t) * opts->a + t * opts->b;
+}
+
+static void putLittleEndian(char* out, double x)
+{
+    uint64_t bits;
+    memcpy(&bits, &x, sizeof(bits));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    bits = __builtin_bswap64(bits);
+#endif
+    memcpy(out, &bits, sizeof(bits));
+}
+
+static void tabulateChunks(void* ctx, size_t begin, size_t end, unsigned worker)
+{
+    (void)worker;
+    struct Table* t = ctx;
+    for (size_t k = begin; k < end; k++) {
+        struct TableChunk* c = &t->chunks[k];
+        size_t first = t->first + k * TABLE_CHUNK;
+        size_t len = t->opts->n - first < TABLE_CHUNK ? t->opts->n - first : TABLE_CHUNK;
+        for (size_t i = 0; i < len; i++)
+            c->xs[i] = gridPoint(t->opts, first + i);
+        evaluateBatch(t->prog, c->xs, c->fs, len);
+        char* p = c->out;
+        for (size_t i = 0; i < len; i++) {
+            if (t->opts->format == TABLE_TEXT) {
+                p += formatDouble(c->xs[i], p);
+                *p++ = ' ';
+                p += formatDouble(c->fs[i], p);
+                *p++ = '\n';
+            } else {
+                putLittleEndian(p, c->xs[i]);
+                putLittleEndian(p + sizeof(double), c->fs[i]);
+                p += 2 * sizeof(double);
+            }
+        }
+        c->outLen = (size_t)(p - c->out);
+    }
+}
+
+// Version 1.0 header, padded with spaces so that the data starts 64-byte aligned
+static bool writeNpyHeader(FILE* out, size_t n)
+{
+    char header[128] = "\x93NUMPY\x01\x00";
+    int len = snprintf(header + 10, sizeof(header) - 10,
+        "{'descr': '<f8', 'fortran_order': False, 'shape': (%zu, 2), }", n);
+    size_t total = (10 + (size_t)len + 1 + 63) / 64 * 64;
+    memset(header + 10 + len, ' ', total - 10 - len - 1);
+    header[total - 1] = '\n';
+    header[8] = (char)((total - 10) & 0xff);
+    header[9] = (char)((total - 10) >> 8);
+    return fwrite(header, 1, total, out) == total;
+}
+
+bool writeTable(const struct Program* prog, const struct TableOptions* opts, FILE* out)
+{
+    unsigned nthreads = opts->nthreads ? opts->nthreads : defaultThreadCount();
+    size_t maxChunks = (size_t)nthreads * CHUNKS_PER_WORKER;
+    size_t needed = (opts->n + TABLE_CHUNK - 1) / TABLE_CHUNK;
+    if (maxChunks > needed)
+        maxChunks = needed;
+    size_t pointBytes = opts->format == TABLE_TEXT ? 2 * FORMAT_DOUBLE_MAX + 2 : 2 * sizeof(double);
+    struct Table t = { prog, opts, 0, calloc(maxChunks, sizeof(struct TableChunk)) };
+    bool ok = t.chunks != NULL || maxChunks == 0;
+    for (size_t k = 0; ok && k < maxChunks; k++) {
+        t.chunks[k].out = malloc(TABLE_CHUNK * pointBytes);
+        ok = t.chunks[k].out != NULL;
+    }
+    if (ok && opts->format == TABLE_NPY)
+        ok = writeNpyHeader(out, opts->n);
+    while (ok && t.first < opts->n) {
+        size_t chunks = (opts->n - t.first + TABLE_CHUNK - 1) / TABLE_CHUNK;
+        if (chunks > maxChunks)
+            chunks = maxChunks;
+        parallelFor(chunks, 1, nthreads, tabulateChunks, &t);
+        for (size_t k = 0; ok && k < chunks; k++)
+            ok = fwrite(t.chunks[k].out, 1, t.chunks[k].outLen, out) == t.chunks[k].outLen;
+        t.first += chunks * TABLE_CHUNK;
+    }
+    for (size_t k = 0; t.chunks && k < maxChunks; k++)
+        free(t.chunks[k].out);
+    free(t.chunks);
+    return ok && fflush(out) == 0;
+}
@@ -0,0 +1,38 @@
+#ifndef TABLE_H
+#define TABLE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct Program;
+
+enum TableFormat {
+    TABLE_TEXT, //< "<x> <f>" lines with the shortest round-trip text of both, see formatDouble()
+    TABLE_RAW, //< x and f as pairs of little-endian doubles
+    TABLE_NPY, //< the same pairs behind a NumPy .npy header, an array of shape (n, 2)
+};
+
+struct TableOptions {
+    double a; //< first and last point, both evaluated exactly
+    double b;
+    size_t n; //< points, evenly spaced; a alone for n = 1
+    enum TableFormat format;
+    unsigned nthreads; //< 0 means one worker per core
+};
+
+// Writes f(x) over the grid to out in order. Workers evaluate chunks of the grid with
+// evaluateBatch() and format them into their own buffers, which are written one after the other
+// in large blocks, so formatting runs in parallel with nothing but the writes serialized. Returns
+// false on an I/O or allocation error.
+bool writeTable(const struct Program* prog, const struct TableOptions* opts, FILE* out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,268 @@
+#ifndef VECMATH_H
+#define VECMATH_H
+
+#include "program.h"
+
+#include <math.h>
+#include <stdbool.h>
+
+// Vector versions of the functions of the grammar for the batch evaluator. They work on the 8-lane
+// vectors of batch.c and are inlined into each of its kernels, so the same code is compiled for
+// SSE2, AVX2 and AVX-512. Arguments are reduced with the split constants of fdlibm, the reduced
+// argument carries the rounding error of the reduction as a tail, and the polynomials are
+// Chebyshev-economized Taylor series. ACCURACY_FAST uses shorter polynomials and does not
+// compensate the roundings inside sin, cos and tan. Lanes the reduction cannot handle
+// (|x| > SINCOS_MAX for sin, cos and tan, inf and NaN) get libm.
+
+// The kernels are always inlined, so no vector is passed the way the ABI warning is about
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpsabi"
+
+typedef double Vec __attribute__((vector_size(64)));
+typedef long long VecInt __attribute__((vector_size(64))); //< comparison lanes are 0 or -1
+
+#define VEC_LANES (sizeof(Vec) / sizeof(double))
+#define VECMATH_INLINE static inline __attribute__((always_inline))
+
+#define ROUND_MAGIC 0x1.8p52 //< x + ROUND_MAGIC - ROUND_MAGIC rounds |x| < 2^51 to an integer
+#define SINCOS_MAX 1e5 //< keeps the quadrant below 2^20, where q * PIO2_1 is exact
+
+// pi/2 as 33 + 33 + 33 + 53 bits
+#define PIO2_1 1.5707963267341256
+#define PIO2_2 6.077100506303966e-11
+#define PIO2_3 2.0222662487111665e-21
+#define PIO2_3T 8.4784276603689e-32
+
+// ln 2 as 32 + 53 bits
+#define LN2_HI 0.6931471806019545
+#define LN2_LO -4.2009150726810846e-11
+
+// (sin r - r) / r^3 and (cos r - 1 + r^2/2) / r^4 in z = r^2 for |r| <= pi/4
+static const double sinCoeffs[] = { -0.16666666666666666, 0.008333333333333331,
+    -0.00019841269841265065, 2.7557319219339963e-06, -2.5052106232697e-08,
+    1.6058531654927018e-10, -7.586699059818967e-13 };
+static const double sinCoeffsFast[] = { -0.16666666666666666, 0.00833333333333095,
+    -0.0001984126983675979, 2.7557316103105014e-06, -2.5051131947374584e-08,
+    1.5918135932868862e-10 };
+static const double cosCoeffs[] = { 0.041666666666666664, -0.0013888888888888887,
+    2.480158730158465e-05, -2.755731922140322e-07, 2.087675579120521e-09,
+    -1.147046090559115e-11, 4.745872873683147e-14 };
+static const double cosCoeffsFast[] = { 0.041666666666666664, -0.0013888888888887398,
+    2.4801587298766363e-05, -2.7557317272036996e-07, 2.087614632531676e-09,
+    -1.138263611596349e-11 };
+// (e^r - 1 - r) / r^2 for |r| <= ln(2)/2
+static const double expCoeffs[] = { 0.5, 0.1666666666666667, 0.04166666666666668,
+    0.008333333333326079, 0.0013888888888878997, 0.0001984126987501941, 2.4801587336648353e-05,
+    2.755725514858277e-06, 2.755726305887823e-07, 2.51053215403267e-08, 2.0918219076809917e-09 };
+static const double expCoeffsFast[] = { 0.5000000000000001, 0.1666666666666667,
+    0.04166666666662379, 0.008333333333326079, 0.0013888888917381996, 0.0001984126987501941,
+    2.480152103515473e-05, 2.755725514858277e-06, 2.762021222586917e-07, 2.51053215403267e-08 };
+// (atan t - t) / t^3 in z = t^2 for |t| <= 7/16
+static const double atanCoeffs[] = { -0.3333333333333333, 0.19999999999999973,
+    -0.1428571428570623, 0.11111111110176455, -0.09090909034456053, 0.07692305658064254,
+    -0.06666619452380995, 0.05881614920554168, -0.05255200116862432, 0.047022382242747796,
+    -0.04038827940239848, 0.02919604032355094, -0.012537383080807171 };
+static const double atanCoeffsFast[] = { -0.33333333333333326, 0.19999999999988158,
+    -0.14285714283215528, 0.11111110905009408, -0.09090900345956142, 0.07692090270836985,
+    -0.06663273879195811, 0.058479780987504705, -0.050350650919700354, 0.03785274887009846,
+    -0.01757594290644411 };
+
+#define COEFFS(name, fast)                                                                         \
+    (fast) ? name##Fast : name, (fast) ? sizeof(name##Fast) / sizeof(double)                       \
+                                       : sizeof(name) / sizeof(double)
+
+VECMATH_INLINE Vec vecSplat(double c) { return (Vec) { 0 } + c; }
+
+VECMATH_INLINE Vec vecSelect(VecInt mask, Vec a, Vec b)
+{
+    return (Vec)(((VecInt)a & mask) | ((VecInt)b & ~mask));
+}
+
+VECMATH_INLINE Vec vecAbs(Vec x) { return (Vec)((VecInt)x & 0x7fffffffffffffffll); }
+
+VECMATH_INLINE bool vecAny(VecInt mask)
+{
+    long long any = 0;
+    for (unsigned l = 0; l < VEC_LANES; l++)
+        any |= mask[l];
+    return any != 0;
+}
+
+VECMATH_INLINE Vec vecHorner(Vec x, const double* c, unsigned n)
+{
+    Vec p = vecSplat(c[n - 1]);
+#pragma GCC unroll 16
+    for (unsigned i = n - 1; i-- > 0;)
+        p = p * x + c[i];
+    return p;
+}
+
+VECMATH_INLINE Vec vecExp(Vec x, bool fast)
+{
+    // e^x = 2^k e^r with r = x - k ln 2. Below -746 the result rounds to 0 and above 710 to inf,
+    // clamping keeps k within the exponent range of the two factors 2^k1 2^k2 = 2^k.
+    x = vecSelect(x < -746., vecSplat(-746.), x);
+    x = vecSelect(x > 710., vecSplat(710.), x);
+    Vec k = x * M_LOG2E + ROUND_MAGIC - ROUND_MAGIC;
+    Vec r = x - k * LN2_HI;
+    r = r - k * LN2_LO;
+    Vec y = 1. + (r + r * r * vecHorner(r, COEFFS(expCoeffs, fast)));
+    VecInt ki = (VecInt)(k + ROUND_MAGIC) - (VecInt)vecSplat(ROUND_MAGIC);
+    VecInt k1 = ki >> 1;
+    VecInt k2 = ki - k1;
+    return y * (Vec)((k1 + 1023) << 52) * (Vec)((k2 + 1023) << 52);
+}
+
+// Error-free a + b = s + *err
+VECMATH_INLINE Vec vecTwoSum(Vec a, Vec b, Vec* err)
+{
+    Vec s = a + b;
+    Vec bb = s - a;
+    *err = (a - (s - bb)) + (b - bb);
+    return s;
+}
+
+// a * b - c without rounding for products near c[0], Dekker's product on halves split by
+// masking so that no contraction into FMA can change it
+VECMATH_INLINE Vec vecProductError(Vec a, Vec b, Vec c)
+{
+    Vec ah = (Vec)((VecInt)a & ~0x7ffffffll), al = a - ah;
+    Vec bh = (Vec)((VecInt)b & ~0x7ffffffll), bl = b - bh;
+    return (((ah * bh - c) + ah * bl) + al * bh) + al * bl;
+}
+
+// sin and cos of x reduced to r = x - q pi/2 with |r| <= pi/4, *quadrant is q mod 4. Both are
+// returned unrounded as sin r = s[0] + s[1] and cos r = c[0] + c[1].
+VECMATH_INLINE void vecSinCos(Vec x, bool fast, Vec s[2], Vec c[2], VecInt* quadrant)
+{
+    Vec q = x * M_2_PI + ROUND_MAGIC - ROUND_MAGIC;
+    *quadrant = (VecInt)(q + ROUND_MAGIC) & 3;
+    Vec e1, e2;
+    Vec a = vecTwoSum(x - q * PIO2_1, -(q * PIO2_2), &e1);
+    Vec b = vecTwoSum(a, -(q * PIO2_3), &e2);
+    Vec tail = (e1 + e2) - q * PIO2_3T;
+    Vec rh = b + tail; //< r = rh + rl
+    Vec rl = tail - (rh - b);
+
+    Vec z = rh * rh;
+    Vec v = z * rh;
+    const double* sc = fast ? sinCoeffsFast : sinCoeffs;
+    unsigned sn = fast ? sizeof(sinCoeffsFast) / sizeof(double)
+                       : sizeof(sinCoeffs) / sizeof(double);
+    // fdlibm's __kernel_sin and __kernel_cos, which add the tail rl to the leading terms
+    s[0] = rh;
+    s[1] = -((z * (0.5 * rl - v * vecHorner(z, sc + 1, sn - 1)) - rl) - v * sc[0]);
+    Vec hz = 0.5 * z;
+    c[0] = 1. - hz;
+    c[1] = ((1. - c[0]) - hz) + (z * z * vecHorner(z, COEFFS(cosCoeffs, fast)) - rh * rl);
+    if (!fast) {
+        // the roundings of z and v that reach the leading terms, a quarter ulp each
+        Vec zl = vecProductError(rh, rh, z);
+        c[1] -= 0.5 * zl;
+        s[1] += sc[0] * (vecProductError(z, rh, v) + zl * rh);
+    }
+}
+
+// Lanes outside the reduction's range, inf and NaN included, are computed by libm
+#define VEC_LIBM_FALLBACK(x, result, f)                                                            \
+    do {                                                                                           \
+        VecInt wide = ~(vecAbs(x) <= SINCOS_MAX);                                                 \
+        if (vecAny(wide)) {                                                                        \
+            for (unsigned l = 0; l < VEC_LANES; l++) {                                             \
+                if (wide[l])                                                                       \
+                    result[l] = f(x[l]);                                                           \
+            }                                                                                      \
+        }                                                                                          \
+    } while (0)
+
+VECMATH_INLINE Vec vecSin(Vec x, bool fast)
+{
+    Vec s[2], c[2];
+    VecInt n;
+    vecSinCos(x, fast, s, c, &n);
+    // sin, cos, -sin, -cos by quadrant
+    Vec result = vecSelect((n & 1) != 0, c[0] + c[1], s[0] + s[1]);
+    result = vecSelect((n & 2) != 0, -result, result);
+    VEC_LIBM_FALLBACK(x, result, sin);
+    return result;
+}
+
+VECMATH_INLINE Vec vecCos(Vec x, bool fast)
+{
+    Vec s[2], c[2];
+    VecInt n;
+    vecSinCos(x, fast, s, c, &n);
+    // cos, -sin, -cos, sin by quadrant
+    Vec result = vecSelect((n & 1) != 0, -(s[0] + s[1]), c[0] + c[1]);
+    result = vecSelect((n & 2) != 0, -result, result);
+    VEC_LIBM_FALLBACK(x, result, cos);
+    return result;
+}
+
+VECMATH_INLINE Vec vecTan(Vec x, bool fast)
+{
+    Vec s[2], c[2];
+    VecInt n;
+    vecSinCos(x, fast, s, c, &n);
+    if (!fast) {
+        s[0] = vecTwoSum(s[0], s[1], &s[1]); //< the tails become rounding errors
+        c[0] = vecTwoSum(c[0], c[1], &c[1]);
+    }
+    VecInt odd = (n & 1) != 0;
+    Vec num = vecSelect(odd, -c[0], s[0]); //< tan(r + pi/2) = -cos r / sin r
+    Vec den = vecSelect(odd, s[0], c[0]);
+    Vec numTail = vecSelect(odd, -c[1], s[1]);
+    Vec denTail = vecSelect(odd, s[1], c[1]);
+    Vec result;
+    if (fast) {
+        result = (num + numTail) / (den + denTail);
+    } else {
+        // q = num / den, then the quotient's remainder with both tails over the rounded divisor
+        Vec q = num / den;
+        Vec rem = numTail - q * denTail - vecProductError(q, den, num);
+        result = q + rem / (den + denTail);
+    }
+    VEC_LIBM_FALLBACK(x, result, tan);
+    return result;
+}
+
+VECMATH_INLINE Vec vecAtan(Vec x, bool fast)
+{
+    // atan |x| = atan(b) + atan(t) with b in {0, 1/2, 1, 3/2, inf} and |t| <= 7/16 as in fdlibm
+    Vec a = vecAbs(x);
+    VecInt m0 = a >= 7. / 16, m1 = a >= 11. / 16, m2 = a >= 19. / 16, m3 = a >= 39. / 16;
+    VecInt half = m0 & ~m1;
+    Vec num = vecSelect(m2, a - 1.5, vecSelect(m0, a - 1., a));
+    Vec den = vecSelect(m2, a * 1.5 + 1., vecSelect(m0, a + 1., vecSplat(1.)));
+    num = vecSelect(half, a * 2. - 1., vecSelect(m3, vecSplat(-1.), num));
+    den = vecSelect(half, a + 2., vecSelect(m3, a, den));
+    Vec hi = vecSelect(m0, vecSplat(0.4636476090008061), vecSplat(0.));
+    Vec lo = vecSelect(m0, vecSplat(2.2698777452961687e-17), vecSplat(0.));
+    hi = vecSelect(m1, vecSplat(0.7853981633974483), hi);
+    lo = vecSelect(m1, vecSplat(3.061616997868383e-17), lo);
+    hi = vecSelect(m2, vecSplat(0.982793723247329), hi);
+    lo = vecSelect(m2, vecSplat(1.3903311031230998e-17), lo);
+    hi = vecSelect(m3, vecSplat(M_PI_2), hi);
+    lo = vecSelect(m3, vecSplat(6.123233995736766e-17), lo);
+
+    Vec t = num / den;
+    Vec z = t * t;
+    Vec u = t * z * vecHorner(z, COEFFS(atanCoeffs, fast)); //< atan t - t
+    Vec result = hi - ((-u - lo) - t);
+    return (Vec)((VecInt)result | ((VecInt)x & ~0x7fffffffffffffffll)); //< odd, NaN stays NaN
+}
+
+VECMATH_INLINE Vec vecSqrt(Vec x)
+{
+    Vec result;
+    for (unsigned l = 0; l < VEC_LANES; l++)
+        result[l] = __builtin_sqrt(x[l]); //< one instruction without errno, see CMakeLists.txt
+    return result;
+}
+
+#pragma GCC diagnostic pop
+
+#undef COEFFS
+#undef VEC_LIBM_FALLBACK
+
+#endif